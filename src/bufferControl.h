@@ -0,0 +1,98 @@
+/* bufferControl.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef BUFFERCONTROL_H
+#define BUFFERCONTROL_H
+
+#include <stdexcept>
+
+#include <pv/pvIntrospect.h>
+#include <pv/serialize.h>
+
+namespace epics { namespace nt { namespace detail {
+
+/**
+ * @brief Serialization control for a buffer sized up front.
+ *
+ * The buffer is never flushed; running out of space is an error.
+ */
+class FixedSerializeControl : public epics::pvData::SerializableControl
+{
+public:
+    FixedSerializeControl(epics::pvData::ByteBuffer *buffer) : buffer(buffer) {}
+
+    virtual void flushSerializeBuffer()
+    {
+        throw std::length_error("serialization buffer too small");
+    }
+
+    virtual void ensureBuffer(std::size_t size)
+    {
+        if (buffer->getRemaining() < size)
+            flushSerializeBuffer();
+    }
+
+    virtual void alignBuffer(std::size_t alignment)
+    {
+        buffer->align(alignment);
+    }
+
+    virtual bool directSerialize(epics::pvData::ByteBuffer *, const char *,
+            std::size_t, std::size_t)
+    {
+        return false;
+    }
+
+    virtual void cachedSerialize(epics::pvData::FieldConstPtr const & field,
+            epics::pvData::ByteBuffer *buffer)
+    {
+        field->serialize(buffer, this);
+    }
+
+private:
+    epics::pvData::ByteBuffer *buffer;
+};
+
+/**
+ * @brief Deserialization control for a complete buffer.
+ *
+ * The buffer cannot be refilled; reading past its end is an error.
+ * Introspection data is always expected in full.
+ */
+class FixedDeserializeControl : public epics::pvData::DeserializableControl
+{
+public:
+    FixedDeserializeControl(epics::pvData::ByteBuffer *buffer) : buffer(buffer) {}
+
+    virtual void ensureData(std::size_t size)
+    {
+        if (buffer->getRemaining() < size)
+            throw std::runtime_error("truncated buffer");
+    }
+
+    virtual void alignData(std::size_t alignment)
+    {
+        buffer->align(alignment);
+    }
+
+    virtual bool directDeserialize(epics::pvData::ByteBuffer *, char *,
+            std::size_t, std::size_t)
+    {
+        return false;
+    }
+
+    virtual epics::pvData::FieldConstPtr cachedDeserialize(
+            epics::pvData::ByteBuffer *buffer)
+    {
+        return epics::pvData::getFieldCreate()->deserialize(buffer, this);
+    }
+
+private:
+    epics::pvData::ByteBuffer *buffer;
+};
+
+}}}
+
+#endif  /* BUFFERCONTROL_H */
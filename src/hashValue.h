@@ -0,0 +1,60 @@
+/* hashValue.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef HASHVALUE_H
+#define HASHVALUE_H
+
+#include <cstring>
+#include <string>
+
+#include <pv/pvData.h>
+
+namespace epics { namespace nt { namespace detail {
+
+// hashing of elements, equal elements having equal hashes
+
+inline epics::pvData::uint64 mix(epics::pvData::uint64 x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+template<typename T>
+inline epics::pvData::uint64 hashValue(T value)
+{
+    return mix(static_cast<epics::pvData::uint64>(value));
+}
+
+inline epics::pvData::uint64 hashValue(double value)
+{
+    if (value == 0)
+        value = 0;  // -0 equals 0
+    epics::pvData::uint64 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return mix(bits);
+}
+
+inline epics::pvData::uint64 hashValue(float value)
+{
+    return hashValue(static_cast<double>(value));
+}
+
+inline epics::pvData::uint64 hashValue(std::string const & value)
+{
+    epics::pvData::uint64 hash = 0xcbf29ce484222325ULL;
+    for (std::size_t i = 0; i < value.size(); ++i) {
+        hash ^= static_cast<unsigned char>(value[i]);
+        hash *= 0x100000001b3ULL;
+    }
+    return mix(hash);
+}
+
+}}}
+
+#endif  /* HASHVALUE_H */
@@ -0,0 +1,238 @@
+/* ndarrayValue.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NDARRAYVALUE_H
+#define NDARRAYVALUE_H
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <pv/pvData.h>
+
+#include <pv/ntndarray.h>
+#include <pv/ntndarrayGraph.h>
+
+namespace epics { namespace nt { namespace detail {
+
+template<typename T>
+void getArrayData(epics::pvData::PVScalarArray *array, const char *&data, std::size_t &count)
+{
+    typename epics::pvData::PVValueArray<T>::const_svector const & value =
+        static_cast<epics::pvData::PVValueArray<T>*>(array)->view();
+    data = reinterpret_cast<const char*>(value.data());
+    count = value.size();
+}
+
+/*
+ * True if the value of a frame is compressed by a codec.
+ */
+inline bool isCompressed(NTNDArrayPtr const & frame)
+{
+    epics::pvData::PVStringPtr name =
+        frame->getCodec()->getSubField<epics::pvData::PVString>("name");
+    return name && !name->get().empty();
+}
+
+/*
+ * The storage of the value of a frame, false if it is not numeric.
+ * Throws if the value is compressed, which would be read as pixels.
+ */
+inline bool valueData(NTNDArrayPtr const & frame, epics::pvData::ScalarType & type,
+    const char *&data, std::size_t &count)
+{
+    using namespace epics::pvData;
+
+    if (isCompressed(frame))
+        throw std::runtime_error("NTNDArray value is compressed by codec " +
+            frame->getCodec()->getSubField<PVString>("name")->get());
+
+    PVScalarArrayPtr array = frame->getValue()->get<PVScalarArray>();
+    if (!array)
+        return false;
+
+    type = array->getScalarArray()->getElementType();
+    switch (type) {
+    case pvByte:    getArrayData<int8>(array.get(), data, count); break;
+    case pvShort:   getArrayData<int16>(array.get(), data, count); break;
+    case pvInt:     getArrayData<int32>(array.get(), data, count); break;
+    case pvLong:    getArrayData<int64>(array.get(), data, count); break;
+    case pvUByte:   getArrayData<uint8>(array.get(), data, count); break;
+    case pvUShort:  getArrayData<uint16>(array.get(), data, count); break;
+    case pvUInt:    getArrayData<uint32>(array.get(), data, count); break;
+    case pvULong:   getArrayData<uint64>(array.get(), data, count); break;
+    case pvFloat:   getArrayData<float>(array.get(), data, count); break;
+    case pvDouble:  getArrayData<double>(array.get(), data, count); break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+template<typename PVT>
+char *allocateArray(epics::pvData::PVUnionPtr const & value, std::string const & fieldName,
+    NTNDArrayBufferPoolPtr const & pool, std::size_t count)
+{
+    typedef typename PVT::value_type T;
+    epics::pvData::shared_vector<T> array(pool->allocate<T>(count));
+    // filled by the caller before the frame is passed on
+    char *storage = reinterpret_cast<char*>(array.data());
+    value->select<PVT>(fieldName)->replace(freeze(array));
+    return storage;
+}
+
+/*
+ * Replaces the value of a frame by an array from the pool and
+ * returns its storage.
+ */
+inline char *allocateValue(NTNDArrayPtr const & frame, NTNDArrayBufferPoolPtr const & pool,
+    epics::pvData::ScalarType type, std::size_t count)
+{
+    using namespace epics::pvData;
+
+    PVUnionPtr value = frame->getValue();
+    std::string fieldName = std::string(ScalarTypeFunc::name(type)) + "Value";
+
+    int64 bytes = static_cast<int64>(count*ScalarTypeFunc::elementSize(type));
+    frame->getCompressedDataSize()->put(bytes);
+    frame->getUncompressedDataSize()->put(bytes);
+
+    switch (type) {
+    case pvByte:   return allocateArray<PVByteArray>(value, fieldName, pool, count);
+    case pvShort:  return allocateArray<PVShortArray>(value, fieldName, pool, count);
+    case pvInt:    return allocateArray<PVIntArray>(value, fieldName, pool, count);
+    case pvLong:   return allocateArray<PVLongArray>(value, fieldName, pool, count);
+    case pvUByte:  return allocateArray<PVUByteArray>(value, fieldName, pool, count);
+    case pvUShort: return allocateArray<PVUShortArray>(value, fieldName, pool, count);
+    case pvUInt:   return allocateArray<PVUIntArray>(value, fieldName, pool, count);
+    case pvULong:  return allocateArray<PVULongArray>(value, fieldName, pool, count);
+    case pvFloat:  return allocateArray<PVFloatArray>(value, fieldName, pool, count);
+    case pvDouble: return allocateArray<PVDoubleArray>(value, fieldName, pool, count);
+    default:
+        throw std::runtime_error("not a numeric NTNDArray value type");
+    }
+}
+
+/*
+ * A copy of a frame that shares the value with it until it is replaced.
+ */
+inline NTNDArrayPtr cloneFrame(NTNDArrayPtr const & frame)
+{
+    return NTNDArray::wrapUnsafe(
+        epics::pvData::getPVDataCreate()->createPVStructure(frame->getPVStructure()));
+}
+
+/*
+ * The sizes of the dimensions of a frame, its element count if it has none.
+ */
+inline std::vector<std::size_t> frameDimensions(NTNDArrayPtr const & frame, std::size_t count)
+{
+    using namespace epics::pvData;
+
+    PVStructureArray::const_svector dims(frame->getDimension()->view());
+    std::vector<std::size_t> sizes;
+    std::size_t product = 1;
+    for (std::size_t i = 0; i < dims.size(); ++i) {
+        PVIntPtr size = dims[i] ? dims[i]->getSubField<PVInt>("size") : PVIntPtr();
+        if (!size || size->get() < 0)
+            throw std::runtime_error("invalid NTNDArray dimension");
+        sizes.push_back(size->get());
+        product *= size->get();
+    }
+
+    if (sizes.empty())
+        sizes.push_back(count);
+    else if (product != count)
+        throw std::runtime_error("NTNDArray value does not match its dimensions");
+    return sizes;
+}
+
+/*
+ * The attribute of a frame with a name, null if there is none.
+ */
+inline epics::pvData::PVStructurePtr findAttribute(NTNDArrayPtr const & frame,
+    std::string const & name)
+{
+    using namespace epics::pvData;
+
+    PVStructureArray::const_svector attributes(frame->getAttribute()->view());
+    for (std::size_t i = 0; i < attributes.size(); ++i) {
+        if (!attributes[i])
+            continue;
+        PVStringPtr attributeName = attributes[i]->getSubField<PVString>("name");
+        if (attributeName && attributeName->get() == name)
+            return attributes[i];
+    }
+    return PVStructurePtr();
+}
+
+/*
+ * The value of a scalar attribute, false if there is none.
+ */
+inline bool getIntAttribute(NTNDArrayPtr const & frame, std::string const & name,
+    epics::pvData::int32 & value)
+{
+    using namespace epics::pvData;
+
+    PVStructurePtr attribute = findAttribute(frame, name);
+    PVUnionPtr attributeValue = attribute ?
+        attribute->getSubField<PVUnion>("value") : PVUnionPtr();
+    PVScalarPtr scalar = attributeValue ?
+        std::tr1::dynamic_pointer_cast<PVScalar>(attributeValue->get()) : PVScalarPtr();
+    if (!scalar)
+        return false;
+    value = scalar->getAs<int32>();
+    return true;
+}
+
+inline epics::pvData::PVFieldPtr intAttributeValue(epics::pvData::int32 value)
+{
+    epics::pvData::PVIntPtr pvValue =
+        epics::pvData::getPVDataCreate()->createPVScalar<epics::pvData::PVInt>();
+    pvValue->put(value);
+    return pvValue;
+}
+
+/*
+ * Sets the value of an attribute of a frame, adding it if needed.
+ */
+inline void setAttribute(NTNDArrayPtr const & frame, std::string const & name,
+    epics::pvData::PVFieldPtr const & value)
+{
+    using namespace epics::pvData;
+
+    PVStructureArrayPtr attribute = frame->getAttribute();
+    PVStructureArray::const_svector attributes(attribute->view());
+
+    // the attribute structures may be shared with copies of the frame,
+    // so the one that changes is replaced by a new one
+    PVStructureArray::svector updated(attributes.size());
+    std::size_t index = attributes.size();
+    for (std::size_t i = 0; i < attributes.size(); ++i) {
+        updated[i] = attributes[i];
+        PVStringPtr attributeName = attributes[i] ?
+            attributes[i]->getSubField<PVString>("name") : PVStringPtr();
+        if (attributeName && attributeName->get() == name)
+            index = i;
+    }
+
+    PVStructurePtr element;
+    if (index < attributes.size()) {
+        element = getPVDataCreate()->createPVStructure(attributes[index]);
+        updated[index] = element;
+    } else {
+        element = getPVDataCreate()->createPVStructure(
+            attribute->getStructureArray()->getStructure());
+        element->getSubField<PVString>("name")->put(name);
+        updated.push_back(element);
+    }
+
+    element->getSubField<PVUnion>("value")->set(value);
+    attribute->replace(freeze(updated));
+}
+
+}}}
+
+#endif  /* NDARRAYVALUE_H */
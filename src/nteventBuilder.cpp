@@ -0,0 +1,398 @@
+/* nteventBuilder.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <epicsGuard.h>
+
+#define epicsExportSharedSymbols
+#include <pv/nteventBuilder.h>
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+namespace {
+
+typedef epicsGuard<epicsMutex> Guard;
+
+const int64 nanosecondsPerSecond = 1000000000LL;
+
+inline int64 toTime(int64 secondsPastEpoch, int32 nanoseconds)
+{
+    return secondsPastEpoch*nanosecondsPerSecond + nanoseconds;
+}
+
+// the position of sample i of a history that starts at first, without a division
+inline size_t ringIndex(size_t first, size_t i, size_t depth)
+{
+    size_t at = first + i;
+    return at >= depth ? at - depth : at;
+}
+
+}
+
+NTEventBuilder::shared_pointer NTEventBuilder::create(vector<string> const & channelNames,
+    ScalarType valueType, size_t depth, double timeout, size_t maxPending)
+{
+    if (channelNames.empty() || depth == 0 || maxPending == 0)
+        throw std::runtime_error("NTEventBuilder needs channels, a depth and pending events");
+    if (!ScalarTypeFunc::isNumeric(valueType))
+        throw std::runtime_error("NTEventBuilder needs a numeric value type");
+
+    StructureConstPtr structure = NTScalarMultiChannel::createBuilder()->
+        value(valueType)->
+        addTimeStamp()->
+        addSecondsPastEpoch()->
+        addNanoseconds()->
+        addIsConnected()->
+        createStructure();
+    return shared_pointer(new NTEventBuilder(channelNames, structure, depth,
+        timeout, maxPending));
+}
+
+NTEventBuilder::NTEventBuilder(vector<string> const & channelNames,
+        StructureConstPtr const & structure, size_t depth,
+        double timeout, size_t maxPending) :
+    channelNames(channelNames), depth(depth), timeout(timeout),
+    maxPending(maxPending), structure(structure),
+    histories(channelNames.size()), interpolations(channelNames.size(), nearest),
+    timedOut(0), dropped(0),
+    before(channelNames.size()), after(channelNames.size()),
+    valueBefore(channelNames.size()), valueAfter(channelNames.size()),
+    selected(channelNames.size()), aligned(channelNames.size()), valid(channelNames.size())
+{
+    for (size_t i = 0; i < channelNames.size(); ++i) {
+        channelIndexes[channelNames[i]] = i;
+        histories[i].times.resize(depth);
+        histories[i].values.resize(depth);
+        histories[i].first = 0;
+        histories[i].count = 0;
+    }
+}
+
+void NTEventBuilder::checkChannel(size_t channel) const
+{
+    if (channel >= channelNames.size())
+        throw std::runtime_error("no such NTEventBuilder channel");
+}
+
+void NTEventBuilder::setInterpolation(size_t channel, Interpolation interpolation)
+{
+    checkChannel(channel);
+    Guard G(mutex);
+    interpolations[channel] = interpolation;
+}
+
+NTEventBuilder::Interpolation NTEventBuilder::getInterpolation(size_t channel) const
+{
+    checkChannel(channel);
+    Guard G(mutex);
+    return interpolations[channel];
+}
+
+// keeps a sample in time order, dropping the oldest if the history is full
+void NTEventBuilder::insert(History & history, int64 time, double value)
+{
+    size_t position = history.count;
+    while (position > 0) {
+        size_t at = (history.first + position - 1) % depth;
+        if (history.times[at] < time)
+            break;
+        if (history.times[at] == time) {
+            history.values[at] = value;
+            return;
+        }
+        --position;
+    }
+    if (position == 0 && history.count == depth)
+        return;  // older than the whole history
+
+    if (history.count == depth) {
+        history.first = (history.first + 1) % depth;
+        --history.count;
+        --position;
+    }
+    for (size_t i = history.count; i > position; --i) {
+        size_t to = (history.first + i) % depth, from = (history.first + i - 1) % depth;
+        history.times[to] = history.times[from];
+        history.values[to] = history.values[from];
+    }
+    size_t at = (history.first + position) % depth;
+    history.times[at] = time;
+    history.values[at] = value;
+    ++history.count;
+}
+
+void NTEventBuilder::add(size_t channel, int64 secondsPastEpoch, int32 nanoseconds, double value)
+{
+    checkChannel(channel);
+    Guard G(mutex);
+    insert(histories[channel], toTime(secondsPastEpoch, nanoseconds), value);
+}
+
+void NTEventBuilder::add(NTScalarMultiChannelPtr const & update)
+{
+    PVScalarArrayPtr pvValue = update->getValue();
+    if (!pvValue || !ScalarTypeFunc::isNumeric(pvValue->getScalarArray()->getElementType()))
+        throw std::runtime_error("NTScalarMultiChannel value is not numeric");
+
+    PVDoubleArray::const_svector values;
+    pvValue->getAs<double>(values);
+    PVStringArray::const_svector names(update->getChannelName()->view());
+    PVLongArrayPtr pvSeconds = update->getSecondsPastEpoch();
+    PVIntArrayPtr pvNanoseconds = update->getNanoseconds();
+    PVBooleanArrayPtr pvConnected = update->getIsConnected();
+    PVStructurePtr timeStamp = update->getTimeStamp();
+    if (!(pvSeconds && pvNanoseconds) && !timeStamp)
+        throw std::runtime_error("NTScalarMultiChannel has no time");
+
+    PVLongArray::const_svector seconds;
+    PVIntArray::const_svector nanoseconds;
+    int64 time = 0;
+    if (pvSeconds && pvNanoseconds) {
+        seconds = pvSeconds->view();
+        nanoseconds = pvNanoseconds->view();
+    } else {
+        time = toTime(timeStamp->getSubField<PVLong>("secondsPastEpoch")->get(),
+            timeStamp->getSubField<PVInt>("nanoseconds")->get());
+    }
+    PVBooleanArray::const_svector connected;
+    if (pvConnected)
+        connected = pvConnected->view();
+
+    Guard G(mutex);
+    size_t count = std::min(values.size(), names.size());
+    for (size_t i = 0; i < count; ++i) {
+        map<string, size_t>::const_iterator channel = channelIndexes.find(names[i]);
+        if (channel == channelIndexes.end() || (i < connected.size() && !connected[i]))
+            continue;
+        int64 sampleTime = time;
+        if (!seconds.empty()) {
+            if (i >= seconds.size() || i >= nanoseconds.size())
+                continue;
+            sampleTime = toTime(seconds[i], nanoseconds[i]);
+        }
+        insert(histories[channel->second], sampleTime, values[i]);
+    }
+}
+
+void NTEventBuilder::trigger(int64 secondsPastEpoch, int32 nanoseconds)
+{
+    epicsTime now(epicsTime::getCurrent());
+
+    Guard G(mutex);
+    if (triggers.size() == maxPending) {
+        triggers.pop_front();
+        ++dropped;
+    }
+    triggers.push_back(Trigger(toTime(secondsPastEpoch, nanoseconds), now));
+}
+
+bool NTEventBuilder::ready(int64 time) const
+{
+    for (size_t i = 0; i < histories.size(); ++i) {
+        History const & history = histories[i];
+        if (history.count == 0 ||
+            history.times[(history.first + history.count - 1) % depth] < time)
+            return false;
+    }
+    return true;
+}
+
+bool NTEventBuilder::isReady(int64 secondsPastEpoch, int32 nanoseconds) const
+{
+    Guard G(mutex);
+    return ready(toTime(secondsPastEpoch, nanoseconds));
+}
+
+size_t NTEventBuilder::poll(vector<NTScalarMultiChannelPtr> & events)
+{
+    epicsTime now(epicsTime::getCurrent());
+
+    Guard G(mutex);
+    size_t count = 0;
+    while (!triggers.empty()) {
+        Trigger const & next = triggers.front();
+        bool complete = ready(next.time);
+        if (!complete && now - next.requested < timeout)
+            break;
+        if (!complete)
+            ++timedOut;
+        events.push_back(build(next.time, complete));
+        triggers.pop_front();
+        ++count;
+    }
+    return count;
+}
+
+/*
+ * Looks up the samples around a time for each channel, then interpolates
+ * all channels in loops without branches on data. The linear value of
+ * every channel is computed first, so that no comparison guards the
+ * division, then the nearest sample is selected where that is the mode;
+ * both loops vectorize. A previous mode is the nearest mode with the
+ * sample after as far as the one before.
+ */
+void NTEventBuilder::alignLocked(int64 time)
+{
+    size_t channelCount = histories.size();
+    for (size_t c = 0; c < channelCount; ++c) {
+        History const & history = histories[c];
+
+        // the number of samples at or before the time
+        size_t low = 0, high = history.count;
+        while (low < high) {
+            size_t middle = (low + high)/2;
+            if (history.times[ringIndex(history.first, middle, depth)] <= time)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        bool hasBefore = low > 0, hasAfter = low < history.count;
+        bool isValid = interpolations[c] == previous ? hasBefore : (hasBefore || hasAfter);
+
+        before[c] = after[c] = 0;
+        valueBefore[c] = valueAfter[c] = 0;
+        if (hasBefore) {
+            size_t at = ringIndex(history.first, low - 1, depth);
+            before[c] = static_cast<double>(time - history.times[at]);
+            valueBefore[c] = valueAfter[c] = history.values[at];
+        }
+        if (hasAfter) {
+            size_t at = ringIndex(history.first, low, depth);
+            after[c] = static_cast<double>(history.times[at] - time);
+            valueAfter[c] = history.values[at];
+            if (!hasBefore)
+                valueBefore[c] = valueAfter[c];
+        }
+        if (interpolations[c] == previous)
+            after[c] = before[c];
+        if (!isValid)
+            valueBefore[c] = valueAfter[c] = 0;
+        selected[c] = interpolations[c] == linear ? 0 : 1;
+        valid[c] = isValid;
+    }
+
+    const double *toBefore = &before[0], *toAfter = &after[0];
+    const double *samplesBefore = &valueBefore[0], *samplesAfter = &valueAfter[0];
+    const double *nearestModes = &selected[0];
+    double *values = &aligned[0];
+    for (size_t c = 0; c < channelCount; ++c) {
+        double span = toBefore[c] + toAfter[c];
+        double weight = toBefore[c]/(span + (span == 0));
+        values[c] = samplesBefore[c] + (samplesAfter[c] - samplesBefore[c])*weight;
+    }
+    for (size_t c = 0; c < channelCount; ++c) {
+        double sampleBefore = samplesBefore[c], sampleAfter = samplesAfter[c];
+        double linearValue = values[c];
+        double nearestValue = toBefore[c] <= toAfter[c] ? sampleBefore : sampleAfter;
+        values[c] = nearestModes[c] != 0 ? nearestValue : linearValue;
+    }
+}
+
+void NTEventBuilder::align(int64 secondsPastEpoch, int32 nanoseconds,
+    vector<double> & values, vector<bool> & connected)
+{
+    Guard G(mutex);
+    alignLocked(toTime(secondsPastEpoch, nanoseconds));
+    values.assign(aligned.begin(), aligned.end());
+    connected.assign(valid.begin(), valid.end());
+}
+
+NTScalarMultiChannelPtr NTEventBuilder::build(int64 time, bool complete)
+{
+    alignLocked(time);
+
+    // channels that have not caught up with the time are left out
+    if (!complete) {
+        for (size_t c = 0; c < histories.size(); ++c) {
+            History const & history = histories[c];
+            if (history.count == 0 ||
+                history.times[(history.first + history.count - 1) % depth] < time) {
+                aligned[c] = 0;
+                valid[c] = 0;
+            }
+        }
+    }
+
+    NTScalarMultiChannelPtr snapshot = NTScalarMultiChannel::wrapUnsafe(
+        getPVDataCreate()->createPVStructure(structure));
+    int64 seconds = time/nanosecondsPerSecond;
+    int32 nanoseconds = static_cast<int32>(time - seconds*nanosecondsPerSecond);
+    if (nanoseconds < 0) {
+        --seconds;
+        nanoseconds += static_cast<int32>(nanosecondsPerSecond);
+    }
+
+    size_t channelCount = channelNames.size();
+    PVDoubleArray::svector values(channelCount);
+    PVStringArray::svector names(channelCount);
+    PVBooleanArray::svector connected(channelCount);
+    std::copy(aligned.begin(), aligned.end(), values.begin());
+    std::copy(channelNames.begin(), channelNames.end(), names.begin());
+    std::copy(valid.begin(), valid.end(), connected.begin());
+    PVLongArray::svector channelSeconds(channelCount, seconds);
+    PVIntArray::svector channelNanoseconds(channelCount, nanoseconds);
+
+    snapshot->getValue()->putFrom<double>(freeze(values));
+    snapshot->getChannelName()->replace(freeze(names));
+    snapshot->getSecondsPastEpoch()->replace(freeze(channelSeconds));
+    snapshot->getNanoseconds()->replace(freeze(channelNanoseconds));
+    snapshot->getIsConnected()->replace(freeze(connected));
+    PVStructurePtr timeStamp = snapshot->getTimeStamp();
+    timeStamp->getSubField<PVLong>("secondsPastEpoch")->put(seconds);
+    timeStamp->getSubField<PVInt>("nanoseconds")->put(nanoseconds);
+    return snapshot;
+}
+
+NTScalarMultiChannelPtr NTEventBuilder::snapshot(int64 secondsPastEpoch, int32 nanoseconds)
+{
+    Guard G(mutex);
+    return build(toTime(secondsPastEpoch, nanoseconds), true);
+}
+
+size_t NTEventBuilder::getChannelCount() const
+{
+    return channelNames.size();
+}
+
+vector<string> const & NTEventBuilder::getChannelNames() const
+{
+    return channelNames;
+}
+
+size_t NTEventBuilder::getPending() const
+{
+    Guard G(mutex);
+    return triggers.size();
+}
+
+size_t NTEventBuilder::getTimedOut() const
+{
+    Guard G(mutex);
+    return timedOut;
+}
+
+size_t NTEventBuilder::getDropped() const
+{
+    Guard G(mutex);
+    return dropped;
+}
+
+double NTEventBuilder::getTimeout() const
+{
+    return timeout;
+}
+
+size_t NTEventBuilder::getMaxPending() const
+{
+    return maxPending;
+}
+
+}}
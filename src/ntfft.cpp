@@ -0,0 +1,483 @@
+/* ntfft.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <list>
+#include <map>
+#include <stdexcept>
+
+#include <epicsGuard.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define epicsExportSharedSymbols
+#include <pv/ntfft.h>
+
+#include "ndarrayValue.h"
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+using namespace detail;
+
+namespace {
+
+typedef std::complex<double> Complex;
+typedef epicsGuard<epicsMutex> Guard;
+
+const double pi = 3.14159265358979323846;
+
+// std::complex multiplication checks for infinities, which keeps it
+// out of line; the butterflies need the plain formula
+inline Complex mul(Complex const & a, Complex const & b)
+{
+    return Complex(a.real()*b.real() - a.imag()*b.imag(),
+        a.real()*b.imag() + a.imag()*b.real());
+}
+
+/*
+ * The radix-4 butterflies of a block of 4*half elements: the radix-2
+ * stages of half and of 2*half. The twiddles w1 and w2 of each j are
+ * next to each other in w, so that they are read in order.
+ */
+#ifdef __SSE2__
+// the product of two complex numbers held in one register each
+inline __m128d mul(__m128d w, __m128d a)
+{
+    const __m128d negateReal = _mm_set_pd(0.0, -0.0);
+    __m128d real = _mm_unpacklo_pd(w, w), imag = _mm_unpackhi_pd(w, w);
+    __m128d swapped = _mm_shuffle_pd(a, a, 1);
+    return _mm_add_pd(_mm_mul_pd(real, a),
+        _mm_xor_pd(_mm_mul_pd(imag, swapped), negateReal));
+}
+
+void butterflies(Complex *a, size_t half, const Complex *w)
+{
+    const __m128d negateImag = _mm_set_pd(-0.0, 0.0);
+    double *a0 = reinterpret_cast<double*>(a);
+    double *a1 = reinterpret_cast<double*>(a + half);
+    double *a2 = reinterpret_cast<double*>(a + 2*half);
+    double *a3 = reinterpret_cast<double*>(a + 3*half);
+    const double *t = reinterpret_cast<const double*>(w);
+    for (size_t j = 0; j < 2*half; j += 2) {
+        __m128d w1 = _mm_loadu_pd(t + 2*j), w2 = _mm_loadu_pd(t + 2*j + 2);
+        __m128d t1 = mul(w1, _mm_loadu_pd(a1 + j));
+        __m128d t3 = mul(w1, _mm_loadu_pd(a3 + j));
+        __m128d x0 = _mm_loadu_pd(a0 + j), x2 = _mm_loadu_pd(a2 + j);
+        __m128d b0 = _mm_add_pd(x0, t1), b1 = _mm_sub_pd(x0, t1);
+        __m128d v0 = mul(w2, _mm_add_pd(x2, t3));
+        __m128d v1 = mul(w2, _mm_sub_pd(x2, t3));
+        // times -i
+        v1 = _mm_xor_pd(_mm_shuffle_pd(v1, v1, 1), negateImag);
+        _mm_storeu_pd(a0 + j, _mm_add_pd(b0, v0));
+        _mm_storeu_pd(a2 + j, _mm_sub_pd(b0, v0));
+        _mm_storeu_pd(a1 + j, _mm_add_pd(b1, v1));
+        _mm_storeu_pd(a3 + j, _mm_sub_pd(b1, v1));
+    }
+}
+#else
+void butterflies(Complex *a, size_t half, const Complex *w)
+{
+    for (size_t j = 0; j < half; ++j) {
+        Complex w1 = w[2*j], w2 = w[2*j + 1];
+        Complex t1 = mul(w1, a[j + half]);
+        Complex t3 = mul(w1, a[j + 3*half]);
+        Complex b0 = a[j] + t1, b1 = a[j] - t1;
+        Complex b2 = a[j + 2*half] + t3, b3 = a[j + 2*half] - t3;
+
+        Complex v0 = mul(w2, b2);
+        Complex v1 = mul(w2, b3);
+        // times -i
+        v1 = Complex(v1.imag(), -v1.real());
+
+        a[j] = b0 + v0;
+        a[j + 2*half] = b0 - v0;
+        a[j + half] = b1 + v1;
+        a[j + 3*half] = b1 - v1;
+    }
+}
+#endif
+
+bool isPowerOfTwo(size_t n)
+{
+    return (n & (n - 1)) == 0;
+}
+
+// there are few power of two lengths, but any number of others
+const size_t maxBluesteinPlans = 16;
+
+struct PlanCache
+{
+    epicsMutex mutex;
+    std::map<size_t, NTFFTPlanPtr> plans;
+    // the Bluestein plans, most recently used first
+    std::list<NTFFTPlanPtr> bluesteinPlans;
+};
+
+PlanCache *planCache;
+epicsThreadOnceId planCacheOnce = EPICS_THREAD_ONCE_INIT;
+
+void initPlanCache(void *)
+{
+    planCache = new PlanCache();
+}
+
+template<typename T>
+void toComplex(const char *data, size_t count, Complex *out)
+{
+    const T *in = reinterpret_cast<const T*>(data);
+    for (size_t i = 0; i < count; ++i)
+        out[i] = Complex(static_cast<double>(in[i]), 0);
+}
+
+void toComplex(ScalarType type, const char *data, size_t count, Complex *out)
+{
+    switch (type) {
+    case pvByte:   toComplex<int8>(data, count, out); break;
+    case pvShort:  toComplex<int16>(data, count, out); break;
+    case pvInt:    toComplex<int32>(data, count, out); break;
+    case pvLong:   toComplex<int64>(data, count, out); break;
+    case pvUByte:  toComplex<uint8>(data, count, out); break;
+    case pvUShort: toComplex<uint16>(data, count, out); break;
+    case pvUInt:   toComplex<uint32>(data, count, out); break;
+    case pvULong:  toComplex<uint64>(data, count, out); break;
+    case pvFloat:  toComplex<float>(data, count, out); break;
+    case pvDouble: toComplex<double>(data, count, out); break;
+    default: break;
+    }
+}
+
+void outputValues(Complex const *in, double *out, size_t count, NTFFT::Output output)
+{
+    switch (output) {
+    case NTFFT::magnitude:
+        for (size_t i = 0; i < count; ++i)
+            out[i] = sqrt(in[i].real()*in[i].real() + in[i].imag()*in[i].imag());
+        break;
+    case NTFFT::phase:
+        for (size_t i = 0; i < count; ++i)
+            out[i] = atan2(in[i].imag(), in[i].real());
+        break;
+    case NTFFT::power:
+        for (size_t i = 0; i < count; ++i)
+            out[i] = in[i].real()*in[i].real() + in[i].imag()*in[i].imag();
+        break;
+    }
+}
+
+/*
+ * Transforms the rows, or the columns, given by the tiles of a
+ * two dimensional array.
+ */
+class TransformKernel : public NTNDArrayKernel
+{
+public:
+    TransformKernel(Complex *data, size_t width, size_t height, bool columns) :
+        data(data), width(width), height(height), columns(columns),
+        plan(NTFFTPlan::get(columns ? height : width))
+    {
+    }
+
+    virtual void apply(NTNDArrayTile const & tile)
+    {
+        if (!columns) {
+            for (size_t y = tile.y; y < tile.y + tile.height; ++y)
+                plan->transform(data + y*width);
+            return;
+        }
+
+        vector<Complex> column(height);
+        for (size_t x = tile.x; x < tile.x + tile.width; ++x) {
+            for (size_t y = 0; y < height; ++y)
+                column[y] = data[y*width + x];
+            plan->transform(&column[0]);
+            for (size_t y = 0; y < height; ++y)
+                data[y*width + x] = column[y];
+        }
+    }
+
+private:
+    Complex *data;
+    size_t width;
+    size_t height;
+    bool columns;
+    NTFFTPlanPtr plan;
+};
+
+void runKernel(NTNDArrayTilerPtr const & tiler, vector<NTNDArrayTile> const & tiles,
+    NTNDArrayKernel & kernel)
+{
+    if (tiler) {
+        tiler->run(tiles, kernel);
+        return;
+    }
+    for (size_t i = 0; i < tiles.size(); ++i)
+        kernel.apply(tiles[i]);
+}
+
+}
+
+NTFFTPlan::shared_pointer NTFFTPlan::get(size_t n)
+{
+    epicsThreadOnce(&planCacheOnce, &initPlanCache, 0);
+
+    // the mutex is recursive, so a Bluestein plan can get its inner plan
+    Guard G(planCache->mutex);
+    if (isPowerOfTwo(n)) {
+        NTFFTPlanPtr & plan = planCache->plans[n];
+        if (!plan)
+            plan.reset(new NTFFTPlan(n));
+        return plan;
+    }
+
+    std::list<NTFFTPlanPtr> & plans = planCache->bluesteinPlans;
+    for (std::list<NTFFTPlanPtr>::iterator it = plans.begin(); it != plans.end(); ++it) {
+        if ((*it)->n == n) {
+            plans.splice(plans.begin(), plans, it);
+            return plans.front();
+        }
+    }
+    plans.push_front(NTFFTPlanPtr(new NTFFTPlan(n)));
+    if (plans.size() > maxBluesteinPlans)
+        plans.pop_back();
+    return plans.front();
+}
+
+NTFFTPlan::NTFFTPlan(size_t n) : n(n)
+{
+    if (n <= 1)
+        return;
+
+    if (isPowerOfTwo(n)) {
+        size_t bits = 0;
+        while ((size_t(1) << bits) < n)
+            ++bits;
+
+        // the twiddles of each radix-4 stage in the order they are used
+        for (size_t half = bits & 1 ? 2 : 1; half < n; half *= 4) {
+            for (size_t j = 0; j < half; ++j) {
+                twiddles.push_back(polar(1.0, -pi*j/half));
+                twiddles.push_back(polar(1.0, -pi*j/(2*half)));
+            }
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            size_t r = 0;
+            for (size_t b = 0; b < bits; ++b)
+                r |= ((i >> b) & 1) << (bits - 1 - b);
+            if (i < r) {
+                swaps.push_back(i);
+                swaps.push_back(r);
+            }
+        }
+        return;
+    }
+
+    // a circular convolution of length m >= 2n - 1 with the chirp
+    size_t m = 1;
+    while (m < 2*n - 1)
+        m <<= 1;
+    inner = NTFFTPlan::get(m);
+
+    chirp.resize(n);
+    for (size_t k = 0; k < n; ++k) {
+        // k*k modulo 2n keeps the angle accurate for large k
+        size_t k2 = static_cast<size_t>((static_cast<uint64>(k)*k) % (2*n));
+        chirp[k] = polar(1.0, -pi*k2/n);
+    }
+
+    kernel.assign(m, Complex());
+    kernel[0] = conj(chirp[0]);
+    for (size_t k = 1; k < n; ++k)
+        kernel[k] = kernel[m - k] = conj(chirp[k]);
+    inner->radix(&kernel[0]);
+    // the normalization of the inverse inner transform
+    for (size_t k = 0; k < m; ++k)
+        kernel[k] /= static_cast<double>(m);
+}
+
+void NTFFTPlan::transform(Complex *data, bool inverse) const
+{
+    if (n <= 1)
+        return;
+
+    // the inverse is the conjugate of the forward transform of the conjugate
+    if (inverse)
+        for (size_t i = 0; i < n; ++i)
+            data[i] = conj(data[i]);
+
+    if (inner)
+        bluestein(data);
+    else
+        radix(data);
+
+    if (inverse) {
+        double scale = 1.0/n;
+        for (size_t i = 0; i < n; ++i)
+            data[i] = Complex(data[i].real()*scale, -data[i].imag()*scale);
+    }
+}
+
+void NTFFTPlan::radix(Complex *data) const
+{
+    for (size_t i = 0; i < swaps.size(); i += 2)
+        std::swap(data[swaps[i]], data[swaps[i + 1]]);
+
+    size_t stages = 0;
+    while ((size_t(1) << stages) < n)
+        ++stages;
+
+    size_t half = 1;
+    if (stages & 1) {
+        // an odd number of stages starts with one radix-2 stage
+        for (size_t i = 0; i < n; i += 2) {
+            Complex u = data[i], v = data[i + 1];
+            data[i] = u + v;
+            data[i + 1] = u - v;
+        }
+        half = 2;
+    }
+
+    // two radix-2 stages, of half and of 2*half, as one radix-4 butterfly
+    const Complex *w = twiddles.empty() ? 0 : &twiddles[0];
+    for (; half < n; half *= 4) {
+        for (size_t block = 0; block < n; block += 4*half)
+            butterflies(data + block, half, w);
+        w += 2*half;
+    }
+}
+
+void NTFFTPlan::bluestein(Complex *data) const
+{
+    size_t m = inner->n;
+    vector<Complex> a(m);
+    for (size_t k = 0; k < n; ++k)
+        a[k] = mul(data[k], chirp[k]);
+
+    // the inverse inner transform, as the conjugate of the forward one
+    inner->radix(&a[0]);
+    for (size_t k = 0; k < m; ++k)
+        a[k] = conj(mul(a[k], kernel[k]));
+    inner->radix(&a[0]);
+
+    for (size_t k = 0; k < n; ++k)
+        data[k] = mul(conj(a[k]), chirp[k]);
+}
+
+size_t NTFFTPlan::getSize() const
+{
+    return n;
+}
+
+bool NTFFTPlan::isBluestein() const
+{
+    return inner.get() != 0;
+}
+
+void NTFFT::transform(vector<Complex> & data, bool inverse)
+{
+    if (!data.empty())
+        NTFFTPlan::get(data.size())->transform(&data[0], inverse);
+}
+
+NTScalarArrayPtr NTFFT::spectrum(NTScalarArrayPtr const & waveform, Output output)
+{
+    PVScalarArrayPtr value = waveform->getValue<PVScalarArray>();
+    if (!value || !ScalarTypeFunc::isNumeric(value->getScalarArray()->getElementType()))
+        throw std::runtime_error("NTScalarArray value is not numeric");
+
+    PVDoubleArray::const_svector samples;
+    value->getAs<double>(samples);
+    vector<Complex> data(samples.begin(), samples.end());
+    transform(data);
+
+    NTScalarArrayBuilderPtr builder = NTScalarArray::createBuilder();
+    builder->value(pvDouble);
+    PVStructurePtr timeStamp = waveform->getTimeStamp();
+    if (timeStamp)
+        builder->addTimeStamp();
+    NTScalarArrayPtr result = builder->create();
+
+    PVDoubleArray::svector bins(data.empty() ? 0 : data.size()/2 + 1);
+    if (!bins.empty())
+        outputValues(&data[0], bins.data(), bins.size(), output);
+    result->getValue<PVDoubleArray>()->replace(freeze(bins));
+    if (timeStamp)
+        result->getTimeStamp()->copy(*timeStamp);
+    return result;
+}
+
+NTNDArrayPtr NTFFT::spectrum(NTNDArrayPtr const & frame, Output output,
+    NTNDArrayTilerPtr const & tiler, NTNDArrayBufferPoolPtr const & pool)
+{
+    ScalarType type;
+    const char *values;
+    size_t count;
+    if (!valueData(frame, type, values, count))
+        throw std::runtime_error("NTNDArray has no numeric value");
+    vector<size_t> dims(frameDimensions(frame, count));
+    if (dims.size() > 2)
+        throw std::runtime_error("NTNDArray spectra have at most two dimensions");
+    size_t width = dims[0];
+    size_t height = dims.size() > 1 ? dims[1] : 1;
+
+    NTNDArrayPtr result = cloneFrame(frame);
+    NTNDArrayBufferPoolPtr outputPool(pool ? pool : NTNDArrayBufferPool::create(0));
+    // a dimension of size 0 leaves no element to transform
+    if (count == 0) {
+        allocateValue(result, outputPool, pvDouble, 0);
+        return result;
+    }
+
+    vector<Complex> data(count);
+    toComplex(type, values, count, &data[0]);
+
+    // bands of rows, then of columns, sized like the tiles of the tiler
+    size_t tileBytes = tiler ? tiler->getTileBytes() : count*sizeof(Complex);
+    NTNDArrayTile tile;
+    memset(&tile, 0, sizeof(tile));
+    vector<NTNDArrayTile> tiles;
+
+    if (width > 1) {
+        size_t rows = std::max(tileBytes/(width*sizeof(Complex)), (size_t)1);
+        tile.width = width;
+        for (size_t y = 0; y < height; y += rows) {
+            tile.y = y;
+            tile.height = std::min(rows, height - y);
+            tiles.push_back(tile);
+        }
+        TransformKernel kernel(&data[0], width, height, false);
+        runKernel(tiler, tiles, kernel);
+    }
+
+    if (height > 1) {
+        size_t columns = std::max(tileBytes/(height*sizeof(Complex)), (size_t)1);
+        tiles.clear();
+        tile.y = 0;
+        tile.height = height;
+        for (size_t x = 0; x < width; x += columns) {
+            tile.x = x;
+            tile.width = std::min(columns, width - x);
+            tiles.push_back(tile);
+        }
+        TransformKernel kernel(&data[0], width, height, true);
+        runKernel(tiler, tiles, kernel);
+    }
+
+    char *out = allocateValue(result, outputPool, pvDouble, count);
+    outputValues(&data[0], reinterpret_cast<double*>(out), count, output);
+    return result;
+}
+
+}}
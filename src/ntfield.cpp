@@ -4,7 +4,10 @@
  * found in the file LICENSE that is included with the distribution
  */
 
-#include <pv/lock.h>
+#include <epicsAtomic.h>
+#include <epicsExit.h>
+#include <epicsThread.h>
+
 #include "validator.h"
 
 #define epicsExportSharedSymbols
@@ -15,15 +18,80 @@ using std::tr1::static_pointer_cast;
 
 namespace epics { namespace nt {
 
-NTFieldPtr NTField::get()
+namespace {
+
+/*
+ * The singletons are created on first use, which may happen from
+ * static initializers in other translation units, so their state is
+ * constant initialized. Once created, a singleton is found through an
+ * atomic load, and epicsThreadOnce(), which locks a mutex, is only
+ * called until then.
+ *
+ * Copies of one shared pointer made by several threads at once all
+ * write its reference count, which keeps them from scaling. Each thread
+ * therefore copies a shared pointer of its own, with a reference count
+ * of its own, which is freed when an EPICS thread exits.
+ */
+struct Singleton
+{
+    epicsThreadOnceId once;
+    EpicsAtomicPtrT instance;  // the shared pointer
+    EpicsAtomicPtrT copies;    // the epicsThreadPrivateId of the copies, set last
+};
+
+struct NoDelete
+{
+    void operator()(const void *) const {}
+};
+
+template<typename T>
+void deleteCopy(void *copy)
+{
+    delete static_cast<std::tr1::shared_ptr<T> *>(copy);
+}
+
+// called by init, once
+template<typename T>
+void publish(Singleton & singleton, T *object)
 {
-    static Mutex mutex;
-    static NTFieldPtr ntstructureField;
-    Lock xx(mutex);
-    if(ntstructureField.get()==NULL) {
-         ntstructureField = NTFieldPtr(new NTField());
+    epicsAtomicSetPtrT(&singleton.instance, new std::tr1::shared_ptr<T>(object));
+    epicsAtomicSetPtrT(&singleton.copies, epicsThreadPrivateCreate());
+}
+
+template<typename T>
+std::tr1::shared_ptr<T> const & instance(Singleton & singleton, EPICSTHREADFUNC init)
+{
+    typedef std::tr1::shared_ptr<T> Pointer;
+    EpicsAtomicPtrT copies = epicsAtomicGetPtrT(&singleton.copies);
+    if (!copies) {
+        epicsThreadOnce(&singleton.once, init, 0);
+        copies = epicsAtomicGetPtrT(&singleton.copies);
+    }
+
+    epicsThreadPrivateId id = static_cast<epicsThreadPrivateId>(copies);
+    Pointer *copy = static_cast<Pointer *>(epicsThreadPrivateGet(id));
+    if (!copy) {
+        // the singleton is never deleted
+        Pointer const & shared = *static_cast<Pointer *>(epicsAtomicGetPtrT(&singleton.instance));
+        copy = new Pointer(shared.get(), NoDelete());
+        epicsThreadPrivateSet(id, copy);
+        epicsAtThreadExit(&deleteCopy<T>, copy);
     }
-    return ntstructureField;
+    return *copy;
+}
+
+Singleton ntstructureField = { EPICS_THREAD_ONCE_INIT, 0, 0 };
+
+}
+
+void NTField::init(void *)
+{
+    publish(ntstructureField, new NTField());
+}
+
+NTFieldPtr NTField::get()
+{
+    return instance<NTField>(ntstructureField, &NTField::init);
 }
 
 NTField::NTField()
@@ -167,15 +235,16 @@ StructureArrayConstPtr NTField::createAlarmArray()
     return fieldCreate->createStructureArray(st);
 }
 
+static Singleton pvntstructureField = { EPICS_THREAD_ONCE_INIT, 0, 0 };
+
+void PVNTField::init(void *)
+{
+    publish(pvntstructureField, new PVNTField());
+}
+
 PVNTFieldPtr PVNTField::get()
 {
-    static Mutex mutex;
-    static PVNTFieldPtr pvntstructureField;
-    Lock xx(mutex);
-    if(pvntstructureField.get()==NULL) {
-         pvntstructureField = PVNTFieldPtr(new PVNTField());
-    }
-    return pvntstructureField;
+    return instance<PVNTField>(pvntstructureField, &PVNTField::init);
 }
 
 PVNTField::PVNTField()
@@ -0,0 +1,268 @@
+/* ntndarrayAccumulator.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#define epicsExportSharedSymbols
+#include <pv/ntndarrayAccumulator.h>
+
+#include "ndarrayValue.h"
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+using namespace detail;
+
+namespace {
+
+enum Operation { assignOperation, addOperation, moveOperation };
+
+template<typename Acc, typename In>
+inline Acc convert(In value)
+{
+    return static_cast<Acc>(value);
+}
+
+/*
+ * SSE2 has no conversion of unsigned 64 bit integers, and the scalar one
+ * branches on the top bit. The two halves convert exactly and their sum
+ * is rounded once, as the direct conversion is, and this vectorizes.
+ */
+template<>
+inline double convert<double, uint64>(uint64 value)
+{
+    return static_cast<double>(static_cast<uint32>(value >> 32))*4294967296.0 +
+        static_cast<double>(static_cast<uint32>(value));
+}
+
+// combines the elements of a frame into the accumulation array
+template<typename In, typename Acc>
+void combine(const In *in, Acc *acc, size_t count, Operation operation, double weight)
+{
+    switch (operation) {
+    case assignOperation:
+        for (size_t i = 0; i < count; ++i)
+            acc[i] = convert<Acc>(in[i]);
+        break;
+    case addOperation:
+        for (size_t i = 0; i < count; ++i)
+            acc[i] += convert<Acc>(in[i]);
+        break;
+    case moveOperation:
+        for (size_t i = 0; i < count; ++i)
+            acc[i] += static_cast<Acc>(weight*(convert<double>(in[i]) - acc[i]));
+        break;
+    }
+}
+
+template<typename In>
+void combineInto(const char *data, ScalarType accumulatorType, char *storage,
+    size_t count, Operation operation, double weight)
+{
+    const In *in = reinterpret_cast<const In*>(data);
+    switch (accumulatorType) {
+    case pvInt:    combine(in, reinterpret_cast<int32*>(storage), count, operation, weight); break;
+    case pvUInt:   combine(in, reinterpret_cast<uint32*>(storage), count, operation, weight); break;
+    case pvLong:   combine(in, reinterpret_cast<int64*>(storage), count, operation, weight); break;
+    case pvULong:  combine(in, reinterpret_cast<uint64*>(storage), count, operation, weight); break;
+    case pvDouble: combine(in, reinterpret_cast<double*>(storage), count, operation, weight); break;
+    default: break;
+    }
+}
+
+void combine(ScalarType type, const char *data, ScalarType accumulatorType, char *storage,
+    size_t count, Operation operation, double weight = 0)
+{
+    switch (type) {
+    case pvByte:   combineInto<int8>(data, accumulatorType, storage, count, operation, weight); break;
+    case pvShort:  combineInto<int16>(data, accumulatorType, storage, count, operation, weight); break;
+    case pvInt:    combineInto<int32>(data, accumulatorType, storage, count, operation, weight); break;
+    case pvLong:   combineInto<int64>(data, accumulatorType, storage, count, operation, weight); break;
+    case pvUByte:  combineInto<uint8>(data, accumulatorType, storage, count, operation, weight); break;
+    case pvUShort: combineInto<uint16>(data, accumulatorType, storage, count, operation, weight); break;
+    case pvUInt:   combineInto<uint32>(data, accumulatorType, storage, count, operation, weight); break;
+    case pvULong:  combineInto<uint64>(data, accumulatorType, storage, count, operation, weight); break;
+    case pvFloat:  combineInto<float>(data, accumulatorType, storage, count, operation, weight); break;
+    case pvDouble: combineInto<double>(data, accumulatorType, storage, count, operation, weight); break;
+    default: break;
+    }
+}
+
+template<typename Acc>
+void scale(const char *storage, char *output, size_t count, double factor)
+{
+    const Acc *acc = reinterpret_cast<const Acc*>(storage);
+    double *out = reinterpret_cast<double*>(output);
+    for (size_t i = 0; i < count; ++i)
+        out[i] = factor*convert<double>(acc[i]);
+}
+
+// whether frameCount frames of In can be added in Acc
+template<typename In, typename Acc>
+bool fits(size_t frameCount)
+{
+    double range = std::max(-static_cast<double>(numeric_limits<In>::min()),
+        static_cast<double>(numeric_limits<In>::max()));
+    return frameCount > 0 &&
+        frameCount <= static_cast<double>(numeric_limits<Acc>::max())/range;
+}
+
+}
+
+NTNDArrayAccumulator::shared_pointer NTNDArrayAccumulator::create(Mode mode,
+    size_t frameCount, NTNDArrayBufferPoolPtr const & pool)
+{
+    if (mode == exponentialMode && frameCount == 0)
+        throw std::runtime_error("exponential moving average needs a frame count");
+    return shared_pointer(new NTNDArrayAccumulator(mode, frameCount,
+        pool ? pool : NTNDArrayBufferPool::create()));
+}
+
+NTNDArrayAccumulator::NTNDArrayAccumulator(Mode mode, size_t frameCount,
+        NTNDArrayBufferPoolPtr const & pool) :
+    mode(mode), frameCount(frameCount), pool(pool), resultCount(0),
+    type(pvDouble), accumulatorType(pvDouble), storage(0), elementCount(0), count(0)
+{
+}
+
+ScalarType NTNDArrayAccumulator::getSumType(ScalarType type, size_t frameCount)
+{
+    switch (type) {
+    case pvByte:   return fits<int8, int32>(frameCount) ? pvInt : pvLong;
+    case pvShort:  return fits<int16, int32>(frameCount) ? pvInt : pvLong;
+    case pvUByte:  return fits<uint8, uint32>(frameCount) ? pvUInt : pvULong;
+    case pvUShort: return fits<uint16, uint32>(frameCount) ? pvUInt : pvULong;
+    case pvInt:    return pvLong;
+    case pvUInt:   return pvULong;
+    default:       return pvDouble;
+    }
+}
+
+NTNDArrayPtr NTNDArrayAccumulator::add(NTNDArrayPtr const & frame)
+{
+    ScalarType frameType;
+    const char *data;
+    size_t frameElements;
+    if (!valueData(frame, frameType, data, frameElements))
+        throw std::runtime_error("NTNDArray has no numeric value");
+    vector<size_t> frameDims(frameDimensions(frame, frameElements));
+
+    if (count == 0) {
+        type = frameType;
+        dimensions = frameDims;
+        accumulatorType = mode == exponentialMode ? pvDouble : getSumType(type, frameCount);
+        accumulator = cloneFrame(frame);
+        elementCount = frameElements;
+        storage = allocateValue(accumulator, pool, accumulatorType, elementCount);
+        combine(type, data, accumulatorType, storage, elementCount, assignOperation);
+        first = frame;
+    } else {
+        if (frameType != type || frameDims != dimensions)
+            throw std::runtime_error("NTNDArray type or dimensions differ from the accumulated frames");
+        if (mode == exponentialMode)
+            combine(type, data, accumulatorType, storage, elementCount, moveOperation,
+                1.0/std::min(count + 1, frameCount));
+        else
+            combine(type, data, accumulatorType, storage, elementCount, addOperation);
+    }
+    ++count;
+    last = frame;
+
+    if (mode == exponentialMode)
+        return result(false);
+    if (count == frameCount) {
+        NTNDArrayPtr output = result(true);
+        reset();
+        return output;
+    }
+    return NTNDArrayPtr();
+}
+
+NTNDArrayPtr NTNDArrayAccumulator::getResult()
+{
+    return count ? result(false) : NTNDArrayPtr();
+}
+
+NTNDArrayPtr NTNDArrayAccumulator::result(bool final)
+{
+    NTNDArrayPtr output = cloneFrame(last);
+    if (mode == averageMode) {
+        char *out = allocateValue(output, pool, pvDouble, elementCount);
+        double factor = 1.0/count;
+        switch (accumulatorType) {
+        case pvInt:   scale<int32>(storage, out, elementCount, factor); break;
+        case pvUInt:  scale<uint32>(storage, out, elementCount, factor); break;
+        case pvLong:  scale<int64>(storage, out, elementCount, factor); break;
+        case pvULong: scale<uint64>(storage, out, elementCount, factor); break;
+        default:      scale<double>(storage, out, elementCount, factor); break;
+        }
+    } else if (final) {
+        // the accumulation is over, so its array is passed on as it is
+        output->getValue()->copy(*accumulator->getValue());
+        output->getCompressedDataSize()->put(accumulator->getCompressedDataSize()->get());
+        output->getUncompressedDataSize()->put(accumulator->getUncompressedDataSize()->get());
+    } else {
+        char *out = allocateValue(output, pool, accumulatorType, elementCount);
+        memcpy(out, storage, elementCount*ScalarTypeFunc::elementSize(accumulatorType));
+    }
+
+    output->getUniqueId()->put(static_cast<int32>(++resultCount));
+    setAttribute(output, "NumAccumulated", intAttributeValue(static_cast<int32>(count)));
+    setAttribute(output, "FirstUniqueId", intAttributeValue(first->getUniqueId()->get()));
+    setAttribute(output, "LastUniqueId", intAttributeValue(last->getUniqueId()->get()));
+    setAttribute(output, "FirstDataTimeStamp",
+        getPVDataCreate()->createPVStructure(first->getDataTimeStamp()));
+    setAttribute(output, "LastDataTimeStamp",
+        getPVDataCreate()->createPVStructure(last->getDataTimeStamp()));
+    return output;
+}
+
+void NTNDArrayAccumulator::reset()
+{
+    count = 0;
+    accumulator.reset();
+    storage = 0;
+    elementCount = 0;
+    first.reset();
+    last.reset();
+}
+
+size_t NTNDArrayAccumulator::getCount() const
+{
+    return count;
+}
+
+NTNDArrayAccumulator::Mode NTNDArrayAccumulator::getMode() const
+{
+    return mode;
+}
+
+size_t NTNDArrayAccumulator::getFrameCount() const
+{
+    return frameCount;
+}
+
+NTNDArrayAccumulatorNode::NTNDArrayAccumulatorNode(string const & name,
+        NTNDArrayAccumulator::Mode mode, size_t frameCount, size_t queueSize) :
+    NTNDArrayNode(name, queueSize)
+{
+    if (frameCount == 0)
+        throw std::runtime_error("accumulator node needs a frame count");
+    accumulator = NTNDArrayAccumulator::create(mode, frameCount);
+}
+
+NTNDArrayPtr NTNDArrayAccumulatorNode::process(NTNDArrayPtr const & frame,
+    NTNDArrayBufferPoolPtr const &)
+{
+    return accumulator->add(frame);
+}
+
+}}
@@ -0,0 +1,478 @@
+/* ntndarrayCentroid.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include <epicsGuard.h>
+
+#define epicsExportSharedSymbols
+#include <pv/ntndarrayCentroid.h>
+
+#include "ndarrayValue.h"
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+using namespace detail;
+
+namespace {
+
+typedef epicsGuard<epicsMutex> Guard;
+
+struct Sums
+{
+    Sums() : total(0), x(0), y(0), xx(0), yy(0), xy(0), min(0), max(0) {}
+
+    double total, x, y, xx, yy, xy;
+    double min, max;
+};
+
+inline bool lowerPeak(NTNDArrayPeak const & a, NTNDArrayPeak const & b)
+{
+    return a.value > b.value;
+}
+
+// the lowest element of type T at or above a threshold, false if there is none
+template<typename T>
+bool lowestCounted(double threshold, T & lowest)
+{
+    if (!numeric_limits<T>::is_integer) {
+        lowest = static_cast<T>(threshold);
+        return true;
+    }
+    double t = ceil(threshold);
+    if (t > static_cast<double>(numeric_limits<T>::max()))
+        return false;
+    lowest = t < static_cast<double>(numeric_limits<T>::min()) ?
+        numeric_limits<T>::min() : static_cast<T>(t);
+    return true;
+}
+
+template<typename T>
+bool isPeak(const T *up, const T *row, const T *down, size_t x, size_t x0, size_t x1)
+{
+    T v = row[x];
+    size_t left = x > x0 ? x - 1 : x, right = x + 1 < x1 ? x + 1 : x;
+    if (left != x && !(v > row[left]))
+        return false;
+    if (right != x && !(v >= row[right]))
+        return false;
+    if (up)
+        for (size_t i = left; i <= right; ++i)
+            if (!(v > up[i]))
+                return false;
+    if (down)
+        for (size_t i = left; i <= right; ++i)
+            if (!(v >= down[i]))
+                return false;
+    return true;
+}
+
+template<typename T>
+void addPeak(vector<NTNDArrayPeak> & heap, size_t peakCount, size_t x, size_t y, T v)
+{
+    NTNDArrayPeak peak;
+    peak.x = x;
+    peak.y = y;
+    peak.value = static_cast<double>(v);
+    if (heap.size() == peakCount) {
+        pop_heap(heap.begin(), heap.end(), lowerPeak);
+        heap.back() = peak;
+    } else {
+        heap.push_back(peak);
+    }
+    push_heap(heap.begin(), heap.end(), lowerPeak);
+}
+
+/*
+ * How the elements counted towards the moments are summed. Elements of 8
+ * and 16 bit types are summed exactly: the sums over a block of a row and
+ * over a band of rows of a column fit 32 bits, and are added up in 64 bits.
+ * Other types are summed in doubles.
+ */
+struct ExactWeights
+{
+    typedef int32 Acc;
+    typedef int64 Total;
+    // 32767 elements of 16 bits sum to less than 2^31
+    static const size_t blockSize = 32767;
+    // the below sums reach 65535*255*256/2 at the end of a band
+    static const size_t bandHeight = 255;
+};
+
+struct DoubleWeights
+{
+    typedef double Acc;
+    typedef double Total;
+    static const size_t blockSize = static_cast<size_t>(-1);
+    static const size_t bandHeight = static_cast<size_t>(-1);
+};
+
+/*
+ * The moment sums of a region, and the largest element of each row.
+ *
+ * The loop over a row has no data dependent branches and no multiplies,
+ * so that compilers vectorize it for the integer weights; floating sums
+ * are not reordered by the compiler and stay scalar. The weights are
+ * summed by row for the y moments and by column for the others. Besides
+ * its sum, each column adds up its sums after each row, which weights an
+ * element by the number of rows from it to the end of the band, and so
+ * gives the y weighted sum of the column. The x, xx and xy moments are
+ * weighted once per column, at the end.
+ */
+template<typename T, typename W>
+void sumRegion(const T *data, size_t width, size_t x0, size_t x1, size_t y0, size_t y1,
+    T lowest, Sums & sums, vector<T> & rowMax)
+{
+    typedef typename W::Acc Acc;
+    typedef typename W::Total Total;
+
+    size_t n = x1 - x0;
+    vector<Acc> column(n), below(n);
+    vector<Total> total(n), weighted(n);
+    T min = data[y0*width + x0], max = min;
+    size_t bandStart = y0;
+
+    for (size_t y = y0; y < y1; ++y) {
+        const T *row = data + y*width + x0;
+        T lo = row[0], hi = row[0];
+        Total s = 0;
+        for (size_t b = 0; b < n; b += W::blockSize) {
+            size_t m = n - b < W::blockSize ? n - b : W::blockSize;
+            const T *in = row + b;
+            Acc *c = &column[b], *d = &below[b];
+            Acc bs = 0;
+            for (size_t k = 0; k < m; ++k) {
+                T v = in[k];
+                lo = v < lo ? v : lo;
+                hi = v > hi ? v : hi;
+                Acc w = v >= lowest ? static_cast<Acc>(v) : Acc(0);
+                bs += w;
+                c[k] += w;
+                d[k] += c[k];
+            }
+            s += bs;
+        }
+        rowMax[y - y0] = hi;
+        min = lo < min ? lo : min;
+        max = hi > max ? hi : max;
+
+        double ds = static_cast<double>(s), dy = static_cast<double>(y);
+        sums.total += ds;
+        sums.y += ds*dy;
+        sums.yy += ds*dy*dy;
+
+        if (y + 1 - bandStart < W::bandHeight && y + 1 < y1)
+            continue;
+        // the sum of y over the weights of the band is end*column - below
+        Total end = static_cast<Total>(y + 1);
+        for (size_t k = 0; k < n; ++k) {
+            total[k] += column[k];
+            weighted[k] += end*column[k] - below[k];
+            column[k] = below[k] = 0;
+        }
+        bandStart = y + 1;
+    }
+
+    for (size_t k = 0; k < n; ++k) {
+        double x = static_cast<double>(x0 + k), t = static_cast<double>(total[k]);
+        sums.x += t*x;
+        sums.xx += t*x*x;
+        sums.xy += static_cast<double>(weighted[k])*x;
+    }
+    sums.min = static_cast<double>(min);
+    sums.max = static_cast<double>(max);
+}
+
+// the elements of a row tested together for peaks
+const size_t peakChunk = 64;
+
+/*
+ * The peaks of a region, searched for in the rows whose largest element
+ * could still make the list. A chunk of such a row is only searched if
+ * one of its elements counts and is above its neighbours in the row,
+ * which is tested without branches.
+ */
+template<typename T>
+void findPeaks(const T *data, size_t width, size_t x0, size_t x1, size_t y0, size_t y1,
+    T lowest, size_t peakCount, vector<T> const & rowMax, vector<NTNDArrayPeak> & heap)
+{
+    for (size_t y = y0; y < y1; ++y) {
+        T max = rowMax[y - y0];
+        if (!(max >= lowest) || (heap.size() == peakCount && !(max > heap.front().value)))
+            continue;
+
+        const T *row = data + y*width;
+        const T *up = y > y0 ? row - width : 0;
+        const T *down = y + 1 < y1 ? row + width : 0;
+        for (size_t b = x0; b < x1; b += peakChunk) {
+            size_t e = x1 - b < peakChunk ? x1 : b + peakChunk;
+            // the first and last element of the region have a single neighbour
+            int found = b == x0 || e == x1;
+            for (size_t x = b + 1; x + 1 < e; ++x) {
+                T v = row[x];
+                found |= (v >= lowest) & (v > row[x - 1]) & (v >= row[x + 1]);
+            }
+            if (!found)
+                continue;
+            for (size_t x = b; x < e; ++x) {
+                T v = row[x];
+                if (v >= lowest && (heap.size() < peakCount || v > heap.front().value) &&
+                        isPeak(up, row, down, x, x0, x1))
+                    addPeak(heap, peakCount, x, y, v);
+            }
+        }
+    }
+}
+
+template<typename T, typename W>
+void analyzeRegion(const char *data, size_t width, size_t x0, size_t x1, size_t y0, size_t y1,
+    double threshold, size_t peakCount, Sums & sums, vector<NTNDArrayPeak> & heap)
+{
+    const T *in = reinterpret_cast<const T*>(data);
+    T lowest = T();
+    bool counted = lowestCounted(threshold, lowest);
+    vector<T> rowMax(y1 - y0);
+    sumRegion<T, W>(in, width, x0, x1, y0, y1, lowest, sums, rowMax);
+    if (!counted) {
+        double min = sums.min, max = sums.max;
+        sums = Sums();
+        sums.min = min;
+        sums.max = max;
+    } else if (peakCount > 0) {
+        findPeaks(in, width, x0, x1, y0, y1, lowest, peakCount, rowMax, heap);
+    }
+}
+
+PVFieldPtr doubleAttributeValue(double value)
+{
+    PVDoublePtr pvValue = getPVDataCreate()->createPVScalar<PVDouble>();
+    pvValue->put(value);
+    return pvValue;
+}
+
+PVFieldPtr doubleArrayAttributeValue(PVDoubleArray::svector & values)
+{
+    PVDoubleArrayPtr pvValue = getPVDataCreate()->createPVScalarArray<PVDoubleArray>();
+    pvValue->replace(freeze(values));
+    return pvValue;
+}
+
+template<typename PVT>
+void setColumn(NTTablePtr const & table, string const & name, typename PVT::svector & values)
+{
+    table->getColumn<PVT>(name)->replace(freeze(values));
+}
+
+}
+
+NTNDArrayCentroid::shared_pointer NTNDArrayCentroid::create(size_t peakCount, double threshold)
+{
+    return shared_pointer(new NTNDArrayCentroid(peakCount, threshold));
+}
+
+NTNDArrayCentroid::NTNDArrayCentroid(size_t peakCount, double threshold) :
+    peakCount(peakCount), threshold(threshold),
+    regionX(0), regionY(0),
+    regionWidth(numeric_limits<size_t>::max()), regionHeight(numeric_limits<size_t>::max())
+{
+}
+
+void NTNDArrayCentroid::setRegion(size_t x, size_t y, size_t width, size_t height)
+{
+    regionX = x;
+    regionY = y;
+    regionWidth = width;
+    regionHeight = height;
+}
+
+void NTNDArrayCentroid::analyze(NTNDArrayPtr const & frame, NTNDArrayMoments & moments,
+    vector<NTNDArrayPeak> & peaks) const
+{
+    ScalarType type;
+    const char *data;
+    size_t count;
+    if (!valueData(frame, type, data, count))
+        throw std::runtime_error("NTNDArray has no numeric value");
+    vector<size_t> dims(frameDimensions(frame, count));
+    if (dims.size() > 2)
+        throw std::runtime_error("NTNDArray centroids need at most two dimensions");
+
+    size_t width = dims[0];
+    size_t height = dims.size() > 1 ? dims[1] : 1;
+    size_t x0 = std::min(regionX, width), y0 = std::min(regionY, height);
+    size_t x1 = x0 + std::min(regionWidth, width - x0);
+    size_t y1 = y0 + std::min(regionHeight, height - y0);
+
+    moments = NTNDArrayMoments();
+    moments.uniqueId = frame->getUniqueId()->get();
+    moments.count = (x1 - x0)*(y1 - y0);
+    peaks.clear();
+    if (moments.count == 0)
+        return;
+
+    Sums sums;
+    switch (type) {
+    case pvByte:   analyzeRegion<int8, ExactWeights>(data, width, x0, x1, y0, y1, threshold, peakCount, sums, peaks); break;
+    case pvShort:  analyzeRegion<int16, ExactWeights>(data, width, x0, x1, y0, y1, threshold, peakCount, sums, peaks); break;
+    case pvInt:    analyzeRegion<int32, DoubleWeights>(data, width, x0, x1, y0, y1, threshold, peakCount, sums, peaks); break;
+    case pvLong:   analyzeRegion<int64, DoubleWeights>(data, width, x0, x1, y0, y1, threshold, peakCount, sums, peaks); break;
+    case pvUByte:  analyzeRegion<uint8, ExactWeights>(data, width, x0, x1, y0, y1, threshold, peakCount, sums, peaks); break;
+    case pvUShort: analyzeRegion<uint16, ExactWeights>(data, width, x0, x1, y0, y1, threshold, peakCount, sums, peaks); break;
+    case pvUInt:   analyzeRegion<uint32, DoubleWeights>(data, width, x0, x1, y0, y1, threshold, peakCount, sums, peaks); break;
+    case pvULong:  analyzeRegion<uint64, DoubleWeights>(data, width, x0, x1, y0, y1, threshold, peakCount, sums, peaks); break;
+    case pvFloat:  analyzeRegion<float, DoubleWeights>(data, width, x0, x1, y0, y1, threshold, peakCount, sums, peaks); break;
+    case pvDouble: analyzeRegion<double, DoubleWeights>(data, width, x0, x1, y0, y1, threshold, peakCount, sums, peaks); break;
+    default: break;
+    }
+    sort_heap(peaks.begin(), peaks.end(), lowerPeak);
+
+    moments.min = sums.min;
+    moments.max = sums.max;
+    moments.total = sums.total;
+    if (sums.total != 0) {
+        double cx = sums.x/sums.total, cy = sums.y/sums.total;
+        double varianceX = sums.xx/sums.total - cx*cx;
+        double varianceY = sums.yy/sums.total - cy*cy;
+        moments.centroidX = cx;
+        moments.centroidY = cy;
+        moments.sigmaX = varianceX > 0 ? sqrt(varianceX) : 0;
+        moments.sigmaY = varianceY > 0 ? sqrt(varianceY) : 0;
+        moments.sigmaXY = sums.xy/sums.total - cx*cy;
+    }
+}
+
+size_t NTNDArrayCentroid::getPeakCount() const
+{
+    return peakCount;
+}
+
+double NTNDArrayCentroid::getThreshold() const
+{
+    return threshold;
+}
+
+NTTablePtr NTNDArrayCentroid::createMomentsTable(vector<NTNDArrayMoments> const & moments)
+{
+    const char *names[] = { "total", "min", "max", "centroidX", "centroidY",
+        "sigmaX", "sigmaY", "sigmaXY" };
+    const size_t columns = sizeof(names)/sizeof(names[0]);
+
+    NTTableBuilderPtr builder = NTTable::createBuilder();
+    builder->addColumn("uniqueId", pvInt)->addColumn("count", pvLong);
+    for (size_t i = 0; i < columns; ++i)
+        builder->addColumn(names[i], pvDouble);
+    NTTablePtr table = builder->create();
+
+    size_t rows = moments.size();
+    PVIntArray::svector uniqueId(rows);
+    PVLongArray::svector count(rows);
+    vector<PVDoubleArray::svector> values(columns);
+    for (size_t i = 0; i < columns; ++i)
+        values[i].resize(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        NTNDArrayMoments const & m = moments[i];
+        uniqueId[i] = m.uniqueId;
+        count[i] = static_cast<int64>(m.count);
+        values[0][i] = m.total;
+        values[1][i] = m.min;
+        values[2][i] = m.max;
+        values[3][i] = m.centroidX;
+        values[4][i] = m.centroidY;
+        values[5][i] = m.sigmaX;
+        values[6][i] = m.sigmaY;
+        values[7][i] = m.sigmaXY;
+    }
+
+    setColumn<PVIntArray>(table, "uniqueId", uniqueId);
+    setColumn<PVLongArray>(table, "count", count);
+    for (size_t i = 0; i < columns; ++i)
+        setColumn<PVDoubleArray>(table, names[i], values[i]);
+    return table;
+}
+
+NTTablePtr NTNDArrayCentroid::createPeakTable(vector<NTNDArrayPeak> const & peaks)
+{
+    NTTablePtr table = NTTable::createBuilder()->
+        addColumn("x", pvInt)->
+        addColumn("y", pvInt)->
+        addColumn("value", pvDouble)->
+        create();
+
+    PVIntArray::svector x(peaks.size()), y(peaks.size());
+    PVDoubleArray::svector value(peaks.size());
+    for (size_t i = 0; i < peaks.size(); ++i) {
+        x[i] = static_cast<int32>(peaks[i].x);
+        y[i] = static_cast<int32>(peaks[i].y);
+        value[i] = peaks[i].value;
+    }
+    setColumn<PVIntArray>(table, "x", x);
+    setColumn<PVIntArray>(table, "y", y);
+    setColumn<PVDoubleArray>(table, "value", value);
+    return table;
+}
+
+void NTNDArrayCentroid::setAttributes(NTNDArrayPtr const & frame,
+    NTNDArrayMoments const & moments, vector<NTNDArrayPeak> const & peaks)
+{
+    setAttribute(frame, "CentroidTotal", doubleAttributeValue(moments.total));
+    setAttribute(frame, "CentroidX", doubleAttributeValue(moments.centroidX));
+    setAttribute(frame, "CentroidY", doubleAttributeValue(moments.centroidY));
+    setAttribute(frame, "SigmaX", doubleAttributeValue(moments.sigmaX));
+    setAttribute(frame, "SigmaY", doubleAttributeValue(moments.sigmaY));
+    setAttribute(frame, "SigmaXY", doubleAttributeValue(moments.sigmaXY));
+
+    PVDoubleArray::svector x(peaks.size()), y(peaks.size()), value(peaks.size());
+    for (size_t i = 0; i < peaks.size(); ++i) {
+        x[i] = static_cast<double>(peaks[i].x);
+        y[i] = static_cast<double>(peaks[i].y);
+        value[i] = peaks[i].value;
+    }
+    setAttribute(frame, "PeakX", doubleArrayAttributeValue(x));
+    setAttribute(frame, "PeakY", doubleArrayAttributeValue(y));
+    setAttribute(frame, "PeakValue", doubleArrayAttributeValue(value));
+}
+
+NTNDArrayCentroidNode::NTNDArrayCentroidNode(string const & name,
+        NTNDArrayCentroidPtr const & centroid, size_t queueSize) :
+    NTNDArrayNode(name, queueSize), centroid(centroid)
+{
+}
+
+NTNDArrayPtr NTNDArrayCentroidNode::process(NTNDArrayPtr const & frame,
+    NTNDArrayBufferPoolPtr const &)
+{
+    NTNDArrayMoments frameMoments;
+    vector<NTNDArrayPeak> framePeaks;
+    centroid->analyze(frame, frameMoments, framePeaks);
+
+    NTNDArrayPtr output = cloneFrame(frame);
+    NTNDArrayCentroid::setAttributes(output, frameMoments, framePeaks);
+
+    Guard G(mutex);
+    moments = frameMoments;
+    peaks.swap(framePeaks);
+    return output;
+}
+
+NTNDArrayMoments NTNDArrayCentroidNode::getMoments() const
+{
+    Guard G(mutex);
+    return moments;
+}
+
+vector<NTNDArrayPeak> NTNDArrayCentroidNode::getPeaks() const
+{
+    Guard G(mutex);
+    return peaks;
+}
+
+}}
@@ -0,0 +1,621 @@
+/* ntndarrayColor.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define epicsExportSharedSymbols
+#include <pv/ntndarrayColor.h>
+
+#include "ndarrayValue.h"
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+using namespace detail;
+
+namespace {
+
+/*
+ * Element strides of the color, column and row of a pixel.
+ * Mono and Bayer frames have a color stride of 0.
+ */
+struct Layout
+{
+    Layout(NTNDArrayColor::Mode mode, size_t width, size_t height)
+    {
+        switch (mode) {
+        case NTNDArrayColor::rgb1: color = 1; x = 3; y = 3*width; break;
+        case NTNDArrayColor::rgb2: color = width; x = 1; y = 3*width; break;
+        case NTNDArrayColor::rgb3: color = width*height; x = 1; y = width; break;
+        default: color = 0; x = 1; y = width; break;
+        }
+    }
+
+    size_t color;
+    size_t x;
+    size_t y;
+};
+
+bool isRGB(NTNDArrayColor::Mode mode)
+{
+    return mode == NTNDArrayColor::rgb1 || mode == NTNDArrayColor::rgb2 ||
+        mode == NTNDArrayColor::rgb3;
+}
+
+// the dimensions that hold x, y and color in a mode, -1 if there is none
+void dimensionIndexes(NTNDArrayColor::Mode mode, int & x, int & y, int & color)
+{
+    switch (mode) {
+    case NTNDArrayColor::rgb1: color = 0; x = 1; y = 2; break;
+    case NTNDArrayColor::rgb2: x = 0; color = 1; y = 2; break;
+    case NTNDArrayColor::rgb3: x = 0; y = 1; color = 2; break;
+    default: x = 0; y = 1; color = -1; break;
+    }
+}
+
+/*
+ * 64 bit elements, a quarter and the remainder each, so that four of
+ * them add up without overflowing or rounding.
+ */
+template<typename T>
+struct Quarters
+{
+    Quarters(T value) : high(value >> 2), low(value & 3) {}
+
+    Quarters operator+(Quarters const & other) const
+    {
+        Quarters sum(*this);
+        sum.high += other.high;
+        sum.low += other.low;
+        return sum;
+    }
+
+    T high;
+    T low;
+};
+
+// wide enough to add four elements, and unsigned for unsigned elements
+template<typename T> struct Sum { typedef int32 type; };
+template<> struct Sum<uint8> { typedef uint32 type; };
+template<> struct Sum<uint16> { typedef uint32 type; };
+template<> struct Sum<int32> { typedef int64 type; };
+template<> struct Sum<uint32> { typedef uint64 type; };
+template<> struct Sum<int64> { typedef Quarters<int64> type; };
+template<> struct Sum<uint64> { typedef Quarters<uint64> type; };
+template<> struct Sum<float> { typedef double type; };
+template<> struct Sum<double> { typedef double type; };
+
+/*
+ * A sum of n = 2 or 4 elements divided by n. Integers round half away
+ * from zero; the signed ones round down after subtracting 1 from the
+ * negative sums, which needs no branch.
+ */
+template<typename T, int n>
+inline T quotient(double sum)
+{
+    return static_cast<T>(sum/n);
+}
+
+template<typename T, int n>
+inline T quotient(int32 sum)
+{
+    return static_cast<T>((sum + n/2 - (sum < 0)) >> (n/2));
+}
+
+template<typename T, int n>
+inline T quotient(int64 sum)
+{
+    return static_cast<T>((sum + n/2 - (sum < 0)) >> (n/2));
+}
+
+template<typename T, int n>
+inline T quotient(uint32 sum)
+{
+    return static_cast<T>((sum + n/2) >> (n/2));
+}
+
+template<typename T, int n>
+inline T quotient(uint64 sum)
+{
+    return static_cast<T>((sum + n/2) >> (n/2));
+}
+
+// the sum is 4*high + low with low at most 12, which is negative when high + low/4 is
+template<typename T, int n>
+inline T quotient(Quarters<T> const & sum)
+{
+    T negative = numeric_limits<T>::is_signed && sum.high + (sum.low >> 2) < T(0);
+    return sum.high*(4/n) + ((sum.low + n/2 - negative) >> (n/2));
+}
+
+template<typename T>
+inline T luma(double r, double g, double b)
+{
+    double value = 0.299*r + 0.587*g + 0.114*b;
+    if (!numeric_limits<T>::is_integer)
+        return static_cast<T>(value);
+    if (!numeric_limits<T>::is_signed)
+        return static_cast<T>(value + 0.5);
+    return static_cast<T>(value + (value < 0 ? -0.5 : 0.5));
+}
+
+template<typename T>
+void lumaRow(const T *r, const T *g, const T *b, size_t width, T *out)
+{
+    for (size_t x = 0; x < width; ++x)
+        out[x] = luma<T>(static_cast<double>(r[x]), static_cast<double>(g[x]),
+            static_cast<double>(b[x]));
+}
+
+// the colors of a pixel are read as a group, so gcc does not build vectors
+// of strided elements one at a time, which is slower than scalar code
+template<typename T>
+void lumaPixels(const T *in, size_t width, T *out)
+{
+    for (size_t x = 0; x < width; ++x)
+        out[x] = luma<T>(static_cast<double>(in[3*x]),
+            static_cast<double>(in[3*x + 1]), static_cast<double>(in[3*x + 2]));
+}
+
+enum Site { redSite, blueSite, greenRedSite, greenBlueSite };
+
+// how a color is found at a site, from the pixel or its neighbours
+enum Source { pixelSource, crossSource, diagonalSource, horizontalSource, verticalSource };
+
+template<int site> struct Sources;
+template<> struct Sources<redSite>
+{
+    enum { red = pixelSource, green = crossSource, blue = diagonalSource };
+};
+template<> struct Sources<blueSite>
+{
+    enum { red = diagonalSource, green = crossSource, blue = pixelSource };
+};
+template<> struct Sources<greenRedSite>
+{
+    enum { red = horizontalSource, green = pixelSource, blue = verticalSource };
+};
+template<> struct Sources<greenBlueSite>
+{
+    enum { red = verticalSource, green = pixelSource, blue = horizontalSource };
+};
+
+/*
+ * Bilinear interpolation of a color at x from the row above, the row
+ * and the row below, at the columns left, x and right.
+ */
+template<typename T, int source>
+inline T sample(const T *up, const T *mid, const T *down,
+    size_t left, size_t x, size_t right)
+{
+    typedef typename Sum<T>::type S;
+    switch (source) {
+    case crossSource:
+        return quotient<T, 4>(S(up[x]) + S(down[x]) + S(mid[left]) + S(mid[right]));
+    case diagonalSource:
+        return quotient<T, 4>(S(up[left]) + S(up[right]) + S(down[left]) + S(down[right]));
+    case horizontalSource:
+        return quotient<T, 2>(S(mid[left]) + S(mid[right]));
+    case verticalSource:
+        return quotient<T, 2>(S(up[x]) + S(down[x]));
+    default:
+        return mid[x];
+    }
+}
+
+template<typename T, int site>
+inline void demosaicPixel(const T *up, const T *mid, const T *down,
+    size_t left, size_t x, size_t right, T *out, size_t color)
+{
+    out[0] = sample<T, Sources<site>::red>(up, mid, down, left, x, right);
+    out[color] = sample<T, Sources<site>::green>(up, mid, down, left, x, right);
+    out[2*color] = sample<T, Sources<site>::blue>(up, mid, down, left, x, right);
+}
+
+/*
+ * One color of a row into contiguous elements. The sources are fixed per
+ * column parity, so the loop over pairs of columns has no branches and
+ * vectorizes.
+ */
+template<typename T, int even, int odd>
+void demosaicColor(const T *up, const T *mid, const T *down, size_t width, T *out)
+{
+    // the edges are mirrored, which keeps the pattern
+    out[0] = sample<T, even>(up, mid, down, 1, 0, 1);
+    size_t x = 1;
+    for (; x + 2 < width; x += 2) {
+        out[x] = sample<T, odd>(up, mid, down, x - 1, x, x + 1);
+        out[x + 1] = sample<T, even>(up, mid, down, x, x + 1, x + 2);
+    }
+    for (; x < width; ++x) {
+        size_t right = x + 1 < width ? x + 1 : width - 2;
+        out[x] = (x & 1) ? sample<T, odd>(up, mid, down, x - 1, x, right) :
+            sample<T, even>(up, mid, down, x - 1, x, right);
+    }
+}
+
+/*
+ * Interleaves rows of red, green and blue into RGB1 pixels and returns
+ * the number of pixels done, which are none without a vector version.
+ */
+template<typename T>
+inline size_t interleaveVectors(const T *, const T *, const T *, size_t, T *)
+{
+    return 0;
+}
+
+#ifdef __SSE2__
+/*
+ * Each pixel is written by a 4 byte store whose last byte the next pixel
+ * overwrites, so the last pixel of the row is left to the caller.
+ */
+inline size_t interleaveBytes(const char *r, const char *g, const char *b,
+    size_t width, char *out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t x = 0;
+    for (; x + 16 < width; x += 16) {
+        __m128i red = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + x));
+        __m128i green = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + x));
+        __m128i blue = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+        __m128i rg[2] = { _mm_unpacklo_epi8(red, green), _mm_unpackhi_epi8(red, green) };
+        __m128i b0[2] = { _mm_unpacklo_epi8(blue, zero), _mm_unpackhi_epi8(blue, zero) };
+        char *pixel = out + 3*x;
+        for (int half = 0; half < 2; ++half) {
+            __m128i pixels[2] = { _mm_unpacklo_epi16(rg[half], b0[half]),
+                _mm_unpackhi_epi16(rg[half], b0[half]) };
+            for (int i = 0; i < 8; ++i) {
+                int32 value = _mm_cvtsi128_si32(pixels[i/4]);
+                memcpy(pixel, &value, 4);
+                pixels[i/4] = _mm_srli_si128(pixels[i/4], 4);
+                pixel += 3;
+            }
+        }
+    }
+    return x;
+}
+
+template<>
+inline size_t interleaveVectors(const int8 *r, const int8 *g, const int8 *b,
+    size_t width, int8 *out)
+{
+    return interleaveBytes(reinterpret_cast<const char*>(r), reinterpret_cast<const char*>(g),
+        reinterpret_cast<const char*>(b), width, reinterpret_cast<char*>(out));
+}
+
+template<>
+inline size_t interleaveVectors(const uint8 *r, const uint8 *g, const uint8 *b,
+    size_t width, uint8 *out)
+{
+    return interleaveBytes(reinterpret_cast<const char*>(r), reinterpret_cast<const char*>(g),
+        reinterpret_cast<const char*>(b), width, reinterpret_cast<char*>(out));
+}
+#endif
+
+template<typename T>
+void interleaveRow(const T *r, const T *g, const T *b, size_t width, T *out)
+{
+    size_t x = interleaveVectors(r, g, b, width, out);
+    for (; x < width; ++x) {
+        out[3*x] = r[x];
+        out[3*x + 1] = g[x];
+        out[3*x + 2] = b[x];
+    }
+}
+
+/*
+ * Planar rows get each color written in place. RGB1 rows of bytes are
+ * interpolated into the rows of planes and then interleaved, which beats
+ * writing the pixels one by one; for wider elements it does not, as a
+ * vector holds too few of them to pay for the extra pass, and the pixels
+ * are written directly.
+ */
+template<typename T, int even, int odd>
+void demosaicRow(const T *up, const T *mid, const T *down, size_t width,
+    T *out, Layout const & layout, T *planes)
+{
+    if (layout.x == 1 || sizeof(T) == 1) {
+        T *red = layout.x == 1 ? out : planes;
+        size_t color = layout.x == 1 ? layout.color : width;
+        demosaicColor<T, Sources<even>::red, Sources<odd>::red>(up, mid, down, width, red);
+        demosaicColor<T, Sources<even>::green, Sources<odd>::green>(up, mid, down, width,
+            red + color);
+        demosaicColor<T, Sources<even>::blue, Sources<odd>::blue>(up, mid, down, width,
+            red + 2*color);
+        if (layout.x != 1)
+            interleaveRow(planes, planes + width, planes + 2*width, width, out);
+        return;
+    }
+
+    demosaicPixel<T, even>(up, mid, down, 1, 0, 1, out, layout.color);
+    size_t x = 1;
+    for (; x + 2 < width; x += 2) {
+        demosaicPixel<T, odd>(up, mid, down, x - 1, x, x + 1,
+            out + x*layout.x, layout.color);
+        demosaicPixel<T, even>(up, mid, down, x, x + 1, x + 2,
+            out + (x + 1)*layout.x, layout.color);
+    }
+    for (; x < width; ++x) {
+        size_t right = x + 1 < width ? x + 1 : width - 2;
+        if (x & 1)
+            demosaicPixel<T, odd>(up, mid, down, x - 1, x, right,
+                out + x*layout.x, layout.color);
+        else
+            demosaicPixel<T, even>(up, mid, down, x - 1, x, right,
+                out + x*layout.x, layout.color);
+    }
+}
+
+// planes holds 3 rows, which RGB1 rows of bytes are interpolated into
+template<typename T>
+void demosaic(const T *in, size_t width, size_t height, size_t y,
+    NTNDArrayColor::BayerPattern pattern, T *out, Layout const & layout, T *planes)
+{
+    // the column and row of the red pixels
+    size_t redX = (pattern == NTNDArrayColor::grbg || pattern == NTNDArrayColor::bggr) ? 1 : 0;
+    size_t redY = (pattern == NTNDArrayColor::gbrg || pattern == NTNDArrayColor::bggr) ? 1 : 0;
+
+    const T *up = in + (y > 0 ? y - 1 : 1)*width;
+    const T *mid = in + y*width;
+    const T *down = in + (y + 1 < height ? y + 1 : height - 2)*width;
+    out += y*layout.y;
+
+    if ((y & 1) == redY) {
+        if (redX == 0)
+            demosaicRow<T, redSite, greenRedSite>(up, mid, down, width, out, layout, planes);
+        else
+            demosaicRow<T, greenRedSite, redSite>(up, mid, down, width, out, layout, planes);
+    } else {
+        if (redX == 0)
+            demosaicRow<T, greenBlueSite, blueSite>(up, mid, down, width, out, layout, planes);
+        else
+            demosaicRow<T, blueSite, greenBlueSite>(up, mid, down, width, out, layout, planes);
+    }
+}
+
+/*
+ * Splits RGB1 pixels into rows of red, green and blue. gcc vectorizes
+ * a loop per color by building vectors one element at a time, which is
+ * slower than this loop that it leaves scalar.
+ */
+template<typename T>
+void splitRow(const T *in, size_t width, T *r, T *g, T *b)
+{
+    for (size_t x = 0; x < width; ++x) {
+        r[x] = in[3*x];
+        g[x] = in[3*x + 1];
+        b[x] = in[3*x + 2];
+    }
+}
+
+/*
+ * Converts bands of rows, given by the tiles, from one mode to another.
+ */
+class ColorKernel : public NTNDArrayKernel
+{
+public:
+    ColorKernel(ScalarType type, size_t width, size_t height,
+            const char *input, NTNDArrayColor::Mode inputMode,
+            char *output, NTNDArrayColor::Mode outputMode,
+            NTNDArrayColor::BayerPattern pattern) :
+        type(type), width(width), height(height),
+        input(input), inputMode(inputMode), inputLayout(inputMode, width, height),
+        output(output), outputMode(outputMode), outputLayout(outputMode, width, height),
+        pattern(pattern)
+    {
+    }
+
+    virtual void apply(NTNDArrayTile const & tile)
+    {
+        switch (type) {
+        case pvByte:   convertRows<int8>(tile.y, tile.height); break;
+        case pvShort:  convertRows<int16>(tile.y, tile.height); break;
+        case pvInt:    convertRows<int32>(tile.y, tile.height); break;
+        case pvLong:   convertRows<int64>(tile.y, tile.height); break;
+        case pvUByte:  convertRows<uint8>(tile.y, tile.height); break;
+        case pvUShort: convertRows<uint16>(tile.y, tile.height); break;
+        case pvUInt:   convertRows<uint32>(tile.y, tile.height); break;
+        case pvULong:  convertRows<uint64>(tile.y, tile.height); break;
+        case pvFloat:  convertRows<float>(tile.y, tile.height); break;
+        case pvDouble: convertRows<double>(tile.y, tile.height); break;
+        default: break;
+        }
+    }
+
+private:
+    template<typename T>
+    void convertRows(size_t first, size_t count)
+    {
+        const T *in = reinterpret_cast<const T*>(input);
+        T *out = reinterpret_cast<T*>(output);
+        Layout const & i = inputLayout;
+        Layout const & o = outputLayout;
+        // rows of red, green and blue for RGB1 pixels
+        vector<T> planes(inputMode == NTNDArrayColor::bayer ? 3*width : 0);
+        T *r = planes.empty() ? 0 : &planes[0];
+
+        for (size_t y = first; y < first + count; ++y) {
+            const T *row = in + y*i.y;
+            T *outRow = out + y*o.y;
+            if (inputMode == NTNDArrayColor::bayer) {
+                demosaic(in, width, height, y, pattern, out, o, r);
+            } else if (outputMode == NTNDArrayColor::mono) {
+                if (i.x == 1)
+                    lumaRow(row, row + i.color, row + 2*i.color, width, outRow);
+                else
+                    lumaPixels(row, width, outRow);
+            } else if (o.x == 3) {
+                // a color stride of 0 copies mono to all colors
+                interleaveRow(row, row + i.color, row + 2*i.color, width, outRow);
+            } else if (i.x == 3) {
+                splitRow(row, width, outRow, outRow + o.color, outRow + 2*o.color);
+            } else {
+                for (size_t c = 0; c < 3; ++c)
+                    memcpy(outRow + c*o.color, row + c*i.color, width*sizeof(T));
+            }
+        }
+    }
+
+    ScalarType type;
+    size_t width;
+    size_t height;
+    const char *input;
+    NTNDArrayColor::Mode inputMode;
+    Layout inputLayout;
+    char *output;
+    NTNDArrayColor::Mode outputMode;
+    Layout outputLayout;
+    NTNDArrayColor::BayerPattern pattern;
+};
+
+void checkOutputMode(NTNDArrayColor::Mode mode)
+{
+    if (mode != NTNDArrayColor::mono && !isRGB(mode))
+        throw std::runtime_error("NTNDArray frames can only be converted to mono or RGB");
+}
+
+}
+
+NTNDArrayColor::Mode NTNDArrayColor::getColorMode(NTNDArrayPtr const & frame)
+{
+    int32 value;
+    if (getIntAttribute(frame, "ColorMode", value)) {
+        if (value < mono || value > rgb3)
+            throw std::runtime_error("unsupported NTNDArray color mode");
+        return static_cast<Mode>(value);
+    }
+
+    PVStructureArray::const_svector dims(frame->getDimension()->view());
+    if (dims.size() == 3) {
+        for (size_t i = 0; i < 3; ++i) {
+            PVIntPtr size = dims[i] ? dims[i]->getSubField<PVInt>("size") : PVIntPtr();
+            if (size && size->get() == 3)
+                return static_cast<Mode>(rgb1 + i);
+        }
+    }
+    return mono;
+}
+
+void NTNDArrayColor::setColorMode(NTNDArrayPtr const & frame, Mode mode)
+{
+    setAttribute(frame, "ColorMode", intAttributeValue(mode));
+}
+
+NTNDArrayColor::BayerPattern NTNDArrayColor::getBayerPattern(NTNDArrayPtr const & frame)
+{
+    int32 value;
+    if (!getIntAttribute(frame, "BayerPattern", value))
+        return rggb;
+    if (value < rggb || value > bggr)
+        throw std::runtime_error("unsupported NTNDArray Bayer pattern");
+    return static_cast<BayerPattern>(value);
+}
+
+void NTNDArrayColor::setBayerPattern(NTNDArrayPtr const & frame, BayerPattern pattern)
+{
+    setAttribute(frame, "BayerPattern", intAttributeValue(pattern));
+}
+
+NTNDArrayPtr NTNDArrayColor::convert(NTNDArrayPtr const & frame, Mode mode,
+    NTNDArrayTilerPtr const & tiler, NTNDArrayBufferPoolPtr const & pool)
+{
+    checkOutputMode(mode);
+    Mode inputMode = getColorMode(frame);
+    if (inputMode == mode)
+        return frame;
+    if (inputMode == bayer && !isRGB(mode))
+        throw std::runtime_error("Bayer NTNDArray frames can only be converted to RGB");
+
+    ScalarType type;
+    const char *data;
+    size_t count;
+    if (!valueData(frame, type, data, count))
+        throw std::runtime_error("NTNDArray has no numeric value");
+
+    vector<size_t> sizes(frameDimensions(frame, count));
+    int inputX, inputY, inputColor;
+    dimensionIndexes(inputMode, inputX, inputY, inputColor);
+    if (sizes.size() != (inputColor < 0 ? 2u : 3u) ||
+        (inputColor >= 0 && sizes[inputColor] != 3))
+        throw std::runtime_error("NTNDArray dimensions do not match the color mode");
+    size_t width = sizes[inputX];
+    size_t height = sizes[inputY];
+    if (inputMode == bayer && (width < 2 || height < 2))
+        throw std::runtime_error("Bayer NTNDArray frames need at least 2x2 pixels");
+
+    NTNDArrayPtr output = cloneFrame(frame);
+    size_t outputCount = isRGB(mode) ? 3*width*height : width*height;
+    char *out = allocateValue(output, pool ? pool : NTNDArrayBufferPool::create(0),
+        type, outputCount);
+
+    // x and y keep their dimension structures, color gets a new one
+    PVStructureArrayPtr dimension = output->getDimension();
+    PVStructureArray::const_svector inputDims(frame->getDimension()->view());
+    int outputX, outputY, outputColor;
+    dimensionIndexes(mode, outputX, outputY, outputColor);
+    PVStructureArray::svector outputDims(outputColor < 0 ? 2 : 3);
+    outputDims[outputX] = getPVDataCreate()->createPVStructure(inputDims[inputX]);
+    outputDims[outputY] = getPVDataCreate()->createPVStructure(inputDims[inputY]);
+    if (outputColor >= 0) {
+        PVStructurePtr color = getPVDataCreate()->createPVStructure(
+            dimension->getStructureArray()->getStructure());
+        color->getSubField<PVInt>("size")->put(3);
+        color->getSubField<PVInt>("fullSize")->put(3);
+        color->getSubField<PVInt>("binning")->put(1);
+        outputDims[outputColor] = color;
+    }
+    dimension->replace(freeze(outputDims));
+    setColorMode(output, mode);
+
+    ColorKernel kernel(type, width, height, data, inputMode, out, mode,
+        inputMode == bayer ? getBayerPattern(frame) : rggb);
+
+    // bands of whole rows, sized like the tiles of the tiler
+    size_t rowBytes = 3*width*ScalarTypeFunc::elementSize(type);
+    size_t rows = tiler ? std::max(tiler->getTileBytes()/rowBytes, (size_t)1) : height;
+    vector<NTNDArrayTile> tiles;
+    NTNDArrayTile tile;
+    memset(&tile, 0, sizeof(tile));
+    tile.width = width;
+    tile.inputType = type;
+    tile.outputType = type;
+    for (size_t y = 0; y < height; y += rows) {
+        tile.y = y;
+        tile.height = std::min(rows, height - y);
+        tiles.push_back(tile);
+    }
+
+    if (tiler)
+        tiler->run(tiles, kernel);
+    else if (!tiles.empty())
+        kernel.apply(tiles[0]);
+    return output;
+}
+
+NTNDArrayColorNode::NTNDArrayColorNode(string const & name,
+        NTNDArrayColor::Mode mode, NTNDArrayTilerPtr const & tiler,
+        size_t queueSize) :
+    NTNDArrayNode(name, queueSize), mode(mode), tiler(tiler)
+{
+    checkOutputMode(mode);
+}
+
+NTNDArrayPtr NTNDArrayColorNode::process(NTNDArrayPtr const & frame,
+    NTNDArrayBufferPoolPtr const & pool)
+{
+    return NTNDArrayColor::convert(frame, mode, tiler, pool);
+}
+
+}}
@@ -0,0 +1,590 @@
+/* ntndarrayDecoder.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <pv/serialize.h>
+#include <pv/serializeHelper.h>
+
+#include "bufferControl.h"
+
+#define epicsExportSharedSymbols
+#include <pv/ntndarrayDecoder.h>
+#include <pv/ntndarray.h>
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+namespace {
+
+void skipBytes(ByteBuffer *buffer, DeserializableControl *control,
+        size_t count, size_t elementSize)
+{
+    if (elementSize && count > buffer->getRemaining()/elementSize)
+        throw std::runtime_error("truncated NTNDArray buffer");
+    control->ensureData(count*elementSize);
+    buffer->setPosition(buffer->getPosition() + count*elementSize);
+}
+
+void skipString(ByteBuffer *buffer, DeserializableControl *control)
+{
+    size_t length = SerializeHelper::readSize(buffer, control);
+    if (length != (size_t)-1)
+        skipBytes(buffer, control, length, 1);
+}
+
+// Fixed size arrays are serialized without their size.
+size_t readCount(Array const & array, ByteBuffer *buffer,
+        DeserializableControl *control)
+{
+    if (array.getArraySizeType() == Array::fixed)
+        return array.getMaximumCapacity();
+    return SerializeHelper::readSize(buffer, control);
+}
+
+void skipField(FieldConstPtr const & field, ByteBuffer *buffer,
+        DeserializableControl *control);
+
+// Introspection data of variant union values is read in place, without
+// creating any Field, so that scanning the attributes of a frame costs no
+// allocation. Type codes are those of the pvAccess protocol: bits 7-5 the
+// kind, bits 4-3 scalar or kind of array, bits 2-0 the size.
+
+const size_t complexElement = (size_t)-1;
+
+// The size of the elements of a scalar or scalar array type code, 0 for
+// strings and complexElement for other types.
+size_t elementSize(uint8 code)
+{
+    switch (code & 0xE7) {
+    case 0x00: case 0x20: case 0x24: return 1;
+    case 0x21: case 0x25: return 2;
+    case 0x22: case 0x26: case 0x42: return 4;
+    case 0x23: case 0x27: case 0x43: return 8;
+    case 0x60: case 0x83: return 0;
+    }
+    return complexElement;
+}
+
+void skipType(ByteBuffer *buffer, DeserializableControl *control)
+{
+    control->ensureData(1);
+    uint8 code = static_cast<uint8>(buffer->getByte());
+    if (code == 0xFF)
+        return;
+
+    if (elementSize(code) != complexElement) {
+        // bounded strings, bounded and fixed size arrays carry their size
+        if ((code & 0xE7) == 0x83)
+            SerializeHelper::readSize(buffer, control);
+        if (code & 0x10)
+            SerializeHelper::readSize(buffer, control);
+        return;
+    }
+
+    switch (code) {
+    case 0x80:
+    case 0x81:
+    {
+        skipString(buffer, control);
+        size_t count = SerializeHelper::readSize(buffer, control);
+        for (size_t i = 0; i < count; ++i) {
+            skipString(buffer, control);
+            skipType(buffer, control);
+        }
+        break;
+    }
+    case 0x82:
+    case 0x8A:
+        break;
+    case 0x88:
+    case 0x89:
+        skipType(buffer, control);
+        break;
+    default:
+        throw std::runtime_error("unsupported introspection data in NTNDArray buffer");
+    }
+}
+
+// A second read position in the scanned buffer, for the introspection
+// data of a value while the value itself is skipped.
+class TypeCursor
+{
+public:
+    TypeCursor(ByteBuffer *buffer, DeserializableControl *control, size_t position) :
+        position(position), buffer(buffer), control(control)
+    {
+    }
+
+    uint8 getByte()
+    {
+        Swap swap(*this);
+        control->ensureData(1);
+        return static_cast<uint8>(buffer->getByte());
+    }
+
+    size_t readSize()
+    {
+        Swap swap(*this);
+        return SerializeHelper::readSize(buffer, control);
+    }
+
+    void skipString()
+    {
+        Swap swap(*this);
+        epics::nt::skipString(buffer, control);
+    }
+
+    void skipType()
+    {
+        Swap swap(*this);
+        epics::nt::skipType(buffer, control);
+    }
+
+    size_t position;
+
+private:
+    struct Swap
+    {
+        Swap(TypeCursor & cursor) : cursor(cursor), saved(cursor.buffer->getPosition())
+        {
+            cursor.buffer->setPosition(cursor.position);
+        }
+        ~Swap()
+        {
+            cursor.position = cursor.buffer->getPosition();
+            cursor.buffer->setPosition(saved);
+        }
+        TypeCursor & cursor;
+        size_t saved;
+    };
+
+    ByteBuffer *buffer;
+    DeserializableControl *control;
+};
+
+void skipVariant(ByteBuffer *buffer, DeserializableControl *control);
+
+void skipValue(TypeCursor & type, ByteBuffer *buffer, DeserializableControl *control)
+{
+    uint8 code = type.getByte();
+    size_t size = elementSize(code);
+    if (size != complexElement) {
+        if ((code & 0xE7) == 0x83)
+            type.readSize();
+        size_t count = 1;
+        switch (code & 0x18) {
+        case 0x08:
+            count = SerializeHelper::readSize(buffer, control);
+            break;
+        case 0x10:
+            type.readSize();
+            count = SerializeHelper::readSize(buffer, control);
+            break;
+        case 0x18:
+            count = type.readSize();
+            break;
+        }
+        if (size) {
+            skipBytes(buffer, control, count, size);
+        } else {
+            for (size_t i = 0; i < count; ++i)
+                skipString(buffer, control);
+        }
+        return;
+    }
+
+    switch (code) {
+    case 0x80:
+    {
+        type.skipString();
+        size_t count = type.readSize();
+        for (size_t i = 0; i < count; ++i) {
+            type.skipString();
+            skipValue(type, buffer, control);
+        }
+        break;
+    }
+    case 0x81:
+    {
+        type.skipString();
+        size_t count = type.readSize();
+        size_t selector = SerializeHelper::readSize(buffer, control);
+        if (selector != (size_t)-1 && selector >= count)
+            throw std::runtime_error("invalid union selector in NTNDArray buffer");
+        for (size_t i = 0; i < count; ++i) {
+            type.skipString();
+            if (i == selector)
+                skipValue(type, buffer, control);
+            else
+                type.skipType();
+        }
+        break;
+    }
+    case 0x82:
+        skipVariant(buffer, control);
+        break;
+    case 0x88:
+    case 0x89:
+    case 0x8A:
+    {
+        // the element type is read again for every element
+        size_t element = type.position;
+        if (code != 0x8A)
+            type.skipType();
+        size_t end = type.position;
+        size_t count = SerializeHelper::readSize(buffer, control);
+        for (size_t i = 0; i < count; ++i) {
+            control->ensureData(1);
+            if (!buffer->getByte())
+                continue;
+            if (code == 0x8A) {
+                skipVariant(buffer, control);
+            } else {
+                type.position = element;
+                skipValue(type, buffer, control);
+            }
+        }
+        type.position = end;
+        break;
+    }
+    default:
+        throw std::runtime_error("unsupported introspection data in NTNDArray buffer");
+    }
+}
+
+// The introspection data of a variant union value precedes the value.
+void skipVariant(ByteBuffer *buffer, DeserializableControl *control)
+{
+    TypeCursor type(buffer, control, buffer->getPosition());
+    skipType(buffer, control);
+    if (static_cast<uint8>(buffer->getBuffer()[type.position]) != 0xFF)
+        skipValue(type, buffer, control);
+}
+
+void skipUnion(UnionConstPtr const & u, ByteBuffer *buffer,
+        DeserializableControl *control)
+{
+    if (u->isVariant()) {
+        skipVariant(buffer, control);
+        return;
+    }
+
+    size_t selector = SerializeHelper::readSize(buffer, control);
+    if (selector == (size_t)-1)
+        return;
+    if (selector >= u->getNumberFields())
+        throw std::runtime_error("invalid union selector in NTNDArray buffer");
+    skipField(u->getField(selector), buffer, control);
+}
+
+void skipField(FieldConstPtr const & field, ByteBuffer *buffer,
+        DeserializableControl *control)
+{
+    switch (field->getType()) {
+    case scalar:
+    {
+        ScalarType type = std::tr1::static_pointer_cast<const Scalar>(field)->getScalarType();
+        if (type == pvString)
+            skipString(buffer, control);
+        else
+            skipBytes(buffer, control, 1, ScalarTypeFunc::elementSize(type));
+        break;
+    }
+    case scalarArray:
+    {
+        ScalarArrayConstPtr array = std::tr1::static_pointer_cast<const ScalarArray>(field);
+        ScalarType type = array->getElementType();
+        size_t count = readCount(*array, buffer, control);
+        if (type == pvString) {
+            for (size_t i = 0; i < count; ++i)
+                skipString(buffer, control);
+        } else {
+            skipBytes(buffer, control, count, ScalarTypeFunc::elementSize(type));
+        }
+        break;
+    }
+    case structure:
+    {
+        FieldConstPtrArray const & fields =
+            std::tr1::static_pointer_cast<const Structure>(field)->getFields();
+        for (size_t i = 0; i < fields.size(); ++i)
+            skipField(fields[i], buffer, control);
+        break;
+    }
+    case structureArray:
+    {
+        StructureArrayConstPtr array = std::tr1::static_pointer_cast<const StructureArray>(field);
+        StructureConstPtr element = array->getStructure();
+        size_t count = readCount(*array, buffer, control);
+        for (size_t i = 0; i < count; ++i) {
+            control->ensureData(1);
+            if (buffer->getByte())
+                skipField(element, buffer, control);
+        }
+        break;
+    }
+    case union_:
+        skipUnion(std::tr1::static_pointer_cast<const Union>(field), buffer, control);
+        break;
+    case unionArray:
+    {
+        UnionArrayConstPtr array = std::tr1::static_pointer_cast<const UnionArray>(field);
+        UnionConstPtr element = array->getUnion();
+        size_t count = readCount(*array, buffer, control);
+        for (size_t i = 0; i < count; ++i) {
+            control->ensureData(1);
+            if (buffer->getByte())
+                skipUnion(element, buffer, control);
+        }
+        break;
+    }
+    }
+}
+
+}
+
+NTNDArrayDecoder::shared_pointer NTNDArrayDecoder::create(StructureConstPtr const & structure)
+{
+    if (!NTNDArray::isCompatible(structure))
+        return shared_pointer();
+
+    return shared_pointer(new NTNDArrayDecoder(structure));
+}
+
+NTNDArrayDecoder::NTNDArrayDecoder(StructureConstPtr const & structure) :
+    structure(structure),
+    valueIndex(structure->getFieldIndex("value")),
+    attributeIndex(structure->getFieldIndex("attribute")),
+    data(0), size(0), byteOrder(EPICS_BYTE_ORDER), scanned(false),
+    valueSelector(PVUnion::UNDEFINED_INDEX), valueType(pvString),
+    valueOffset(0), valueCount(0)
+{
+}
+
+void NTNDArrayDecoder::scan(const char *data, size_t size, int byteOrder)
+{
+    FieldConstPtrArray const & fields = structure->getFields();
+
+    this->data = data;
+    this->size = size;
+    this->byteOrder = byteOrder;
+    scanned = false;
+    offsets.clear();
+    decoded.assign(fields.size(), PVFieldPtr());
+    valueSelector = PVUnion::UNDEFINED_INDEX;
+    valueCount = 0;
+    attributeNames.clear();
+    attributeOffsets.clear();
+
+    ByteBuffer buffer(const_cast<char*>(data), size, byteOrder);
+    detail::FixedDeserializeControl control(&buffer);
+
+    for (size_t i = 0; i < fields.size(); ++i)
+    {
+        offsets.push_back(buffer.getPosition());
+
+        if (i == attributeIndex) {
+            scanAttributes(&buffer, &control);
+            continue;
+        }
+
+        UnionConstPtr u = std::tr1::dynamic_pointer_cast<const Union>(fields[i]);
+        if (i != valueIndex || !u || u->isVariant()) {
+            skipField(fields[i], &buffer, &control);
+            continue;
+        }
+
+        size_t selector = SerializeHelper::readSize(&buffer, &control);
+        if (selector == (size_t)-1)
+            continue;
+        if (selector >= u->getNumberFields())
+            throw std::runtime_error("invalid union selector in NTNDArray buffer");
+
+        ScalarArrayConstPtr array =
+            std::tr1::dynamic_pointer_cast<const ScalarArray>(u->getField(selector));
+        if (!array || array->getElementType() == pvString) {
+            skipField(u->getField(selector), &buffer, &control);
+            continue;
+        }
+
+        size_t count = readCount(*array, &buffer, &control);
+        size_t offset = buffer.getPosition();
+        skipBytes(&buffer, &control, count, ScalarTypeFunc::elementSize(array->getElementType()));
+
+        valueSelector = static_cast<int32>(selector);
+        valueType = array->getElementType();
+        valueOffset = offset;
+        valueCount = count;
+    }
+
+    scanned = true;
+}
+
+void NTNDArrayDecoder::scan(std::vector<epicsUInt8> const & data, int byteOrder)
+{
+    scan(data.empty() ? 0 : reinterpret_cast<const char*>(&data[0]),
+         data.size(), byteOrder);
+}
+
+void NTNDArrayDecoder::scanAttributes(ByteBuffer *buffer, DeserializableControl *control)
+{
+    StructureConstPtr element = std::tr1::static_pointer_cast<const StructureArray>(
+        structure->getField(attributeIndex))->getStructure();
+    FieldConstPtrArray const & fields = element->getFields();
+    size_t nameIndex = element->getFieldIndex("name");
+
+    size_t count = readCount(*std::tr1::static_pointer_cast<const StructureArray>(
+        structure->getField(attributeIndex)), buffer, control);
+    // every element takes at least one byte
+    if (count > buffer->getRemaining())
+        throw std::runtime_error("truncated NTNDArray buffer");
+    attributeNames.reserve(count);
+    attributeOffsets.reserve(count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        attributeOffsets.push_back(buffer->getPosition());
+        control->ensureData(1);
+        if (!buffer->getByte()) {
+            attributeNames.push_back(string());
+            continue;
+        }
+
+        string name;
+        for (size_t j = 0; j < fields.size(); ++j)
+        {
+            if (j == nameIndex && fields[j]->getType() == scalar &&
+                std::tr1::static_pointer_cast<const Scalar>(fields[j])->getScalarType() == pvString)
+                name = SerializeHelper::deserializeString(buffer, control);
+            else
+                skipField(fields[j], buffer, control);
+        }
+        attributeNames.push_back(name);
+    }
+}
+
+StructureConstPtr NTNDArrayDecoder::getStructure() const
+{
+    return structure;
+}
+
+PVFieldPtr NTNDArrayDecoder::decode(string const & fieldName)
+{
+    size_t index = structure->getFieldIndex(fieldName);
+    if (!scanned || index == (size_t)-1)
+        return PVFieldPtr();
+
+    if (!decoded[index]) {
+        PVFieldPtr pvField = getPVDataCreate()->createPVField(structure->getField(index));
+        ByteBuffer buffer(const_cast<char*>(data), size, byteOrder);
+        buffer.setPosition(offsets[index]);
+        detail::FixedDeserializeControl control(&buffer);
+        pvField->deserialize(&buffer, &control);
+        decoded[index] = pvField;
+    }
+
+    return decoded[index];
+}
+
+int32 NTNDArrayDecoder::getUniqueId()
+{
+    PVScalarPtr uniqueId = decode<PVScalar>("uniqueId");
+    if (!uniqueId)
+        throw std::runtime_error("no NTNDArray scanned");
+    return uniqueId->getAs<int32>();
+}
+
+PVStructurePtr NTNDArrayDecoder::getDataTimeStamp()
+{
+    return decode<PVStructure>("dataTimeStamp");
+}
+
+PVStructureArrayPtr NTNDArrayDecoder::getDimension()
+{
+    return decode<PVStructureArray>("dimension");
+}
+
+size_t NTNDArrayDecoder::getNumberAttributes() const
+{
+    return attributeNames.size();
+}
+
+shared_vector<const string> NTNDArrayDecoder::getAttributeNames() const
+{
+    shared_vector<string> names(attributeNames.size());
+    std::copy(attributeNames.begin(), attributeNames.end(), names.begin());
+    return freeze(names);
+}
+
+PVStructurePtr NTNDArrayDecoder::getAttribute(string const & name)
+{
+    for (size_t i = 0; i < attributeNames.size(); ++i)
+    {
+        if (attributeNames[i] != name)
+            continue;
+
+        ByteBuffer buffer(const_cast<char*>(data), size, byteOrder);
+        buffer.setPosition(attributeOffsets[i]);
+        detail::FixedDeserializeControl control(&buffer);
+        if (!buffer.getByte())
+            continue;
+
+        StructureConstPtr element = std::tr1::static_pointer_cast<const StructureArray>(
+            structure->getField(attributeIndex))->getStructure();
+        PVStructurePtr attribute = getPVDataCreate()->createPVStructure(element);
+        attribute->deserialize(&buffer, &control);
+        return attribute;
+    }
+
+    return PVStructurePtr();
+}
+
+bool NTNDArrayDecoder::hasValue() const
+{
+    return scanned && valueSelector != PVUnion::UNDEFINED_INDEX;
+}
+
+string NTNDArrayDecoder::getValueFieldName() const
+{
+    if (!hasValue())
+        return string();
+
+    return std::tr1::static_pointer_cast<const Union>(
+        structure->getField(valueIndex))->getFieldName(valueSelector);
+}
+
+ScalarType NTNDArrayDecoder::getValueType() const
+{
+    if (!hasValue())
+        throw std::runtime_error("no NTNDArray value selected");
+    return valueType;
+}
+
+size_t NTNDArrayDecoder::getValueCount() const
+{
+    return valueCount;
+}
+
+const char *NTNDArrayDecoder::getValueData() const
+{
+    return hasValue() ? data + valueOffset : 0;
+}
+
+size_t NTNDArrayDecoder::getValueBytes() const
+{
+    return hasValue() ? valueCount*ScalarTypeFunc::elementSize(valueType) : 0;
+}
+
+int NTNDArrayDecoder::getByteOrder() const
+{
+    return byteOrder;
+}
+
+}}
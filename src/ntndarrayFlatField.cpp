@@ -0,0 +1,238 @@
+/* ntndarrayFlatField.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <stdexcept>
+
+#define epicsExportSharedSymbols
+#include <pv/ntndarrayFlatField.h>
+
+#include "ndarrayValue.h"
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+using namespace detail;
+
+namespace {
+
+template<typename T>
+void toFloat(const char *data, size_t count, vector<float> & values)
+{
+    const T *in = reinterpret_cast<const T*>(data);
+    values.resize(count);
+    for (size_t i = 0; i < count; ++i)
+        values[i] = static_cast<float>(in[i]);
+}
+
+// the value of a reference frame as float, with its dimensions
+void referenceValue(NTNDArrayPtr const & frame, vector<float> & values,
+    vector<size_t> & dimensions)
+{
+    ScalarType type;
+    const char *data;
+    size_t count;
+    if (!valueData(frame, type, data, count))
+        throw std::runtime_error("NTNDArray reference frame has no numeric value");
+
+    vector<size_t> dims(frameDimensions(frame, count));
+    if (!dimensions.empty() && dims != dimensions)
+        throw std::runtime_error("NTNDArray reference frames differ in their dimensions");
+    dimensions = dims;
+
+    switch (type) {
+    case pvByte:   toFloat<int8>(data, count, values); break;
+    case pvShort:  toFloat<int16>(data, count, values); break;
+    case pvInt:    toFloat<int32>(data, count, values); break;
+    case pvLong:   toFloat<int64>(data, count, values); break;
+    case pvUByte:  toFloat<uint8>(data, count, values); break;
+    case pvUShort: toFloat<uint16>(data, count, values); break;
+    case pvUInt:   toFloat<uint32>(data, count, values); break;
+    case pvULong:  toFloat<uint64>(data, count, values); break;
+    case pvFloat:  toFloat<float>(data, count, values); break;
+    case pvDouble: toFloat<double>(data, count, values); break;
+    default: break;
+    }
+}
+
+// the maps and limits of a correction; a null dark map is 0 and a null
+// gain map is the scale, so that a corrector with one reference frame
+// reads one map per element rather than two
+struct Correction
+{
+    const float *dark;
+    const float *gain;
+    float scale;
+    float minimum;
+    float maximum;
+};
+
+// the whole correction of a row in one pass, without branches so that
+// it vectorizes for all but the 64 bit integers
+template<typename T, bool darkMap, bool gainMap>
+void correctRow(const T *in, const float *dark, const float *gain, float scale,
+    float *out, size_t count, float minimum, float maximum)
+{
+    for (size_t i = 0; i < count; ++i) {
+        float value = static_cast<float>(in[i]);
+        if (darkMap)
+            value -= dark[i];
+        value *= gainMap ? gain[i] : scale;
+        value = value < minimum ? minimum : value;
+        out[i] = value > maximum ? maximum : value;
+    }
+}
+
+template<typename T>
+void correctRow(const char *data, Correction const & correction, size_t offset,
+    float *out, size_t count)
+{
+    const T *in = reinterpret_cast<const T*>(data);
+    const float *dark = correction.dark ? correction.dark + offset : 0;
+    const float *gain = correction.gain ? correction.gain + offset : 0;
+    if (!gain)
+        correctRow<T, true, false>(in, dark, 0, correction.scale, out, count,
+            correction.minimum, correction.maximum);
+    else if (!dark)
+        correctRow<T, false, true>(in, 0, gain, 0, out, count,
+            correction.minimum, correction.maximum);
+    else
+        correctRow<T, true, true>(in, dark, gain, 0, out, count,
+            correction.minimum, correction.maximum);
+}
+
+void correctRow(ScalarType type, const char *data, Correction const & correction,
+    size_t offset, float *out, size_t count)
+{
+    switch (type) {
+    case pvByte:   correctRow<int8>(data, correction, offset, out, count); break;
+    case pvShort:  correctRow<int16>(data, correction, offset, out, count); break;
+    case pvInt:    correctRow<int32>(data, correction, offset, out, count); break;
+    case pvLong:   correctRow<int64>(data, correction, offset, out, count); break;
+    case pvUByte:  correctRow<uint8>(data, correction, offset, out, count); break;
+    case pvUShort: correctRow<uint16>(data, correction, offset, out, count); break;
+    case pvUInt:   correctRow<uint32>(data, correction, offset, out, count); break;
+    case pvULong:  correctRow<uint64>(data, correction, offset, out, count); break;
+    case pvFloat:  correctRow<float>(data, correction, offset, out, count); break;
+    case pvDouble: correctRow<double>(data, correction, offset, out, count); break;
+    default: break;
+    }
+}
+
+class CorrectionKernel : public NTNDArrayKernel
+{
+public:
+    CorrectionKernel(float *output, Correction const & correction) :
+        output(output), correction(correction)
+    {
+    }
+
+    virtual void apply(NTNDArrayTile const & tile)
+    {
+        for (size_t row = 0; row < tile.height; ++row) {
+            float *out = reinterpret_cast<float*>(tile.output + row*tile.outputStride);
+            correctRow(tile.inputType, tile.input + row*tile.inputStride, correction,
+                out - output, out, tile.width);
+        }
+    }
+
+private:
+    float *output;
+    Correction correction;
+};
+
+}
+
+NTNDArrayFlatField::shared_pointer NTNDArrayFlatField::create(
+    NTNDArrayPtr const & dark, NTNDArrayPtr const & flat,
+    NTNDArrayTilerPtr const & tiler, double scale, double minimum, double maximum)
+{
+    if (!dark && !flat)
+        throw std::runtime_error("flat-field correction needs a dark or a flat frame");
+    return shared_pointer(new NTNDArrayFlatField(dark, flat, tiler, scale, minimum, maximum));
+}
+
+NTNDArrayFlatField::NTNDArrayFlatField(NTNDArrayPtr const & darkFrame,
+        NTNDArrayPtr const & flatFrame, NTNDArrayTilerPtr const & tiler,
+        double scale, double minimum, double maximum) :
+    scale(static_cast<float>(scale)), minimum(static_cast<float>(minimum)),
+    maximum(static_cast<float>(maximum)), hasDark(darkFrame), hasFlat(flatFrame),
+    tiler(tiler), pool(NTNDArrayBufferPool::create())
+{
+    vector<float> flat;
+    if (darkFrame)
+        referenceValue(darkFrame, dark, dimensions);
+    if (flatFrame)
+        referenceValue(flatFrame, flat, dimensions);
+    if (!darkFrame)
+        dark.assign(flat.size(), 0);
+
+    if (!flatFrame) {
+        gain.assign(dark.size(), static_cast<float>(scale));
+        return;
+    }
+    gain.resize(flat.size());
+    for (size_t i = 0; i < gain.size(); ++i) {
+        float range = flat[i] - dark[i];
+        gain[i] = range > 0 ? static_cast<float>(scale/range) : 0;
+    }
+}
+
+NTNDArrayPtr NTNDArrayFlatField::correct(NTNDArrayPtr const & frame,
+    NTNDArrayBufferPoolPtr const & pool)
+{
+    NTNDArrayPtr output = cloneFrame(frame);
+    char *out = allocateValue(output, pool ? pool : this->pool, pvFloat, gain.size());
+    correct(frame, reinterpret_cast<float*>(out));
+    return output;
+}
+
+void NTNDArrayFlatField::correct(NTNDArrayPtr const & frame, float *output)
+{
+    ScalarType type;
+    const char *data;
+    size_t count;
+    if (!valueData(frame, type, data, count))
+        throw std::runtime_error("NTNDArray has no numeric value");
+    if (frameDimensions(frame, count) != dimensions)
+        throw std::runtime_error("NTNDArray dimensions differ from the reference frames");
+    if (count == 0)
+        return;
+
+    Correction correction = { hasDark ? &dark[0] : 0, hasFlat ? &gain[0] : 0,
+        scale, minimum, maximum };
+    if (!tiler) {
+        correctRow(type, data, correction, 0, output, count);
+        return;
+    }
+    CorrectionKernel kernel(output, correction);
+    tiler->run(tiler->split(frame, pvFloat, reinterpret_cast<char*>(output)), kernel);
+}
+
+size_t NTNDArrayFlatField::getElementCount() const
+{
+    return gain.size();
+}
+
+vector<float> const & NTNDArrayFlatField::getGain() const
+{
+    return gain;
+}
+
+NTNDArrayFlatFieldNode::NTNDArrayFlatFieldNode(string const & name,
+        NTNDArrayFlatFieldPtr const & flatField, size_t queueSize) :
+    NTNDArrayNode(name, queueSize), flatField(flatField)
+{
+}
+
+NTNDArrayPtr NTNDArrayFlatFieldNode::process(NTNDArrayPtr const & frame,
+    NTNDArrayBufferPoolPtr const & pool)
+{
+    return flatField->correct(frame, pool);
+}
+
+}}
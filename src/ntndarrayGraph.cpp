@@ -0,0 +1,504 @@
+/* ntndarrayGraph.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+#include <epicsAtomic.h>
+#include <epicsGuard.h>
+#include <epicsThread.h>
+
+#define epicsExportSharedSymbols
+#include <pv/ntndarrayGraph.h>
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+namespace {
+
+typedef epicsGuard<epicsMutex> Guard;
+
+// the number of frames a worker processes for a node before it lets
+// other nodes have their turn
+const size_t batchSize = 8;
+// the longest a waiting thread sleeps before it checks again
+const double waitSlice = 0.1;
+
+}
+
+NTNDArrayBufferPool::shared_pointer NTNDArrayBufferPool::create(size_t maxFree)
+{
+    return shared_pointer(new NTNDArrayBufferPool(maxFree));
+}
+
+NTNDArrayBufferPool::NTNDArrayBufferPool(size_t maxFree) :
+    maxFree(maxFree), allocated(0), reused(0)
+{
+}
+
+NTNDArrayBufferPool::~NTNDArrayBufferPool()
+{
+    for (multimap<size_t, char*>::iterator it = freeBlocks.begin(); it != freeBlocks.end(); ++it)
+        free(it->second);
+}
+
+char *NTNDArrayBufferPool::allocateBlock(size_t size)
+{
+    {
+        Guard G(mutex);
+        multimap<size_t, char*>::iterator it = freeBlocks.find(size);
+        if (it != freeBlocks.end()) {
+            char *block = it->second;
+            freeBlocks.erase(it);
+            ++reused;
+            return block;
+        }
+        ++allocated;
+    }
+
+    char *block = static_cast<char*>(malloc(size ? size : 1));
+    if (!block)
+        throw std::bad_alloc();
+    return block;
+}
+
+void NTNDArrayBufferPool::releaseBlock(char *block, size_t size)
+{
+    {
+        Guard G(mutex);
+        if (freeBlocks.size() < maxFree) {
+            freeBlocks.insert(make_pair(size, block));
+            return;
+        }
+    }
+    free(block);
+}
+
+size_t NTNDArrayBufferPool::getAllocated() const
+{
+    Guard G(mutex);
+    return allocated;
+}
+
+size_t NTNDArrayBufferPool::getReused() const
+{
+    Guard G(mutex);
+    return reused;
+}
+
+size_t NTNDArrayBufferPool::getFree() const
+{
+    Guard G(mutex);
+    return freeBlocks.size();
+}
+
+
+NTNDArrayNode::NTNDArrayNode(string const & name, size_t queueSize) :
+    name(name), queueSize(queueSize), graph(0), predecessors(0),
+    scheduled(false), frames(0), dropped(0), errors(0),
+    totalLatency(0), maxLatency(0), totalProcessTime(0)
+{
+}
+
+NTNDArrayNode::~NTNDArrayNode()
+{
+}
+
+string NTNDArrayNode::getName() const
+{
+    return name;
+}
+
+size_t NTNDArrayNode::getQueueSize() const
+{
+    return queueSize;
+}
+
+size_t NTNDArrayNode::getDepth() const
+{
+    Guard G(mutex);
+    return input.size();
+}
+
+size_t NTNDArrayNode::getFrames() const
+{
+    Guard G(mutex);
+    return frames;
+}
+
+size_t NTNDArrayNode::getDropped() const
+{
+    Guard G(mutex);
+    return dropped;
+}
+
+size_t NTNDArrayNode::getErrors() const
+{
+    Guard G(mutex);
+    return errors;
+}
+
+double NTNDArrayNode::getMeanLatency() const
+{
+    Guard G(mutex);
+    return frames ? totalLatency/frames : 0;
+}
+
+double NTNDArrayNode::getMaxLatency() const
+{
+    Guard G(mutex);
+    return maxLatency;
+}
+
+double NTNDArrayNode::getMeanProcessTime() const
+{
+    Guard G(mutex);
+    return frames ? totalProcessTime/frames : 0;
+}
+
+double NTNDArrayNode::getThroughput() const
+{
+    Guard G(mutex);
+    double elapsed = lastEnd - firstStart;
+    return frames && elapsed > 0 ? frames/elapsed : 0;
+}
+
+void NTNDArrayNode::resetStatistics()
+{
+    Guard G(mutex);
+    frames = dropped = errors = 0;
+    for (size_t i = 0; i < successorDropped.size(); ++i)
+        epicsAtomicSetSizeT(&successorDropped[i], 0);
+    totalLatency = maxLatency = totalProcessTime = 0;
+}
+
+
+class NTNDArrayGraph::Worker : public epicsThreadRunable
+{
+public:
+    Worker(NTNDArrayGraph *graph, size_t index) :
+        graph(graph), index(index), sleeping(0),
+        thread(*this, "ntndarrayGraph",
+            epicsThreadGetStackSize(epicsThreadStackSmall), epicsThreadPriorityMedium)
+    {
+    }
+
+    virtual void run()
+    {
+        while (!epicsAtomicGetIntT(&graph->stopping))
+        {
+            NTNDArrayNode *node = graph->take(index);
+            if (node) {
+                graph->run(node, index);
+                continue;
+            }
+
+            // schedule() wakes up sleeping workers, check once more after
+            // announcing it to not miss a node scheduled meanwhile
+            epicsAtomicSetIntT(&sleeping, 1);
+            node = graph->take(index);
+            if (node) {
+                epicsAtomicSetIntT(&sleeping, 0);
+                graph->run(node, index);
+                continue;
+            }
+            wakeup.wait(waitSlice);
+            epicsAtomicSetIntT(&sleeping, 0);
+        }
+    }
+
+    NTNDArrayGraph *graph;
+    size_t index;
+    epicsMutex mutex;
+    deque<NTNDArrayNode*> nodes;
+    epicsEvent wakeup;
+    int sleeping;
+    epicsThread thread;
+};
+
+NTNDArrayGraph::shared_pointer NTNDArrayGraph::create(size_t threadCount,
+    size_t maxInFlight, NTNDArrayBufferPoolPtr const & pool)
+{
+    if (threadCount == 0)
+        threadCount = std::max(epicsThreadGetCPUs(), 1);
+    return shared_pointer(new NTNDArrayGraph(threadCount,
+        std::max(maxInFlight, (size_t)1),
+        pool ? pool : NTNDArrayBufferPool::create()));
+}
+
+NTNDArrayGraph::NTNDArrayGraph(size_t threadCount, size_t maxInFlight,
+        NTNDArrayBufferPoolPtr const & pool) :
+    maxInFlight(maxInFlight), pool(pool), nextWorker(0),
+    inFlight(0), stopping(0)
+{
+    for (size_t i = 0; i < threadCount; ++i)
+        workers.push_back(new Worker(this, i));
+    for (size_t i = 0; i < threadCount; ++i)
+        workers[i]->thread.start();
+}
+
+NTNDArrayGraph::~NTNDArrayGraph()
+{
+    epicsAtomicSetIntT(&stopping, 1);
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i]->wakeup.signal();
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i]->thread.exitWait();
+        delete workers[i];
+    }
+
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        Guard G(nodes[i]->mutex);
+        nodes[i]->graph = 0;
+        nodes[i]->successors.clear();
+        nodes[i]->successorDropped.clear();
+        nodes[i]->predecessors = 0;
+        nodes[i]->input.clear();
+        nodes[i]->scheduled = false;
+    }
+}
+
+void NTNDArrayGraph::addNode(NTNDArrayNodePtr const & node)
+{
+    if (node->graph == this)
+        return;
+    if (node->graph)
+        throw std::runtime_error("node " + node->getName() + " belongs to another graph");
+
+    node->graph = this;
+    nodes.push_back(node);
+}
+
+void NTNDArrayGraph::connect(NTNDArrayNodePtr const & from, NTNDArrayNodePtr const & to)
+{
+    if (from == to || (to->graph == this && from->graph == this && reaches(to.get(), from.get())))
+        throw std::runtime_error("connecting " + from->getName() + " to " +
+            to->getName() + " would create a cycle");
+
+    addNode(from);
+    addNode(to);
+    if (std::find(from->successors.begin(), from->successors.end(), to.get()) !=
+        from->successors.end())
+        return;
+
+    from->successors.push_back(to.get());
+    from->successorDropped.push_back(0);
+    ++to->predecessors;
+}
+
+bool NTNDArrayGraph::reaches(NTNDArrayNode *from, NTNDArrayNode *to) const
+{
+    if (from == to)
+        return true;
+    for (size_t i = 0; i < from->successors.size(); ++i)
+        if (reaches(from->successors[i], to))
+            return true;
+    return false;
+}
+
+vector<NTNDArrayNodePtr> NTNDArrayGraph::getNodes() const
+{
+    return nodes;
+}
+
+bool NTNDArrayGraph::push(NTNDArrayPtr const & frame, bool wait)
+{
+    // reserve a place below the limit, so that concurrent callers
+    // cannot all pass the check before any of them delivers
+    size_t current = epicsAtomicGetSizeT(&inFlight);
+    while (true) {
+        if (current >= maxInFlight) {
+            if (!wait || epicsAtomicGetIntT(&stopping))
+                return false;
+            space.wait(waitSlice);
+            current = epicsAtomicGetSizeT(&inFlight);
+            continue;
+        }
+        size_t previous = epicsAtomicCmpAndSwapSizeT(&inFlight, current, current + 1);
+        if (previous == current)
+            break;
+        current = previous;
+    }
+
+    size_t worker = epicsAtomicIncrSizeT(&nextWorker) % workers.size();
+    for (size_t i = 0; i < nodes.size(); ++i)
+        if (nodes[i]->predecessors == 0)
+            deliver(nodes[i].get(), frame, worker);
+    release();
+    return true;
+}
+
+void NTNDArrayGraph::waitIdle()
+{
+    while (epicsAtomicGetSizeT(&inFlight) > 0)
+        idle.wait(waitSlice);
+}
+
+size_t NTNDArrayGraph::getInFlight() const
+{
+    return epicsAtomicGetSizeT(&inFlight);
+}
+
+size_t NTNDArrayGraph::getThreadCount() const
+{
+    return workers.size();
+}
+
+NTNDArrayBufferPoolPtr NTNDArrayGraph::getBufferPool() const
+{
+    return pool;
+}
+
+size_t NTNDArrayGraph::getDropped(NTNDArrayNodePtr const & from, NTNDArrayNodePtr const & to) const
+{
+    if (from->graph != this)
+        return 0;
+    for (size_t i = 0; i < from->successors.size(); ++i)
+        if (from->successors[i] == to.get())
+            return epicsAtomicGetSizeT(&from->successorDropped[i]);
+    return 0;
+}
+
+bool NTNDArrayGraph::deliver(NTNDArrayNode *node, NTNDArrayPtr const & frame, size_t worker)
+{
+    {
+        Guard G(node->mutex);
+        if (node->input.size() >= node->queueSize) {
+            ++node->dropped;
+            return false;
+        }
+        node->input.push_back(NTNDArrayNode::Input(frame, epicsTime::getCurrent()));
+        epicsAtomicIncrSizeT(&inFlight);
+        if (node->scheduled)
+            return true;
+        node->scheduled = true;
+    }
+    schedule(node, worker, false);
+    return true;
+}
+
+void NTNDArrayGraph::release()
+{
+    size_t remaining = epicsAtomicDecrSizeT(&inFlight);
+    if (remaining < maxInFlight)
+        space.signal();
+    if (remaining == 0)
+        idle.signal();
+}
+
+void NTNDArrayGraph::schedule(NTNDArrayNode *node, size_t worker, bool front)
+{
+    Worker *owner = workers[worker];
+    {
+        Guard G(owner->mutex);
+        if (front)
+            owner->nodes.push_front(node);
+        else
+            owner->nodes.push_back(node);
+    }
+    owner->wakeup.signal();
+
+    // let an idle worker steal it if the owner is busy
+    for (size_t i = 1; i < workers.size(); ++i) {
+        Worker *other = workers[(worker + i) % workers.size()];
+        if (epicsAtomicGetIntT(&other->sleeping)) {
+            other->wakeup.signal();
+            break;
+        }
+    }
+}
+
+NTNDArrayNode *NTNDArrayGraph::take(size_t worker)
+{
+    {
+        Worker *owner = workers[worker];
+        Guard G(owner->mutex);
+        if (!owner->nodes.empty()) {
+            NTNDArrayNode *node = owner->nodes.back();
+            owner->nodes.pop_back();
+            return node;
+        }
+    }
+
+    for (size_t i = 1; i < workers.size(); ++i) {
+        Worker *victim = workers[(worker + i) % workers.size()];
+        Guard G(victim->mutex);
+        if (!victim->nodes.empty()) {
+            NTNDArrayNode *node = victim->nodes.front();
+            victim->nodes.pop_front();
+            return node;
+        }
+    }
+    return 0;
+}
+
+void NTNDArrayGraph::run(NTNDArrayNode *node, size_t worker)
+{
+    for (size_t n = 0; n < batchSize; ++n)
+    {
+        NTNDArrayPtr frame;
+        epicsTime arrival;
+        {
+            Guard G(node->mutex);
+            if (node->input.empty()) {
+                node->scheduled = false;
+                return;
+            }
+            frame.swap(node->input.front().frame);
+            arrival = node->input.front().arrival;
+            node->input.pop_front();
+        }
+
+        epicsTime start(epicsTime::getCurrent());
+        NTNDArrayPtr output;
+        bool failed = false;
+        try {
+            output = node->process(frame, pool);
+        } catch (...) {
+            failed = true;
+        }
+        epicsTime end(epicsTime::getCurrent());
+
+        {
+            Guard G(node->mutex);
+            if (failed) {
+                ++node->errors;
+            } else {
+                if (node->frames == 0)
+                    node->firstStart = start;
+                ++node->frames;
+                node->lastEnd = end;
+                double latency = end - arrival;
+                node->totalLatency += latency;
+                node->maxLatency = std::max(node->maxLatency, latency);
+                node->totalProcessTime += end - start;
+            }
+        }
+
+        if (output)
+            for (size_t i = 0; i < node->successors.size(); ++i)
+                if (!deliver(node->successors[i], output, worker))
+                    epicsAtomicIncrSizeT(&node->successorDropped[i]);
+
+        release();
+    }
+
+    // requeue at the cold end, where other workers steal from
+    {
+        Guard G(node->mutex);
+        if (node->input.empty()) {
+            node->scheduled = false;
+            return;
+        }
+    }
+    schedule(node, worker, true);
+}
+
+}}
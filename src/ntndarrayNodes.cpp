@@ -0,0 +1,247 @@
+/* ntndarrayNodes.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include <epicsGuard.h>
+
+#define epicsExportSharedSymbols
+#include <pv/ntndarrayNodes.h>
+
+#include "ndarrayValue.h"
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+using namespace detail;
+
+namespace {
+
+typedef epicsGuard<epicsMutex> Guard;
+
+template<typename F, typename T>
+void convertTo(const F *from, char *to, size_t count)
+{
+    T *out = reinterpret_cast<T*>(to);
+    for (size_t i = 0; i < count; ++i)
+        out[i] = static_cast<T>(from[i]);
+}
+
+template<typename F>
+void convertFrom(const char *from, ScalarType type, char *to, size_t count)
+{
+    const F *in = reinterpret_cast<const F*>(from);
+    switch (type) {
+    case pvByte:   convertTo<F, int8>(in, to, count); break;
+    case pvShort:  convertTo<F, int16>(in, to, count); break;
+    case pvInt:    convertTo<F, int32>(in, to, count); break;
+    case pvLong:   convertTo<F, int64>(in, to, count); break;
+    case pvUByte:  convertTo<F, uint8>(in, to, count); break;
+    case pvUShort: convertTo<F, uint16>(in, to, count); break;
+    case pvUInt:   convertTo<F, uint32>(in, to, count); break;
+    case pvULong:  convertTo<F, uint64>(in, to, count); break;
+    case pvFloat:  convertTo<F, float>(in, to, count); break;
+    case pvDouble: convertTo<F, double>(in, to, count); break;
+    default: break;
+    }
+}
+
+void convert(ScalarType fromType, const char *from, ScalarType toType, char *to, size_t count)
+{
+    switch (fromType) {
+    case pvByte:   convertFrom<int8>(from, toType, to, count); break;
+    case pvShort:  convertFrom<int16>(from, toType, to, count); break;
+    case pvInt:    convertFrom<int32>(from, toType, to, count); break;
+    case pvLong:   convertFrom<int64>(from, toType, to, count); break;
+    case pvUByte:  convertFrom<uint8>(from, toType, to, count); break;
+    case pvUShort: convertFrom<uint16>(from, toType, to, count); break;
+    case pvUInt:   convertFrom<uint32>(from, toType, to, count); break;
+    case pvULong:  convertFrom<uint64>(from, toType, to, count); break;
+    case pvFloat:  convertFrom<float>(from, toType, to, count); break;
+    case pvDouble: convertFrom<double>(from, toType, to, count); break;
+    default: break;
+    }
+}
+
+template<typename T>
+NTNDArrayStatistics computeStatistics(const char *data, size_t count)
+{
+    const T *in = reinterpret_cast<const T*>(data);
+    NTNDArrayStatistics statistics;
+    statistics.count = count;
+    if (count == 0)
+        return statistics;
+
+    T min = in[0], max = in[0];
+    double total = 0, squares = 0;
+    for (size_t i = 0; i < count; ++i) {
+        T v = in[i];
+        min = v < min ? v : min;
+        max = v > max ? v : max;
+        double d = static_cast<double>(v);
+        total += d;
+        squares += d*d;
+    }
+
+    statistics.min = static_cast<double>(min);
+    statistics.max = static_cast<double>(max);
+    statistics.total = total;
+    statistics.mean = total/count;
+    double variance = squares/count - statistics.mean*statistics.mean;
+    statistics.sigma = variance > 0 ? sqrt(variance) : 0;
+    return statistics;
+}
+
+}
+
+NTNDArrayROINode::NTNDArrayROINode(string const & name,
+        vector<size_t> const & offset, vector<size_t> const & size,
+        size_t queueSize) :
+    NTNDArrayNode(name, queueSize), offset(offset), size(size)
+{
+}
+
+NTNDArrayPtr NTNDArrayROINode::process(NTNDArrayPtr const & frame,
+    NTNDArrayBufferPoolPtr const & pool)
+{
+    ScalarType type;
+    const char *data;
+    size_t count;
+    if (!valueData(frame, type, data, count))
+        return NTNDArrayPtr();
+
+    vector<size_t> full(frameDimensions(frame, count));
+    size_t n = full.size();
+    vector<size_t> start(n), length(n);
+    size_t outCount = 1;
+    for (size_t i = 0; i < n; ++i) {
+        start[i] = i < offset.size() ? std::min(offset[i], full[i]) : 0;
+        length[i] = full[i] - start[i];
+        if (i < size.size())
+            length[i] = std::min(length[i], size[i]);
+        outCount *= length[i];
+    }
+    if (outCount == 0)
+        return NTNDArrayPtr();
+
+    NTNDArrayPtr output = cloneFrame(frame);
+    char *out = allocateValue(output, pool, type, outCount);
+
+    size_t elementSize = ScalarTypeFunc::elementSize(type);
+    vector<size_t> stride(n);
+    stride[0] = elementSize;
+    for (size_t i = 1; i < n; ++i)
+        stride[i] = stride[i - 1]*full[i - 1];
+
+    // copy rows of dimension[0], iterating over the other dimensions
+    size_t rowBytes = length[0]*elementSize;
+    vector<size_t> index(n, 0);
+    while (true) {
+        size_t position = start[0]*stride[0];
+        for (size_t i = 1; i < n; ++i)
+            position += (start[i] + index[i])*stride[i];
+        memcpy(out, data + position, rowBytes);
+        out += rowBytes;
+
+        size_t d = 1;
+        while (d < n && ++index[d] == length[d])
+            index[d++] = 0;
+        if (d >= n)
+            break;
+    }
+
+    PVStructureArrayPtr dimension = output->getDimension();
+    PVStructureArray::const_svector inDims(frame->getDimension()->view());
+    StructureConstPtr element = dimension->getStructureArray()->getStructure();
+    PVStructureArray::svector outDims(n);
+    for (size_t i = 0; i < n; ++i) {
+        outDims[i] = i < inDims.size() ?
+            getPVDataCreate()->createPVStructure(inDims[i]) :
+            getPVDataCreate()->createPVStructure(element);
+        PVIntPtr dimOffset = outDims[i]->getSubField<PVInt>("offset");
+        if (i >= inDims.size()) {
+            outDims[i]->getSubField<PVInt>("fullSize")->put(static_cast<int32>(full[i]));
+            outDims[i]->getSubField<PVInt>("binning")->put(1);
+        }
+        outDims[i]->getSubField<PVInt>("size")->put(static_cast<int32>(length[i]));
+        dimOffset->put(dimOffset->get() + static_cast<int32>(start[i]));
+    }
+    dimension->replace(freeze(outDims));
+    return output;
+}
+
+NTNDArrayConvertNode::NTNDArrayConvertNode(string const & name,
+        ScalarType type, size_t queueSize) :
+    NTNDArrayNode(name, queueSize), type(type)
+{
+    if (!ScalarTypeFunc::isNumeric(type))
+        throw std::runtime_error("NTNDArray values can only be converted to numeric types");
+}
+
+NTNDArrayPtr NTNDArrayConvertNode::process(NTNDArrayPtr const & frame,
+    NTNDArrayBufferPoolPtr const & pool)
+{
+    ScalarType fromType;
+    const char *data;
+    size_t count;
+    if (!valueData(frame, fromType, data, count))
+        return NTNDArrayPtr();
+    if (fromType == type)
+        return frame;
+
+    NTNDArrayPtr output = cloneFrame(frame);
+    char *out = allocateValue(output, pool, type, count);
+    convert(fromType, data, type, out, count);
+    return output;
+}
+
+NTNDArrayStatisticsNode::NTNDArrayStatisticsNode(string const & name,
+        size_t queueSize) :
+    NTNDArrayNode(name, queueSize)
+{
+}
+
+NTNDArrayPtr NTNDArrayStatisticsNode::process(NTNDArrayPtr const & frame,
+    NTNDArrayBufferPoolPtr const &)
+{
+    ScalarType type;
+    const char *data;
+    size_t count;
+    if (isCompressed(frame) || !valueData(frame, type, data, count))
+        return frame;
+
+    NTNDArrayStatistics result;
+    switch (type) {
+    case pvByte:   result = computeStatistics<int8>(data, count); break;
+    case pvShort:  result = computeStatistics<int16>(data, count); break;
+    case pvInt:    result = computeStatistics<int32>(data, count); break;
+    case pvLong:   result = computeStatistics<int64>(data, count); break;
+    case pvUByte:  result = computeStatistics<uint8>(data, count); break;
+    case pvUShort: result = computeStatistics<uint16>(data, count); break;
+    case pvUInt:   result = computeStatistics<uint32>(data, count); break;
+    case pvULong:  result = computeStatistics<uint64>(data, count); break;
+    case pvFloat:  result = computeStatistics<float>(data, count); break;
+    case pvDouble: result = computeStatistics<double>(data, count); break;
+    default: break;
+    }
+
+    Guard G(mutex);
+    statistics = result;
+    return frame;
+}
+
+NTNDArrayStatistics NTNDArrayStatisticsNode::getStatistics() const
+{
+    Guard G(mutex);
+    return statistics;
+}
+
+}}
@@ -0,0 +1,350 @@
+/* ntndarrayPyramid.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <epicsGuard.h>
+
+#define epicsExportSharedSymbols
+#include <pv/ntndarrayPyramid.h>
+#include <pv/ntndarrayColor.h>
+
+#include "ndarrayValue.h"
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+using namespace detail;
+
+namespace {
+
+typedef epicsGuard<epicsMutex> Guard;
+
+const size_t maxLevelCount = 6;
+
+// the type block sums are kept in, exact for the integer types up to 64x64 blocks
+template<typename T> struct BlockSum { typedef double type; };
+template<> struct BlockSum<int8> { typedef int32 type; };
+template<> struct BlockSum<uint8> { typedef int32 type; };
+template<> struct BlockSum<int16> { typedef int32 type; };
+template<> struct BlockSum<uint16> { typedef int32 type; };
+template<> struct BlockSum<int32> { typedef int64 type; };
+template<> struct BlockSum<uint32> { typedef uint64 type; };
+
+/*
+ * The average of a block sum of 2^shift elements, rounded half up as
+ * floor(average + 0.5) for integers. Integer sums are rounded with a
+ * shift, which vectorizes where floor does not.
+ */
+template<typename T, typename Sum>
+inline T average(Sum sum, int shift, double)
+{
+    return static_cast<T>((sum + (Sum(1) << (shift - 1))) >> shift);
+}
+
+template<typename T>
+inline T average(double sum, int, double scale)
+{
+    return numeric_limits<T>::is_integer ?
+        static_cast<T>(floor(sum*scale + 0.5)) : static_cast<T>(sum*scale);
+}
+
+/*
+ * Sums 2x2 blocks of two rows of pixels of some channels each. The
+ * number of channels is a constant, so that the sums of a pixel are
+ * one group of unit stride stores.
+ */
+template<size_t channels, typename In, typename Sum>
+inline void sumBlocks(const In *a, const In *b, Sum *out, size_t width)
+{
+    for (size_t i = 0; i < width*channels; i += channels)
+        for (size_t c = 0; c < channels; ++c) {
+            size_t left = 2*i + c, right = left + channels;
+            out[i + c] = static_cast<Sum>(a[left]) + static_cast<Sum>(a[right]) +
+                         static_cast<Sum>(b[left]) + static_cast<Sum>(b[right]);
+        }
+}
+
+template<typename In, typename Sum>
+inline void sumBlocks(const In *a, const In *b, Sum *out, size_t width, size_t channels)
+{
+    if (channels == 1)
+        sumBlocks<1>(a, b, out, width);
+    else
+        sumBlocks<3>(a, b, out, width);
+}
+
+/*
+ * Generates the levels of bands of rows, given by the tiles. A tile starts
+ * at a multiple of 2^depth rows, depth being the deepest level generated.
+ * The block sums of each level are kept for a band of 2^depth rows only.
+ */
+class PyramidKernel : public NTNDArrayKernel
+{
+public:
+    PyramidKernel(ScalarType type, size_t width, size_t height, size_t channels,
+            const char *input, vector<char*> const & outputs) :
+        type(type), width(width), height(height), channels(channels),
+        input(input), outputs(outputs)
+    {
+    }
+
+    virtual void apply(NTNDArrayTile const & tile)
+    {
+        switch (type) {
+        case pvByte:   generate<int8>(tile.y, tile.height); break;
+        case pvShort:  generate<int16>(tile.y, tile.height); break;
+        case pvInt:    generate<int32>(tile.y, tile.height); break;
+        case pvLong:   generate<int64>(tile.y, tile.height); break;
+        case pvUByte:  generate<uint8>(tile.y, tile.height); break;
+        case pvUShort: generate<uint16>(tile.y, tile.height); break;
+        case pvUInt:   generate<uint32>(tile.y, tile.height); break;
+        case pvULong:  generate<uint64>(tile.y, tile.height); break;
+        case pvFloat:  generate<float>(tile.y, tile.height); break;
+        case pvDouble: generate<double>(tile.y, tile.height); break;
+        default: break;
+        }
+    }
+
+private:
+    template<typename T>
+    void generate(size_t first, size_t count)
+    {
+        typedef typename BlockSum<T>::type Sum;
+        const T *in = reinterpret_cast<const T*>(input);
+        size_t depth = outputs.size();
+        size_t band = size_t(1) << depth;
+
+        // the block sums of a band, level k at offsets[k - 1]
+        vector<size_t> offsets(depth + 1, 0);
+        for (size_t k = 1; k <= depth; ++k)
+            offsets[k] = offsets[k - 1] + (band >> k)*(width >> k)*channels;
+        vector<Sum> sums(offsets[depth]);
+
+        for (size_t y = first; y < first + count; y += band) {
+            size_t rows = std::min(band, first + count - y);
+            for (size_t k = 1; k <= depth; ++k) {
+                size_t levelWidth = (width >> k)*channels;
+                Sum *levelSums = &sums[0] + offsets[k - 1];
+                T *out = reinterpret_cast<T*>(outputs[k - 1]);
+                int shift = static_cast<int>(2*k);
+                double scale = 1.0/double(size_t(1) << shift);
+
+                for (size_t r = 0; r < rows >> k; ++r) {
+                    Sum *rowSums = levelSums + r*levelWidth;
+                    if (k == 1) {
+                        const T *a = in + (y + 2*r)*width*channels;
+                        sumBlocks(a, a + width*channels, rowSums, width >> 1, channels);
+                    } else {
+                        size_t belowWidth = (width >> (k - 1))*channels;
+                        const Sum *a = &sums[0] + offsets[k - 2] + 2*r*belowWidth;
+                        sumBlocks(a, a + belowWidth, rowSums, width >> k, channels);
+                    }
+                    if (!out)
+                        continue;
+                    T *outRow = out + ((y >> k) + r)*levelWidth;
+                    for (size_t i = 0; i < levelWidth; ++i)
+                        outRow[i] = average<T>(rowSums[i], shift, scale);
+                }
+            }
+        }
+    }
+
+    ScalarType type;
+    size_t width;
+    size_t height;
+    size_t channels;
+    const char *input;
+    vector<char*> outputs;
+};
+
+// the x and y dimension of a level: size / factor, binning * factor, fullSize of the frame
+PVStructurePtr levelDimension(PVStructurePtr const & dimension, size_t factor)
+{
+    PVStructurePtr level = getPVDataCreate()->createPVStructure(dimension);
+    PVIntPtr size = level->getSubField<PVInt>("size");
+    PVIntPtr fullSize = level->getSubField<PVInt>("fullSize");
+    PVIntPtr binning = level->getSubField<PVInt>("binning");
+    if (fullSize && fullSize->get() <= 0)
+        fullSize->put(size->get());
+    if (binning)
+        binning->put(std::max(binning->get(), 1)*static_cast<int32>(factor));
+    size->put(size->get()/static_cast<int32>(factor));
+    return level;
+}
+
+}
+
+NTNDArrayPyramid::shared_pointer NTNDArrayPyramid::create(size_t levelCount,
+    NTNDArrayTilerPtr const & tiler)
+{
+    if (levelCount == 0 || levelCount > maxLevelCount)
+        throw std::runtime_error("NTNDArray pyramids have 1 to 6 levels");
+    return shared_pointer(new NTNDArrayPyramid(levelCount, tiler));
+}
+
+NTNDArrayPyramid::NTNDArrayPyramid(size_t levelCount, NTNDArrayTilerPtr const & tiler) :
+    levelCount(levelCount), tiler(tiler), subscribers(levelCount, 0),
+    lastLevels(levelCount), lastSubscribed(levelCount, false)
+{
+}
+
+void NTNDArrayPyramid::checkLevel(size_t level) const
+{
+    if (level == 0 || level > levelCount)
+        throw std::runtime_error("no such NTNDArray pyramid level");
+}
+
+void NTNDArrayPyramid::subscribe(size_t level)
+{
+    checkLevel(level);
+    Guard G(mutex);
+    ++subscribers[level - 1];
+}
+
+void NTNDArrayPyramid::unsubscribe(size_t level)
+{
+    checkLevel(level);
+    Guard G(mutex);
+    if (subscribers[level - 1] > 0)
+        --subscribers[level - 1];
+}
+
+size_t NTNDArrayPyramid::getSubscribers(size_t level) const
+{
+    checkLevel(level);
+    Guard G(mutex);
+    return subscribers[level - 1];
+}
+
+vector<NTNDArrayPtr> NTNDArrayPyramid::generate(NTNDArrayPtr const & frame,
+    NTNDArrayBufferPoolPtr const & pool)
+{
+    ScalarType type;
+    const char *data;
+    size_t count;
+    if (!valueData(frame, type, data, count))
+        throw std::runtime_error("NTNDArray has no numeric value");
+
+    vector<size_t> sizes(frameDimensions(frame, count));
+    NTNDArrayColor::Mode mode = NTNDArrayColor::getColorMode(frame);
+    size_t channels = mode == NTNDArrayColor::rgb1 ? 3 : 1;
+    if (!(mode == NTNDArrayColor::mono && sizes.size() == 2) &&
+        !(mode == NTNDArrayColor::rgb1 && sizes.size() == 3 && sizes[0] == 3))
+        throw std::runtime_error("NTNDArray pyramids need mono or RGB1 frames");
+    size_t xIndex = channels == 1 ? 0 : 1;
+    size_t width = sizes[xIndex];
+    size_t height = sizes[xIndex + 1];
+
+    vector<bool> subscribed(levelCount);
+    {
+        Guard G(mutex);
+        for (size_t k = 0; k < levelCount; ++k)
+            subscribed[k] = subscribers[k] > 0;
+    }
+
+    // the deepest subscribed level of at least one element
+    size_t depth = 0;
+    for (size_t k = 1; k <= levelCount; ++k)
+        if (subscribed[k - 1] && (width >> k) > 0 && (height >> k) > 0)
+            depth = k;
+
+    vector<NTNDArrayPtr> levels(levelCount);
+    if (depth == 0)
+        return levels;
+
+    NTNDArrayBufferPoolPtr valuePool(pool ? pool : NTNDArrayBufferPool::create(0));
+    PVStructureArray::const_svector dims(frame->getDimension()->view());
+    vector<char*> outputs(depth, static_cast<char*>(0));
+    for (size_t k = 1; k <= depth; ++k) {
+        if (!subscribed[k - 1] || (width >> k) == 0 || (height >> k) == 0)
+            continue;
+        NTNDArrayPtr level = cloneFrame(frame);
+        outputs[k - 1] = allocateValue(level, valuePool, type,
+            (width >> k)*(height >> k)*channels);
+
+        PVStructureArrayPtr dimension = level->getDimension();
+        PVStructureArray::svector levelDims(dims.size());
+        if (channels != 1)
+            levelDims[0] = getPVDataCreate()->createPVStructure(dims[0]);
+        levelDims[xIndex] = levelDimension(dims[xIndex], size_t(1) << k);
+        levelDims[xIndex + 1] = levelDimension(dims[xIndex + 1], size_t(1) << k);
+        dimension->replace(freeze(levelDims));
+        levels[k - 1] = level;
+    }
+
+    PyramidKernel kernel(type, width, height, channels, data, outputs);
+
+    // bands of 2^depth rows of the frame, as many per tile as fit a tile of the tiler
+    size_t band = size_t(1) << depth;
+    size_t bandBytes = band*width*channels*ScalarTypeFunc::elementSize(type);
+    size_t rows = tiler ? band*std::max(tiler->getTileBytes()/bandBytes, (size_t)1) : height;
+    vector<NTNDArrayTile> tiles;
+    NTNDArrayTile tile;
+    memset(&tile, 0, sizeof(tile));
+    tile.width = width;
+    tile.inputType = type;
+    tile.outputType = type;
+    for (size_t y = 0; y < height; y += rows) {
+        tile.y = y;
+        tile.height = std::min(rows, height - y);
+        tiles.push_back(tile);
+    }
+
+    if (tiler)
+        tiler->run(tiles, kernel);
+    else
+        kernel.apply(tiles[0]);
+    return levels;
+}
+
+NTNDArrayPtr NTNDArrayPyramid::getLevel(NTNDArrayPtr const & frame, size_t level,
+    NTNDArrayBufferPoolPtr const & pool)
+{
+    checkLevel(level);
+    if (getSubscribers(level) == 0)
+        return NTNDArrayPtr();
+
+    Guard G(lastMutex);
+    if (lastFrame.lock() != frame || !lastSubscribed[level - 1]) {
+        for (size_t k = 1; k <= levelCount; ++k)
+            lastSubscribed[k - 1] = getSubscribers(k) > 0;
+        lastLevels = generate(frame, pool);
+        lastFrame = frame;
+    }
+    return lastLevels[level - 1];
+}
+
+size_t NTNDArrayPyramid::getLevelCount() const
+{
+    return levelCount;
+}
+
+NTNDArrayPyramidNode::NTNDArrayPyramidNode(string const & name,
+        NTNDArrayPyramidPtr const & pyramid, size_t level, size_t queueSize) :
+    NTNDArrayNode(name, queueSize), pyramid(pyramid), level(level)
+{
+    pyramid->subscribe(level);
+}
+
+NTNDArrayPyramidNode::~NTNDArrayPyramidNode()
+{
+    pyramid->unsubscribe(level);
+}
+
+NTNDArrayPtr NTNDArrayPyramidNode::process(NTNDArrayPtr const & frame,
+    NTNDArrayBufferPoolPtr const & pool)
+{
+    return pyramid->getLevel(frame, level, pool);
+}
+
+}}
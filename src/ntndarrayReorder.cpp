@@ -0,0 +1,241 @@
+/* ntndarrayReorder.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <stdexcept>
+
+#include <epicsGuard.h>
+
+#define epicsExportSharedSymbols
+#include <pv/ntndarrayReorder.h>
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+namespace {
+
+typedef epicsGuard<epicsMutex> Guard;
+
+// b - a, for uniqueIds that wrap around
+inline int32 distance(int32 a, int32 b)
+{
+    return static_cast<int32>(static_cast<uint32>(b) - static_cast<uint32>(a));
+}
+
+}
+
+NTNDArrayReorder::shared_pointer NTNDArrayReorder::create(size_t window, double timeout)
+{
+    if (window == 0)
+        throw std::runtime_error("NTNDArray reorder window must not be 0");
+    return shared_pointer(new NTNDArrayReorder(window, timeout));
+}
+
+NTNDArrayReorder::NTNDArrayReorder(size_t window, double timeout) :
+    window(window), timeout(timeout), slots(window),
+    started(false), settling(false), next(0), head(0), pending(0), blocked(false),
+    gaps(0), duplicates(0), late(0), restarts(0), releasedCount(0)
+{
+}
+
+NTNDArrayPtr & NTNDArrayReorder::slot(size_t ahead)
+{
+    return slots[(head + ahead) % window];
+}
+
+// the number of uniqueIds from the next one to the last held frame
+size_t NTNDArrayReorder::extent() const
+{
+    size_t n = window;
+    while (n > 0 && !slots[(head + n - 1) % window])
+        --n;
+    return n;
+}
+
+// moves on by one uniqueId, releasing its frame or skipping it
+void NTNDArrayReorder::advance(vector<NTNDArrayPtr> & released)
+{
+    NTNDArrayPtr & frame = slots[head];
+    if (frame) {
+        released.push_back(frame);
+        frame.reset();
+        --pending;
+        ++releasedCount;
+    } else {
+        ++gaps;
+    }
+    next = static_cast<int32>(static_cast<uint32>(next) + 1);
+    head = (head + 1) % window;
+}
+
+// releases the frames from the next uniqueId on, up to the first missing one
+void NTNDArrayReorder::release(vector<NTNDArrayPtr> & released)
+{
+    bool moved = false;
+    while (pending > 0 && slots[head]) {
+        advance(released);
+        moved = true;
+    }
+
+    // held frames wait for the missing uniqueId from now on
+    if (pending == 0) {
+        blocked = false;
+    } else if (moved || !blocked) {
+        blocked = true;
+        blockedSince = epicsTime::getCurrent();
+    }
+}
+
+void NTNDArrayReorder::push(NTNDArrayPtr const & frame, vector<NTNDArrayPtr> & released)
+{
+    int32 uniqueId = frame->getUniqueId()->get();
+
+    Guard G(mutex);
+    if (!started) {
+        // hold the first frames for the timeout, frames before them
+        // may still arrive from other threads
+        next = uniqueId;
+        started = true;
+        settling = true;
+        blocked = true;
+        blockedSince = epicsTime::getCurrent();
+    }
+
+    int32 ahead = distance(next, uniqueId);
+    if (ahead < 0) {
+        size_t behind = static_cast<size_t>(-static_cast<int64>(ahead));
+        if (behind >= window) {
+            // a new sequence, as after a restart of the acquisition
+            while (pending > 0)
+                advance(released);
+            next = uniqueId;
+            settling = false;
+            blocked = false;
+            ++restarts;
+        } else if (settling && behind + extent() <= window) {
+            // nothing is released yet, start from this frame
+            head = (head + window - behind) % window;
+            next = uniqueId;
+        } else {
+            ++late;
+            return;
+        }
+        ahead = 0;
+    }
+    while (static_cast<size_t>(ahead) >= window) {
+        settling = false;
+        if (pending == 0) {
+            // nothing to keep, start over from this frame
+            gaps += static_cast<size_t>(ahead);
+            next = uniqueId;
+            ahead = 0;
+            break;
+        }
+        advance(released);
+        ahead = distance(next, uniqueId);
+    }
+
+    NTNDArrayPtr & held = slot(static_cast<size_t>(ahead));
+    if (held) {
+        ++duplicates;
+        return;
+    }
+    held = frame;
+    ++pending;
+    if (!settling)
+        release(released);
+}
+
+void NTNDArrayReorder::poll(vector<NTNDArrayPtr> & released)
+{
+    epicsTime now(epicsTime::getCurrent());
+
+    Guard G(mutex);
+    if (!blocked || now - blockedSince < timeout)
+        return;
+    settling = false;
+    while (!slots[head])
+        advance(released);
+    release(released);
+}
+
+void NTNDArrayReorder::flush(vector<NTNDArrayPtr> & released)
+{
+    Guard G(mutex);
+    while (pending > 0)
+        advance(released);
+    settling = false;
+    blocked = false;
+}
+
+void NTNDArrayReorder::reset()
+{
+    Guard G(mutex);
+    for (size_t i = 0; i < slots.size(); ++i)
+        slots[i].reset();
+    started = false;
+    settling = false;
+    next = 0;
+    head = 0;
+    pending = 0;
+    blocked = false;
+    gaps = duplicates = late = restarts = releasedCount = 0;
+}
+
+int32 NTNDArrayReorder::getNext() const
+{
+    Guard G(mutex);
+    return next;
+}
+
+size_t NTNDArrayReorder::getPending() const
+{
+    Guard G(mutex);
+    return pending;
+}
+
+size_t NTNDArrayReorder::getGaps() const
+{
+    Guard G(mutex);
+    return gaps;
+}
+
+size_t NTNDArrayReorder::getDuplicates() const
+{
+    Guard G(mutex);
+    return duplicates;
+}
+
+size_t NTNDArrayReorder::getLate() const
+{
+    Guard G(mutex);
+    return late;
+}
+
+size_t NTNDArrayReorder::getRestarts() const
+{
+    Guard G(mutex);
+    return restarts;
+}
+
+size_t NTNDArrayReorder::getReleased() const
+{
+    Guard G(mutex);
+    return releasedCount;
+}
+
+size_t NTNDArrayReorder::getWindow() const
+{
+    return window;
+}
+
+double NTNDArrayReorder::getTimeout() const
+{
+    return timeout;
+}
+
+}}
@@ -0,0 +1,602 @@
+/* ntndarrayShm.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <pv/serialize.h>
+
+#include "bufferControl.h"
+
+#define epicsExportSharedSymbols
+#include <pv/ntndarrayShm.h>
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+namespace {
+
+const char shmMagic[8] = { 'N', 'T', 'N', 'D', 'S', 'H', 'M', '2' };
+const size_t shmAlignment = 64;
+// the number of consumers that can have a ring open at once
+const size_t shmConsumers = 64;
+
+size_t alignUp(size_t size)
+{
+    return (size + shmAlignment - 1) & ~(shmAlignment - 1);
+}
+
+string shmName(string const & name)
+{
+    return (!name.empty() && name[0] == '/') ? name : "/" + name;
+}
+
+// Words of the segment are shared with other processes. epicsAtomic may
+// implement them with a lock local to the process, so they are accessed
+// with the atomic builtins of the compiler, which must not need a lock.
+typedef char atomicSizeIsLockFree[__atomic_always_lock_free(sizeof(size_t), 0) ? 1 : -1];
+typedef char atomicIntIsLockFree[__atomic_always_lock_free(sizeof(int), 0) ? 1 : -1];
+
+template<typename T>
+T atomicGet(T *word)
+{
+    return __atomic_load_n(word, __ATOMIC_ACQUIRE);
+}
+
+template<typename T>
+void atomicSet(T *word, T value)
+{
+    __atomic_store_n(word, value, __ATOMIC_RELEASE);
+}
+
+// returns the previous value
+template<typename T>
+T atomicCmpAndSwap(T *word, T expected, T value)
+{
+    __atomic_compare_exchange_n(word, &expected, value, false,
+        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    return expected;
+}
+
+template<typename T>
+void atomicAdd(T *word, T delta)
+{
+    __atomic_add_fetch(word, delta, __ATOMIC_ACQ_REL);
+}
+
+template<typename T>
+void atomicDecr(T *word)
+{
+    __atomic_sub_fetch(word, 1, __ATOMIC_ACQ_REL);
+}
+
+// whether a process is known to have terminated
+bool processDead(pid_t pid)
+{
+    return kill(pid, 0) != 0 && errno == ESRCH;
+}
+
+string errorText(string const & what, string const & name)
+{
+    return what + "(" + name + ") failed: " + strerror(errno);
+}
+
+template<typename T>
+void getArrayData(PVScalarArray *array, const char *&data, size_t &count)
+{
+    typename PVValueArray<T>::const_svector const & value =
+        static_cast<PVValueArray<T>*>(array)->view();
+    data = reinterpret_cast<const char*>(value.data());
+    count = value.size();
+}
+
+template<typename T, typename D>
+void putArrayData(PVScalarArray *array, char *data, size_t count, D const & deleter)
+{
+    typename PVValueArray<T>::svector value(reinterpret_cast<T*>(data), deleter, 0, count);
+    static_cast<PVValueArray<T>*>(array)->replace(freeze(value));
+}
+
+void arrayData(PVScalarArray *array, const char *&data, size_t &count)
+{
+    switch (array->getScalarArray()->getElementType()) {
+    case pvBoolean: getArrayData<boolean>(array, data, count); break;
+    case pvByte:    getArrayData<int8>(array, data, count); break;
+    case pvShort:   getArrayData<int16>(array, data, count); break;
+    case pvInt:     getArrayData<int32>(array, data, count); break;
+    case pvLong:    getArrayData<int64>(array, data, count); break;
+    case pvUByte:   getArrayData<uint8>(array, data, count); break;
+    case pvUShort:  getArrayData<uint16>(array, data, count); break;
+    case pvUInt:    getArrayData<uint32>(array, data, count); break;
+    case pvULong:   getArrayData<uint64>(array, data, count); break;
+    case pvFloat:   getArrayData<float>(array, data, count); break;
+    case pvDouble:  getArrayData<double>(array, data, count); break;
+    case pvString:
+        throw std::runtime_error("string value arrays cannot be published");
+    }
+}
+
+template<typename D>
+void setArrayData(PVScalarArray *array, char *data, size_t count, D const & deleter)
+{
+    switch (array->getScalarArray()->getElementType()) {
+    case pvBoolean: putArrayData<boolean>(array, data, count, deleter); break;
+    case pvByte:    putArrayData<int8>(array, data, count, deleter); break;
+    case pvShort:   putArrayData<int16>(array, data, count, deleter); break;
+    case pvInt:     putArrayData<int32>(array, data, count, deleter); break;
+    case pvLong:    putArrayData<int64>(array, data, count, deleter); break;
+    case pvUByte:   putArrayData<uint8>(array, data, count, deleter); break;
+    case pvUShort:  putArrayData<uint16>(array, data, count, deleter); break;
+    case pvUInt:    putArrayData<uint32>(array, data, count, deleter); break;
+    case pvULong:   putArrayData<uint64>(array, data, count, deleter); break;
+    case pvFloat:   putArrayData<float>(array, data, count, deleter); break;
+    case pvDouble:  putArrayData<double>(array, data, count, deleter); break;
+    case pvString:
+        throw std::runtime_error("string value arrays cannot be received");
+    }
+}
+
+}
+
+struct NTNDArrayShmRing::Header {
+    // set last by the producer, once the other fields are written
+    int ready;
+    char magic[8];
+    size_t slotCount;
+    size_t slotSize;
+    size_t metadataSize;
+    size_t published;
+    // 0: free, -1: being reclaimed, else the process id of a consumer
+    int consumers[shmConsumers];
+};
+
+struct NTNDArrayShmRing::Slot {
+    // 0: free, -1: being written by the producer,
+    // n > 0: published and referenced n-1 times besides the ring itself
+    int state;
+    size_t sequence;
+    size_t introspectionBytes;
+    size_t metadataBytes;
+    int32 selector;
+    size_t valueOffset;
+    size_t valueCount;
+};
+
+NTNDArrayShmRing::shared_pointer NTNDArrayShmRing::create(string const & name,
+        size_t slotCount, size_t slotSize, size_t metadataSize, bool replace)
+{
+    if (slotCount == 0 || slotSize == 0 || metadataSize == 0)
+        throw std::runtime_error("slot count and sizes must be non-zero");
+
+    string segment = shmName(name);
+    size_t size = alignUp(sizeof(Header)) + alignUp(slotCount*sizeof(Slot)) +
+        alignUp(shmConsumers*slotCount*sizeof(int)) +
+        slotCount*(alignUp(metadataSize) + alignUp(slotSize));
+
+    if (replace)
+        shm_unlink(segment.c_str());
+    int fd = shm_open(segment.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+    if (fd < 0)
+        throw std::runtime_error(errorText("shm_open", segment));
+
+    if (ftruncate(fd, size) != 0) {
+        string error = errorText("ftruncate", segment);
+        close(fd);
+        shm_unlink(segment.c_str());
+        throw std::runtime_error(error);
+    }
+
+    void *base = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        string error = errorText("mmap", segment);
+        shm_unlink(segment.c_str());
+        throw std::runtime_error(error);
+    }
+
+    // the segment is zero filled, so all slots are free
+    Header *header = static_cast<Header*>(base);
+    header->slotCount = slotCount;
+    header->slotSize = slotSize;
+    header->metadataSize = metadataSize;
+    header->published = 0;
+    memcpy(header->magic, shmMagic, sizeof(shmMagic));
+    atomicSet(&header->ready, 1);
+
+    return shared_pointer(new NTNDArrayShmRing(segment, true, base, size));
+}
+
+NTNDArrayShmRing::shared_pointer NTNDArrayShmRing::open(string const & name)
+{
+    string segment = shmName(name);
+    int fd = shm_open(segment.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        throw std::runtime_error(errorText("shm_open", segment));
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        string error = errorText("fstat", segment);
+        close(fd);
+        throw std::runtime_error(error);
+    }
+    size_t size = st.st_size;
+    if (size < sizeof(Header)) {
+        close(fd);
+        throw std::runtime_error(segment + " is not an NTNDArray ring");
+    }
+
+    void *base = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        throw std::runtime_error(errorText("mmap", segment));
+
+    // the other fields of the header are only read once it is ready
+    Header *header = static_cast<Header*>(base);
+    if (atomicGet(&header->ready) != 1 ||
+        memcmp(header->magic, shmMagic, sizeof(shmMagic)) != 0 ||
+        header->slotCount == 0 ||
+        size < alignUp(sizeof(Header)) + alignUp(header->slotCount*sizeof(Slot)) +
+               alignUp(shmConsumers*header->slotCount*sizeof(int)) +
+               header->slotCount*(alignUp(header->metadataSize) + alignUp(header->slotSize)))
+    {
+        munmap(base, size);
+        throw std::runtime_error(segment + " is not an NTNDArray ring");
+    }
+
+    shared_pointer ring(new NTNDArrayShmRing(segment, false, base, size));
+    if (ring->consumer == (size_t)-1)
+        throw std::runtime_error(segment + " has too many consumers");
+    return ring;
+}
+
+NTNDArrayShmRing::NTNDArrayShmRing(string const & name, bool producer,
+        void *base, size_t mappedSize) :
+    name(name),
+    producer(producer),
+    base(static_cast<char*>(base)),
+    mappedSize(mappedSize),
+    header(static_cast<Header*>(base)),
+    nextSlot(0),
+    readSequence(0),
+    missed(0),
+    consumer((size_t)-1)
+{
+    size_t slotCount = header->slotCount;
+    slots = reinterpret_cast<Slot*>(this->base + alignUp(sizeof(Header)));
+    holds = reinterpret_cast<int*>(this->base + alignUp(sizeof(Header)) +
+        alignUp(slotCount*sizeof(Slot)));
+    slotArea = reinterpret_cast<char*>(holds) + alignUp(shmConsumers*slotCount*sizeof(int));
+    slotStride = alignUp(header->metadataSize) + alignUp(header->slotSize);
+
+    // each consumer has an entry, so that the slots it holds can be
+    // reclaimed if it terminates without releasing them
+    if (!producer) {
+        consumer = registerConsumer();
+        if (consumer == (size_t)-1) {
+            reclaim();
+            consumer = registerConsumer();
+        }
+    }
+}
+
+NTNDArrayShmRing::~NTNDArrayShmRing()
+{
+    // the frames of a consumer hold the ring, so it holds no slot any more
+    if (consumer != (size_t)-1)
+        atomicSet(&header->consumers[consumer], 0);
+    munmap(base, mappedSize);
+    if (producer)
+        shm_unlink(name.c_str());
+}
+
+string NTNDArrayShmRing::getName() const
+{
+    return name;
+}
+
+size_t NTNDArrayShmRing::getSlotCount() const
+{
+    return header->slotCount;
+}
+
+size_t NTNDArrayShmRing::getSlotSize() const
+{
+    return header->slotSize;
+}
+
+size_t NTNDArrayShmRing::registerConsumer()
+{
+    int pid = getpid();
+    for (size_t n = 0; n < shmConsumers; ++n)
+        if (atomicCmpAndSwap(&header->consumers[n], 0, pid) == 0)
+            return n;
+    return (size_t)-1;
+}
+
+void NTNDArrayShmRing::reclaim()
+{
+    size_t slotCount = header->slotCount;
+    for (size_t n = 0; n < shmConsumers; ++n)
+    {
+        int pid = atomicGet(&header->consumers[n]);
+        if (pid <= 0 || !processDead(pid))
+            continue;
+        // only one process returns the references of a consumer
+        if (atomicCmpAndSwap(&header->consumers[n], pid, -1) != pid)
+            continue;
+        int *held = holds + n*slotCount;
+        for (size_t slot = 0; slot < slotCount; ++slot) {
+            int count = atomicGet(&held[slot]);
+            if (count > 0)
+                atomicAdd(&slots[slot].state, -count);
+            atomicSet(&held[slot], 0);
+        }
+        atomicSet(&header->consumers[n], 0);
+    }
+}
+
+size_t NTNDArrayShmRing::allocateSlot(size_t size)
+{
+    if (!producer)
+        throw std::runtime_error("only the producer can allocate frames");
+    if (size > header->slotSize)
+        throw std::runtime_error("frame exceeds the slot size");
+
+    // when all slots are referenced, those held by consumers that
+    // terminated are returned before giving up
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        if (attempt > 0)
+            reclaim();
+
+        for (size_t n = 0; n < header->slotCount; ++n)
+        {
+            size_t slot = nextSlot;
+            nextSlot = (nextSlot + 1) % header->slotCount;
+
+            // take slots that are free or only referenced by the ring itself
+            if (atomicCmpAndSwap(&slots[slot].state, 0, -1) == 0 ||
+                atomicCmpAndSwap(&slots[slot].state, 1, -1) == 1)
+            {
+                atomicSet<size_t>(&slots[slot].sequence, 0);
+                return slot;
+            }
+        }
+    }
+
+    return (size_t)-1;
+}
+
+void NTNDArrayShmRing::release(size_t slot)
+{
+    // an allocated slot that was never published becomes free again
+    if (atomicCmpAndSwap(&slots[slot].state, -1, 0) == -1)
+        return;
+    // the entry of the consumer is decremented first, so that a consumer
+    // that terminates in between leaves a reference rather than removes one
+    if (consumer != (size_t)-1)
+        atomicDecr(&holds[consumer*header->slotCount + slot]);
+    atomicDecr(&slots[slot].state);
+}
+
+char *NTNDArrayShmRing::slotMetadata(size_t slot) const
+{
+    return slotArea + slot*slotStride;
+}
+
+void *NTNDArrayShmRing::slotData(size_t slot) const
+{
+    return slotMetadata(slot) + alignUp(header->metadataSize);
+}
+
+size_t NTNDArrayShmRing::findSlot(const char *data, size_t size, size_t &offset) const
+{
+    if (data < slotArea || data >= slotArea + header->slotCount*slotStride)
+        return (size_t)-1;
+
+    size_t slot = (data - slotArea)/slotStride;
+    size_t position = (data - slotArea)%slotStride;
+    size_t dataStart = alignUp(header->metadataSize);
+    if (position < dataStart || position - dataStart + size > header->slotSize)
+        return (size_t)-1;
+
+    // only arrays that are still being written can be published in place
+    if (atomicGet(&slots[slot].state) != -1)
+        return (size_t)-1;
+
+    offset = position - dataStart;
+    return slot;
+}
+
+bool NTNDArrayShmRing::publish(NTNDArrayPtr const & ntndArray)
+{
+    if (!producer)
+        throw std::runtime_error("only the producer can publish frames");
+
+    PVStructurePtr pvStructure = ntndArray->getPVStructure();
+    PVUnionPtr value = ntndArray->getValue();
+
+    int32 selector = value->getSelectedIndex();
+    const char *data = 0;
+    size_t count = 0;
+    size_t bytes = 0;
+    if (selector != PVUnion::UNDEFINED_INDEX) {
+        PVScalarArrayPtr array = value->get<PVScalarArray>();
+        if (!array)
+            throw std::runtime_error("value must be a scalar array");
+        arrayData(array.get(), data, count);
+        bytes = count*ScalarTypeFunc::elementSize(array->getScalarArray()->getElementType());
+    }
+
+    size_t offset = 0;
+    size_t slot = findSlot(data, bytes, offset);
+    bool inPlace = (slot != (size_t)-1);
+    if (!inPlace) {
+        slot = allocateSlot(bytes);
+        if (slot == (size_t)-1)
+            return false;
+        if (bytes)
+            memcpy(slotData(slot), data, bytes);
+    }
+
+    Slot &s = slots[slot];
+    ByteBuffer buffer(slotMetadata(slot), header->metadataSize, EPICS_BYTE_ORDER);
+    detail::FixedSerializeControl control(&buffer);
+    try {
+        pvStructure->getStructure()->serialize(&buffer, &control);
+        s.introspectionBytes = buffer.getPosition();
+
+        PVFieldPtrArray const & pvFields = pvStructure->getPVFields();
+        for (PVFieldPtrArray::const_iterator it = pvFields.begin();
+             it != pvFields.end(); ++it)
+        {
+            if (it->get() != value.get())
+                (*it)->serialize(&buffer, &control);
+        }
+    } catch (std::length_error &) {
+        if (!inPlace)
+            release(slot);
+        throw std::runtime_error("frame metadata exceeds the metadata size of the ring");
+    }
+
+    s.metadataBytes = buffer.getPosition();
+    s.selector = selector;
+    s.valueOffset = offset;
+    s.valueCount = count;
+
+    size_t sequence = header->published + 1;
+    atomicSet(&s.sequence, sequence);
+    // the array allocated by the caller keeps referencing the slot
+    atomicSet(&s.state, inPlace ? 2 : 1);
+    atomicSet(&header->published, sequence);
+
+    return true;
+}
+
+size_t NTNDArrayShmRing::getLastSequence() const
+{
+    return atomicGet(&header->published);
+}
+
+NTNDArrayPtr NTNDArrayShmRing::get(size_t sequence)
+{
+    if (sequence == 0)
+        return NTNDArrayPtr();
+
+    for (size_t slot = 0; slot < header->slotCount; ++slot)
+    {
+        if (atomicGet(&slots[slot].sequence) != sequence)
+            continue;
+
+        // a published slot cannot be reused while it is referenced
+        int state = atomicGet(&slots[slot].state);
+        while (state > 0) {
+            int previous = atomicCmpAndSwap(&slots[slot].state, state, state + 1);
+            if (previous == state)
+                break;
+            state = previous;
+        }
+        if (state <= 0)
+            return NTNDArrayPtr();
+        if (consumer != (size_t)-1)
+            atomicAdd(&holds[consumer*header->slotCount + slot], 1);
+
+        if (atomicGet(&slots[slot].sequence) != sequence) {
+            release(slot);
+            return NTNDArrayPtr();
+        }
+
+        try {
+            return decodeSlot(slot);
+        } catch (...) {
+            release(slot);
+            throw;
+        }
+    }
+
+    return NTNDArrayPtr();
+}
+
+NTNDArrayPtr NTNDArrayShmRing::decodeSlot(size_t slot)
+{
+    Slot &s = slots[slot];
+    char *metadata = slotMetadata(slot);
+    ByteBuffer buffer(metadata, s.metadataBytes, EPICS_BYTE_ORDER);
+    detail::FixedDeserializeControl control(&buffer);
+
+    // frames of a stream share their introspection data
+    if (!structure || introspection.size() != s.introspectionBytes ||
+        memcmp(&introspection[0], metadata, s.introspectionBytes) != 0)
+    {
+        StructureConstPtr next = std::tr1::dynamic_pointer_cast<const Structure>(
+            getFieldCreate()->deserialize(&buffer, &control));
+        if (!NTNDArray::isCompatible(next))
+            throw std::runtime_error("frame is not an NTNDArray");
+        structure = next;
+        introspection.assign(metadata, metadata + s.introspectionBytes);
+    }
+    buffer.setPosition(s.introspectionBytes);
+
+    PVStructurePtr pvStructure = getPVDataCreate()->createPVStructure(structure);
+    NTNDArrayPtr ntndArray = NTNDArray::wrapUnsafe(pvStructure);
+    PVUnionPtr value = ntndArray->getValue();
+
+    PVFieldPtrArray const & pvFields = pvStructure->getPVFields();
+    for (PVFieldPtrArray::const_iterator it = pvFields.begin();
+         it != pvFields.end(); ++it)
+    {
+        if (it->get() != value.get())
+            (*it)->deserialize(&buffer, &control);
+    }
+
+    if (s.selector == PVUnion::UNDEFINED_INDEX) {
+        release(slot);
+    } else {
+        PVScalarArrayPtr array = value->select<PVScalarArray>(s.selector);
+        if (!array)
+            throw std::runtime_error("value must be a scalar array");
+        setArrayData(array.get(), static_cast<char*>(slotData(slot)) + s.valueOffset,
+            s.valueCount, SlotRelease(shared_from_this(), slot));
+    }
+
+    return ntndArray;
+}
+
+NTNDArrayPtr NTNDArrayShmRing::next()
+{
+    size_t last = getLastSequence();
+
+    // older frames have been replaced already
+    if (last > header->slotCount && readSequence < last - header->slotCount) {
+        missed += last - header->slotCount - readSequence;
+        readSequence = last - header->slotCount;
+    }
+
+    while (readSequence < last) {
+        NTNDArrayPtr ntndArray = get(++readSequence);
+        if (ntndArray)
+            return ntndArray;
+        ++missed;
+    }
+
+    return NTNDArrayPtr();
+}
+
+size_t NTNDArrayShmRing::getMissed() const
+{
+    return missed;
+}
+
+}}
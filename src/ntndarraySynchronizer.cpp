@@ -0,0 +1,259 @@
+/* ntndarraySynchronizer.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+#include <epicsGuard.h>
+
+#define epicsExportSharedSymbols
+#include <pv/ntndarraySynchronizer.h>
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+namespace {
+
+typedef epicsGuard<epicsMutex> Guard;
+
+const size_t npos = static_cast<size_t>(-1);
+
+// the dataTimeStamp of a frame in nanoseconds
+int64 frameTime(NTNDArrayPtr const & frame)
+{
+    PVStructurePtr timeStamp = frame->getDataTimeStamp();
+    return timeStamp->getSubField<PVLong>("secondsPastEpoch")->get()*1000000000LL +
+        timeStamp->getSubField<PVInt>("nanoseconds")->get();
+}
+
+inline int64 difference(int64 a, int64 b)
+{
+    return a < b ? b - a : a - b;
+}
+
+}
+
+NTNDArraySynchronizer::shared_pointer NTNDArraySynchronizer::create(size_t streamCount,
+    double tolerance, size_t depth)
+{
+    if (streamCount == 0 || depth == 0)
+        throw std::runtime_error("NTNDArray synchronizers need streams and a depth");
+    return shared_pointer(new NTNDArraySynchronizer(streamCount, tolerance, depth));
+}
+
+NTNDArraySynchronizer::NTNDArraySynchronizer(size_t streamCount, double tolerance, size_t depth) :
+    depth(depth), tolerance(tolerance),
+    toleranceNanoseconds(static_cast<int64>(floor(tolerance*1e9 + 0.5))),
+    streams(streamCount), matches(streamCount),
+    groups(0), dropped(0)
+{
+    for (size_t i = 0; i < streams.size(); ++i) {
+        streams[i].times.resize(depth);
+        streams[i].frames.resize(depth);
+        streams[i].first = 0;
+        streams[i].count = 0;
+    }
+}
+
+void NTNDArraySynchronizer::checkStream(size_t stream) const
+{
+    if (stream >= streams.size())
+        throw std::runtime_error("no such NTNDArray synchronizer stream");
+}
+
+// the held frame closest to a time within the tolerance, npos if there is none
+size_t NTNDArraySynchronizer::find(Stream const & stream, int64 time) const
+{
+    int64 earliest = time - toleranceNanoseconds;
+    size_t low = 0, high = stream.count;
+    while (low < high) {
+        size_t middle = (low + high)/2;
+        if (stream.times[(stream.first + middle) % depth] < earliest)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    size_t best = npos;
+    for (size_t i = low; i < stream.count; ++i) {
+        int64 held = stream.times[(stream.first + i) % depth];
+        if (held - time > toleranceNanoseconds)
+            break;
+        if (best == npos ||
+            difference(held, time) < difference(stream.times[(stream.first + best) % depth], time))
+            best = i;
+    }
+    return best;
+}
+
+// holds a frame in dataTimeStamp order, dropping the oldest if the ring is full
+void NTNDArraySynchronizer::insert(Stream & stream, int64 time, NTNDArrayPtr const & frame)
+{
+    if (stream.count == depth) {
+        drop(stream, 1);
+        ++dropped;
+    }
+
+    size_t position = stream.count;
+    while (position > 0) {
+        size_t before = (stream.first + position - 1) % depth;
+        if (stream.times[before] <= time)
+            break;
+        size_t at = (stream.first + position) % depth;
+        stream.times[at] = stream.times[before];
+        stream.frames[at].swap(stream.frames[before]);
+        --position;
+    }
+    size_t at = (stream.first + position) % depth;
+    stream.times[at] = time;
+    stream.frames[at] = frame;
+    ++stream.count;
+}
+
+void NTNDArraySynchronizer::drop(Stream & stream, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        stream.frames[stream.first].reset();
+        stream.first = (stream.first + 1) % depth;
+    }
+    stream.count -= count;
+}
+
+bool NTNDArraySynchronizer::push(size_t stream, NTNDArrayPtr const & frame,
+    vector<NTNDArrayPtr> & group)
+{
+    checkStream(stream);
+    int64 time = frameTime(frame);
+
+    Guard G(mutex);
+    for (size_t i = 0; i < streams.size(); ++i) {
+        if (i == stream)
+            continue;
+        matches[i] = find(streams[i], time);
+        if (matches[i] == npos) {
+            insert(streams[stream], time, frame);
+            return false;
+        }
+    }
+
+    group.resize(streams.size());
+    group[stream] = frame;
+    for (size_t i = 0; i < streams.size(); ++i) {
+        Stream & other = streams[i];
+        if (i == stream) {
+            // frames held before this one are passed over
+            size_t older = 0;
+            while (older < other.count && other.times[(other.first + older) % depth] < time)
+                ++older;
+            drop(other, older);
+            dropped += older;
+            continue;
+        }
+        group[i].swap(other.frames[(other.first + matches[i]) % depth]);
+        drop(other, matches[i] + 1);
+        dropped += matches[i];
+    }
+    ++groups;
+    return true;
+}
+
+void NTNDArraySynchronizer::reset()
+{
+    Guard G(mutex);
+    for (size_t i = 0; i < streams.size(); ++i)
+        drop(streams[i], streams[i].count);
+    groups = 0;
+    dropped = 0;
+}
+
+size_t NTNDArraySynchronizer::getPending(size_t stream) const
+{
+    checkStream(stream);
+    Guard G(mutex);
+    return streams[stream].count;
+}
+
+size_t NTNDArraySynchronizer::getGroups() const
+{
+    Guard G(mutex);
+    return groups;
+}
+
+size_t NTNDArraySynchronizer::getDropped() const
+{
+    Guard G(mutex);
+    return dropped;
+}
+
+size_t NTNDArraySynchronizer::getStreamCount() const
+{
+    return streams.size();
+}
+
+double NTNDArraySynchronizer::getTolerance() const
+{
+    return tolerance;
+}
+
+size_t NTNDArraySynchronizer::getDepth() const
+{
+    return depth;
+}
+
+NTMultiChannelPtr NTNDArraySynchronizer::createBundle(vector<NTNDArrayPtr> const & group,
+    vector<string> const & names)
+{
+    if (!names.empty() && names.size() != group.size())
+        throw std::runtime_error("NTNDArray bundles need a name per frame");
+
+    NTMultiChannelPtr bundle = NTMultiChannel::createBuilder()->
+        addTimeStamp()->
+        addSecondsPastEpoch()->
+        addNanoseconds()->
+        create();
+
+    size_t count = group.size();
+    PVUnionArray::svector values(count);
+    PVStringArray::svector channelNames(count);
+    PVLongArray::svector seconds(count);
+    PVIntArray::svector nanoseconds(count);
+    size_t earliest = 0;
+    for (size_t i = 0; i < count; ++i) {
+        values[i] = getPVDataCreate()->createPVVariantUnion();
+        values[i]->set(group[i]->getPVStructure());
+        if (names.empty()) {
+            ostringstream name;
+            name << i;
+            channelNames[i] = name.str();
+        } else {
+            channelNames[i] = names[i];
+        }
+        PVStructurePtr timeStamp = group[i]->getDataTimeStamp();
+        seconds[i] = timeStamp->getSubField<PVLong>("secondsPastEpoch")->get();
+        nanoseconds[i] = timeStamp->getSubField<PVInt>("nanoseconds")->get();
+        if (seconds[i] < seconds[earliest] ||
+            (seconds[i] == seconds[earliest] && nanoseconds[i] < nanoseconds[earliest]))
+            earliest = i;
+    }
+
+    if (count > 0) {
+        PVStructurePtr timeStamp = bundle->getTimeStamp();
+        timeStamp->getSubField<PVLong>("secondsPastEpoch")->put(seconds[earliest]);
+        timeStamp->getSubField<PVInt>("nanoseconds")->put(nanoseconds[earliest]);
+        timeStamp->getSubField<PVInt>("userTag")->put(
+            group[earliest]->getDataTimeStamp()->getSubField<PVInt>("userTag")->get());
+    }
+    bundle->getValue()->replace(freeze(values));
+    bundle->getChannelName()->replace(freeze(channelNames));
+    bundle->getSecondsPastEpoch()->replace(freeze(seconds));
+    bundle->getNanoseconds()->replace(freeze(nanoseconds));
+    return bundle;
+}
+
+}}
@@ -0,0 +1,274 @@
+/* ntndarrayTiler.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+#include <epicsAtomic.h>
+#include <epicsGuard.h>
+#include <epicsThread.h>
+
+#define epicsExportSharedSymbols
+#include <pv/ntndarrayTiler.h>
+
+#include "ndarrayValue.h"
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+using namespace detail;
+
+namespace {
+
+typedef epicsGuard<epicsMutex> Guard;
+
+}
+
+struct NTNDArrayTiler::Job
+{
+    Job(vector<NTNDArrayTile> const & tiles, NTNDArrayKernel & kernel) :
+        tiles(tiles), kernel(kernel), next(0), remaining(tiles.size()) {}
+
+    vector<NTNDArrayTile> const & tiles;
+    NTNDArrayKernel & kernel;
+    size_t next;
+    size_t remaining;
+    string error;
+};
+
+class NTNDArrayTiler::Worker : public epicsThreadRunable
+{
+public:
+    explicit Worker(NTNDArrayTiler *tiler) :
+        tiler(tiler),
+        thread(*this, "ntndarrayTiler",
+            epicsThreadGetStackSize(epicsThreadStackSmall), epicsThreadPriorityMedium)
+    {
+    }
+
+    virtual void run()
+    {
+        while (true)
+        {
+            wakeup.wait();
+            if (epicsAtomicGetIntT(&tiler->stopping))
+                break;
+
+            Job *job;
+            {
+                Guard G(tiler->mutex);
+                job = tiler->job;
+                if (!job)
+                    continue;
+                ++tiler->active;
+            }
+
+            tiler->runTiles(*job);
+
+            {
+                Guard G(tiler->mutex);
+                --tiler->active;
+            }
+            tiler->done.signal();
+        }
+    }
+
+    NTNDArrayTiler *tiler;
+    epicsEvent wakeup;
+    epicsThread thread;
+};
+
+NTNDArrayTiler::shared_pointer NTNDArrayTiler::create(size_t threadCount, size_t tileBytes)
+{
+    if (threadCount == 0)
+        threadCount = std::max(epicsThreadGetCPUs(), 1);
+    return shared_pointer(new NTNDArrayTiler(threadCount, std::max(tileBytes, (size_t)1)));
+}
+
+NTNDArrayTiler::NTNDArrayTiler(size_t threadCount, size_t tileBytes) :
+    tileBytes(tileBytes), pool(NTNDArrayBufferPool::create()),
+    job(0), runner(0), active(0), stopping(0)
+{
+    // the calling thread is one of them
+    for (size_t i = 1; i < threadCount; ++i)
+        workers.push_back(new Worker(this));
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i]->thread.start();
+}
+
+NTNDArrayTiler::~NTNDArrayTiler()
+{
+    epicsAtomicSetIntT(&stopping, 1);
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i]->wakeup.signal();
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i]->thread.exitWait();
+        delete workers[i];
+    }
+}
+
+size_t NTNDArrayTiler::getThreadCount() const
+{
+    return workers.size() + 1;
+}
+
+size_t NTNDArrayTiler::getTileBytes() const
+{
+    return tileBytes;
+}
+
+vector<NTNDArrayTile> NTNDArrayTiler::split(NTNDArrayPtr const & frame,
+    ScalarType outputType, char *output) const
+{
+    ScalarType type;
+    const char *data;
+    size_t count;
+    if (!valueData(frame, type, data, count))
+        throw std::runtime_error("NTNDArray has no numeric value");
+
+    vector<size_t> dims(frameDimensions(frame, count));
+    size_t width = dims[0];
+    size_t height = dims.size() > 1 ? dims[1] : 1;
+    vector<NTNDArrayTile> tiles;
+    if (width == 0 || height == 0)
+        return tiles;
+    size_t planes = count/(width*height);
+
+    size_t inputSize = ScalarTypeFunc::elementSize(type);
+    size_t outputSize = output ? ScalarTypeFunc::elementSize(outputType) : 0;
+    size_t elements = std::max(tileBytes/(inputSize + outputSize), (size_t)1);
+
+    // whole rows keep the accesses sequential, only rows that do not fit
+    // into a tile on their own are split
+    size_t tileWidth = std::min(width, elements);
+    size_t tileHeight = std::min(std::max(elements/tileWidth, (size_t)1), height);
+
+    NTNDArrayTile tile;
+    tile.inputType = type;
+    tile.inputStride = width*inputSize;
+    tile.outputType = outputType;
+    tile.outputStride = width*outputSize;
+    for (size_t plane = 0; plane < planes; ++plane)
+        for (size_t y = 0; y < height; y += tileHeight)
+            for (size_t x = 0; x < width; x += tileWidth) {
+                size_t offset = (plane*height + y)*width + x;
+                tile.x = x;
+                tile.y = y;
+                tile.plane = plane;
+                tile.width = std::min(tileWidth, width - x);
+                tile.height = std::min(tileHeight, height - y);
+                tile.input = data + offset*inputSize;
+                tile.output = output ? output + offset*outputSize : 0;
+                tiles.push_back(tile);
+            }
+    return tiles;
+}
+
+NTNDArrayPtr NTNDArrayTiler::transform(NTNDArrayPtr const & frame,
+    NTNDArrayKernel & kernel, ScalarType outputType, NTNDArrayBufferPoolPtr const & pool)
+{
+    ScalarType type;
+    const char *data;
+    size_t count;
+    if (!valueData(frame, type, data, count))
+        throw std::runtime_error("NTNDArray has no numeric value");
+
+    NTNDArrayPtr output = cloneFrame(frame);
+    char *out = allocateValue(output, pool ? pool : this->pool, outputType, count);
+    run(split(frame, outputType, out), kernel);
+    return output;
+}
+
+void NTNDArrayTiler::visit(NTNDArrayPtr const & frame, NTNDArrayKernel & kernel)
+{
+    run(split(frame, pvByte), kernel);
+}
+
+void NTNDArrayTiler::run(vector<NTNDArrayTile> const & tiles, NTNDArrayKernel & kernel)
+{
+    if (tiles.empty())
+        return;
+
+    Job current(tiles, kernel);
+    if (isNested()) {
+        runTiles(current);
+        if (!current.error.empty())
+            throw std::runtime_error(current.error);
+        return;
+    }
+
+    Guard R(runMutex);
+    {
+        Guard G(mutex);
+        job = &current;
+        runner = epicsThreadGetIdSelf();
+    }
+    size_t helpers = std::min(workers.size(), tiles.size() - 1);
+    for (size_t i = 0; i < helpers; ++i)
+        workers[i]->wakeup.signal();
+
+    runTiles(current);
+
+    // wait for the workers that joined to leave the job
+    {
+        Guard G(mutex);
+        job = 0;
+        runner = 0;
+    }
+    while (true) {
+        {
+            Guard G(mutex);
+            if (epicsAtomicGetSizeT(&current.remaining) == 0 && active == 0)
+                break;
+        }
+        done.wait();
+    }
+
+    if (!current.error.empty())
+        throw std::runtime_error(current.error);
+}
+
+// whether the calling thread is running a kernel of this tiler
+bool NTNDArrayTiler::isNested()
+{
+    epicsThreadId self = epicsThreadGetIdSelf();
+    for (size_t i = 0; i < workers.size(); ++i)
+        if (workers[i]->thread.getId() == self)
+            return true;
+    Guard G(mutex);
+    return runner == self;
+}
+
+void NTNDArrayTiler::runTiles(Job & job)
+{
+    size_t count = job.tiles.size();
+    while (true)
+    {
+        size_t index = epicsAtomicIncrSizeT(&job.next) - 1;
+        if (index >= count)
+            break;
+
+        try {
+            job.kernel.apply(job.tiles[index]);
+        } catch (std::exception & e) {
+            Guard G(mutex);
+            if (job.error.empty())
+                job.error = e.what();
+        } catch (...) {
+            Guard G(mutex);
+            if (job.error.empty())
+                job.error = "kernel threw an unknown exception";
+        }
+
+        if (epicsAtomicDecrSizeT(&job.remaining) == 0)
+            done.signal();
+    }
+}
+
+}}
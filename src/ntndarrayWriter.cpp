@@ -0,0 +1,471 @@
+/* ntndarrayWriter.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <epicsEndian.h>
+#include <epicsGuard.h>
+
+#define epicsExportSharedSymbols
+#include <pv/ntndarrayWriter.h>
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+namespace {
+
+typedef epicsGuard<epicsMutex> Guard;
+typedef epicsGuardRelease<epicsMutex> Unguard;
+
+// the alignment of buffers, file offsets and sizes required by O_DIRECT
+const size_t ioAlignment = 4096;
+// the space reserved for the .npy header, so that the data stays aligned
+const size_t npyHeaderSize = ioAlignment;
+const size_t noBuffer = (size_t)-1;
+
+size_t alignUp(size_t size)
+{
+    return (size + ioAlignment - 1) & ~(ioAlignment - 1);
+}
+
+string errorText(string const & what, string const & name)
+{
+    return what + "(" + name + ") failed: " + strerror(errno);
+}
+
+template<typename T>
+void getArrayData(PVScalarArray *array, const char *&data, size_t &count)
+{
+    typename PVValueArray<T>::const_svector const & value =
+        static_cast<PVValueArray<T>*>(array)->view();
+    data = reinterpret_cast<const char*>(value.data());
+    count = value.size();
+}
+
+void arrayData(PVScalarArray *array, const char *&data, size_t &count)
+{
+    switch (array->getScalarArray()->getElementType()) {
+    case pvBoolean: getArrayData<boolean>(array, data, count); break;
+    case pvByte:    getArrayData<int8>(array, data, count); break;
+    case pvShort:   getArrayData<int16>(array, data, count); break;
+    case pvInt:     getArrayData<int32>(array, data, count); break;
+    case pvLong:    getArrayData<int64>(array, data, count); break;
+    case pvUByte:   getArrayData<uint8>(array, data, count); break;
+    case pvUShort:  getArrayData<uint16>(array, data, count); break;
+    case pvUInt:    getArrayData<uint32>(array, data, count); break;
+    case pvULong:   getArrayData<uint64>(array, data, count); break;
+    case pvFloat:   getArrayData<float>(array, data, count); break;
+    case pvDouble:  getArrayData<double>(array, data, count); break;
+    case pvString:
+        throw std::runtime_error("string value arrays cannot be written");
+    }
+}
+
+bool writeAll(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+}
+
+NTNDArrayWriter::shared_pointer NTNDArrayWriter::create(
+    string const & fileName, Format format,
+    size_t bufferSize, size_t bufferCount, bool direct)
+{
+    if (bufferSize == 0 || bufferCount < 2)
+        throw std::runtime_error("buffer size must be non-zero and buffer count at least 2");
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    int fd = -1;
+#ifdef O_DIRECT
+    if (direct) {
+        fd = ::open(fileName.c_str(), flags | O_DIRECT, 0644);
+        // not all file systems support O_DIRECT
+        if (fd < 0 && errno == EINVAL)
+            direct = false;
+    }
+    if (!direct)
+        fd = ::open(fileName.c_str(), flags, 0644);
+#else
+    fd = ::open(fileName.c_str(), flags, 0644);
+#endif
+    if (fd < 0)
+        throw std::runtime_error(errorText("open", fileName));
+
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+    if (direct && fcntl(fd, F_NOCACHE, 1) != 0)
+        direct = false;
+#elif !defined(O_DIRECT)
+    direct = false;
+#endif
+
+    try {
+        return shared_pointer(new NTNDArrayWriter(fileName, format, fd,
+            direct, alignUp(bufferSize), bufferCount));
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+}
+
+NTNDArrayWriter::NTNDArrayWriter(string const & fileName, Format format,
+        int fd, bool direct, size_t bufferSize, size_t bufferCount) :
+    fileName(fileName), format(format), fd(fd), direct(direct),
+    bufferSize(bufferSize),
+    headerSize(format == npyFormat ? npyHeaderSize : 0),
+    current(noBuffer), fill(0),
+    type(pvUByte), frameBytes(0), frames(0), dropped(0), written(0),
+    stopping(false), closed(false),
+    thread(*this, "ntndarrayWriter",
+        epicsThreadGetStackSize(epicsThreadStackSmall), epicsThreadPriorityMedium)
+{
+    for (size_t i = 0; i < bufferCount; ++i) {
+        void *buffer = 0;
+        if (posix_memalign(&buffer, ioAlignment, bufferSize) != 0) {
+            for (size_t j = 0; j < buffers.size(); ++j)
+                free(buffers[j]);
+            throw std::bad_alloc();
+        }
+        buffers.push_back(static_cast<char*>(buffer));
+        freeBuffers.push_back(bufferCount - 1 - i);
+    }
+
+    // the header is completed on close, when the number of frames is known
+    if (headerSize) {
+        current = freeBuffers.back();
+        freeBuffers.pop_back();
+        string header(npyHeader());
+        memcpy(buffers[current], header.data(), header.size());
+        fill = headerSize;
+    }
+
+    thread.start();
+}
+
+NTNDArrayWriter::~NTNDArrayWriter()
+{
+    try {
+        close();
+    } catch (...) {
+    }
+}
+
+string NTNDArrayWriter::getFileName() const
+{
+    return fileName;
+}
+
+bool NTNDArrayWriter::isDirect() const
+{
+    return direct;
+}
+
+size_t NTNDArrayWriter::getFrameCount() const
+{
+    Guard G(mutex);
+    return frames;
+}
+
+size_t NTNDArrayWriter::getDropped() const
+{
+    Guard G(mutex);
+    return dropped;
+}
+
+uint64 NTNDArrayWriter::getBytesWritten() const
+{
+    Guard G(mutex);
+    return written > headerSize ? written - headerSize : 0;
+}
+
+bool NTNDArrayWriter::write(NTNDArrayPtr const & ntndArray, bool wait)
+{
+    bool first;
+    {
+        Guard G(mutex);
+        if (closed)
+            throw std::runtime_error("NTNDArray writer is closed");
+        first = frames == 0 && dropped == 0;
+    }
+    checkError();
+
+    PVScalarArrayPtr array = ntndArray->getValue()->get<PVScalarArray>();
+    if (!array)
+        throw std::runtime_error("NTNDArray has no numeric value");
+
+    const char *data = 0;
+    size_t count = 0;
+    arrayData(array.get(), data, count);
+    ScalarType elementType = array->getScalarArray()->getElementType();
+
+    // NumPy's C order has the fastest varying index last
+    vector<size_t> shape;
+    PVStructureArray::const_svector dimension(ntndArray->getDimension()->view());
+    size_t product = 1;
+    for (size_t i = dimension.size(); i-- > 0; ) {
+        PVIntPtr size = dimension[i] ? dimension[i]->getSubField<PVInt>("size") : PVIntPtr();
+        if (!size || size->get() < 0)
+            throw std::runtime_error("invalid NTNDArray dimension");
+        shape.push_back(size->get());
+        product *= size->get();
+    }
+    if (shape.empty())
+        shape.push_back(count);
+    else if (product != count)
+        throw std::runtime_error("NTNDArray value does not match its dimensions");
+
+    if (first)
+        setShape(elementType, shape);
+    else if (elementType != type || shape != frameShape)
+        throw std::runtime_error("NTNDArray differs from the first frame of the stream");
+
+    if (!wait) {
+        Guard G(mutex);
+        size_t available = freeBuffers.size()*bufferSize;
+        if (current != noBuffer)
+            available += bufferSize - fill;
+        if (available < frameBytes) {
+            ++dropped;
+            return false;
+        }
+    }
+
+    size_t remaining = frameBytes;
+    while (remaining > 0) {
+        if (current == noBuffer) {
+            Guard G(mutex);
+            while (freeBuffers.empty()) {
+                {
+                    Unguard U(G);
+                    done.wait();
+                }
+                if (!error.empty())
+                    throw std::runtime_error(error);
+            }
+            current = freeBuffers.back();
+            freeBuffers.pop_back();
+            fill = 0;
+        }
+
+        size_t n = std::min(remaining, bufferSize - fill);
+        memcpy(buffers[current] + fill, data, n);
+        data += n;
+        fill += n;
+        remaining -= n;
+
+        if (fill == bufferSize)
+            submit(false);
+    }
+
+    Guard G(mutex);
+    ++frames;
+    return true;
+}
+
+void NTNDArrayWriter::submit(bool last)
+{
+    Guard G(mutex);
+    size_t length = fill;
+    if (last && direct) {
+        // O_DIRECT writes whole blocks, the file is truncated on close
+        length = alignUp(fill);
+        memset(buffers[current] + fill, 0, length - fill);
+    }
+    fullBuffers.push_back(make_pair(current, length));
+    current = noBuffer;
+    fill = 0;
+    work.signal();
+}
+
+void NTNDArrayWriter::checkError()
+{
+    Guard G(mutex);
+    if (!error.empty())
+        throw std::runtime_error(error);
+}
+
+void NTNDArrayWriter::run()
+{
+    Guard G(mutex);
+    while (true) {
+        while (fullBuffers.empty() && !stopping) {
+            Unguard U(G);
+            work.wait();
+        }
+        if (fullBuffers.empty())
+            break;
+
+        pair<size_t, size_t> buffer(fullBuffers.front());
+        fullBuffers.pop_front();
+        bool failed = !error.empty();
+
+        if (!failed) {
+            Unguard U(G);
+            failed = !writeAll(fd, buffers[buffer.first], buffer.second);
+        }
+        if (failed && error.empty())
+            error = errorText("write", fileName);
+        else if (!failed)
+            written += buffer.second;
+
+        freeBuffers.push_back(buffer.first);
+        done.signal();
+    }
+}
+
+void NTNDArrayWriter::close()
+{
+    size_t size;
+    {
+        Guard G(mutex);
+        if (closed)
+            return;
+        closed = true;
+        size = headerSize + frames*frameBytes;
+    }
+    if (current != noBuffer && fill > 0)
+        submit(true);
+
+    {
+        Guard G(mutex);
+        stopping = true;
+        work.signal();
+    }
+    thread.exitWait();
+
+    if (error.empty() && written != size && ftruncate(fd, size) != 0)
+        error = errorText("ftruncate", fileName);
+    written = size;
+
+    if (error.empty() && format == npyFormat) {
+        // buffers[0] is free and suitably aligned for O_DIRECT
+        string header(npyHeader());
+        memset(buffers[0], ' ', headerSize);
+        memcpy(buffers[0], header.data(), header.size());
+        if (pwrite(fd, buffers[0], headerSize, 0) != (ssize_t)headerSize)
+            error = errorText("pwrite", fileName);
+    }
+
+    if (::close(fd) != 0 && error.empty())
+        error = errorText("close", fileName);
+    fd = -1;
+
+    for (size_t i = 0; i < buffers.size(); ++i)
+        free(buffers[i]);
+    buffers.clear();
+    freeBuffers.clear();
+
+    if (error.empty() && format == rawFormat)
+        writeSidecar();
+
+    if (!error.empty())
+        throw std::runtime_error(error);
+}
+
+void NTNDArrayWriter::setShape(ScalarType type, vector<size_t> const & shape)
+{
+    this->type = type;
+    frameShape = shape;
+    frameBytes = ScalarTypeFunc::elementSize(type);
+    for (size_t i = 0; i < shape.size(); ++i)
+        frameBytes *= shape[i];
+}
+
+string NTNDArrayWriter::descr() const
+{
+    size_t size = ScalarTypeFunc::elementSize(type);
+    ostringstream s;
+    if (size == 1)
+        s << '|';
+    else
+        s << (EPICS_BYTE_ORDER == EPICS_ENDIAN_LITTLE ? '<' : '>');
+
+    switch (type) {
+    case pvBoolean:
+        s << 'b';
+        break;
+    case pvByte: case pvShort: case pvInt: case pvLong:
+        s << 'i';
+        break;
+    case pvUByte: case pvUShort: case pvUInt: case pvULong:
+        s << 'u';
+        break;
+    default:
+        s << 'f';
+        break;
+    }
+    s << size;
+    return s.str();
+}
+
+string NTNDArrayWriter::shapeText() const
+{
+    ostringstream s;
+    s << frames;
+    for (size_t i = 0; i < frameShape.size(); ++i)
+        s << ", " << frameShape[i];
+    return s.str();
+}
+
+string NTNDArrayWriter::npyHeader() const
+{
+    string dict = "{'descr': '" + descr() + "', 'fortran_order': False, 'shape': (" +
+        shapeText() + (frameShape.empty() ? ",), }" : "), }");
+
+    // magic, version 1.0, little endian header length, padded dictionary
+    size_t length = headerSize - 10;
+    string header("\x93NUMPY\x01\x00", 8);
+    header += static_cast<char>(length & 0xff);
+    header += static_cast<char>(length >> 8);
+    header += dict;
+    header.append(headerSize - 1 - header.size(), ' ');
+    header += '\n';
+    return header;
+}
+
+void NTNDArrayWriter::writeSidecar()
+{
+    ostringstream s;
+    s << "{\n"
+      << "    \"descr\": \"" << descr() << "\",\n"
+      << "    \"fortran_order\": false,\n"
+      << "    \"shape\": [" << shapeText() << "]\n"
+      << "}\n";
+    string text(s.str());
+
+    string sidecar(fileName + ".json");
+    FILE *file = fopen(sidecar.c_str(), "w");
+    if (!file) {
+        error = errorText("fopen", sidecar);
+        return;
+    }
+    bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+    if (fclose(file) != 0 || !ok)
+        error = errorText("fwrite", sidecar);
+}
+
+}}
@@ -5,6 +5,7 @@
  */
 
 #include "validator.h"
+#include "structureCache.h"
 
 #define epicsExportSharedSymbols
 #include <pv/ntscalarArray.h>
@@ -15,8 +16,6 @@ using namespace epics::pvData;
 
 namespace epics { namespace nt {
 
-static NTFieldPtr ntField = NTField::get();
-
 namespace detail {
 
 NTScalarArrayBuilder::shared_pointer NTScalarArrayBuilder::value(
@@ -44,32 +43,9 @@ StructureConstPtr NTScalarArrayBuilder::createStructure()
     if (!valueTypeSet)
         throw std::runtime_error("value array element type not set");
 
-    FieldBuilderPtr builder =
-            getFieldCreate()->createFieldBuilder()->
-               setId(NTScalarArray::URI)->
-               addArray("value", valueType);
-
-    if (descriptor)
-        builder->add("descriptor", pvString);
-
-    if (alarm)
-        builder->add("alarm", ntField->createAlarm());
-
-    if (timeStamp)
-        builder->add("timeStamp", ntField->createTimeStamp());
-
-    if (display)
-        builder->add("display", ntField->createDisplay());
-
-    if (control)
-        builder->add("control", ntField->createControl());
-
-    size_t extraCount = extraFieldNames.size();
-    for (size_t i = 0; i< extraCount; i++)
-        builder->add(extraFieldNames[i], extraFields[i]);
-
-
-    StructureConstPtr s = builder->createStructure();
+    StructureConstPtr s = createValueStructure(NTScalarArray::URI, true, valueType,
+        descriptor, alarm, timeStamp, display, control,
+        extraFieldNames, extraFields);
 
     reset();
     return s;
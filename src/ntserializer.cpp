@@ -0,0 +1,681 @@
+/* ntserializer.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <pv/serializeHelper.h>
+
+#include "bufferControl.h"
+
+#define epicsExportSharedSymbols
+#include <pv/ntserializer.h>
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+namespace {
+
+// Runs of fixed size scalars are covered by a single ensureBuffer() call.
+// Keep them well below the size of any transport buffer.
+const size_t maxRunSize = 128;
+
+size_t sizeOfSize(size_t size)
+{
+    if (size == (size_t)-1)
+        return 1;
+    return size < 254 ? 1 : 5;
+}
+
+template<typename T>
+inline void putScalar(ByteBuffer *buffer, PVField *field)
+{
+    buffer->put(static_cast<PVScalarValue<T>*>(field)->get());
+}
+
+template<typename T>
+void putArray(ByteBuffer *buffer, SerializableControl *flusher, PVField *field)
+{
+    typename PVValueArray<T>::const_svector const & data =
+        static_cast<PVValueArray<T>*>(field)->view();
+    size_t count = data.size();
+    SerializeHelper::writeSize(count, buffer, flusher);
+
+    const T* cur = data.data();
+    if (!buffer->reverse<T>() &&
+        flusher->directSerialize(buffer, (const char*)cur, count, sizeof(T)))
+        return;
+
+    while (count) {
+        const size_t spaceFor = buffer->getRemaining()/sizeof(T);
+        if (spaceFor == 0) {
+            flusher->flushSerializeBuffer();
+            continue;
+        }
+        const size_t n = std::min(count, spaceFor);
+        buffer->putArray(cur, n);
+        cur += n;
+        count -= n;
+    }
+}
+
+void putScalarEntry(ByteBuffer *buffer, ScalarType type, PVField *field)
+{
+    switch (type) {
+    case pvBoolean: putScalar<boolean>(buffer, field); break;
+    case pvByte:    putScalar<int8>(buffer, field); break;
+    case pvShort:   putScalar<int16>(buffer, field); break;
+    case pvInt:     putScalar<int32>(buffer, field); break;
+    case pvLong:    putScalar<int64>(buffer, field); break;
+    case pvUByte:   putScalar<uint8>(buffer, field); break;
+    case pvUShort:  putScalar<uint16>(buffer, field); break;
+    case pvUInt:    putScalar<uint32>(buffer, field); break;
+    case pvULong:   putScalar<uint64>(buffer, field); break;
+    case pvFloat:   putScalar<float>(buffer, field); break;
+    case pvDouble:  putScalar<double>(buffer, field); break;
+    case pvString:  break;
+    }
+}
+
+void putArrayEntry(ByteBuffer *buffer, SerializableControl *flusher,
+        ScalarType type, PVField *field)
+{
+    switch (type) {
+    case pvBoolean: putArray<boolean>(buffer, flusher, field); break;
+    case pvByte:    putArray<int8>(buffer, flusher, field); break;
+    case pvShort:   putArray<int16>(buffer, flusher, field); break;
+    case pvInt:     putArray<int32>(buffer, flusher, field); break;
+    case pvLong:    putArray<int64>(buffer, flusher, field); break;
+    case pvUByte:   putArray<uint8>(buffer, flusher, field); break;
+    case pvUShort:  putArray<uint16>(buffer, flusher, field); break;
+    case pvUInt:    putArray<uint32>(buffer, flusher, field); break;
+    case pvULong:   putArray<uint64>(buffer, flusher, field); break;
+    case pvFloat:   putArray<float>(buffer, flusher, field); break;
+    case pvDouble:  putArray<double>(buffer, flusher, field); break;
+    case pvString:  break;
+    }
+}
+
+template<typename T>
+void getArray(ByteBuffer *buffer, DeserializableControl *control, PVField *field)
+{
+    PVValueArray<T> *pvArray = static_cast<PVValueArray<T>*>(field);
+    size_t count = SerializeHelper::readSize(buffer, control);
+
+    // Take the current storage over if nobody else refers to it and it is
+    // large enough. Otherwise leave it to its other owners, and avoid
+    // copying its old contents, by starting from a new vector.
+    typename PVValueArray<T>::const_svector current;
+    pvArray->swap(current);
+    typename PVValueArray<T>::svector next;
+    if (current.unique() && current.capacity() >= count) {
+        next = thaw(current);
+        next.resize(count);
+    } else {
+        current.clear();
+        next.resize(count);
+    }
+
+    T* cur = next.data();
+    if (buffer->reverse<T>() ||
+        !control->directDeserialize(buffer, (char*)cur, count, sizeof(T)))
+    {
+        while (count) {
+            const size_t availFor = buffer->getRemaining()/sizeof(T);
+            if (availFor == 0) {
+                control->ensureData(sizeof(T));
+                continue;
+            }
+            const size_t n = std::min(count, availFor);
+            buffer->getArray(cur, n);
+            cur += n;
+            count -= n;
+        }
+    }
+
+    pvArray->replace(freeze(next));
+}
+
+void getArrayEntry(ByteBuffer *buffer, DeserializableControl *control,
+        ScalarType type, PVField *field)
+{
+    switch (type) {
+    case pvBoolean: getArray<boolean>(buffer, control, field); break;
+    case pvByte:    getArray<int8>(buffer, control, field); break;
+    case pvShort:   getArray<int16>(buffer, control, field); break;
+    case pvInt:     getArray<int32>(buffer, control, field); break;
+    case pvLong:    getArray<int64>(buffer, control, field); break;
+    case pvUByte:   getArray<uint8>(buffer, control, field); break;
+    case pvUShort:  getArray<uint16>(buffer, control, field); break;
+    case pvUInt:    getArray<uint32>(buffer, control, field); break;
+    case pvULong:   getArray<uint64>(buffer, control, field); break;
+    case pvFloat:   getArray<float>(buffer, control, field); break;
+    case pvDouble:  getArray<double>(buffer, control, field); break;
+    case pvString:  break;
+    }
+}
+
+typedef void (*ArrayPut)(ByteBuffer *, SerializableControl *, PVField *);
+typedef void (*ArrayGet)(ByteBuffer *, DeserializableControl *, PVField *);
+
+ArrayPut arrayPut(ScalarType type)
+{
+    switch (type) {
+    case pvBoolean: return &putArray<boolean>;
+    case pvByte:    return &putArray<int8>;
+    case pvShort:   return &putArray<int16>;
+    case pvInt:     return &putArray<int32>;
+    case pvLong:    return &putArray<int64>;
+    case pvUByte:   return &putArray<uint8>;
+    case pvUShort:  return &putArray<uint16>;
+    case pvUInt:    return &putArray<uint32>;
+    case pvULong:   return &putArray<uint64>;
+    case pvFloat:   return &putArray<float>;
+    case pvDouble:  return &putArray<double>;
+    case pvString:  break;
+    }
+    return 0;
+}
+
+ArrayGet arrayGet(ScalarType type)
+{
+    switch (type) {
+    case pvBoolean: return &getArray<boolean>;
+    case pvByte:    return &getArray<int8>;
+    case pvShort:   return &getArray<int16>;
+    case pvInt:     return &getArray<int32>;
+    case pvLong:    return &getArray<int64>;
+    case pvUByte:   return &getArray<uint8>;
+    case pvUShort:  return &getArray<uint16>;
+    case pvUInt:    return &getArray<uint32>;
+    case pvULong:   return &getArray<uint64>;
+    case pvFloat:   return &getArray<float>;
+    case pvDouble:  return &getArray<double>;
+    case pvString:  break;
+    }
+    return 0;
+}
+
+void getStringArray(ByteBuffer *buffer, DeserializableControl *control, PVField *field)
+{
+    PVStringArray *pvArray = static_cast<PVStringArray*>(field);
+    size_t count = SerializeHelper::readSize(buffer, control);
+
+    PVStringArray::const_svector current;
+    pvArray->swap(current);
+    PVStringArray::svector next;
+    if (current.unique())
+        next = thaw(current);
+    else
+        current.clear();
+    next.resize(count);
+
+    for (size_t i = 0; i < count; ++i)
+        next[i] = SerializeHelper::deserializeString(buffer, control);
+
+    pvArray->replace(freeze(next));
+}
+
+// Returns the element type if field is a scalar array handled by
+// putArrayEntry() and getArrayEntry(), pvString otherwise.
+ScalarType arrayType(PVField const *field)
+{
+    FieldConstPtr const & introspection = field->getField();
+    if (introspection->getType() != scalarArray)
+        return pvString;
+
+    ScalarArrayConstPtr array =
+        std::tr1::static_pointer_cast<const ScalarArray>(introspection);
+    if (array->getArraySizeType() == Array::fixed)
+        return pvString;
+    return array->getElementType();
+}
+
+// Control counting the bytes a field serializes to, through a small
+// scratch buffer.
+class CountingControl : public SerializableControl
+{
+public:
+    CountingControl() : buffer(256), total(0) {}
+
+    size_t count(PVField const *field)
+    {
+        total = 0;
+        buffer.clear();
+        field->serialize(&buffer, this);
+        return total + buffer.getPosition();
+    }
+
+    virtual void flushSerializeBuffer()
+    {
+        total += buffer.getPosition();
+        buffer.clear();
+    }
+
+    virtual void ensureBuffer(size_t size)
+    {
+        if (buffer.getRemaining() < size)
+            flushSerializeBuffer();
+    }
+
+    virtual void alignBuffer(size_t alignment)
+    {
+        buffer.align(alignment);
+    }
+
+    virtual bool directSerialize(ByteBuffer *, const char *,
+            size_t elementCount, size_t elementSize)
+    {
+        total += elementCount*elementSize;
+        return true;
+    }
+
+    virtual void cachedSerialize(FieldConstPtr const & field, ByteBuffer *buffer)
+    {
+        field->serialize(buffer, this);
+    }
+
+private:
+    ByteBuffer buffer;
+    size_t total;
+};
+
+size_t valueSize(PVField const *field)
+{
+    ScalarType type = arrayType(field);
+    if (type == pvString) {
+        CountingControl control;
+        return control.count(field);
+    }
+
+    size_t count = static_cast<PVScalarArray const *>(field)->getLength();
+    return sizeOfSize(count) + count*ScalarTypeFunc::elementSize(type);
+}
+
+void putValue(ByteBuffer *buffer, SerializableControl *flusher, PVField *field)
+{
+    ScalarType type = arrayType(field);
+    if (type == pvString)
+        field->serialize(buffer, flusher);
+    else
+        putArrayEntry(buffer, flusher, type, field);
+}
+
+void getValue(ByteBuffer *buffer, DeserializableControl *control, PVField *field)
+{
+    ScalarType type = arrayType(field);
+    if (type == pvString)
+        field->deserialize(buffer, control);
+    else
+        getArrayEntry(buffer, control, type, field);
+}
+
+// Returns the field at a position of a structure if it has the name
+// and type, null otherwise.
+template<typename PVT>
+PVT *fieldAt(PVStructure const & pvStructure, size_t index, const char *name)
+{
+    PVFieldPtrArray const & pvFields = pvStructure.getPVFields();
+    if (index >= pvFields.size() || pvFields[index]->getFieldName() != name)
+        return 0;
+    return dynamic_cast<PVT*>(pvFields[index].get());
+}
+
+}
+
+bool NTSerializer::isSupported(StructureConstPtr const & structure)
+{
+    if (!structure.get()) return false;
+
+    FieldConstPtrArray const & fields = structure->getFields();
+    for (FieldConstPtrArray::const_iterator it = fields.begin();
+         it != fields.end(); ++it)
+    {
+        switch ((*it)->getType()) {
+        case scalar:
+            break;
+        case scalarArray:
+            if (std::tr1::static_pointer_cast<const ScalarArray>(*it)->
+                    getArraySizeType() == Array::fixed)
+                return false;
+            break;
+        case epics::pvData::structure:
+            if (!isSupported(std::tr1::static_pointer_cast<const Structure>(*it)))
+                return false;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+NTSerializer::shared_pointer NTSerializer::create(PVStructurePtr const & pvStructure)
+{
+    if (!pvStructure.get())
+        return shared_pointer();
+
+    return shared_pointer(new NTSerializer(pvStructure));
+}
+
+NTSerializer::NTSerializer(PVStructurePtr const & pvStructure) :
+    pvStructure(pvStructure),
+    isFixed(false)
+{
+    addFields(*pvStructure);
+    isFixed = addFixed();
+
+    for (size_t i = 0; i < entries.size(); )
+    {
+        if (entries[i].kind != Entry::scalarEntry) {
+            ++i;
+            continue;
+        }
+
+        size_t j = i;
+        size_t bytes = 0;
+        while (j < entries.size() && entries[j].kind == Entry::scalarEntry)
+        {
+            size_t size = ScalarTypeFunc::elementSize(entries[j].type);
+            if (bytes + size > maxRunSize)
+                break;
+            bytes += size;
+            ++j;
+        }
+        entries[i].run = bytes;
+        i = j;
+    }
+}
+
+void NTSerializer::addFields(PVStructure const & pvStructure)
+{
+    PVFieldPtrArray const & pvFields = pvStructure.getPVFields();
+    for (PVFieldPtrArray::const_iterator it = pvFields.begin();
+         it != pvFields.end(); ++it)
+    {
+        FieldConstPtr const & field = (*it)->getField();
+
+        Entry entry;
+        entry.field = it->get();
+        entry.run = 0;
+
+        switch (field->getType()) {
+        case scalar:
+            entry.type = std::tr1::static_pointer_cast<const Scalar>(field)->getScalarType();
+            entry.kind = (entry.type == pvString) ? Entry::stringEntry : Entry::scalarEntry;
+            entries.push_back(entry);
+            break;
+        case scalarArray:
+            entry.type = std::tr1::static_pointer_cast<const ScalarArray>(field)->getElementType();
+            if (std::tr1::static_pointer_cast<const ScalarArray>(field)->
+                    getArraySizeType() == Array::fixed)
+                entry.kind = Entry::fieldEntry;
+            else
+                entry.kind = (entry.type == pvString) ? Entry::stringArrayEntry : Entry::arrayEntry;
+            entries.push_back(entry);
+            break;
+        case epics::pvData::structure:
+            addFields(static_cast<PVStructure const &>(**it));
+            break;
+        case union_:
+            entry.kind = std::tr1::static_pointer_cast<const Union>(field)->isVariant() ?
+                Entry::fieldEntry : Entry::unionEntry;
+            entries.push_back(entry);
+            break;
+        default:
+            entry.kind = Entry::fieldEntry;
+            entries.push_back(entry);
+            break;
+        }
+    }
+}
+
+bool NTSerializer::addFixed()
+{
+    fixed = Fixed();
+    PVStructure const & top = *pvStructure;
+    size_t index = 0;
+
+    fixed.value = fieldAt<PVDouble>(top, index, "value");
+    fixed.array = fieldAt<PVScalarArray>(top, index, "value");
+    if (fixed.array) {
+        ScalarType type = arrayType(fixed.array);
+        if (type == pvString)
+            return false;
+        fixed.putArray = arrayPut(type);
+        fixed.getArray = arrayGet(type);
+    } else if (!fixed.value) {
+        return false;
+    }
+    ++index;
+
+    fixed.descriptor = fieldAt<PVString>(top, index, "descriptor");
+    if (fixed.descriptor)
+        ++index;
+
+    PVStructure *alarm = fieldAt<PVStructure>(top, index++, "alarm");
+    PVStructure *timeStamp = fieldAt<PVStructure>(top, index++, "timeStamp");
+    if (!alarm || !timeStamp || index != top.getPVFields().size() ||
+        alarm->getPVFields().size() != 3 || timeStamp->getPVFields().size() != 3)
+        return false;
+
+    fixed.severity = fieldAt<PVInt>(*alarm, 0, "severity");
+    fixed.status = fieldAt<PVInt>(*alarm, 1, "status");
+    fixed.message = fieldAt<PVString>(*alarm, 2, "message");
+    fixed.secondsPastEpoch = fieldAt<PVLong>(*timeStamp, 0, "secondsPastEpoch");
+    fixed.nanoseconds = fieldAt<PVInt>(*timeStamp, 1, "nanoseconds");
+    fixed.userTag = fieldAt<PVInt>(*timeStamp, 2, "userTag");
+    return fixed.severity && fixed.status && fixed.message &&
+        fixed.secondsPastEpoch && fixed.nanoseconds && fixed.userTag;
+}
+
+PVStructurePtr NTSerializer::getPVStructure() const
+{
+    return pvStructure;
+}
+
+size_t NTSerializer::getSerializedSize() const
+{
+    size_t size = 0;
+    for (vector<Entry>::const_iterator it = entries.begin();
+         it != entries.end(); ++it)
+    {
+        switch (it->kind) {
+        case Entry::scalarEntry:
+            size += ScalarTypeFunc::elementSize(it->type);
+            break;
+        case Entry::stringEntry:
+        {
+            size_t len = static_cast<PVString*>(it->field)->get().size();
+            size += sizeOfSize(len) + len;
+            break;
+        }
+        case Entry::arrayEntry:
+        {
+            size_t count = static_cast<PVScalarArray*>(it->field)->getLength();
+            size += sizeOfSize(count) + count*ScalarTypeFunc::elementSize(it->type);
+            break;
+        }
+        case Entry::stringArrayEntry:
+        {
+            PVStringArray::const_svector const & data =
+                static_cast<PVStringArray*>(it->field)->view();
+            size += sizeOfSize(data.size());
+            for (size_t i = 0; i < data.size(); ++i)
+                size += sizeOfSize(data[i].size()) + data[i].size();
+            break;
+        }
+        case Entry::unionEntry:
+        {
+            PVUnion const *pvUnion = static_cast<PVUnion*>(it->field);
+            size += sizeOfSize(pvUnion->getSelectedIndex());
+            if (pvUnion->getSelectedIndex() != PVUnion::UNDEFINED_INDEX)
+                size += valueSize(pvUnion->get().get());
+            break;
+        }
+        case Entry::fieldEntry:
+            size += valueSize(it->field);
+            break;
+        }
+    }
+    return size;
+}
+
+void NTSerializer::serialize(ByteBuffer *buffer, SerializableControl *flusher) const
+{
+    if (isFixed) {
+        serializeFixed(buffer, flusher);
+        return;
+    }
+
+    for (vector<Entry>::const_iterator it = entries.begin();
+         it != entries.end(); ++it)
+    {
+        switch (it->kind) {
+        case Entry::scalarEntry:
+            if (it->run)
+                flusher->ensureBuffer(it->run);
+            putScalarEntry(buffer, it->type, it->field);
+            break;
+        case Entry::stringEntry:
+            SerializeHelper::serializeString(
+                static_cast<PVString*>(it->field)->get(), buffer, flusher);
+            break;
+        case Entry::arrayEntry:
+            putArrayEntry(buffer, flusher, it->type, it->field);
+            break;
+        case Entry::stringArrayEntry:
+        {
+            PVStringArray::const_svector const & data =
+                static_cast<PVStringArray*>(it->field)->view();
+            SerializeHelper::writeSize(data.size(), buffer, flusher);
+            for (size_t i = 0; i < data.size(); ++i)
+                SerializeHelper::serializeString(data[i], buffer, flusher);
+            break;
+        }
+        case Entry::unionEntry:
+        {
+            PVUnion const *pvUnion = static_cast<PVUnion*>(it->field);
+            int32 selector = pvUnion->getSelectedIndex();
+            SerializeHelper::writeSize(selector, buffer, flusher);
+            if (selector != PVUnion::UNDEFINED_INDEX)
+                putValue(buffer, flusher, pvUnion->get().get());
+            break;
+        }
+        case Entry::fieldEntry:
+            it->field->serialize(buffer, flusher);
+            break;
+        }
+    }
+}
+
+void NTSerializer::serializeFixed(ByteBuffer *buffer, SerializableControl *flusher) const
+{
+    if (fixed.array) {
+        fixed.putArray(buffer, flusher, fixed.array);
+    } else {
+        flusher->ensureBuffer(sizeof(double));
+        buffer->put(fixed.value->get());
+    }
+    if (fixed.descriptor)
+        SerializeHelper::serializeString(fixed.descriptor->get(), buffer, flusher);
+
+    flusher->ensureBuffer(2*sizeof(int32));
+    buffer->put(fixed.severity->get());
+    buffer->put(fixed.status->get());
+    SerializeHelper::serializeString(fixed.message->get(), buffer, flusher);
+
+    flusher->ensureBuffer(sizeof(int64) + 2*sizeof(int32));
+    buffer->put(fixed.secondsPastEpoch->get());
+    buffer->put(fixed.nanoseconds->get());
+    buffer->put(fixed.userTag->get());
+}
+
+void NTSerializer::serialize(std::vector<epicsUInt8>& out, int byteOrder) const
+{
+    out.resize(getSerializedSize());
+    if (out.empty())
+        return;
+
+    ByteBuffer buffer(reinterpret_cast<char*>(&out[0]), out.size(), byteOrder);
+    detail::FixedSerializeControl control(&buffer);
+    serialize(&buffer, &control);
+}
+
+void NTSerializer::deserialize(ByteBuffer *buffer, DeserializableControl *flusher)
+{
+    if (isFixed) {
+        deserializeFixed(buffer, flusher);
+        return;
+    }
+
+    for (vector<Entry>::const_iterator it = entries.begin();
+         it != entries.end(); ++it)
+    {
+        switch (it->kind) {
+        case Entry::scalarEntry:
+            if (it->run)
+                flusher->ensureData(it->run);
+            // put() would post a change of every field, which
+            // PVStructure::deserialize() does not do either
+            it->field->deserialize(buffer, flusher);
+            break;
+        case Entry::stringEntry:
+            it->field->deserialize(buffer, flusher);
+            break;
+        case Entry::arrayEntry:
+            getArrayEntry(buffer, flusher, it->type, it->field);
+            break;
+        case Entry::stringArrayEntry:
+            getStringArray(buffer, flusher, it->field);
+            break;
+        case Entry::unionEntry:
+        {
+            PVUnion *pvUnion = static_cast<PVUnion*>(it->field);
+            size_t size = SerializeHelper::readSize(buffer, flusher);
+            int32 selector = (size == (size_t)-1) ?
+                PVUnion::UNDEFINED_INDEX : static_cast<int32>(size);
+
+            if (selector == PVUnion::UNDEFINED_INDEX) {
+                pvUnion->select(PVUnion::UNDEFINED_INDEX);
+            } else {
+                PVFieldPtr value = (selector == pvUnion->getSelectedIndex()) ?
+                    pvUnion->get() : pvUnion->select(selector);
+                getValue(buffer, flusher, value.get());
+            }
+            break;
+        }
+        case Entry::fieldEntry:
+            it->field->deserialize(buffer, flusher);
+            break;
+        }
+    }
+}
+
+void NTSerializer::deserializeFixed(ByteBuffer *buffer, DeserializableControl *flusher)
+{
+    // The scalars are read with qualified calls, which are not virtual,
+    // as put() would post a change of every field.
+    if (fixed.array)
+        fixed.getArray(buffer, flusher, fixed.array);
+    else
+        fixed.value->PVDouble::deserialize(buffer, flusher);
+    if (fixed.descriptor)
+        fixed.descriptor->PVString::deserialize(buffer, flusher);
+
+    fixed.severity->PVInt::deserialize(buffer, flusher);
+    fixed.status->PVInt::deserialize(buffer, flusher);
+    fixed.message->PVString::deserialize(buffer, flusher);
+
+    fixed.secondsPastEpoch->PVLong::deserialize(buffer, flusher);
+    fixed.nanoseconds->PVInt::deserialize(buffer, flusher);
+    fixed.userTag->PVInt::deserialize(buffer, flusher);
+}
+
+}}
@@ -0,0 +1,116 @@
+/* ntstructurePool.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <stdexcept>
+
+#include <epicsGuard.h>
+
+#define epicsExportSharedSymbols
+#include <pv/ntstructurePool.h>
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+namespace {
+
+typedef epicsGuard<epicsMutex> Guard;
+
+// whether the fields of a structure are referenced by their parents only
+bool unreferenced(PVStructure const & pvStructure)
+{
+    PVFieldPtrArray const & pvFields = pvStructure.getPVFields();
+    for (size_t i = 0; i < pvFields.size(); ++i) {
+        if (pvFields[i].use_count() != 1)
+            return false;
+        if (pvFields[i]->getField()->getType() == structure &&
+            !unreferenced(static_cast<PVStructure const &>(*pvFields[i])))
+            return false;
+    }
+    return true;
+}
+
+}
+
+NTStructurePool::shared_pointer NTStructurePool::create(
+    PVStructurePtr const & prototype, size_t maxFree)
+{
+    if (!prototype)
+        throw std::runtime_error("NTStructurePool needs a prototype");
+    return shared_pointer(new NTStructurePool(prototype, maxFree));
+}
+
+NTStructurePool::NTStructurePool(PVStructurePtr const & prototype, size_t maxFree) :
+    prototype(getPVDataCreate()->createPVStructure(prototype)),
+    maxFree(maxFree), allocated(0), reused(0)
+{
+}
+
+StructureConstPtr NTStructurePool::getStructure() const
+{
+    return prototype->getStructure();
+}
+
+PVStructurePtr NTStructurePool::acquire()
+{
+    {
+        Guard G(mutex);
+        if (!freeStructures.empty()) {
+            PVStructurePtr pvStructure;
+            pvStructure.swap(freeStructures.back());
+            freeStructures.pop_back();
+            ++reused;
+            return pvStructure;
+        }
+        ++allocated;
+    }
+    return getPVDataCreate()->createPVStructure(prototype);
+}
+
+void NTStructurePool::release(PVStructurePtr const & pvStructure)
+{
+    // a structure still referenced elsewhere must not be handed out again
+    if (pvStructure.use_count() != 1 || !unreferenced(*pvStructure))
+        return;
+
+    {
+        Guard G(mutex);
+        if (freeStructures.size() >= maxFree)
+            return;
+    }
+
+    try {
+        pvStructure->copyUnchecked(*prototype);
+    } catch (...) {
+        // fields made immutable cannot be reset
+        return;
+    }
+
+    Guard G(mutex);
+    if (freeStructures.size() < maxFree)
+        freeStructures.push_back(pvStructure);
+}
+
+size_t NTStructurePool::getAllocated() const
+{
+    Guard G(mutex);
+    return allocated;
+}
+
+size_t NTStructurePool::getReused() const
+{
+    Guard G(mutex);
+    return reused;
+}
+
+size_t NTStructurePool::getFree() const
+{
+    Guard G(mutex);
+    return freeStructures.size();
+}
+
+}}
@@ -0,0 +1,473 @@
+/* nttableArrow.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <epicsMath.h>
+
+#define epicsExportSharedSymbols
+#include <pv/nttableArrow.h>
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+namespace {
+
+const char labelKey[] = "epics:label";
+
+// Arrow data buffers must not be null, even for empty arrays.
+const int64_t emptyBuffer = 0;
+
+const char *arrowFormat(ScalarType type)
+{
+    switch (type) {
+    case pvBoolean: return "b";
+    case pvByte:    return "c";
+    case pvUByte:   return "C";
+    case pvShort:   return "s";
+    case pvUShort:  return "S";
+    case pvInt:     return "i";
+    case pvUInt:    return "I";
+    case pvLong:    return "l";
+    case pvULong:   return "L";
+    case pvFloat:   return "f";
+    case pvDouble:  return "g";
+    case pvString:  return "u";
+    }
+    return "";
+}
+
+bool scalarType(const char *format, ScalarType &type)
+{
+    static const ScalarType types[] = {
+        pvBoolean, pvByte, pvUByte, pvShort, pvUShort, pvInt,
+        pvUInt, pvLong, pvULong, pvFloat, pvDouble, pvString
+    };
+
+    if (!format)
+        return false;
+    if (strcmp(format, "U") == 0) {
+        type = pvString;
+        return true;
+    }
+    for (size_t i = 0; i < sizeof(types)/sizeof(types[0]); ++i) {
+        if (strcmp(format, arrowFormat(types[i])) == 0) {
+            type = types[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+string labelMetadata(string const & label)
+{
+    int32_t counts[] = { 1, static_cast<int32_t>(sizeof(labelKey) - 1) };
+    int32_t valueSize = static_cast<int32_t>(label.size());
+
+    string metadata(reinterpret_cast<const char*>(counts), sizeof(counts));
+    metadata.append(labelKey, sizeof(labelKey) - 1);
+    metadata.append(reinterpret_cast<const char*>(&valueSize), sizeof(valueSize));
+    metadata.append(label);
+    return metadata;
+}
+
+bool findLabel(const char *metadata, string &label)
+{
+    if (!metadata)
+        return false;
+
+    int32_t count;
+    memcpy(&count, metadata, sizeof(count));
+    metadata += sizeof(count);
+    for (int32_t i = 0; i < count; ++i) {
+        int32_t keySize, valueSize;
+        memcpy(&keySize, metadata, sizeof(keySize));
+        metadata += sizeof(keySize);
+        string key(metadata, keySize);
+        metadata += keySize;
+        memcpy(&valueSize, metadata, sizeof(valueSize));
+        metadata += sizeof(valueSize);
+        if (key == labelKey) {
+            label.assign(metadata, valueSize);
+            return true;
+        }
+        metadata += valueSize;
+    }
+    return false;
+}
+
+// private_data of exported schemas
+struct ExportedSchema {
+    string format;
+    string name;
+    string metadata;
+    vector<ArrowSchema*> children;
+};
+
+void releaseSchema(ArrowSchema *schema)
+{
+    ExportedSchema *data = static_cast<ExportedSchema*>(schema->private_data);
+    for (size_t i = 0; i < data->children.size(); ++i) {
+        ArrowSchema *child = data->children[i];
+        if (child->release)
+            child->release(child);
+        delete child;
+    }
+    delete data;
+    schema->release = 0;
+}
+
+void initSchema(ArrowSchema *schema, ExportedSchema *data)
+{
+    schema->format = data->format.c_str();
+    schema->name = data->name.c_str();
+    schema->metadata = data->metadata.empty() ? 0 : data->metadata.c_str();
+    schema->flags = 0;
+    schema->n_children = static_cast<int64_t>(data->children.size());
+    schema->children = data->children.empty() ? 0 : &data->children[0];
+    schema->dictionary = 0;
+    schema->release = &releaseSchema;
+    schema->private_data = data;
+}
+
+// keeps the storage of an exported column alive
+struct Holder {
+    virtual ~Holder() {}
+};
+
+template<typename T>
+struct VectorHolder : public Holder {
+    VectorHolder(shared_vector<const T> const & value) : value(value) {}
+    shared_vector<const T> value;
+};
+
+// private_data of exported arrays
+struct ExportedArray {
+    ExportedArray() : holder(0) {}
+    ~ExportedArray() { delete holder; }
+
+    Holder *holder;
+    vector<epicsUInt8> bits;
+    vector<int32_t> offsets;
+    vector<int64_t> largeOffsets;
+    string chars;
+    vector<const void*> buffers;
+    vector<ArrowArray*> children;
+
+private:
+    ExportedArray(ExportedArray const &);
+    ExportedArray & operator=(ExportedArray const &);
+};
+
+void releaseArray(ArrowArray *array)
+{
+    ExportedArray *data = static_cast<ExportedArray*>(array->private_data);
+    for (size_t i = 0; i < data->children.size(); ++i) {
+        ArrowArray *child = data->children[i];
+        if (child->release)
+            child->release(child);
+        delete child;
+    }
+    delete data;
+    array->release = 0;
+}
+
+void initArray(ArrowArray *array, ExportedArray *data, int64_t length)
+{
+    array->length = length;
+    array->null_count = 0;
+    array->offset = 0;
+    array->n_buffers = static_cast<int64_t>(data->buffers.size());
+    array->n_children = static_cast<int64_t>(data->children.size());
+    array->buffers = &data->buffers[0];
+    array->children = data->children.empty() ? 0 : &data->children[0];
+    array->dictionary = 0;
+    array->release = &releaseArray;
+    array->private_data = data;
+}
+
+template<typename T>
+void exportNumeric(PVScalarArray *column, ExportedArray *data)
+{
+    shared_vector<const T> value(static_cast<PVValueArray<T>*>(column)->view());
+    data->holder = new VectorHolder<T>(value);
+    data->buffers.push_back(0);
+    data->buffers.push_back(value.empty() ? static_cast<const void*>(&emptyBuffer) : value.data());
+}
+
+void exportBoolean(PVScalarArray *column, ExportedArray *data)
+{
+    PVBooleanArray::const_svector const & value =
+        static_cast<PVBooleanArray*>(column)->view();
+
+    data->bits.assign((value.size() + 7)/8 + 1, 0);
+    for (size_t i = 0; i < value.size(); ++i)
+        if (value[i])
+            data->bits[i/8] |= static_cast<epicsUInt8>(1u << (i%8));
+    data->buffers.push_back(0);
+    data->buffers.push_back(&data->bits[0]);
+}
+
+// returns the format, large utf8 if the characters exceed 32 bit offsets
+const char *exportString(PVScalarArray *column, ExportedArray *data)
+{
+    PVStringArray::const_svector const & value =
+        static_cast<PVStringArray*>(column)->view();
+
+    size_t total = 0;
+    for (size_t i = 0; i < value.size(); ++i)
+        total += value[i].size();
+    data->chars.reserve(total);
+
+    bool large = total > static_cast<size_t>(numeric_limits<int32_t>::max());
+    if (large)
+        data->largeOffsets.reserve(value.size() + 1);
+    else
+        data->offsets.reserve(value.size() + 1);
+
+    for (size_t i = 0; i <= value.size(); ++i) {
+        if (large)
+            data->largeOffsets.push_back(static_cast<int64_t>(data->chars.size()));
+        else
+            data->offsets.push_back(static_cast<int32_t>(data->chars.size()));
+        if (i < value.size())
+            data->chars.append(value[i]);
+    }
+
+    data->buffers.push_back(0);
+    if (large)
+        data->buffers.push_back(&data->largeOffsets[0]);
+    else
+        data->buffers.push_back(&data->offsets[0]);
+    data->buffers.push_back(data->chars.empty() ? &emptyBuffer :
+        static_cast<const void*>(data->chars.data()));
+    return large ? "U" : "u";
+}
+
+const char *exportColumn(PVScalarArray *column, ExportedArray *data)
+{
+    ScalarType type = column->getScalarArray()->getElementType();
+    switch (type) {
+    case pvBoolean: exportBoolean(column, data); break;
+    case pvByte:    exportNumeric<int8>(column, data); break;
+    case pvUByte:   exportNumeric<uint8>(column, data); break;
+    case pvShort:   exportNumeric<int16>(column, data); break;
+    case pvUShort:  exportNumeric<uint16>(column, data); break;
+    case pvInt:     exportNumeric<int32>(column, data); break;
+    case pvUInt:    exportNumeric<uint32>(column, data); break;
+    case pvLong:    exportNumeric<int64>(column, data); break;
+    case pvULong:   exportNumeric<uint64>(column, data); break;
+    case pvFloat:   exportNumeric<float>(column, data); break;
+    case pvDouble:  exportNumeric<double>(column, data); break;
+    case pvString:  return exportString(column, data);
+    }
+    return arrowFormat(type);
+}
+
+// Owns an imported struct array, released with the last column using it.
+struct ImportedArray {
+    void operator()(ArrowArray *array)
+    {
+        if (array->release)
+            array->release(array);
+        delete array;
+    }
+};
+
+// Deleter of imported columns referring to the Arrow buffers.
+struct ImportedBuffer {
+    ImportedBuffer(std::tr1::shared_ptr<ArrowArray> const & owner) : owner(owner) {}
+
+    template<typename T>
+    void operator()(T *) {}
+
+    std::tr1::shared_ptr<ArrowArray> owner;
+};
+
+bool isValid(ArrowArray const *array, int64_t index)
+{
+    const epicsUInt8 *validity = static_cast<const epicsUInt8*>(array->buffers[0]);
+    if (array->null_count == 0 || !validity)
+        return true;
+    return (validity[index/8] >> (index%8)) & 1;
+}
+
+template<typename T>
+T nullValue()
+{
+    return numeric_limits<T>::has_quiet_NaN ? static_cast<T>(epicsNAN) : T();
+}
+
+template<typename T>
+void importNumeric(PVScalarArray *column, ArrowArray const *array, int64_t offset,
+        int64_t length, std::tr1::shared_ptr<ArrowArray> const & owner)
+{
+    const T *values = static_cast<const T*>(array->buffers[1]);
+    bool aligned = (reinterpret_cast<uintptr_t>(values + offset) % sizeof(T)) == 0;
+
+    typename PVValueArray<T>::svector value;
+    if (aligned && (array->null_count == 0 || !array->buffers[0])) {
+        value = typename PVValueArray<T>::svector(const_cast<T*>(values + offset),
+            ImportedBuffer(owner), 0, length);
+    } else {
+        value.resize(length);
+        for (int64_t i = 0; i < length; ++i) {
+            if (isValid(array, offset + i))
+                memcpy(&value[i], values + offset + i, sizeof(T));
+            else
+                value[i] = nullValue<T>();
+        }
+    }
+    static_cast<PVValueArray<T>*>(column)->replace(freeze(value));
+}
+
+void importBoolean(PVScalarArray *column, ArrowArray const *array, int64_t offset,
+        int64_t length)
+{
+    const epicsUInt8 *bits = static_cast<const epicsUInt8*>(array->buffers[1]);
+
+    PVBooleanArray::svector value(length);
+    for (int64_t i = 0; i < length; ++i) {
+        int64_t bit = offset + i;
+        value[i] = isValid(array, bit) && ((bits[bit/8] >> (bit%8)) & 1);
+    }
+    static_cast<PVBooleanArray*>(column)->replace(freeze(value));
+}
+
+template<typename O>
+void importString(PVScalarArray *column, ArrowArray const *array, int64_t offset,
+        int64_t length)
+{
+    const O *offsets = static_cast<const O*>(array->buffers[1]);
+    const char *chars = static_cast<const char*>(array->buffers[2]);
+
+    PVStringArray::svector value(length);
+    for (int64_t i = 0; i < length; ++i) {
+        if (isValid(array, offset + i))
+            value[i].assign(chars + offsets[offset + i],
+                offsets[offset + i + 1] - offsets[offset + i]);
+    }
+    static_cast<PVStringArray*>(column)->replace(freeze(value));
+}
+
+void importColumn(PVScalarArray *column, ArrowArray const *array, const char *format,
+        int64_t offset, int64_t length, std::tr1::shared_ptr<ArrowArray> const & owner)
+{
+    switch (column->getScalarArray()->getElementType()) {
+    case pvBoolean: importBoolean(column, array, offset, length); break;
+    case pvByte:    importNumeric<int8>(column, array, offset, length, owner); break;
+    case pvUByte:   importNumeric<uint8>(column, array, offset, length, owner); break;
+    case pvShort:   importNumeric<int16>(column, array, offset, length, owner); break;
+    case pvUShort:  importNumeric<uint16>(column, array, offset, length, owner); break;
+    case pvInt:     importNumeric<int32>(column, array, offset, length, owner); break;
+    case pvUInt:    importNumeric<uint32>(column, array, offset, length, owner); break;
+    case pvLong:    importNumeric<int64>(column, array, offset, length, owner); break;
+    case pvULong:   importNumeric<uint64>(column, array, offset, length, owner); break;
+    case pvFloat:   importNumeric<float>(column, array, offset, length, owner); break;
+    case pvDouble:  importNumeric<double>(column, array, offset, length, owner); break;
+    case pvString:
+        if (strcmp(format, "U") == 0)
+            importString<int64_t>(column, array, offset, length);
+        else
+            importString<int32_t>(column, array, offset, length);
+        break;
+    }
+}
+
+}
+
+void NTTableArrow::exportTable(NTTablePtr const & table,
+        ArrowArray *array, ArrowSchema *schema)
+{
+    StringArray const & names = table->getColumnNames();
+    PVStringArray::const_svector labels(table->getLabels()->view());
+
+    vector<PVScalarArrayPtr> columns;
+    for (size_t i = 0; i < names.size(); ++i) {
+        PVScalarArrayPtr column = table->getColumn<PVScalarArray>(names[i]);
+        if (!column)
+            throw std::runtime_error("column " + names[i] + " is not a scalar array");
+        if (!columns.empty() && column->getLength() != columns[0]->getLength())
+            throw std::runtime_error("columns differ in length");
+        columns.push_back(column);
+    }
+    int64_t length = columns.empty() ? 0 : static_cast<int64_t>(columns[0]->getLength());
+
+    ExportedSchema *schemaData = new ExportedSchema();
+    schemaData->format = "+s";
+    ExportedArray *arrayData = new ExportedArray();
+    arrayData->buffers.push_back(0);
+
+    for (size_t i = 0; i < columns.size(); ++i) {
+        ExportedArray *columnData = new ExportedArray();
+        ExportedSchema *columnSchema = new ExportedSchema();
+        columnSchema->format = exportColumn(columns[i].get(), columnData);
+        columnSchema->name = names[i];
+        if (i < labels.size())
+            columnSchema->metadata = labelMetadata(labels[i]);
+
+        ArrowArray *childArray = new ArrowArray();
+        initArray(childArray, columnData, length);
+        arrayData->children.push_back(childArray);
+
+        ArrowSchema *childSchema = new ArrowSchema();
+        initSchema(childSchema, columnSchema);
+        schemaData->children.push_back(childSchema);
+    }
+
+    initSchema(schema, schemaData);
+    initArray(array, arrayData, length);
+}
+
+NTTablePtr NTTableArrow::importTable(ArrowArray *array, ArrowSchema const *schema)
+{
+    if (!array || !array->release)
+        throw std::runtime_error("Arrow array is null or released");
+    if (!schema || !schema->format || strcmp(schema->format, "+s") != 0)
+        throw std::runtime_error("Arrow schema is not a struct");
+    if (schema->n_children != array->n_children)
+        throw std::runtime_error("Arrow schema does not match the array");
+
+    NTTableBuilderPtr builder = NTTable::createBuilder();
+    vector<string> names;
+    PVStringArray::svector labels;
+    for (int64_t i = 0; i < schema->n_children; ++i) {
+        ArrowSchema const *child = schema->children[i];
+        ScalarType type;
+        if (!scalarType(child->format, type) || child->dictionary)
+            throw std::runtime_error(string("unsupported Arrow format ") +
+                (child->format ? child->format : "(null)"));
+
+        names.push_back(child->name ? child->name : "");
+        builder->addColumn(names.back(), type);
+
+        string label;
+        labels.push_back(findLabel(child->metadata, label) ? label : names.back());
+    }
+
+    NTTablePtr table = builder->create();
+    table->getLabels()->replace(freeze(labels));
+
+    // move the array, as the interface specifies for consumers
+    std::tr1::shared_ptr<ArrowArray> owner(new ArrowArray(*array), ImportedArray());
+    array->release = 0;
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        ArrowArray const *child = owner->children[i];
+        importColumn(table->getColumn<PVScalarArray>(names[i]).get(), child,
+            schema->children[i]->format, owner->offset + child->offset,
+            owner->length, owner);
+    }
+
+    return table;
+}
+
+}}
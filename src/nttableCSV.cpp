@@ -0,0 +1,1240 @@
+/* nttableCSV.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cfloat>
+#include <clocale>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <epicsThread.h>
+
+#define epicsExportSharedSymbols
+#include <pv/nttableCSV.h>
+
+#include "parallelParts.h"
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+using namespace detail;
+
+namespace {
+
+// chunks smaller than this are not worth a thread
+const size_t minimumChunkSize = 64*1024;
+
+// output is written to the stream in pieces of about this size
+const size_t outputBufferSize = 1024*1024;
+
+// the powers of ten that are exact in a double
+const double exactPowers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline bool isDigit(char c)
+{
+    return static_cast<unsigned>(c - '0') < 10;
+}
+
+void trim(const char *& begin, const char *& end)
+{
+    while (begin != end && (*begin == ' ' || *begin == '\t'))
+        ++begin;
+    while (end != begin && (end[-1] == ' ' || end[-1] == '\t'))
+        --end;
+}
+
+// the decimal point of the C library's locale, which strtod uses; it is
+// looked up once for a whole table rather than for every number
+char decimalPoint()
+{
+    const char *point = localeconv()->decimal_point;
+    return point && point[0] && !point[1] ? point[0] : '.';
+}
+
+bool parseDoubleSlow(const char *begin, const char *end, double & value, char point)
+{
+    string text(begin, end);
+    if (point != '.') {
+        if (text.find(point) != string::npos)
+            return false;
+        std::replace(text.begin(), text.end(), '.', point);
+    }
+    char *stop;
+    value = strtod(text.c_str(), &stop);
+    return !text.empty() && stop == text.c_str() + text.size();
+}
+
+/*
+ * Clinger's fast path: a mantissa of at most 53 bits scaled by an exact
+ * power of ten is correctly rounded by a single multiplication or
+ * division. Everything else, including nan and inf, goes to strtod.
+ */
+bool parseDouble(const char *begin, const char *end, double & value, char point)
+{
+    const char *p = begin;
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    uint64 mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    for (; p != end && isDigit(*p); ++p) {
+        if (digits == 19)
+            return parseDoubleSlow(begin, end, value, point);
+        mantissa = mantissa*10 + (*p - '0');
+        if (mantissa)
+            ++digits;
+        any = true;
+    }
+    if (p != end && *p == '.') {
+        for (++p; p != end && isDigit(*p); ++p) {
+            if (digits == 19)
+                return parseDoubleSlow(begin, end, value, point);
+            mantissa = mantissa*10 + (*p - '0');
+            if (mantissa)
+                ++digits;
+            --exponent;
+            any = true;
+        }
+    }
+    if (!any)
+        return parseDoubleSlow(begin, end, value, point);
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negativeExponent = false;
+        if (p != end && (*p == '-' || *p == '+'))
+            negativeExponent = *p++ == '-';
+        if (p == end || !isDigit(*p))
+            return false;
+        int e = 0;
+        for (; p != end && isDigit(*p); ++p)
+            if (e < 10000)
+                e = e*10 + (*p - '0');
+        exponent += negativeExponent ? -e : e;
+    }
+    if (p != end)
+        return parseDoubleSlow(begin, end, value, point);
+
+    if (mantissa == 0) {
+        value = negative ? -0.0 : 0.0;
+        return true;
+    }
+    if (mantissa > (static_cast<uint64>(1) << 53) || exponent < -22 || exponent > 22)
+        return parseDoubleSlow(begin, end, value, point);
+    value = static_cast<double>(mantissa);
+    if (exponent < 0)
+        value /= exactPowers[-exponent];
+    else
+        value *= exactPowers[exponent];
+    if (negative)
+        value = -value;
+    return true;
+}
+
+bool parseUnsigned(const char *p, const char *end, uint64 & value)
+{
+    if (p == end)
+        return false;
+    const uint64 limit = numeric_limits<uint64>::max();
+    value = 0;
+    for (; p != end; ++p) {
+        if (!isDigit(*p))
+            return false;
+        unsigned digit = *p - '0';
+        if (value > (limit - digit)/10)
+            return false;
+        value = value*10 + digit;
+    }
+    return true;
+}
+
+bool parseInteger(const char *p, const char *end, int64 & value)
+{
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    uint64 magnitude;
+    if (!parseUnsigned(p, end, magnitude))
+        return false;
+    const uint64 limit = static_cast<uint64>(numeric_limits<int64>::max());
+    if (magnitude > limit + (negative ? 1 : 0))
+        return false;
+    value = negative ? static_cast<int64>(0 - magnitude) : static_cast<int64>(magnitude);
+    return true;
+}
+
+bool equalsIgnoreCase(const char *begin, const char *end, const char *word)
+{
+    for (; begin != end && *word; ++begin, ++word)
+        if ((*begin | 0x20) != *word)
+            return false;
+    return begin == end && !*word;
+}
+
+bool isBooleanWord(const char *begin, const char *end)
+{
+    return equalsIgnoreCase(begin, end, "true") || equalsIgnoreCase(begin, end, "false");
+}
+
+// conversion of a field to the element type of its column
+
+template<typename T>
+bool parseSigned(const char *begin, const char *end, T & value)
+{
+    trim(begin, end);
+    int64 v = 0;
+    if (begin != end && !parseInteger(begin, end, v))
+        return false;
+    if (v < static_cast<int64>(numeric_limits<T>::min()) ||
+        v > static_cast<int64>(numeric_limits<T>::max()))
+        return false;
+    value = static_cast<T>(v);
+    return true;
+}
+
+template<typename T>
+bool parseUnsignedField(const char *begin, const char *end, T & value)
+{
+    trim(begin, end);
+    uint64 v = 0;
+    if (begin != end && !parseUnsigned(begin, end, v))
+        return false;
+    if (v > static_cast<uint64>(numeric_limits<T>::max()))
+        return false;
+    value = static_cast<T>(v);
+    return true;
+}
+
+bool parseField(const char *b, const char *e, int8 & value, char)   { return parseSigned(b, e, value); }
+bool parseField(const char *b, const char *e, int16 & value, char)  { return parseSigned(b, e, value); }
+bool parseField(const char *b, const char *e, int32 & value, char)  { return parseSigned(b, e, value); }
+bool parseField(const char *b, const char *e, int64 & value, char)  { return parseSigned(b, e, value); }
+bool parseField(const char *b, const char *e, uint8 & value, char)  { return parseUnsignedField(b, e, value); }
+bool parseField(const char *b, const char *e, uint16 & value, char) { return parseUnsignedField(b, e, value); }
+bool parseField(const char *b, const char *e, uint32 & value, char) { return parseUnsignedField(b, e, value); }
+bool parseField(const char *b, const char *e, uint64 & value, char) { return parseUnsignedField(b, e, value); }
+
+bool parseField(const char *begin, const char *end, double & value, char point)
+{
+    trim(begin, end);
+    if (begin == end) {
+        value = numeric_limits<double>::quiet_NaN();
+        return true;
+    }
+    return parseDouble(begin, end, value, point);
+}
+
+bool parseField(const char *begin, const char *end, float & value, char point)
+{
+    double v;
+    if (!parseField(begin, end, v, point))
+        return false;
+    value = static_cast<float>(v);
+    return true;
+}
+
+bool parseField(const char *begin, const char *end, boolean & value, char)
+{
+    trim(begin, end);
+    if (begin == end || equalsIgnoreCase(begin, end, "false") ||
+        (end - begin == 1 && *begin == '0'))
+        value = false;
+    else if (equalsIgnoreCase(begin, end, "true") ||
+        (end - begin == 1 && *begin == '1'))
+        value = true;
+    else
+        return false;
+    return true;
+}
+
+bool parseField(const char *begin, const char *end, string & value, char)
+{
+    value.assign(begin, end);
+    return true;
+}
+
+/*
+ * Splits text into rows and fields. Quoted fields that contain no
+ * doubled quotes are returned in place, others are unescaped into
+ * a scratch string, valid until the next field.
+ */
+class RowReader
+{
+public:
+    RowReader(const char *begin, const char *end, char delimiter) :
+        p(begin), end(end), delimiter(delimiter), rowDone(true) {}
+
+    // moves to the next non-empty row, returns false at the end
+    bool nextRow()
+    {
+        const char *b, *e;
+        while (nextField(b, e))
+            ;
+        while (p != end && (*p == '\n' || (*p == '\r' && p + 1 != end && p[1] == '\n')))
+            ++p;
+        rowDone = p == end;
+        return !rowDone;
+    }
+
+    // returns the next field of the row, or false at the end of the row
+    bool nextField(const char *& begin, const char *& e)
+    {
+        if (rowDone)
+            return false;
+        if (p != end && *p == '"') {
+            const char *start = ++p;
+            scratch.clear();
+            bool escaped = false;
+            while (true) {
+                const char *q = static_cast<const char *>(memchr(p, '"', end - p));
+                if (!q) {
+                    scratch.append(p, end);
+                    p = end;
+                    escaped = true;
+                    break;
+                }
+                if (q + 1 != end && q[1] == '"') {
+                    scratch.append(p, q + 1);
+                    p = q + 2;
+                    escaped = true;
+                    continue;
+                }
+                if (escaped) {
+                    scratch.append(p, q);
+                } else {
+                    begin = start;
+                    e = q;
+                }
+                p = q + 1;
+                break;
+            }
+            if (escaped) {
+                begin = scratch.data();
+                e = begin + scratch.size();
+            }
+            // anything between the closing quote and the delimiter is ignored
+            const char *dummy;
+            endField(dummy);
+        } else {
+            begin = p;
+            endField(e);
+        }
+        return true;
+    }
+
+    const char *position() const
+    {
+        return p;
+    }
+
+private:
+    void endField(const char *& fieldEnd)
+    {
+        const char *q = p;
+        while (q != end && *q != delimiter && *q != '\n')
+            ++q;
+        fieldEnd = q;
+        if (q == end || *q == '\n') {
+            if (fieldEnd != p && fieldEnd[-1] == '\r')
+                --fieldEnd;
+            rowDone = true;
+        }
+        p = q == end ? q : q + 1;
+    }
+
+    const char *p;
+    const char *end;
+    char delimiter;
+    bool rowDone;
+    string scratch;
+};
+
+// the values of one column parsed from one chunk
+class ColumnSink
+{
+public:
+    virtual ~ColumnSink() {}
+    virtual void add(const char *begin, const char *end) = 0;
+
+    // the sink holding the values, of the element type of the column
+    virtual ColumnSink & typed()
+    {
+        return *this;
+    }
+};
+
+typedef std::tr1::shared_ptr<ColumnSink> ColumnSinkPtr;
+
+template<typename T>
+class TypedSink : public ColumnSink
+{
+public:
+    TypedSink(string const & name, char point) : name(name), point(point) {}
+
+    virtual void add(const char *begin, const char *end)
+    {
+        T value;
+        if (!parseField(begin, end, value, point))
+            throw std::runtime_error("invalid value '" + string(begin, end) +
+                "' in CSV column " + name);
+        values.push_back(value);
+    }
+
+    string name;
+    char point;
+    vector<T> values;
+};
+
+/*
+ * A column inferred as long from the first rows, which becomes a
+ * column of doubles at the first number that is not an integer. Empty
+ * fields read before that are remembered to become NaN then, as in a
+ * double column.
+ */
+class WideningSink : public ColumnSink
+{
+public:
+    WideningSink(string const & name, char point) :
+        integers(name, point), doubles(name, point), widened(false) {}
+
+    virtual void add(const char *begin, const char *end)
+    {
+        if (!widened) {
+            int64 value;
+            if (parseField(begin, end, value, point())) {
+                trim(begin, end);
+                if (begin == end)
+                    blanks.push_back(integers.values.size());
+                integers.values.push_back(value);
+                return;
+            }
+            double number;
+            if (!parseField(begin, end, number, point()))
+                throw std::runtime_error("invalid value '" + string(begin, end) +
+                    "' in CSV column " + integers.name);
+            widen();
+        }
+        doubles.add(begin, end);
+    }
+
+    virtual ColumnSink & typed()
+    {
+        if (widened)
+            return doubles;
+        return integers;
+    }
+
+    bool isWidened() const
+    {
+        return widened;
+    }
+
+    void widen()
+    {
+        if (widened)
+            return;
+        widened = true;
+        doubles.values.assign(integers.values.begin(), integers.values.end());
+        for (size_t i = 0; i < blanks.size(); ++i)
+            doubles.values[blanks[i]] = numeric_limits<double>::quiet_NaN();
+        vector<int64>().swap(integers.values);
+        vector<size_t>().swap(blanks);
+    }
+
+private:
+    char point() const
+    {
+        return integers.point;
+    }
+
+    TypedSink<int64> integers;
+    TypedSink<double> doubles;
+    vector<size_t> blanks;
+    bool widened;
+};
+
+ColumnSinkPtr createSink(ScalarType type, string const & name, char point)
+{
+    switch (type) {
+    case pvBoolean: return ColumnSinkPtr(new TypedSink<boolean>(name, point));
+    case pvByte:    return ColumnSinkPtr(new TypedSink<int8>(name, point));
+    case pvShort:   return ColumnSinkPtr(new TypedSink<int16>(name, point));
+    case pvInt:     return ColumnSinkPtr(new TypedSink<int32>(name, point));
+    case pvLong:    return ColumnSinkPtr(new TypedSink<int64>(name, point));
+    case pvUByte:   return ColumnSinkPtr(new TypedSink<uint8>(name, point));
+    case pvUShort:  return ColumnSinkPtr(new TypedSink<uint16>(name, point));
+    case pvUInt:    return ColumnSinkPtr(new TypedSink<uint32>(name, point));
+    case pvULong:   return ColumnSinkPtr(new TypedSink<uint64>(name, point));
+    case pvFloat:   return ColumnSinkPtr(new TypedSink<float>(name, point));
+    case pvDouble:  return ColumnSinkPtr(new TypedSink<double>(name, point));
+    case pvString:  return ColumnSinkPtr(new TypedSink<string>(name, point));
+    }
+    throw std::runtime_error("unsupported NTTable column type");
+}
+
+// a range of whole rows and the values parsed from it
+struct Chunk
+{
+    const char *begin;
+    const char *end;
+    vector<ColumnSinkPtr> sinks;
+    string error;
+};
+
+typedef std::tr1::shared_ptr<Chunk> ChunkPtr;
+
+void parseChunk(Chunk & chunk, char delimiter)
+{
+    try {
+        RowReader reader(chunk.begin, chunk.end, delimiter);
+        const size_t columnCount = chunk.sinks.size();
+        const char *begin, *end;
+        while (reader.nextRow()) {
+            size_t i = 0;
+            for (; reader.nextField(begin, end); ++i)
+                if (i < columnCount)
+                    chunk.sinks[i]->add(begin, end);
+            for (; i < columnCount; ++i)
+                chunk.sinks[i]->add(end, end);
+        }
+    } catch (std::exception & e) {
+        chunk.error = e.what();
+    }
+}
+
+// parses the chunks of a block, one part per chunk
+class ChunkTask : public ParallelTask
+{
+public:
+    ChunkTask(vector<ChunkPtr> const & chunks, char delimiter) :
+        chunks(chunks), delimiter(delimiter) {}
+
+    virtual void run(size_t part)
+    {
+        parseChunk(*chunks[part], delimiter);
+    }
+
+private:
+    vector<ChunkPtr> const & chunks;
+    char delimiter;
+};
+
+/*
+ * Finds the end of the last complete row of a block, all of it at the
+ * end of the input, and splits the rows into about equal parts.
+ * Line breaks within quotes are found by the parity of the quotes
+ * before them, which needs a serial scan; text without quotes is split
+ * by searching for the nearest line break.
+ */
+const char *splitRows(const char *begin, const char *end, size_t parts,
+    bool atEnd, vector<const char *> & bounds)
+{
+    const size_t size = end - begin;
+    bounds.assign(1, begin);
+    const char *rowsEnd = begin;
+    const bool quoted = memchr(begin, '"', size) != 0;
+    if (quoted) {
+        bool inQuotes = false;
+        size_t part = 1;
+        const char *target = begin + size/parts;
+        for (const char *p = begin; p != end; ++p) {
+            if (*p == '"') {
+                inQuotes = !inQuotes;
+            } else if (*p == '\n' && !inQuotes) {
+                rowsEnd = p + 1;
+                if (part < parts && rowsEnd >= target) {
+                    bounds.push_back(rowsEnd);
+                    target = begin + size/parts*++part;
+                }
+            }
+        }
+    } else {
+        for (const char *p = end; p != begin; --p)
+            if (p[-1] == '\n') {
+                rowsEnd = p;
+                break;
+            }
+    }
+    if (atEnd)
+        rowsEnd = end;
+    while (bounds.size() > 1 && bounds.back() >= rowsEnd)
+        bounds.pop_back();
+
+    if (!quoted) {
+        const size_t rowsSize = rowsEnd - begin;
+        for (size_t part = 1; part < parts; ++part) {
+            const char *target = std::max(begin + rowsSize/parts*part, bounds.back());
+            const char *q = static_cast<const char *>(memchr(target, '\n', rowsEnd - target));
+            if (!q || q + 1 == rowsEnd)
+                break;
+            bounds.push_back(q + 1);
+        }
+    }
+    bounds.push_back(rowsEnd);
+    return rowsEnd;
+}
+
+string columnName(string const & label, size_t index, vector<string> const & names)
+{
+    string name = label;
+    for (size_t i = 0; i < name.size(); ++i) {
+        char c = name[i];
+        if (!isDigit(c) && !((c | 0x20) >= 'a' && (c | 0x20) <= 'z') && c != '_')
+            name[i] = '_';
+    }
+    if (name.empty()) {
+        char buffer[32];
+        sprintf(buffer, "column%u", static_cast<unsigned>(index));
+        name = buffer;
+    } else if (isDigit(name[0])) {
+        name = "_" + name;
+    }
+    string unique = name;
+    for (unsigned n = 2; std::find(names.begin(), names.end(), unique) != names.end(); ++n) {
+        char buffer[32];
+        sprintf(buffer, "_%u", n);
+        unique = name + buffer;
+    }
+    return unique;
+}
+
+ScalarType inferType(bool seen, bool isBoolean, bool isInteger, bool isNumber)
+{
+    if (!seen)
+        return pvString;
+    if (isBoolean)
+        return pvBoolean;
+    if (isInteger)
+        return pvLong;
+    if (isNumber)
+        return pvDouble;
+    return pvString;
+}
+
+inline void moveValue(string & from, string & to)
+{
+    to.swap(from);
+}
+
+template<typename T>
+inline void moveValue(T const & from, T & to)
+{
+    to = from;
+}
+
+/*
+ * The values of one column parsed from all chunks, copied into the
+ * column array one chunk at a time.
+ */
+class ColumnMerge
+{
+public:
+    virtual ~ColumnMerge() {}
+    virtual void copy(size_t chunk) = 0;
+    virtual void finish() = 0;
+};
+
+typedef std::tr1::shared_ptr<ColumnMerge> ColumnMergePtr;
+
+template<typename T>
+class TypedMerge : public ColumnMerge
+{
+public:
+    TypedMerge(vector<ChunkPtr> const & chunks, size_t column, PVScalarArrayPtr const & pvColumn) :
+        chunks(chunks), column(column), pvColumn(pvColumn), offsets(1, 0)
+    {
+        for (size_t i = 0; i < chunks.size(); ++i)
+            offsets.push_back(offsets.back() + sink(i).values.size());
+        values.resize(offsets.back());
+    }
+
+    // frees the values of the chunk once they are copied
+    virtual void copy(size_t chunk)
+    {
+        vector<T> & chunkValues = sink(chunk).values;
+        typename PVValueArray<T>::svector::iterator out = values.begin() + offsets[chunk];
+        for (size_t i = 0; i < chunkValues.size(); ++i)
+            moveValue(chunkValues[i], out[i]);
+        vector<T>().swap(chunkValues);
+    }
+
+    virtual void finish()
+    {
+        std::tr1::static_pointer_cast<PVValueArray<T> >(pvColumn)->replace(freeze(values));
+    }
+
+private:
+    TypedSink<T> & sink(size_t chunk) const
+    {
+        return static_cast<TypedSink<T> &>(chunks[chunk]->sinks[column]->typed());
+    }
+
+    vector<ChunkPtr> const & chunks;
+    size_t column;
+    PVScalarArrayPtr pvColumn;
+    vector<size_t> offsets;
+    typename PVValueArray<T>::svector values;
+};
+
+ColumnMergePtr createMerge(ScalarType type, vector<ChunkPtr> const & chunks, size_t column,
+    PVScalarArrayPtr const & pvColumn)
+{
+    switch (type) {
+    case pvBoolean: return ColumnMergePtr(new TypedMerge<boolean>(chunks, column, pvColumn));
+    case pvByte:    return ColumnMergePtr(new TypedMerge<int8>(chunks, column, pvColumn));
+    case pvShort:   return ColumnMergePtr(new TypedMerge<int16>(chunks, column, pvColumn));
+    case pvInt:     return ColumnMergePtr(new TypedMerge<int32>(chunks, column, pvColumn));
+    case pvLong:    return ColumnMergePtr(new TypedMerge<int64>(chunks, column, pvColumn));
+    case pvUByte:   return ColumnMergePtr(new TypedMerge<uint8>(chunks, column, pvColumn));
+    case pvUShort:  return ColumnMergePtr(new TypedMerge<uint16>(chunks, column, pvColumn));
+    case pvUInt:    return ColumnMergePtr(new TypedMerge<uint32>(chunks, column, pvColumn));
+    case pvULong:   return ColumnMergePtr(new TypedMerge<uint64>(chunks, column, pvColumn));
+    case pvFloat:   return ColumnMergePtr(new TypedMerge<float>(chunks, column, pvColumn));
+    case pvDouble:  return ColumnMergePtr(new TypedMerge<double>(chunks, column, pvColumn));
+    case pvString:  return ColumnMergePtr(new TypedMerge<string>(chunks, column, pvColumn));
+    }
+    throw std::runtime_error("unsupported NTTable column type");
+}
+
+// copies the values of a chunk into all columns, one part per chunk
+class MergeTask : public ParallelTask
+{
+public:
+    explicit MergeTask(vector<ColumnMergePtr> const & merges) : merges(merges) {}
+
+    virtual void run(size_t part)
+    {
+        for (size_t i = 0; i < merges.size(); ++i)
+            merges[i]->copy(part);
+    }
+
+private:
+    vector<ColumnMergePtr> const & merges;
+};
+
+/*
+ * The state of reading one table: the columns, known after the first
+ * block, and the chunks parsed so far. The number of rows of a chunk
+ * is only known once it is parsed, so chunks are parsed into vectors
+ * of their own, which are copied into the columns at the end, in
+ * parallel like the parsing. The workers are kept from block to block.
+ * A column inferred as long becomes double at the end if any chunk
+ * found a number in it that is not an integer.
+ */
+class TableReader
+{
+public:
+    explicit TableReader(NTTableCSVOptions const & options) :
+        options(options), prepared(false), threadCount(options.threadCount),
+        point(decimalPoint())
+    {
+        if (threadCount == 0)
+            threadCount = std::max(epicsThreadGetCPUs(), 1);
+    }
+
+    // parses the complete rows of a block, returns the end of the rows parsed
+    const char *parse(const char *begin, const char *end, bool atEnd)
+    {
+        size_t parts = std::max<size_t>(std::min(threadCount,
+            static_cast<size_t>(end - begin)/minimumChunkSize), 1);
+        vector<const char *> bounds;
+        const char *rowsEnd = splitRows(begin, end, parts, atEnd, bounds);
+        if (!prepared) {
+            // wait for the rows the types are inferred from
+            if (!atEnd && (rowsEnd == begin ||
+                (options.types.empty() && countRows(begin, rowsEnd) <= options.inferRows)))
+                return begin;
+            const char *dataBegin = prepare(begin, rowsEnd);
+            for (size_t i = 0; i < bounds.size(); ++i)
+                bounds[i] = std::max(bounds[i], dataBegin);
+        }
+
+        vector<ChunkPtr> blockChunks;
+        for (size_t i = 0; i + 1 < bounds.size(); ++i) {
+            if (bounds[i] == bounds[i + 1])
+                continue;
+            ChunkPtr chunk(new Chunk());
+            chunk->begin = bounds[i];
+            chunk->end = bounds[i + 1];
+            for (size_t j = 0; j < types.size(); ++j)
+                chunk->sinks.push_back(widening[j] ?
+                    ColumnSinkPtr(new WideningSink(names[j], point)) :
+                    createSink(types[j], names[j], point));
+            blockChunks.push_back(chunk);
+        }
+        ChunkTask task(blockChunks, options.delimiter);
+        runParallel(tiler, threadCount, task, blockChunks.size());
+        for (size_t i = 0; i < blockChunks.size(); ++i) {
+            if (!blockChunks[i]->error.empty())
+                throw std::runtime_error(blockChunks[i]->error);
+            chunks.push_back(blockChunks[i]);
+        }
+        return rowsEnd;
+    }
+
+    NTTablePtr create()
+    {
+        widen();
+        NTTableBuilderPtr builder = NTTable::createBuilder();
+        for (size_t i = 0; i < names.size(); ++i)
+            builder->addColumn(names[i], types[i]);
+        NTTablePtr table = builder->create();
+
+        PVStringArray::svector labelValues(labels.size());
+        std::copy(labels.begin(), labels.end(), labelValues.begin());
+        table->getLabels()->replace(freeze(labelValues));
+
+        vector<ColumnMergePtr> merges;
+        for (size_t i = 0; i < names.size(); ++i)
+            merges.push_back(createMerge(types[i], chunks, i,
+                table->getColumn<PVScalarArray>(names[i])));
+        MergeTask task(merges);
+        runParallel(tiler, threadCount, task, chunks.size());
+        for (size_t i = 0; i < merges.size(); ++i)
+            merges[i]->finish();
+        return table;
+    }
+
+private:
+    void widen()
+    {
+        for (size_t i = 0; i < types.size(); ++i) {
+            if (!widening[i])
+                continue;
+            bool widened = false;
+            for (size_t j = 0; j < chunks.size() && !widened; ++j)
+                widened = sink(j, i).isWidened();
+            if (!widened)
+                continue;
+            for (size_t j = 0; j < chunks.size(); ++j)
+                sink(j, i).widen();
+            types[i] = pvDouble;
+        }
+    }
+
+    WideningSink & sink(size_t chunk, size_t column) const
+    {
+        return static_cast<WideningSink &>(*chunks[chunk]->sinks[column]);
+    }
+
+    size_t countRows(const char *begin, const char *end) const
+    {
+        RowReader reader(begin, end, options.delimiter);
+        size_t count = 0;
+        while (count <= options.inferRows && reader.nextRow())
+            ++count;
+        return options.header && count ? count - 1 : count;
+    }
+
+    // reads the header and infers the types, returns the start of the data
+    const char *prepare(const char *begin, const char *end)
+    {
+        prepared = true;
+        RowReader reader(begin, end, options.delimiter);
+        const char *fieldBegin, *fieldEnd;
+        if (reader.nextRow()) {
+            RowReader first = reader;
+            for (size_t i = 0; first.nextField(fieldBegin, fieldEnd); ++i) {
+                string label = options.header ? string(fieldBegin, fieldEnd) : string();
+                names.push_back(columnName(label, i, names));
+                labels.push_back(options.header ? label : names.back());
+            }
+            if (options.header)
+                reader = first;
+        }
+
+        if (!options.types.empty()) {
+            if (options.types.size() != names.size() && !names.empty())
+                throw std::runtime_error("CSV column types differ in number from the columns");
+            types = options.types;
+            if (names.empty())
+                types.clear();
+            widening.assign(types.size(), false);
+        } else {
+            const size_t columnCount = names.size();
+            vector<char> seen(columnCount, false);
+            vector<char> isBoolean(columnCount, true);
+            vector<char> isInteger(columnCount, true);
+            vector<char> isNumber(columnCount, true);
+            RowReader sample = reader;
+            for (size_t row = 0; row < options.inferRows && sample.nextRow(); ++row) {
+                for (size_t i = 0; sample.nextField(fieldBegin, fieldEnd); ++i) {
+                    trim(fieldBegin, fieldEnd);
+                    if (i >= columnCount || fieldBegin == fieldEnd)
+                        continue;
+                    seen[i] = true;
+                    if (isBoolean[i] && !isBooleanWord(fieldBegin, fieldEnd))
+                        isBoolean[i] = false;
+                    int64 integer;
+                    if (isInteger[i] && !parseInteger(fieldBegin, fieldEnd, integer))
+                        isInteger[i] = false;
+                    double number;
+                    if (isNumber[i] && !parseDouble(fieldBegin, fieldEnd, number, point))
+                        isNumber[i] = false;
+                }
+            }
+            for (size_t i = 0; i < columnCount; ++i)
+                types.push_back(inferType(seen[i], isBoolean[i], isInteger[i], isNumber[i]));
+            for (size_t i = 0; i < columnCount; ++i)
+                widening.push_back(types[i] == pvLong);
+        }
+        return options.header ? reader.position() : begin;
+    }
+
+    NTTableCSVOptions options;
+    bool prepared;
+    size_t threadCount;
+    char point;
+    vector<string> names;
+    vector<string> labels;
+    vector<ScalarType> types;
+    vector<char> widening;
+    vector<ChunkPtr> chunks;
+    NTNDArrayTilerPtr tiler;
+};
+
+// formatting of the elements of a column
+
+void appendUnsigned(string & out, uint64 value)
+{
+    char buffer[24];
+    char *p = buffer + sizeof(buffer);
+    do {
+        *--p = static_cast<char>('0' + value%10);
+        value /= 10;
+    } while (value);
+    out.append(p, buffer + sizeof(buffer));
+}
+
+void appendInteger(string & out, int64 value)
+{
+    if (value < 0) {
+        out += '-';
+        appendUnsigned(out, 0 - static_cast<uint64>(value));
+    } else {
+        appendUnsigned(out, static_cast<uint64>(value));
+    }
+}
+
+/*
+ * The significant digits of a nonzero finite value, rounded to count
+ * digits, and the decimal exponent of the first.
+ */
+struct Digits
+{
+    char digits[24];
+    int count;
+    int exponent;
+};
+
+void formatDigits(double value, int count, Digits & out)
+{
+    char buffer[40];
+    sprintf(buffer, "%.*e", count - 1, std::fabs(value));
+    const char *p = buffer;
+    out.count = 0;
+    for (; *p != 'e'; ++p)
+        if (isDigit(*p))
+            out.digits[out.count++] = *p;
+    out.exponent = atoi(p + 1);
+}
+
+/*
+ * Rounds digits to fewer, returns false for a tie, where rounding the
+ * rounded digits again may differ from rounding the value.
+ */
+bool roundDigits(Digits const & from, int count, Digits & out)
+{
+    out = from;
+    out.count = count;
+    char first = from.digits[count];
+    bool up = first > '5';
+    if (first == '5') {
+        for (int i = count + 1; i < from.count && !up; ++i)
+            up = from.digits[i] != '0';
+        if (!up)
+            return false;
+    }
+    if (!up)
+        return true;
+    int i = count - 1;
+    while (i >= 0 && out.digits[i] == '9')
+        out.digits[i--] = '0';
+    if (i >= 0) {
+        ++out.digits[i];
+    } else {
+        out.digits[0] = '1';
+        ++out.exponent;
+    }
+    return true;
+}
+
+// appends digits as %g does with a precision of their count
+void appendDigits(string & out, bool negative, Digits const & d)
+{
+    int last = d.count;
+    while (last > 1 && d.digits[last - 1] == '0')
+        --last;
+    if (negative)
+        out += '-';
+    const int e = d.exponent;
+    if (e < -4 || e >= d.count) {
+        out += d.digits[0];
+        if (last > 1) {
+            out += '.';
+            out.append(d.digits + 1, last - 1);
+        }
+        char buffer[8];
+        sprintf(buffer, "e%c%02d", e < 0 ? '-' : '+', e < 0 ? -e : e);
+        out += buffer;
+    } else if (e < 0) {
+        out += "0.";
+        out.append(-e - 1, '0');
+        out.append(d.digits, last);
+    } else {
+        out.append(d.digits, std::min(last, e + 1));
+        if (last < e + 1)
+            out.append(e + 1 - last, '0');
+        if (last > e + 1) {
+            out += '.';
+            out.append(d.digits + e + 1, last - e - 1);
+        }
+    }
+}
+
+/*
+ * Writes value with the fewest significant digits, up to maxDigits,
+ * that read back as the same value of type T, and a '.' as the decimal
+ * point whatever the locale, as %g would. The value is formatted once
+ * with maxDigits digits, and shorter candidates are rounded from those,
+ * unless the digits dropped are a tie. A normal value that reads back
+ * from digits10 digits or fewer is written with the fewest digits by
+ * the first candidate; subnormal values have fewer significant bits
+ * and are tried from one digit up.
+ */
+template<typename T>
+void appendShortest(string & out, T value, int maxDigits, char point)
+{
+    Digits all, candidate;
+    formatDigits(value, maxDigits, all);
+    const bool negative = value < 0;
+    int minDigits = std::fabs(value) < numeric_limits<T>::min() ? 1 : numeric_limits<T>::digits10;
+    for (int digits = minDigits; digits < maxDigits; ++digits) {
+        if (!roundDigits(all, digits, candidate))
+            formatDigits(value, digits, candidate);
+        const size_t begin = out.size();
+        appendDigits(out, negative, candidate);
+        double readBack;
+        if (parseDouble(out.data() + begin, out.data() + out.size(), readBack, point) &&
+            static_cast<T>(readBack) == value)
+            return;
+        out.resize(begin);
+    }
+    appendDigits(out, negative, all);
+}
+
+/*
+ * Integral values are written as integers, others with the fewest
+ * digits; no double needs more than 17, no float more than 9.
+ */
+void appendDouble(string & out, double value, char point)
+{
+    if (value != value) {
+        out += "nan";
+    } else if (value > DBL_MAX || value < -DBL_MAX) {
+        out += value < 0 ? "-inf" : "inf";
+    } else if (value == 0) {
+        out += 1/value < 0 ? "-0" : "0";
+    } else if (value == std::floor(value) && std::fabs(value) < 1e15) {
+        appendInteger(out, static_cast<int64>(value));
+    } else {
+        appendShortest(out, value, 17, point);
+    }
+}
+
+void appendFloat(string & out, float value, char point)
+{
+    if (value != value || value > FLT_MAX || value < -FLT_MAX ||
+        (value == std::floor(value) && std::fabs(value) < 1e7f)) {
+        appendDouble(out, value, point);
+    } else {
+        appendShortest(out, value, 9, point);
+    }
+}
+
+void appendString(string & out, string const & value, char delimiter)
+{
+    bool quote = false;
+    for (size_t i = 0; i < value.size() && !quote; ++i) {
+        char c = value[i];
+        quote = c == delimiter || c == '"' || c == '\n' || c == '\r';
+    }
+    if (!quote) {
+        out += value;
+        return;
+    }
+    out += '"';
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (value[i] == '"')
+            out += '"';
+        out += value[i];
+    }
+    out += '"';
+}
+
+void appendValue(string & out, int8 value, char, char)   { appendInteger(out, value); }
+void appendValue(string & out, int16 value, char, char)  { appendInteger(out, value); }
+void appendValue(string & out, int32 value, char, char)  { appendInteger(out, value); }
+void appendValue(string & out, int64 value, char, char)  { appendInteger(out, value); }
+void appendValue(string & out, uint8 value, char, char)  { appendUnsigned(out, value); }
+void appendValue(string & out, uint16 value, char, char) { appendUnsigned(out, value); }
+void appendValue(string & out, uint32 value, char, char) { appendUnsigned(out, value); }
+void appendValue(string & out, uint64 value, char, char) { appendUnsigned(out, value); }
+void appendValue(string & out, float value, char, char point)  { appendFloat(out, value, point); }
+void appendValue(string & out, double value, char, char point) { appendDouble(out, value, point); }
+void appendValue(string & out, boolean value, char, char) { out += value ? "true" : "false"; }
+void appendValue(string & out, string const & value, char delimiter, char) { appendString(out, value, delimiter); }
+
+class ColumnFormatter
+{
+public:
+    virtual ~ColumnFormatter() {}
+    virtual void append(string & out, size_t row, char delimiter, char point) const = 0;
+};
+
+typedef std::tr1::shared_ptr<ColumnFormatter> ColumnFormatterPtr;
+
+template<typename T>
+class TypedFormatter : public ColumnFormatter
+{
+public:
+    explicit TypedFormatter(PVScalarArrayPtr const & column) :
+        values(std::tr1::static_pointer_cast<PVValueArray<T> >(column)->view()) {}
+
+    virtual void append(string & out, size_t row, char delimiter, char point) const
+    {
+        appendValue(out, values[row], delimiter, point);
+    }
+
+private:
+    typename PVValueArray<T>::const_svector values;
+};
+
+ColumnFormatterPtr createFormatter(PVScalarArrayPtr const & column)
+{
+    switch (column->getScalarArray()->getElementType()) {
+    case pvBoolean: return ColumnFormatterPtr(new TypedFormatter<boolean>(column));
+    case pvByte:    return ColumnFormatterPtr(new TypedFormatter<int8>(column));
+    case pvShort:   return ColumnFormatterPtr(new TypedFormatter<int16>(column));
+    case pvInt:     return ColumnFormatterPtr(new TypedFormatter<int32>(column));
+    case pvLong:    return ColumnFormatterPtr(new TypedFormatter<int64>(column));
+    case pvUByte:   return ColumnFormatterPtr(new TypedFormatter<uint8>(column));
+    case pvUShort:  return ColumnFormatterPtr(new TypedFormatter<uint16>(column));
+    case pvUInt:    return ColumnFormatterPtr(new TypedFormatter<uint32>(column));
+    case pvULong:   return ColumnFormatterPtr(new TypedFormatter<uint64>(column));
+    case pvFloat:   return ColumnFormatterPtr(new TypedFormatter<float>(column));
+    case pvDouble:  return ColumnFormatterPtr(new TypedFormatter<double>(column));
+    case pvString:  return ColumnFormatterPtr(new TypedFormatter<string>(column));
+    }
+    throw std::runtime_error("unsupported NTTable column type");
+}
+
+}
+
+NTTablePtr NTTableCSV::read(std::istream & in, NTTableCSVOptions const & options)
+{
+    TableReader reader(options);
+    vector<char> buffer(std::max<size_t>(options.blockSize, 1));
+    size_t filled = 0;
+    bool atEnd = false;
+    while (!atEnd) {
+        in.read(&buffer[filled], buffer.size() - filled);
+        filled += static_cast<size_t>(in.gcount());
+        atEnd = !in;
+        if (in.bad())
+            throw std::runtime_error("cannot read CSV");
+
+        const char *begin = &buffer[0];
+        const char *rowsEnd = reader.parse(begin, begin + filled, atEnd);
+
+        // the incomplete last row is kept for the next block
+        size_t rest = begin + filled - rowsEnd;
+        memmove(&buffer[0], rowsEnd, rest);
+        filled = rest;
+        if (filled == buffer.size())
+            buffer.resize(2*buffer.size());
+    }
+    return reader.create();
+}
+
+NTTablePtr NTTableCSV::read(const char *data, size_t size, NTTableCSVOptions const & options)
+{
+    TableReader reader(options);
+    reader.parse(data, data + size, true);
+    return reader.create();
+}
+
+void NTTableCSV::write(std::ostream & out, NTTablePtr const & table,
+    NTTableCSVOptions const & options)
+{
+    StringArray const & names = table->getColumnNames();
+    PVStringArray::const_svector labels(table->getLabels()->view());
+    const char delimiter = options.delimiter;
+    const char point = decimalPoint();
+
+    vector<ColumnFormatterPtr> formatters;
+    size_t rows = 0;
+    for (size_t i = 0; i < names.size(); ++i) {
+        PVScalarArrayPtr column = table->getColumn<PVScalarArray>(names[i]);
+        if (!column)
+            throw std::runtime_error("NTTable column is not a scalar array");
+        if (i == 0)
+            rows = column->getLength();
+        else if (column->getLength() != rows)
+            throw std::runtime_error("NTTable columns differ in length");
+        formatters.push_back(createFormatter(column));
+    }
+
+    string buffer;
+    buffer.reserve(outputBufferSize + 4096);
+    if (options.header && !names.empty()) {
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (i)
+                buffer += delimiter;
+            appendString(buffer, i < labels.size() && !labels[i].empty() ? labels[i] : names[i],
+                delimiter);
+        }
+        buffer += '\n';
+    }
+    for (size_t row = 0; row < rows; ++row) {
+        for (size_t i = 0; i < formatters.size(); ++i) {
+            if (i)
+                buffer += delimiter;
+            formatters[i]->append(buffer, row, delimiter, point);
+        }
+        buffer += '\n';
+        if (buffer.size() >= outputBufferSize) {
+            out.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+    out.write(buffer.data(), buffer.size());
+    if (!out)
+        throw std::runtime_error("cannot write CSV");
+}
+
+}}
@@ -0,0 +1,831 @@
+/* nttableCodec.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include <epicsEndian.h>
+
+#define epicsExportSharedSymbols
+#include <pv/nttableCodec.h>
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+namespace {
+
+const epicsUInt8 magic[4] = { 'N', 'T', 'T', 'C' };
+const epicsUInt8 version = 1;
+
+// the optional fields of the table that are kept
+const epicsUInt8 hasDescriptor = 1;
+const epicsUInt8 hasAlarm = 2;
+const epicsUInt8 hasTimeStamp = 4;
+
+// the number of elements of a bit packed block
+const size_t blockSize = 128;
+
+// encodings are compared on this many windows of this many rows
+const size_t sampleCount = 8;
+const size_t sampleSize = 512;
+
+const uint64 signBit = static_cast<uint64>(1) << 63;
+
+// signed integers with small magnitudes as small unsigned ones, without
+// branches on the sign: 0, -1, 1, -2 are 0, 1, 2, 3
+inline uint64 zigzag(int64 value)
+{
+    uint64 bits = static_cast<uint64>(value);
+    return (bits << 1) ^ (0 - (bits >> 63));
+}
+
+inline int64 unzigzag(uint64 value)
+{
+    return static_cast<int64>((value >> 1) ^ (0 - (value & 1)));
+}
+
+class Output
+{
+public:
+    explicit Output(vector<epicsUInt8> & out) : out(out) {}
+
+    // appends n bytes, returns where they start
+    epicsUInt8 *extend(size_t n)
+    {
+        size_t size = out.size();
+        out.resize(size + n);
+        return n ? &out[size] : 0;
+    }
+
+    void putByte(epicsUInt8 value)
+    {
+        out.push_back(value);
+    }
+
+    void putVarint(uint64 value)
+    {
+        while (value >= 0x80) {
+            out.push_back(static_cast<epicsUInt8>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<epicsUInt8>(value));
+    }
+
+    void putSigned(int64 value)
+    {
+        putVarint(zigzag(value));
+    }
+
+    void putString(string const & value)
+    {
+        putVarint(value.size());
+        if (!value.empty())
+            memcpy(extend(value.size()), value.data(), value.size());
+    }
+
+    size_t size() const
+    {
+        return out.size();
+    }
+
+private:
+    vector<epicsUInt8> & out;
+};
+
+class Input
+{
+public:
+    Input(const epicsUInt8 *begin, const epicsUInt8 *end) : p(begin), end(end) {}
+
+    const epicsUInt8 *bytes(size_t n)
+    {
+        if (static_cast<size_t>(end - p) < n)
+            throw std::runtime_error("NTTable binary form is truncated");
+        const epicsUInt8 *start = p;
+        p += n;
+        return start;
+    }
+
+    epicsUInt8 getByte()
+    {
+        return *bytes(1);
+    }
+
+    uint64 getVarint()
+    {
+        uint64 value = 0;
+        for (unsigned shift = 0; ; shift += 7) {
+            if (shift > 63)
+                throw std::runtime_error("NTTable binary form has an invalid integer");
+            epicsUInt8 byte = getByte();
+            value |= static_cast<uint64>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+    }
+
+    int64 getSigned()
+    {
+        return unzigzag(getVarint());
+    }
+
+    string getString()
+    {
+        size_t size = static_cast<size_t>(getVarint());
+        const epicsUInt8 *data = bytes(size);
+        return string(reinterpret_cast<const char *>(data), size);
+    }
+
+    size_t remaining() const
+    {
+        return end - p;
+    }
+
+    bool atEnd() const
+    {
+        return p == end;
+    }
+
+private:
+    const epicsUInt8 *p;
+    const epicsUInt8 *end;
+};
+
+// plain encoding
+
+void swapBytes(epicsUInt8 *data, size_t count, size_t size)
+{
+    if (EPICS_BYTE_ORDER == EPICS_ENDIAN_LITTLE || size == 1)
+        return;
+    for (size_t i = 0; i < count; ++i, data += size)
+        std::reverse(data, data + size);
+}
+
+template<typename T>
+void putPlain(const T *values, size_t count, Output & out)
+{
+    epicsUInt8 *data = out.extend(count*sizeof(T));
+    if (count) {
+        memcpy(data, values, count*sizeof(T));
+        swapBytes(data, count, sizeof(T));
+    }
+}
+
+void putPlain(const string *values, size_t count, Output & out)
+{
+    for (size_t i = 0; i < count; ++i)
+        out.putString(values[i]);
+}
+
+template<typename T>
+void getPlain(Input & in, T *values, size_t count)
+{
+    if (count > in.remaining()/sizeof(T))
+        throw std::runtime_error("NTTable binary form is truncated");
+    const epicsUInt8 *data = in.bytes(count*sizeof(T));
+    if (count) {
+        memcpy(values, data, count*sizeof(T));
+        swapBytes(reinterpret_cast<epicsUInt8 *>(values), count, sizeof(T));
+    }
+}
+
+void getPlain(Input & in, string *values, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        values[i] = in.getString();
+}
+
+// the fewest bytes an element takes in the plain encoding
+template<typename T>
+size_t plainSize(const T *)
+{
+    return sizeof(T);
+}
+
+size_t plainSize(const string *)
+{
+    return 1;
+}
+
+template<typename T>
+void skipPlain(Input & in, const T *)
+{
+    in.bytes(sizeof(T));
+}
+
+void skipPlain(Input & in, const string *)
+{
+    in.bytes(static_cast<size_t>(in.getVarint()));
+}
+
+// run length encoding; floating point elements are equal if their bits are
+
+template<typename T>
+inline bool same(T const & a, T const & b)
+{
+    return memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+inline bool same(string const & a, string const & b)
+{
+    return a == b;
+}
+
+template<typename T>
+void putRuns(const T *values, size_t count, Output & out)
+{
+    for (size_t i = 0; i < count; ) {
+        size_t j = i + 1;
+        while (j < count && same(values[j], values[i]))
+            ++j;
+        out.putVarint(j - i);
+        putPlain(values + i, 1, out);
+        i = j;
+    }
+}
+
+template<typename T>
+void getRuns(Input & in, T *values, size_t count)
+{
+    for (size_t i = 0; i < count; ) {
+        uint64 run = in.getVarint();
+        if (run == 0 || run > count - i)
+            throw std::runtime_error("NTTable binary form has an invalid run");
+        getPlain(in, values + i, 1);
+        std::fill(values + i + 1, values + i + run, values[i]);
+        i += static_cast<size_t>(run);
+    }
+}
+
+// checks that the runs add up to count elements, without decoding them
+template<typename T>
+void checkRuns(Input in, size_t count)
+{
+    for (size_t i = 0; i < count; ) {
+        uint64 run = in.getVarint();
+        if (run == 0 || run > count - i)
+            throw std::runtime_error("NTTable binary form has an invalid run");
+        skipPlain(in, static_cast<const T *>(0));
+        i += static_cast<size_t>(run);
+    }
+}
+
+/*
+ * Bit packing of blocks of blockSize elements into 2*width words. The
+ * word being filled or emptied is kept in a register rather than read
+ * back from memory for every element.
+ */
+
+void packBlock(const uint64 *values, unsigned width, uint64 *words)
+{
+    uint64 current = 0;
+    unsigned used = 0;
+    for (size_t i = 0; i < blockSize; ++i) {
+        current |= values[i] << used;
+        used += width;
+        if (used >= 64) {
+            *words++ = current;
+            used -= 64;
+            current = used ? values[i] >> (width - used) : 0;
+        }
+    }
+}
+
+// words has one more word after the block, which is read but not used
+void unpackBlock(const uint64 *words, unsigned width, uint64 *values)
+{
+    const uint64 mask = width == 64 ? ~static_cast<uint64>(0) : (static_cast<uint64>(1) << width) - 1;
+    uint64 current = *words;
+    unsigned used = 0;
+    for (size_t i = 0; i < blockSize; ++i) {
+        uint64 value = current >> used;
+        used += width;
+        if (used >= 64) {
+            used -= 64;
+            current = *++words;
+            if (used)
+                value |= current << (width - used);
+        }
+        values[i] = value & mask;
+    }
+}
+
+unsigned bitWidth(uint64 value)
+{
+    unsigned width = 0;
+    for (; value; value >>= 1)
+        ++width;
+    return width;
+}
+
+void putBlock(const uint64 *block, size_t n, Output & out)
+{
+    uint64 base = block[0], top = block[0];
+    for (size_t i = 1; i < n; ++i) {
+        base = block[i] < base ? block[i] : base;
+        top = block[i] > top ? block[i] : top;
+    }
+    unsigned width = bitWidth(top - base);
+    out.putVarint(base);
+    out.putByte(static_cast<epicsUInt8>(width));
+    if (width == 0)
+        return;
+
+    uint64 offsets[blockSize];
+    uint64 words[2*64];
+    for (size_t i = 0; i < n; ++i)
+        offsets[i] = block[i] - base;
+    std::fill(offsets + n, offsets + blockSize, 0);
+    packBlock(offsets, width, words);
+
+    // the words are little endian
+    epicsUInt8 *data = out.extend(16*width);
+    memcpy(data, words, 16*width);
+    swapBytes(data, 2*width, 8);
+}
+
+void getBlock(Input & in, uint64 *block, size_t n)
+{
+    uint64 base = in.getVarint();
+    unsigned width = in.getByte();
+    if (width > 64)
+        throw std::runtime_error("NTTable binary form has an invalid bit width");
+    if (width == 0) {
+        std::fill(block, block + n, base);
+        return;
+    }
+
+    uint64 words[2*64 + 1];
+    memcpy(words, in.bytes(16*width), 16*width);
+    swapBytes(reinterpret_cast<epicsUInt8 *>(words), 2*width, 8);
+    words[2*width] = 0;
+    unpackBlock(words, width, block);
+    for (size_t i = 0; i < n; ++i)
+        block[i] += base;
+}
+
+// integers as 64 bit words: raw keeps the bits, ordered keeps the order
+
+template<typename T>
+inline uint64 toRaw(T value)
+{
+    return numeric_limits<T>::is_signed ?
+        static_cast<uint64>(static_cast<int64>(value)) : static_cast<uint64>(value);
+}
+
+template<typename T>
+inline uint64 toOrdered(T value)
+{
+    return toRaw(value) ^ (numeric_limits<T>::is_signed ? signBit : 0);
+}
+
+template<typename T>
+inline T fromOrdered(uint64 value)
+{
+    return static_cast<T>(value ^ (numeric_limits<T>::is_signed ? signBit : 0));
+}
+
+// the delta encoding holds the first element, then the differences,
+// converted a block at a time
+template<typename T>
+void putPacked(const T *values, size_t count, bool delta, Output & out)
+{
+    delta = delta && count;
+    if (delta)
+        out.putVarint(toRaw(values[0]));
+    size_t words = delta ? count - 1 : count;
+    uint64 block[blockSize];
+    for (size_t begin = 0; begin < words; begin += blockSize) {
+        size_t n = std::min(blockSize, words - begin);
+        const T *in = values + begin;
+        if (delta) {
+            for (size_t i = 0; i < n; ++i)
+                block[i] = zigzag(static_cast<int64>(toRaw(in[i + 1]) - toRaw(in[i])));
+        } else {
+            for (size_t i = 0; i < n; ++i)
+                block[i] = toOrdered(in[i]);
+        }
+        putBlock(block, n, out);
+    }
+}
+
+template<typename T>
+void getPacked(Input & in, T *values, size_t count, bool delta)
+{
+    delta = delta && count;
+    uint64 sum = 0;
+    if (delta) {
+        sum = in.getVarint();
+        *values++ = static_cast<T>(sum);
+    }
+    size_t words = delta ? count - 1 : count;
+    uint64 block[blockSize];
+    for (size_t begin = 0; begin < words; begin += blockSize) {
+        size_t n = std::min(blockSize, words - begin);
+        getBlock(in, block, n);
+        T *out = values + begin;
+        if (delta) {
+            for (size_t i = 0; i < n; ++i) {
+                sum += static_cast<uint64>(unzigzag(block[i]));
+                out[i] = static_cast<T>(sum);
+            }
+        } else {
+            for (size_t i = 0; i < n; ++i)
+                out[i] = fromOrdered<T>(block[i]);
+        }
+    }
+}
+
+void notInteger()
+{
+    throw std::runtime_error("NTTable binary form has an integer encoding for a column that is not");
+}
+
+void putPacked(const float *, size_t, bool, Output &) { notInteger(); }
+void putPacked(const double *, size_t, bool, Output &) { notInteger(); }
+void putPacked(const string *, size_t, bool, Output &) { notInteger(); }
+void getPacked(Input &, float *, size_t, bool) { notInteger(); }
+void getPacked(Input &, double *, size_t, bool) { notInteger(); }
+void getPacked(Input &, string *, size_t, bool) { notInteger(); }
+
+template<typename T>
+void encodeValues(const T *values, size_t count, NTTableCodec::Encoding encoding, Output & out)
+{
+    switch (encoding) {
+    case NTTableCodec::plainEncoding:     putPlain(values, count, out); break;
+    case NTTableCodec::runLengthEncoding: putRuns(values, count, out); break;
+    case NTTableCodec::bitPackedEncoding: putPacked(values, count, false, out); break;
+    case NTTableCodec::deltaEncoding:     putPacked(values, count, true, out); break;
+    }
+}
+
+template<typename T>
+void decodeValues(Input & in, NTTableCodec::Encoding encoding, T *values, size_t count)
+{
+    switch (encoding) {
+    case NTTableCodec::plainEncoding:     getPlain(in, values, count); break;
+    case NTTableCodec::runLengthEncoding: getRuns(in, values, count); break;
+    case NTTableCodec::bitPackedEncoding: getPacked(in, values, count, false); break;
+    case NTTableCodec::deltaEncoding:     getPacked(in, values, count, true); break;
+    default:
+        throw std::runtime_error("NTTable binary form has an unknown encoding");
+    }
+}
+
+/*
+ * Encodes windows of rows spread over the column with each encoding
+ * that applies, and returns the one that takes fewest bytes; plain on
+ * a tie.
+ */
+template<typename T>
+NTTableCodec::Encoding chooseEncoding(const T *values, size_t count)
+{
+    vector<size_t> windows;
+    size_t window = count;
+    if (count > sampleCount*sampleSize) {
+        window = sampleSize;
+        for (size_t i = 0; i < sampleCount; ++i)
+            windows.push_back((count - sampleSize)*i/(sampleCount - 1));
+    } else {
+        windows.push_back(0);
+    }
+
+    const int encodingCount = numeric_limits<T>::is_integer ? 4 : 2;
+    NTTableCodec::Encoding best = NTTableCodec::plainEncoding;
+    size_t bestSize = 0;
+    vector<epicsUInt8> scratch;
+    for (int e = 0; e < encodingCount; ++e) {
+        NTTableCodec::Encoding encoding = static_cast<NTTableCodec::Encoding>(e);
+        scratch.clear();
+        Output out(scratch);
+        for (size_t i = 0; i < windows.size(); ++i)
+            encodeValues(values + windows[i], window, encoding, out);
+        if (e == 0 || scratch.size() < bestSize) {
+            best = encoding;
+            bestSize = scratch.size();
+        }
+    }
+    return best;
+}
+
+template<typename T>
+typename PVValueArray<T>::const_svector columnValues(PVScalarArrayPtr const & column)
+{
+    return std::tr1::static_pointer_cast<PVValueArray<T> >(column)->view();
+}
+
+template<typename T>
+NTTableCodec::Encoding chooseColumn(PVScalarArrayPtr const & column)
+{
+    typename PVValueArray<T>::const_svector values(columnValues<T>(column));
+    return chooseEncoding(values.data(), values.size());
+}
+
+template<typename T>
+void encodeColumn(PVScalarArrayPtr const & column, Output & out)
+{
+    typename PVValueArray<T>::const_svector values(columnValues<T>(column));
+    NTTableCodec::Encoding encoding = chooseEncoding(values.data(), values.size());
+    vector<epicsUInt8> payload;
+    Output payloadOut(payload);
+    encodeValues(values.data(), values.size(), encoding, payloadOut);
+    out.putByte(static_cast<epicsUInt8>(encoding));
+    out.putVarint(payload.size());
+    if (!payload.empty())
+        memcpy(out.extend(payload.size()), &payload[0], payload.size());
+}
+
+// the fewest bytes of bit packed elements, a base and a width byte per block
+size_t packedSize(size_t count)
+{
+    return (count/blockSize + (count%blockSize != 0))*2;
+}
+
+/*
+ * Whether a payload is large enough for a number of elements. Runs can
+ * be of any length, so they are checked one by one instead.
+ */
+template<typename T>
+bool holdsRows(Input const & in, NTTableCodec::Encoding encoding, size_t rows)
+{
+    size_t size = in.remaining();
+    switch (encoding) {
+    case NTTableCodec::plainEncoding:
+        return rows <= size/plainSize(static_cast<const T *>(0));
+    case NTTableCodec::runLengthEncoding:
+        checkRuns<T>(in, rows);
+        return true;
+    case NTTableCodec::bitPackedEncoding:
+        return packedSize(rows) <= size;
+    case NTTableCodec::deltaEncoding:
+        return rows == 0 || (size > 0 && packedSize(rows - 1) <= size - 1);
+    }
+    return true;
+}
+
+template<typename T>
+void decodeColumn(Input & in, NTTableCodec::Encoding encoding, size_t rows,
+    PVScalarArrayPtr const & column)
+{
+    if (!holdsRows<T>(in, encoding, rows))
+        throw std::runtime_error("NTTable binary form has more rows than a column holds");
+    typename PVValueArray<T>::svector values(rows);
+    decodeValues(in, encoding, values.data(), rows);
+    std::tr1::static_pointer_cast<PVValueArray<T> >(column)->replace(freeze(values));
+}
+
+NTTableCodec::Encoding chooseColumn(ScalarType type, PVScalarArrayPtr const & column)
+{
+    switch (type) {
+    case pvBoolean: return chooseColumn<boolean>(column);
+    case pvByte:    return chooseColumn<int8>(column);
+    case pvShort:   return chooseColumn<int16>(column);
+    case pvInt:     return chooseColumn<int32>(column);
+    case pvLong:    return chooseColumn<int64>(column);
+    case pvUByte:   return chooseColumn<uint8>(column);
+    case pvUShort:  return chooseColumn<uint16>(column);
+    case pvUInt:    return chooseColumn<uint32>(column);
+    case pvULong:   return chooseColumn<uint64>(column);
+    case pvFloat:   return chooseColumn<float>(column);
+    case pvDouble:  return chooseColumn<double>(column);
+    case pvString:  return chooseColumn<string>(column);
+    }
+    throw std::runtime_error("unsupported NTTable column type");
+}
+
+void encodeColumn(ScalarType type, PVScalarArrayPtr const & column, Output & out)
+{
+    switch (type) {
+    case pvBoolean: encodeColumn<boolean>(column, out); break;
+    case pvByte:    encodeColumn<int8>(column, out); break;
+    case pvShort:   encodeColumn<int16>(column, out); break;
+    case pvInt:     encodeColumn<int32>(column, out); break;
+    case pvLong:    encodeColumn<int64>(column, out); break;
+    case pvUByte:   encodeColumn<uint8>(column, out); break;
+    case pvUShort:  encodeColumn<uint16>(column, out); break;
+    case pvUInt:    encodeColumn<uint32>(column, out); break;
+    case pvULong:   encodeColumn<uint64>(column, out); break;
+    case pvFloat:   encodeColumn<float>(column, out); break;
+    case pvDouble:  encodeColumn<double>(column, out); break;
+    case pvString:  encodeColumn<string>(column, out); break;
+    }
+}
+
+void decodeColumn(ScalarType type, Input & in, NTTableCodec::Encoding encoding, size_t rows,
+    PVScalarArrayPtr const & column)
+{
+    switch (type) {
+    case pvBoolean: decodeColumn<boolean>(in, encoding, rows, column); break;
+    case pvByte:    decodeColumn<int8>(in, encoding, rows, column); break;
+    case pvShort:   decodeColumn<int16>(in, encoding, rows, column); break;
+    case pvInt:     decodeColumn<int32>(in, encoding, rows, column); break;
+    case pvLong:    decodeColumn<int64>(in, encoding, rows, column); break;
+    case pvUByte:   decodeColumn<uint8>(in, encoding, rows, column); break;
+    case pvUShort:  decodeColumn<uint16>(in, encoding, rows, column); break;
+    case pvUInt:    decodeColumn<uint32>(in, encoding, rows, column); break;
+    case pvULong:   decodeColumn<uint64>(in, encoding, rows, column); break;
+    case pvFloat:   decodeColumn<float>(in, encoding, rows, column); break;
+    case pvDouble:  decodeColumn<double>(in, encoding, rows, column); break;
+    case pvString:  decodeColumn<string>(in, encoding, rows, column); break;
+    }
+}
+
+// the binary form, up to the payloads of the columns
+
+struct Column
+{
+    string name;
+    string label;
+    ScalarType type;
+    NTTableCodec::Encoding encoding;
+    const epicsUInt8 *payload;
+    size_t payloadSize;
+};
+
+struct Header
+{
+    Header() : flags(0), severity(0), status(0), secondsPastEpoch(0),
+        nanoseconds(0), userTag(0), rows(0) {}
+
+    epicsUInt8 flags;
+    string descriptor;
+    int32 severity;
+    int32 status;
+    string message;
+    int64 secondsPastEpoch;
+    int32 nanoseconds;
+    int32 userTag;
+    size_t rows;
+    vector<Column> columns;
+};
+
+void readHeader(Input & in, Header & header)
+{
+    if (memcmp(in.bytes(sizeof(magic)), magic, sizeof(magic)) != 0)
+        throw std::runtime_error("not an NTTable binary form");
+    if (in.getByte() != version)
+        throw std::runtime_error("unsupported NTTable binary form version");
+
+    header.flags = in.getByte();
+    if (header.flags & hasDescriptor)
+        header.descriptor = in.getString();
+    if (header.flags & hasAlarm) {
+        header.severity = static_cast<int32>(in.getSigned());
+        header.status = static_cast<int32>(in.getSigned());
+        header.message = in.getString();
+    }
+    if (header.flags & hasTimeStamp) {
+        header.secondsPastEpoch = in.getSigned();
+        header.nanoseconds = static_cast<int32>(in.getSigned());
+        header.userTag = static_cast<int32>(in.getSigned());
+    }
+
+    size_t columnCount = static_cast<size_t>(in.getVarint());
+    header.rows = static_cast<size_t>(in.getVarint());
+    for (size_t i = 0; i < columnCount; ++i) {
+        Column column;
+        column.name = in.getString();
+        column.label = in.getString();
+        epicsUInt8 type = in.getByte();
+        epicsUInt8 encoding = in.getByte();
+        if (type > pvString || encoding > NTTableCodec::deltaEncoding)
+            throw std::runtime_error("NTTable binary form has an invalid column");
+        column.type = static_cast<ScalarType>(type);
+        column.encoding = static_cast<NTTableCodec::Encoding>(encoding);
+        column.payloadSize = static_cast<size_t>(in.getVarint());
+        column.payload = in.bytes(column.payloadSize);
+        header.columns.push_back(column);
+    }
+    if (!in.atEnd())
+        throw std::runtime_error("NTTable binary form has trailing bytes");
+}
+
+}
+
+NTTableCodec::Encoding NTTableCodec::chooseEncoding(PVScalarArrayPtr const & column)
+{
+    return chooseColumn(column->getScalarArray()->getElementType(), column);
+}
+
+void NTTableCodec::encode(NTTablePtr const & table, vector<epicsUInt8> & out)
+{
+    StringArray const & names = table->getColumnNames();
+    PVStringArray::const_svector labels(table->getLabels()->view());
+    vector<PVScalarArrayPtr> columns;
+    size_t rows = 0;
+    for (size_t i = 0; i < names.size(); ++i) {
+        PVScalarArrayPtr column = table->getColumn<PVScalarArray>(names[i]);
+        if (!column)
+            throw std::runtime_error("NTTable column is not a scalar array");
+        if (i == 0)
+            rows = column->getLength();
+        else if (column->getLength() != rows)
+            throw std::runtime_error("NTTable columns differ in length");
+        columns.push_back(column);
+    }
+
+    PVStringPtr descriptor = table->getDescriptor();
+    PVStructurePtr alarm = table->getAlarm();
+    PVStructurePtr timeStamp = table->getTimeStamp();
+
+    out.clear();
+    Output output(out);
+    memcpy(output.extend(sizeof(magic)), magic, sizeof(magic));
+    output.putByte(version);
+    output.putByte((descriptor ? hasDescriptor : 0) | (alarm ? hasAlarm : 0) |
+        (timeStamp ? hasTimeStamp : 0));
+    if (descriptor)
+        output.putString(descriptor->get());
+    if (alarm) {
+        output.putSigned(alarm->getSubField<PVInt>("severity")->get());
+        output.putSigned(alarm->getSubField<PVInt>("status")->get());
+        output.putString(alarm->getSubField<PVString>("message")->get());
+    }
+    if (timeStamp) {
+        output.putSigned(timeStamp->getSubField<PVLong>("secondsPastEpoch")->get());
+        output.putSigned(timeStamp->getSubField<PVInt>("nanoseconds")->get());
+        output.putSigned(timeStamp->getSubField<PVInt>("userTag")->get());
+    }
+
+    output.putVarint(columns.size());
+    output.putVarint(rows);
+    for (size_t i = 0; i < columns.size(); ++i) {
+        output.putString(names[i]);
+        output.putString(i < labels.size() ? labels[i] : names[i]);
+        ScalarType type = columns[i]->getScalarArray()->getElementType();
+        output.putByte(static_cast<epicsUInt8>(type));
+        encodeColumn(type, columns[i], output);
+    }
+}
+
+NTTablePtr NTTableCodec::decode(const epicsUInt8 *data, size_t size)
+{
+    Input in(data, data + size);
+    Header header;
+    readHeader(in, header);
+
+    NTTableBuilderPtr builder = NTTable::createBuilder();
+    for (size_t i = 0; i < header.columns.size(); ++i)
+        builder->addColumn(header.columns[i].name, header.columns[i].type);
+    if (header.flags & hasDescriptor)
+        builder->addDescriptor();
+    if (header.flags & hasAlarm)
+        builder->addAlarm();
+    if (header.flags & hasTimeStamp)
+        builder->addTimeStamp();
+    NTTablePtr table = builder->create();
+
+    if (header.flags & hasDescriptor)
+        table->getDescriptor()->put(header.descriptor);
+    if (header.flags & hasAlarm) {
+        PVStructurePtr alarm = table->getAlarm();
+        alarm->getSubField<PVInt>("severity")->put(header.severity);
+        alarm->getSubField<PVInt>("status")->put(header.status);
+        alarm->getSubField<PVString>("message")->put(header.message);
+    }
+    if (header.flags & hasTimeStamp) {
+        PVStructurePtr timeStamp = table->getTimeStamp();
+        timeStamp->getSubField<PVLong>("secondsPastEpoch")->put(header.secondsPastEpoch);
+        timeStamp->getSubField<PVInt>("nanoseconds")->put(header.nanoseconds);
+        timeStamp->getSubField<PVInt>("userTag")->put(header.userTag);
+    }
+
+    PVStringArray::svector labels(header.columns.size());
+    for (size_t i = 0; i < header.columns.size(); ++i) {
+        Column const & column = header.columns[i];
+        labels[i] = column.label;
+        Input payload(column.payload, column.payload + column.payloadSize);
+        decodeColumn(column.type, payload, column.encoding, header.rows,
+            table->getColumn<PVScalarArray>(column.name));
+        if (!payload.atEnd())
+            throw std::runtime_error("NTTable binary form has an invalid column");
+    }
+    table->getLabels()->replace(freeze(labels));
+    return table;
+}
+
+NTTablePtr NTTableCodec::decode(vector<epicsUInt8> const & data)
+{
+    return decode(data.empty() ? 0 : &data[0], data.size());
+}
+
+vector<NTTableCodec::Encoding> NTTableCodec::getEncodings(vector<epicsUInt8> const & data)
+{
+    Input in(data.empty() ? 0 : &data[0], data.empty() ? 0 : &data[0] + data.size());
+    Header header;
+    readHeader(in, header);
+    vector<Encoding> encodings;
+    for (size_t i = 0; i < header.columns.size(); ++i)
+        encodings.push_back(header.columns[i].encoding);
+    return encodings;
+}
+
+}}
@@ -0,0 +1,257 @@
+/* nttableDictionary.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <epicsGuard.h>
+
+#define epicsExportSharedSymbols
+#include <pv/nttableDictionary.h>
+
+#include "hashValue.h"
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+using namespace detail;
+
+namespace {
+
+typedef epicsGuard<epicsMutex> Guard;
+
+// the size of the hash table of a new dictionary, a power of two
+const size_t initialSlots = 16;
+
+}
+
+NTStringDictionary::shared_pointer NTStringDictionary::create()
+{
+    return shared_pointer(new NTStringDictionary());
+}
+
+NTStringDictionary::NTStringDictionary() :
+    slots(initialSlots, -1)
+{
+}
+
+int32 NTStringDictionary::encode(string const & value)
+{
+    int32 code;
+    encode(&value, 1, &code);
+    return code;
+}
+
+void NTStringDictionary::encode(string const *values, size_t count, int32 *codes)
+{
+    Guard G(mutex);
+    int32 last = -1;
+    for (size_t i = 0; i < count; ++i) {
+        // runs of equal strings are common, and cost no lookup
+        if (last >= 0 && this->values[last] == values[i]) {
+            codes[i] = last;
+            continue;
+        }
+        size_t s = slot(values[i]);
+        last = slots[s];
+        if (last < 0) {
+            last = slots[s] = static_cast<int32>(this->values.size());
+            this->values.push_back(values[i]);
+            if (2*this->values.size() > slots.size())
+                grow();
+        }
+        codes[i] = last;
+    }
+}
+
+// the slot holding the code of value, or the empty slot it would go to
+size_t NTStringDictionary::slot(string const & value) const
+{
+    const size_t mask = slots.size() - 1;
+    size_t s = hashValue(value) & mask;
+    while (slots[s] >= 0 && values[slots[s]] != value)
+        s = (s + 1) & mask;
+    return s;
+}
+
+// doubles the table, keeping it at most half full
+void NTStringDictionary::grow()
+{
+    slots.assign(2*slots.size(), -1);
+    const size_t mask = slots.size() - 1;
+    for (size_t code = 0; code < values.size(); ++code) {
+        size_t s = hashValue(values[code]) & mask;
+        while (slots[s] >= 0)
+            s = (s + 1) & mask;
+        slots[s] = static_cast<int32>(code);
+    }
+}
+
+int32 NTStringDictionary::find(string const & value) const
+{
+    Guard G(mutex);
+    return slots[slot(value)];
+}
+
+string NTStringDictionary::decode(int32 code) const
+{
+    string value;
+    decode(&code, 1, &value);
+    return value;
+}
+
+void NTStringDictionary::decode(int32 const *codes, size_t count, string *values) const
+{
+    Guard G(mutex);
+    for (size_t i = 0; i < count; ++i) {
+        if (codes[i] < 0 || static_cast<size_t>(codes[i]) >= this->values.size())
+            throw std::runtime_error("no such code in NTStringDictionary");
+        values[i] = this->values[codes[i]];
+    }
+}
+
+size_t NTStringDictionary::size() const
+{
+    Guard G(mutex);
+    return values.size();
+}
+
+NTTableDictionary::shared_pointer NTTableDictionary::create(NTTablePtr const & table,
+    vector<string> const & columns, NTStringDictionaryPtr const & dictionary)
+{
+    return shared_pointer(new NTTableDictionary(table, columns,
+        dictionary ? dictionary : NTStringDictionary::create()));
+}
+
+NTTableDictionary::NTTableDictionary(NTTablePtr const & table, vector<string> const & columns,
+    NTStringDictionaryPtr const & dictionary) :
+    dictionary(dictionary),
+    columns(columns),
+    rows(0)
+{
+    StringArray const & names = table->getColumnNames();
+    if (this->columns.empty()) {
+        for (size_t i = 0; i < names.size(); ++i)
+            if (table->getColumn<PVStringArray>(names[i]))
+                this->columns.push_back(names[i]);
+    }
+    for (size_t i = 0; i < names.size(); ++i) {
+        PVScalarArrayPtr column = table->getColumn<PVScalarArray>(names[i]);
+        if (!column)
+            throw std::runtime_error("NTTable column is not a scalar array");
+        if (i == 0)
+            rows = column->getLength();
+        else if (column->getLength() != rows)
+            throw std::runtime_error("NTTable columns differ in length");
+    }
+
+    // the table without the strings of the encoded columns, sharing the rest
+    this->table = NTTable::wrapUnsafe(getPVDataCreate()->createPVStructure(table->getPVStructure()));
+
+    for (size_t i = 0; i < this->columns.size(); ++i) {
+        PVStringArrayPtr column = table->getColumn<PVStringArray>(this->columns[i]);
+        if (!column)
+            throw std::runtime_error("NTTable has no string column " + this->columns[i]);
+        PVStringArray::const_svector values(column->view());
+        shared_vector<int32> columnCodes(values.size());
+        dictionary->encode(values.data(), values.size(), columnCodes.data());
+        codes.push_back(freeze(columnCodes));
+        this->table->getColumn<PVStringArray>(this->columns[i])->replace(PVStringArray::const_svector());
+    }
+}
+
+NTStringDictionaryPtr NTTableDictionary::getDictionary() const
+{
+    return dictionary;
+}
+
+vector<string> const & NTTableDictionary::getEncodedColumns() const
+{
+    return columns;
+}
+
+bool NTTableDictionary::isEncoded(string const & column) const
+{
+    return std::find(columns.begin(), columns.end(), column) != columns.end();
+}
+
+size_t NTTableDictionary::getRowCount() const
+{
+    return rows;
+}
+
+size_t NTTableDictionary::getColumnIndex(string const & column) const
+{
+    for (size_t i = 0; i < columns.size(); ++i)
+        if (columns[i] == column)
+            return i;
+    throw std::runtime_error("NTTable column " + column + " is not encoded");
+}
+
+shared_vector<const int32> NTTableDictionary::getCodes(string const & column) const
+{
+    return codes[getColumnIndex(column)];
+}
+
+PVStringArray::const_svector NTTableDictionary::getValues(string const & column) const
+{
+    shared_vector<const int32> const & columnCodes = codes[getColumnIndex(column)];
+    PVStringArray::svector values(columnCodes.size());
+    dictionary->decode(columnCodes.data(), columnCodes.size(), values.data());
+    return freeze(values);
+}
+
+vector<size_t> NTTableDictionary::findEqual(string const & column, string const & value) const
+{
+    shared_vector<const int32> const & columnCodes = codes[getColumnIndex(column)];
+    vector<size_t> found;
+    int32 code = dictionary->find(value);
+    if (code < 0)
+        return found;
+    for (size_t i = 0; i < columnCodes.size(); ++i)
+        if (columnCodes[i] == code)
+            found.push_back(i);
+    return found;
+}
+
+void NTTableDictionary::groupBy(string const & column, vector<string> & keys,
+    vector<vector<size_t> > & groups) const
+{
+    shared_vector<const int32> const & columnCodes = codes[getColumnIndex(column)];
+    keys.clear();
+    groups.clear();
+
+    // the group of each code, the codes used by this column being known
+    int32 maximum = -1;
+    for (size_t i = 0; i < columnCodes.size(); ++i)
+        maximum = std::max(maximum, columnCodes[i]);
+    vector<size_t> group(static_cast<size_t>(maximum + 1), static_cast<size_t>(-1));
+    vector<int32> groupCodes;
+    for (size_t i = 0; i < columnCodes.size(); ++i) {
+        size_t & g = group[columnCodes[i]];
+        if (g == static_cast<size_t>(-1)) {
+            g = groups.size();
+            groups.push_back(vector<size_t>());
+            groupCodes.push_back(columnCodes[i]);
+        }
+        groups[g].push_back(i);
+    }
+    keys.resize(groupCodes.size());
+    if (!groupCodes.empty())
+        dictionary->decode(&groupCodes[0], groupCodes.size(), &keys[0]);
+}
+
+NTTablePtr NTTableDictionary::toNTTable() const
+{
+    NTTablePtr plain = NTTable::wrapUnsafe(getPVDataCreate()->createPVStructure(table->getPVStructure()));
+    for (size_t i = 0; i < columns.size(); ++i)
+        plain->getColumn<PVStringArray>(columns[i])->replace(getValues(columns[i]));
+    return plain;
+}
+
+}}
@@ -0,0 +1,567 @@
+/* nttableIndex.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include <epicsGuard.h>
+#include <epicsThread.h>
+
+#define epicsExportSharedSymbols
+#include <pv/nttableIndex.h>
+
+#include "hashValue.h"
+#include "parallelParts.h"
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+using namespace detail;
+
+/*
+ * The index of a column, for one array of the column. Lookups with keys
+ * of the wrong type are rejected here and accepted by the subclasses.
+ */
+class NTTableIndex::Column
+{
+public:
+    virtual ~Column() {}
+
+    virtual bool isCurrent(PVScalarArrayPtr const & column) const = 0;
+
+    virtual void find(double, vector<size_t> &) const
+    {
+        throw std::runtime_error("NTTable column holds strings");
+    }
+
+    virtual void find(string const &, vector<size_t> &) const
+    {
+        throw std::runtime_error("NTTable column does not hold strings");
+    }
+
+    virtual void findRange(double, double, vector<size_t> &) const
+    {
+        throw std::runtime_error("NTTable column holds strings");
+    }
+
+    virtual void findRange(string const &, string const &, vector<size_t> &) const
+    {
+        throw std::runtime_error("NTTable column does not hold strings");
+    }
+};
+
+namespace {
+
+typedef epicsGuard<epicsMutex> Guard;
+
+// ranges smaller than this are not worth a thread
+const size_t minimumPartSize = 16*1024;
+
+// the order of a sorted index, NaN after everything else
+
+template<typename T>
+inline bool isNaN(T const &)
+{
+    return false;
+}
+
+inline bool isNaN(double value)
+{
+    return value != value;
+}
+
+inline bool isNaN(float value)
+{
+    return value != value;
+}
+
+template<typename T>
+struct RowLess
+{
+    explicit RowLess(T const *values) : values(values) {}
+
+    bool operator()(size_t a, size_t b) const
+    {
+        if (values[a] < values[b])
+            return true;
+        if (values[b] < values[a])
+            return false;
+        if (isNaN(values[a]) != isNaN(values[b]))
+            return isNaN(values[b]);
+        return a < b;
+    }
+
+    T const *values;
+};
+
+// comparison of the elements with range bounds
+
+template<typename T>
+inline double boundValue(T value)
+{
+    return static_cast<double>(value);
+}
+
+inline string const & boundValue(string const & value)
+{
+    return value;
+}
+
+template<typename T, typename B>
+struct BelowBound
+{
+    explicit BelowBound(T const *values) : values(values) {}
+
+    bool operator()(size_t row, B const & bound) const
+    {
+        return boundValue(values[row]) < bound;
+    }
+
+    bool operator()(B const & bound, size_t row) const
+    {
+        return bound < boundValue(values[row]);
+    }
+
+    T const *values;
+};
+
+// a key, told apart from a row when the elements are size_t
+template<typename T>
+struct Key
+{
+    explicit Key(T const & value) : value(value) {}
+    T const & value;
+};
+
+template<typename T>
+struct KeyLess
+{
+    explicit KeyLess(T const *values) : values(values) {}
+
+    bool operator()(size_t row, Key<T> const & key) const
+    {
+        return values[row] < key.value;
+    }
+
+    bool operator()(Key<T> const & key, size_t row) const
+    {
+        return key.value < values[row];
+    }
+
+    T const *values;
+};
+
+// conversion of numeric keys to the element type
+
+template<typename T>
+bool convertKey(double key, T & value)
+{
+    if (!(key >= static_cast<double>(numeric_limits<T>::min()) &&
+          key < static_cast<double>(numeric_limits<T>::max()) + 1.0))
+        return false;
+    value = static_cast<T>(key);
+    return static_cast<double>(value) == key;
+}
+
+bool convertKey(double key, boolean & value)
+{
+    value = key != 0;
+    return key == 0 || key == 1;
+}
+
+bool convertKey(double key, float & value)
+{
+    value = static_cast<float>(key);
+    return key == key;
+}
+
+bool convertKey(double key, double & value)
+{
+    value = key;
+    return key == key;
+}
+
+template<typename T>
+class TypedColumn : public NTTableIndex::Column
+{
+public:
+    typedef typename PVValueArray<T>::const_svector const_svector;
+
+    TypedColumn(PVScalarArrayPtr const & column, NTTableIndex::Kind kind,
+        NTNDArrayTilerPtr & tiler, size_t threadCount) :
+        values(std::tr1::static_pointer_cast<PVValueArray<T> >(column)->view()),
+        kind(kind), mask(0), ordered(0)
+    {
+        size_t count = values.size();
+        size_t parts = std::max<size_t>(std::min(threadCount, count/minimumPartSize), 1);
+        if (kind == NTTableIndex::hashIndex)
+            buildHash(tiler, threadCount, parts);
+        else
+            buildSorted(tiler, threadCount, parts);
+    }
+
+    virtual bool isCurrent(PVScalarArrayPtr const & column) const
+    {
+        const_svector current(std::tr1::static_pointer_cast<PVValueArray<T> >(column)->view());
+        return current.data() == values.data() && current.size() == values.size();
+    }
+
+protected:
+    void lookup(T const & key, vector<size_t> & found) const
+    {
+        if (isNaN(key))
+            return;
+        if (kind == NTTableIndex::hashIndex) {
+            size_t bucket = hashValue(key) & mask;
+            for (size_t i = offsets[bucket]; i < offsets[bucket + 1]; ++i)
+                if (values[rows[i]] == key)
+                    found.push_back(rows[i]);
+        } else {
+            KeyLess<T> compare(values.data());
+            vector<size_t>::const_iterator first = std::lower_bound(rows.begin(),
+                rows.begin() + ordered, Key<T>(key), compare);
+            vector<size_t>::const_iterator last = std::upper_bound(first,
+                rows.begin() + ordered, Key<T>(key), compare);
+            found.assign(first, last);
+        }
+    }
+
+    template<typename B>
+    void range(B const & low, B const & high, vector<size_t> & found) const
+    {
+        if (kind != NTTableIndex::sortedIndex)
+            throw std::runtime_error("range lookups need a sorted NTTable index");
+        BelowBound<T, B> compare(values.data());
+        vector<size_t>::const_iterator first = std::lower_bound(rows.begin(),
+            rows.begin() + ordered, low, compare);
+        vector<size_t>::const_iterator last = std::upper_bound(first,
+            rows.begin() + ordered, high, compare);
+        if (first < last)
+            found.assign(first, last);
+    }
+
+private:
+    struct HashTask : public ParallelTask
+    {
+        HashTask(const_svector const & values, vector<uint64> & hashes, size_t parts) :
+            values(values), hashes(hashes), parts(parts) {}
+
+        virtual void run(size_t part)
+        {
+            size_t begin = values.size()*part/parts;
+            size_t end = values.size()*(part + 1)/parts;
+            for (size_t i = begin; i < end; ++i)
+                hashes[i] = hashValue(values[i]);
+        }
+
+        const_svector const & values;
+        vector<uint64> & hashes;
+        size_t parts;
+    };
+
+    struct SortTask : public ParallelTask
+    {
+        SortTask(T const *values, vector<size_t> & rows, vector<size_t> const & runs) :
+            values(values), rows(rows), runs(runs), sorting(true), step(1) {}
+
+        // sorts run part, or merges the runs part*2*step and part*2*step + step
+        virtual void run(size_t part)
+        {
+            RowLess<T> less(values);
+            if (sorting) {
+                std::sort(rows.begin() + runs[part], rows.begin() + runs[part + 1], less);
+            } else {
+                size_t first = part*2*step;
+                size_t middle = std::min(first + step, runs.size() - 1);
+                size_t last = std::min(first + 2*step, runs.size() - 1);
+                std::inplace_merge(rows.begin() + runs[first], rows.begin() + runs[middle],
+                    rows.begin() + runs[last], less);
+            }
+        }
+
+        T const *values;
+        vector<size_t> & rows;
+        vector<size_t> const & runs;
+        bool sorting;
+        size_t step;
+    };
+
+    void buildHash(NTNDArrayTilerPtr & tiler, size_t threadCount, size_t parts)
+    {
+        size_t count = values.size();
+        vector<uint64> hashes(count);
+        HashTask task(values, hashes, parts);
+        runParallel(tiler, threadCount, task, parts);
+
+        size_t bucketCount = 1;
+        while (bucketCount < count)
+            bucketCount *= 2;
+        mask = bucketCount - 1;
+
+        // the rows grouped by bucket, in ascending order within a bucket
+        offsets.assign(bucketCount + 1, 0);
+        for (size_t i = 0; i < count; ++i)
+            ++offsets[(hashes[i] & mask) + 1];
+        for (size_t b = 0; b < bucketCount; ++b)
+            offsets[b + 1] += offsets[b];
+        vector<size_t> next(offsets.begin(), offsets.end() - 1);
+        rows.resize(count);
+        for (size_t i = 0; i < count; ++i)
+            rows[next[hashes[i] & mask]++] = i;
+    }
+
+    void buildSorted(NTNDArrayTilerPtr & tiler, size_t threadCount, size_t parts)
+    {
+        size_t count = values.size();
+        rows.resize(count);
+        for (size_t i = 0; i < count; ++i)
+            rows[i] = i;
+
+        vector<size_t> runs(parts + 1);
+        for (size_t part = 0; part <= parts; ++part)
+            runs[part] = count*part/parts;
+
+        SortTask task(values.data(), rows, runs);
+        runParallel(tiler, threadCount, task, parts);
+        task.sorting = false;
+        for (; task.step < parts; task.step *= 2)
+            runParallel(tiler, threadCount, task, (parts + 2*task.step - 1)/(2*task.step));
+
+        ordered = count;
+        while (ordered > 0 && isNaN(values[rows[ordered - 1]]))
+            --ordered;
+    }
+
+    const_svector values;
+    NTTableIndex::Kind kind;
+    vector<size_t> rows;
+    vector<size_t> offsets;
+    size_t mask;
+    size_t ordered;
+};
+
+template<typename T>
+class NumericColumn : public TypedColumn<T>
+{
+public:
+    NumericColumn(PVScalarArrayPtr const & column, NTTableIndex::Kind kind,
+        NTNDArrayTilerPtr & tiler, size_t threadCount) :
+        TypedColumn<T>(column, kind, tiler, threadCount) {}
+
+    virtual void find(double key, vector<size_t> & found) const
+    {
+        T value;
+        if (convertKey(key, value))
+            this->lookup(value, found);
+    }
+
+    virtual void findRange(double low, double high, vector<size_t> & found) const
+    {
+        this->range(low, high, found);
+    }
+};
+
+class StringColumn : public TypedColumn<string>
+{
+public:
+    StringColumn(PVScalarArrayPtr const & column, NTTableIndex::Kind kind,
+        NTNDArrayTilerPtr & tiler, size_t threadCount) :
+        TypedColumn<string>(column, kind, tiler, threadCount) {}
+
+    virtual void find(string const & key, vector<size_t> & found) const
+    {
+        lookup(key, found);
+    }
+
+    virtual void findRange(string const & low, string const & high, vector<size_t> & found) const
+    {
+        range(low, high, found);
+    }
+};
+
+NTTableIndex::Column *createColumn(PVScalarArrayPtr const & column,
+    NTTableIndex::Kind kind, NTNDArrayTilerPtr & tiler, size_t threadCount)
+{
+    switch (column->getScalarArray()->getElementType()) {
+    case pvBoolean: return new NumericColumn<boolean>(column, kind, tiler, threadCount);
+    case pvByte:    return new NumericColumn<int8>(column, kind, tiler, threadCount);
+    case pvShort:   return new NumericColumn<int16>(column, kind, tiler, threadCount);
+    case pvInt:     return new NumericColumn<int32>(column, kind, tiler, threadCount);
+    case pvLong:    return new NumericColumn<int64>(column, kind, tiler, threadCount);
+    case pvUByte:   return new NumericColumn<uint8>(column, kind, tiler, threadCount);
+    case pvUShort:  return new NumericColumn<uint16>(column, kind, tiler, threadCount);
+    case pvUInt:    return new NumericColumn<uint32>(column, kind, tiler, threadCount);
+    case pvULong:   return new NumericColumn<uint64>(column, kind, tiler, threadCount);
+    case pvFloat:   return new NumericColumn<float>(column, kind, tiler, threadCount);
+    case pvDouble:  return new NumericColumn<double>(column, kind, tiler, threadCount);
+    case pvString:  return new StringColumn(column, kind, tiler, threadCount);
+    }
+    throw std::runtime_error("unsupported NTTable column type");
+}
+
+template<typename T>
+void gather(PVScalarArrayPtr const & source, vector<size_t> const & rows,
+    PVScalarArrayPtr const & destination)
+{
+    typename PVValueArray<T>::const_svector values(
+        std::tr1::static_pointer_cast<PVValueArray<T> >(source)->view());
+    typename PVValueArray<T>::svector selected(rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        if (rows[i] >= values.size())
+            throw std::runtime_error("no such NTTable row");
+        selected[i] = values[rows[i]];
+    }
+    std::tr1::static_pointer_cast<PVValueArray<T> >(destination)->replace(freeze(selected));
+}
+
+void gather(ScalarType type, PVScalarArrayPtr const & source, vector<size_t> const & rows,
+    PVScalarArrayPtr const & destination)
+{
+    switch (type) {
+    case pvBoolean: gather<boolean>(source, rows, destination); break;
+    case pvByte:    gather<int8>(source, rows, destination); break;
+    case pvShort:   gather<int16>(source, rows, destination); break;
+    case pvInt:     gather<int32>(source, rows, destination); break;
+    case pvLong:    gather<int64>(source, rows, destination); break;
+    case pvUByte:   gather<uint8>(source, rows, destination); break;
+    case pvUShort:  gather<uint16>(source, rows, destination); break;
+    case pvUInt:    gather<uint32>(source, rows, destination); break;
+    case pvULong:   gather<uint64>(source, rows, destination); break;
+    case pvFloat:   gather<float>(source, rows, destination); break;
+    case pvDouble:  gather<double>(source, rows, destination); break;
+    case pvString:  gather<string>(source, rows, destination); break;
+    }
+}
+
+}
+
+NTTableIndex::shared_pointer NTTableIndex::create(NTTablePtr const & table,
+    string const & column, Kind kind, size_t threadCount)
+{
+    return shared_pointer(new NTTableIndex(table, column, kind, threadCount));
+}
+
+NTTableIndex::NTTableIndex(NTTablePtr const & table, string const & column,
+    Kind kind, size_t threadCount) :
+    table(table),
+    column(column),
+    kind(kind),
+    threadCount(threadCount),
+    buildCount(0)
+{
+    if (this->threadCount == 0)
+        this->threadCount = std::max(epicsThreadGetCPUs(), 1);
+    build();
+}
+
+void NTTableIndex::build()
+{
+    PVScalarArrayPtr pvColumn = table->getColumn<PVScalarArray>(column);
+    if (!pvColumn)
+        throw std::runtime_error("no NTTable scalar array column " + column);
+    index.reset(createColumn(pvColumn, kind, tiler, threadCount));
+    ++buildCount;
+}
+
+NTTableIndex::Column const & NTTableIndex::current()
+{
+    if (!index->isCurrent(table->getColumn<PVScalarArray>(column)))
+        build();
+    return *index;
+}
+
+NTTableIndex::Kind NTTableIndex::getKind() const
+{
+    return kind;
+}
+
+string NTTableIndex::getColumn() const
+{
+    return column;
+}
+
+bool NTTableIndex::isValid() const
+{
+    Guard G(mutex);
+    return index->isCurrent(table->getColumn<PVScalarArray>(column));
+}
+
+size_t NTTableIndex::getBuildCount() const
+{
+    Guard G(mutex);
+    return buildCount;
+}
+
+void NTTableIndex::rebuild()
+{
+    Guard G(mutex);
+    build();
+}
+
+vector<size_t> NTTableIndex::find(double key)
+{
+    vector<size_t> rows;
+    Guard G(mutex);
+    current().find(key, rows);
+    return rows;
+}
+
+vector<size_t> NTTableIndex::find(string const & key)
+{
+    vector<size_t> rows;
+    Guard G(mutex);
+    current().find(key, rows);
+    return rows;
+}
+
+vector<size_t> NTTableIndex::findRange(double low, double high)
+{
+    vector<size_t> rows;
+    Guard G(mutex);
+    current().findRange(low, high, rows);
+    return rows;
+}
+
+vector<size_t> NTTableIndex::findRange(string const & low, string const & high)
+{
+    vector<size_t> rows;
+    Guard G(mutex);
+    current().findRange(low, high, rows);
+    return rows;
+}
+
+NTTablePtr NTTableIndex::project(NTTablePtr const & table, vector<size_t> const & rows,
+    vector<string> const & columns)
+{
+    StringArray const & names = table->getColumnNames();
+    PVStringArray::const_svector labels(table->getLabels()->view());
+    vector<string> const & selected = columns.empty() ? names : columns;
+
+    NTTableBuilderPtr builder = NTTable::createBuilder();
+    vector<PVScalarArrayPtr> sources;
+    PVStringArray::svector selectedLabels(selected.size());
+    for (size_t i = 0; i < selected.size(); ++i) {
+        PVScalarArrayPtr source = table->getColumn<PVScalarArray>(selected[i]);
+        if (!source)
+            throw std::runtime_error("no NTTable scalar array column " + selected[i]);
+        size_t position = std::find(names.begin(), names.end(), selected[i]) - names.begin();
+        selectedLabels[i] = position < labels.size() ? labels[position] : selected[i];
+        builder->addColumn(selected[i], source->getScalarArray()->getElementType());
+        sources.push_back(source);
+    }
+
+    NTTablePtr result = builder->create();
+    result->getLabels()->replace(freeze(selectedLabels));
+    for (size_t i = 0; i < selected.size(); ++i)
+        gather(sources[i]->getScalarArray()->getElementType(), sources[i], rows,
+            result->getColumn<PVScalarArray>(selected[i]));
+    return result;
+}
+
+}}
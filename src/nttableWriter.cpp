@@ -0,0 +1,158 @@
+/* nttableWriter.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <stdexcept>
+
+#define epicsExportSharedSymbols
+#include <pv/nttableWriter.h>
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt {
+
+using namespace detail;
+
+namespace {
+
+NTTableWriterColumn::shared_pointer createColumn(ScalarType type)
+{
+    switch (type) {
+    case pvBoolean: return NTTableWriterColumn::shared_pointer(new NTTableWriterTypedColumn<boolean>());
+    case pvByte:    return NTTableWriterColumn::shared_pointer(new NTTableWriterTypedColumn<int8>());
+    case pvShort:   return NTTableWriterColumn::shared_pointer(new NTTableWriterTypedColumn<int16>());
+    case pvInt:     return NTTableWriterColumn::shared_pointer(new NTTableWriterTypedColumn<int32>());
+    case pvLong:    return NTTableWriterColumn::shared_pointer(new NTTableWriterTypedColumn<int64>());
+    case pvUByte:   return NTTableWriterColumn::shared_pointer(new NTTableWriterTypedColumn<uint8>());
+    case pvUShort:  return NTTableWriterColumn::shared_pointer(new NTTableWriterTypedColumn<uint16>());
+    case pvUInt:    return NTTableWriterColumn::shared_pointer(new NTTableWriterTypedColumn<uint32>());
+    case pvULong:   return NTTableWriterColumn::shared_pointer(new NTTableWriterTypedColumn<uint64>());
+    case pvFloat:   return NTTableWriterColumn::shared_pointer(new NTTableWriterTypedColumn<float>());
+    case pvDouble:  return NTTableWriterColumn::shared_pointer(new NTTableWriterTypedColumn<double>());
+    case pvString:  return NTTableWriterColumn::shared_pointer(new NTTableWriterTypedColumn<string>());
+    }
+    throw std::runtime_error("unsupported NTTable column type");
+}
+
+}
+
+NTTableWriter::shared_pointer NTTableWriter::create(NTTablePtr const & prototype, size_t capacity)
+{
+    return shared_pointer(new NTTableWriter(prototype, capacity));
+}
+
+NTTableWriter::NTTableWriter(NTTablePtr const & prototype, size_t capacity) :
+    structure(prototype->getPVStructure()->getStructure()),
+    columnNames(prototype->getColumnNames()),
+    labels(prototype->getLabels()->view()),
+    rows(0)
+{
+    for (size_t i = 0; i < columnNames.size(); ++i) {
+        PVScalarArrayPtr column = prototype->getColumn<PVScalarArray>(columnNames[i]);
+        if (!column)
+            throw std::runtime_error("NTTable column is not a scalar array");
+        columns.push_back(createColumn(column->getScalarArray()->getElementType()));
+    }
+    reserve(capacity);
+}
+
+size_t NTTableWriter::getColumnCount() const
+{
+    return columns.size();
+}
+
+size_t NTTableWriter::getColumnIndex(string const & name) const
+{
+    for (size_t i = 0; i < columnNames.size(); ++i)
+        if (columnNames[i] == name)
+            return i;
+    throw std::runtime_error("no NTTable column " + name);
+}
+
+size_t NTTableWriter::getRowCount() const
+{
+    return rows;
+}
+
+size_t NTTableWriter::getCapacity() const
+{
+    size_t capacity = columns.empty() ? 0 : columns[0]->capacity();
+    for (size_t i = 1; i < columns.size(); ++i)
+        capacity = std::min(capacity, columns[i]->capacity());
+    return capacity;
+}
+
+void NTTableWriter::reserve(size_t rows)
+{
+    for (size_t i = 0; i < columns.size(); ++i)
+        columns[i]->reserve(rows);
+}
+
+void NTTableWriter::appendValue(size_t column, double value)
+{
+    if (column >= columns.size())
+        throw std::runtime_error("no such NTTable column");
+    columns[column]->appendDouble(value);
+}
+
+void NTTableWriter::appendValue(size_t column, string const & value)
+{
+    if (column >= columns.size())
+        throw std::runtime_error("no such NTTable column");
+    columns[column]->appendString(value);
+}
+
+void NTTableWriter::endRow()
+{
+    bool complete = true;
+    for (size_t i = 0; i < columns.size(); ++i)
+        complete = complete && columns[i]->size == rows + 1;
+    if (!complete) {
+        for (size_t i = 0; i < columns.size(); ++i)
+            columns[i]->size = rows;
+        throw std::runtime_error("NTTable row has not one value per column");
+    }
+    ++rows;
+}
+
+void NTTableWriter::appendRows(NTTablePtr const & table)
+{
+    vector<PVScalarArrayPtr> sources(columns.size());
+    size_t count = 0;
+    for (size_t i = 0; i < columns.size(); ++i) {
+        sources[i] = table->getColumn<PVScalarArray>(columnNames[i]);
+        if (!sources[i])
+            throw std::runtime_error("NTTable has no column " + columnNames[i]);
+        if (i == 0)
+            count = sources[i]->getLength();
+        else if (sources[i]->getLength() != count)
+            throw std::runtime_error("NTTable columns differ in length");
+    }
+
+    for (size_t i = 0; i < columns.size(); ++i) {
+        columns[i]->size = rows;
+        columns[i]->appendArray(sources[i]);
+    }
+    rows += count;
+}
+
+NTTablePtr NTTableWriter::snapshot() const
+{
+    NTTablePtr table = NTTable::wrapUnsafe(getPVDataCreate()->createPVStructure(structure));
+    table->getLabels()->replace(labels);
+    for (size_t i = 0; i < columns.size(); ++i)
+        columns[i]->publish(table->getColumn<PVScalarArray>(columnNames[i]), rows);
+    return table;
+}
+
+void NTTableWriter::clear()
+{
+    for (size_t i = 0; i < columns.size(); ++i)
+        columns[i]->clear();
+    rows = 0;
+}
+
+}}
@@ -0,0 +1,66 @@
+/* parallelParts.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef PARALLELPARTS_H
+#define PARALLELPARTS_H
+
+#include <vector>
+
+#include <pv/ntndarrayTiler.h>
+
+namespace epics { namespace nt { namespace detail {
+
+/*
+ * Work split into parts, run on the threads of a tiler.
+ */
+class ParallelTask
+{
+public:
+    virtual ~ParallelTask() {}
+    virtual void run(std::size_t part) = 0;
+};
+
+// runs the part given by the row of a tile
+class PartKernel : public NTNDArrayKernel
+{
+public:
+    explicit PartKernel(ParallelTask & task) : task(task) {}
+
+    virtual void apply(NTNDArrayTile const & tile)
+    {
+        task.run(tile.y);
+    }
+
+private:
+    ParallelTask & task;
+};
+
+/*
+ * Runs the parts of a task on the calling thread and the workers of a
+ * tiler, created with threadCount threads when first needed and kept
+ * for later tasks.
+ * Throws std::runtime_error if a part threw an exception.
+ */
+inline void runParallel(NTNDArrayTilerPtr & tiler, std::size_t threadCount,
+    ParallelTask & task, std::size_t parts)
+{
+    if (parts <= 1 || threadCount <= 1) {
+        for (std::size_t part = 0; part < parts; ++part)
+            task.run(part);
+        return;
+    }
+
+    if (!tiler)
+        tiler = NTNDArrayTiler::create(threadCount);
+    std::vector<NTNDArrayTile> tiles(parts, NTNDArrayTile());
+    for (std::size_t part = 0; part < parts; ++part)
+        tiles[part].y = part;
+    PartKernel kernel(task);
+    tiler->run(tiles, kernel);
+}
+
+}}}
+
+#endif  /* PARALLELPARTS_H */
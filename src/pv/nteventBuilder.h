@@ -0,0 +1,270 @@
+/* nteventBuilder.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTEVENTBUILDER_H
+#define NTEVENTBUILDER_H
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef epicsExportSharedSymbols
+#   define nteventBuilderEpicsExportSharedSymbols
+#   undef epicsExportSharedSymbols
+#endif
+
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+#include <pv/pvData.h>
+
+#ifdef nteventBuilderEpicsExportSharedSymbols
+#   define epicsExportSharedSymbols
+#	undef nteventBuilderEpicsExportSharedSymbols
+#endif
+
+#include <pv/ntscalarMultiChannel.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTEventBuilder;
+typedef std::tr1::shared_ptr<NTEventBuilder> NTEventBuilderPtr;
+
+/**
+ * @brief Builds NTScalarMultiChannel snapshots of channels aligned in time.
+ *
+ * Timestamped samples of each channel are kept in a history of the
+ * last depth samples, sorted by time. A snapshot holds the value of
+ * every channel at one time, interpolated from the samples around it:
+ * the nearest sample, the previous sample, or linearly between the two.
+ * At either end of the history of a channel, linear interpolation holds
+ * the nearest sample. A channel without a sample to take a value from
+ * is not connected in the snapshot and its value is 0.
+ *
+ * The samples around the time are looked up per channel by bisection,
+ * then all channels are interpolated in a single loop.
+ *
+ * Events are snapshots at trigger times. They are built once every
+ * channel has a sample at or after the trigger time, so that the
+ * samples around it are known, or when the trigger has waited for the
+ * timeout; channels without a sample at or after the time are then not
+ * connected in the event. At most maxPending triggers wait, a trigger
+ * beyond that drops the oldest one. The builder can be used from
+ * several threads at once.
+ */
+class epicsShareClass NTEventBuilder
+{
+public:
+    POINTER_DEFINITIONS(NTEventBuilder);
+
+    /**
+     * How the value of a channel at a time is taken from its samples.
+     */
+    enum Interpolation {
+        nearest,   ///< the sample closest in time, the earlier one of two as close
+        previous,  ///< the last sample at or before the time
+        linear     ///< linear between the samples before and after the time
+    };
+
+    /**
+     * Creates an event builder.
+     * @param channelNames the names of the channels.
+     * @param valueType the value type of the snapshots.
+     * @param depth the number of samples kept per channel.
+     * @param timeout the time in seconds a trigger waits for the samples of all channels.
+     * @param maxPending the maximum number of waiting triggers.
+     * @return the event builder.
+     * @throws std::runtime_error if there are no channels, depth or
+     *         maxPending is 0 or valueType is not numeric.
+     */
+    static shared_pointer create(std::vector<std::string> const & channelNames,
+        epics::pvData::ScalarType valueType = epics::pvData::pvDouble,
+        std::size_t depth = 256, double timeout = 1.0, std::size_t maxPending = 1024);
+
+    /**
+     * Sets the interpolation of a channel, nearest by default.
+     * @param channel the channel, 0 to getChannelCount() - 1.
+     * @param interpolation the interpolation.
+     * @throws std::runtime_error if the channel does not exist.
+     */
+    void setInterpolation(std::size_t channel, Interpolation interpolation);
+
+    /**
+     * Returns the interpolation of a channel.
+     * @param channel the channel, 0 to getChannelCount() - 1.
+     * @return the interpolation.
+     * @throws std::runtime_error if the channel does not exist.
+     */
+    Interpolation getInterpolation(std::size_t channel) const;
+
+    /**
+     * Adds a sample of a channel. A sample at the time of an earlier one
+     * replaces it.
+     * @param channel the channel, 0 to getChannelCount() - 1.
+     * @param secondsPastEpoch the seconds of the time of the sample.
+     * @param nanoseconds the nanoseconds of the time of the sample.
+     * @param value the value.
+     * @throws std::runtime_error if the channel does not exist.
+     */
+    void add(std::size_t channel, epics::pvData::int64 secondsPastEpoch,
+        epics::pvData::int32 nanoseconds, double value);
+
+    /**
+     * Adds the values of an NTScalarMultiChannel as samples, each at the
+     * time of its secondsPastEpoch and nanoseconds, or of the timeStamp
+     * without them. Channels are matched by channelName; values of unknown
+     * channels and of disconnected channels are ignored.
+     * @param update the values.
+     * @throws std::runtime_error if the value is not numeric or the time is missing.
+     */
+    void add(NTScalarMultiChannelPtr const & update);
+
+    /**
+     * Requests an event at a time.
+     * If maxPending triggers wait, the oldest one is dropped.
+     * @param secondsPastEpoch the seconds of the time.
+     * @param nanoseconds the nanoseconds of the time.
+     */
+    void trigger(epics::pvData::int64 secondsPastEpoch, epics::pvData::int32 nanoseconds);
+
+    /**
+     * Builds the events whose time every channel has a sample at or
+     * after or that have waited for the timeout, in the order they were
+     * requested.
+     * @param events the vector the events are appended to.
+     * @return the number of events appended.
+     */
+    std::size_t poll(std::vector<NTScalarMultiChannelPtr> & events);
+
+    /**
+     * Returns whether every channel has a sample at or after a time.
+     * @param secondsPastEpoch the seconds of the time.
+     * @param nanoseconds the nanoseconds of the time.
+     * @return (false,true) if the samples around the time (are not,are) known.
+     */
+    bool isReady(epics::pvData::int64 secondsPastEpoch, epics::pvData::int32 nanoseconds) const;
+
+    /**
+     * Builds a snapshot at a time from the samples so far.
+     * The timeStamp and the secondsPastEpoch and nanoseconds of every
+     * channel are the time.
+     * @param secondsPastEpoch the seconds of the time.
+     * @param nanoseconds the nanoseconds of the time.
+     * @return the snapshot.
+     */
+    NTScalarMultiChannelPtr snapshot(epics::pvData::int64 secondsPastEpoch,
+        epics::pvData::int32 nanoseconds);
+
+    /**
+     * Computes the values of all channels at a time from the samples so far.
+     * @param secondsPastEpoch the seconds of the time.
+     * @param nanoseconds the nanoseconds of the time.
+     * @param values set to the value of each channel.
+     * @param connected set to whether each channel has a value.
+     */
+    void align(epics::pvData::int64 secondsPastEpoch, epics::pvData::int32 nanoseconds,
+        std::vector<double> & values, std::vector<bool> & connected);
+
+    /**
+     * Returns the number of channels.
+     * @return the number of channels.
+     */
+    std::size_t getChannelCount() const;
+
+    /**
+     * Returns the names of the channels.
+     * @return the names.
+     */
+    std::vector<std::string> const & getChannelNames() const;
+
+    /**
+     * Returns the number of pending event requests.
+     * @return the number of requests.
+     */
+    std::size_t getPending() const;
+
+    /**
+     * Returns the number of events built after the timeout, with
+     * channels that had no sample at or after their time.
+     * @return the number of events.
+     */
+    std::size_t getTimedOut() const;
+
+    /**
+     * Returns the number of triggers dropped because maxPending were waiting.
+     * @return the number of triggers.
+     */
+    std::size_t getDropped() const;
+
+    /**
+     * Returns the timeout.
+     * @return the timeout in seconds.
+     */
+    double getTimeout() const;
+
+    /**
+     * Returns the maximum number of waiting triggers.
+     * @return the number of triggers.
+     */
+    std::size_t getMaxPending() const;
+
+private:
+    NTEventBuilder(std::vector<std::string> const & channelNames,
+        epics::pvData::StructureConstPtr const & structure, std::size_t depth,
+        double timeout, std::size_t maxPending);
+
+    struct History
+    {
+        std::vector<epics::pvData::int64> times;
+        std::vector<double> values;
+        std::size_t first;
+        std::size_t count;
+    };
+
+    struct Trigger
+    {
+        Trigger(epics::pvData::int64 time, epicsTime const & requested)
+        : time(time), requested(requested) {}
+
+        epics::pvData::int64 time;
+        epicsTime requested;
+    };
+
+    void checkChannel(std::size_t channel) const;
+    void insert(History & history, epics::pvData::int64 time, double value);
+    bool ready(epics::pvData::int64 time) const;
+    void alignLocked(epics::pvData::int64 time);
+    NTScalarMultiChannelPtr build(epics::pvData::int64 time, bool complete);
+
+    std::vector<std::string> channelNames;
+    std::map<std::string, std::size_t> channelIndexes;
+    std::size_t depth;
+    double timeout;
+    std::size_t maxPending;
+    epics::pvData::StructureConstPtr structure;
+
+    mutable epicsMutex mutex;
+    std::vector<History> histories;
+    std::vector<Interpolation> interpolations;
+    std::deque<Trigger> triggers;
+    std::size_t timedOut;
+    std::size_t dropped;
+
+    // per channel, the samples around the aligned time and the result
+    std::vector<double> before;
+    std::vector<double> after;
+    std::vector<double> valueBefore;
+    std::vector<double> valueAfter;
+    // 1 where the value is the nearest sample, 0 where it is interpolated
+    std::vector<double> selected;
+    std::vector<double> aligned;
+    std::vector<char> valid;
+};
+
+}}
+#endif  /* NTEVENTBUILDER_H */
@@ -0,0 +1,145 @@
+/* ntfft.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTFFT_H
+#define NTFFT_H
+
+#include <complex>
+#include <vector>
+
+#include <pv/ntscalarArray.h>
+#include <pv/ntndarray.h>
+#include <pv/ntndarrayGraph.h>
+#include <pv/ntndarrayTiler.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTFFTPlan;
+typedef std::tr1::shared_ptr<NTFFTPlan> NTFFTPlanPtr;
+
+/**
+ * @brief Fast Fourier transform of one length.
+ *
+ * Lengths that are powers of two are transformed by radix-2 stages,
+ * combined in pairs into radix-4 butterflies. Other lengths are
+ * transformed by Bluestein's algorithm on a power of two length.
+ * The butterflies hold a complex number in one SSE2 register where
+ * the target has SSE2, and are plain C++ elsewhere.
+ * The forward transform is not normalized, the inverse transform is
+ * normalized by 1/n, so that one undoes the other.
+ *
+ * A plan is immutable and can be used from several threads at once.
+ */
+class epicsShareClass NTFFTPlan
+{
+public:
+    POINTER_DEFINITIONS(NTFFTPlan);
+
+    /**
+     * Returns the plan for a length, creating it on first use.
+     * Plans for powers of two are cached for the lifetime of the
+     * process, only the 16 most recently used plans for other lengths
+     * are kept. A caller that transforms many lengths in turn can hold
+     * on to its plans.
+     * @param n the length.
+     * @return the plan.
+     */
+    static shared_pointer get(std::size_t n);
+
+    /**
+     * Transforms data in place.
+     * @param data the n elements to transform.
+     * @param inverse (false,true) for the (forward,inverse) transform.
+     */
+    void transform(std::complex<double> *data, bool inverse = false) const;
+
+    /**
+     * Returns the length.
+     * @return the length.
+     */
+    std::size_t getSize() const;
+
+    /**
+     * Returns whether the length is transformed by Bluestein's algorithm.
+     * @return (false,true) if the length (is,is not) a power of two.
+     */
+    bool isBluestein() const;
+
+private:
+    explicit NTFFTPlan(std::size_t n);
+
+    void radix(std::complex<double> *data) const;
+    void bluestein(std::complex<double> *data) const;
+
+    std::size_t n;
+    std::vector<std::complex<double> > twiddles;
+    std::vector<std::size_t> swaps;
+
+    shared_pointer inner;
+    std::vector<std::complex<double> > chirp;
+    std::vector<std::complex<double> > kernel;
+};
+
+/**
+ * @brief Spectra of NTScalarArray waveforms and NTNDArray frames.
+ */
+class epicsShareClass NTFFT
+{
+public:
+    /**
+     * Values of a spectrum.
+     */
+    enum Output {
+        magnitude,  ///< |X|
+        phase,      ///< arg X, in radians
+        power       ///< |X|^2
+    };
+
+    /**
+     * Transforms data in place.
+     * @param data the data.
+     * @param inverse (false,true) for the (forward,inverse) transform.
+     */
+    static void transform(std::vector<std::complex<double> > & data, bool inverse = false);
+
+    /**
+     * Computes the spectrum of a real waveform.
+     * Only the bins 0 to n/2 are returned, the others are their mirror.
+     * @param waveform the waveform, with a numeric value.
+     * @param output the values of the spectrum.
+     * @return a double NTScalarArray of n/2 + 1 values, with the
+     *         timeStamp of the waveform if it has one.
+     * @throws std::runtime_error if the value is not numeric.
+     */
+    static NTScalarArrayPtr spectrum(NTScalarArrayPtr const & waveform,
+        Output output = magnitude);
+
+    /**
+     * Computes the spectrum of a one or two dimensional frame.
+     * All bins are returned, in the order of the transform, so that
+     * the 0 frequency is element 0.
+     * @param frame the frame.
+     * @param output the values of the spectrum.
+     * @param tiler the tiler to spread the rows and columns over, or null
+     *        to transform in the calling thread.
+     * @param pool the pool to allocate the value from, or null.
+     * @return a frame with the fields of the input frame and a doubleValue.
+     * @throws std::runtime_error if the frame has no numeric value or
+     *         more than two dimensions.
+     */
+    static NTNDArrayPtr spectrum(NTNDArrayPtr const & frame,
+        Output output = magnitude,
+        NTNDArrayTilerPtr const & tiler = NTNDArrayTilerPtr(),
+        NTNDArrayBufferPoolPtr const & pool = NTNDArrayBufferPoolPtr());
+
+private:
+    // disable object creation
+    NTFFT() {}
+};
+
+}}
+#endif  /* NTFFT_H */
@@ -149,6 +149,7 @@ public:
 
 private:
     NTField();
+    static void init(void *);
     epics::pvData::FieldCreatePtr fieldCreate;
     epics::pvData::StandardFieldPtr standardField;
 
@@ -249,6 +250,7 @@ public:
 
 private:
     PVNTField();
+    static void init(void *);
     epics::pvData::PVDataCreatePtr pvDataCreate;
     epics::pvData::StandardFieldPtr standardField;
     epics::pvData::StandardPVFieldPtr standardPVField;
@@ -0,0 +1,191 @@
+/* ntndarrayAccumulator.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTNDARRAYACCUMULATOR_H
+#define NTNDARRAYACCUMULATOR_H
+
+#include <string>
+#include <vector>
+
+#ifdef epicsExportSharedSymbols
+#   define ntndarrayAccumulatorEpicsExportSharedSymbols
+#   undef epicsExportSharedSymbols
+#endif
+
+#include <pv/pvData.h>
+
+#ifdef ntndarrayAccumulatorEpicsExportSharedSymbols
+#   define epicsExportSharedSymbols
+#	undef ntndarrayAccumulatorEpicsExportSharedSymbols
+#endif
+
+#include <pv/ntndarray.h>
+#include <pv/ntndarrayGraph.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTNDArrayAccumulator;
+typedef std::tr1::shared_ptr<NTNDArrayAccumulator> NTNDArrayAccumulatorPtr;
+
+/**
+ * @brief Accumulator of consecutive NTNDArray frames.
+ *
+ * Frames are added element by element into a buffer whose type is wide
+ * enough not to overflow: sums of integers are kept in a 32 or 64 bit
+ * integer type chosen by getSumType(), everything else in double.
+ *
+ * In sum and average mode, a result is produced each time frameCount
+ * frames have been added, after which accumulation starts again. The sum
+ * has the accumulation type, the average is double. In exponential mode
+ * every frame produces a result, the exponential moving average with
+ * weight 1/frameCount for the newest frame, as double. The nth of the
+ * first frameCount frames has weight 1/n, so that the average does not
+ * start biased towards the first frame.
+ *
+ * A result has the fields of the last frame added, the uniqueId of its
+ * number in the results of this accumulator, starting at 1, and the
+ * attributes NumAccumulated, FirstUniqueId, LastUniqueId,
+ * FirstDataTimeStamp and LastDataTimeStamp describing the frames it
+ * was computed from.
+ *
+ * An instance of this object must not be used concurrently.
+ */
+class epicsShareClass NTNDArrayAccumulator
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayAccumulator);
+
+    /**
+     * Accumulation modes.
+     */
+    enum Mode {
+        sumMode,         ///< the sum of frameCount frames
+        averageMode,     ///< the average of frameCount frames
+        exponentialMode  ///< the exponential moving average
+    };
+
+    /**
+     * Creates an accumulator.
+     * @param mode the accumulation mode.
+     * @param frameCount the number of frames per result in sum and average
+     *        mode, 0 to produce results only on getResult();
+     *        the inverse of the weight of a frame in exponential mode.
+     * @param pool the pool to allocate value arrays from,
+     *        a new pool if null.
+     * @return the accumulator.
+     * @throws std::runtime_error if frameCount is 0 in exponential mode.
+     */
+    static shared_pointer create(Mode mode, std::size_t frameCount,
+        NTNDArrayBufferPoolPtr const & pool = NTNDArrayBufferPoolPtr());
+
+    /**
+     * Returns the type sums of frames are accumulated in.
+     * @param type the element type of the frames.
+     * @param frameCount the number of frames added, 0 if unbounded.
+     * @return the smallest of the 32 and 64 bit integer types of the
+     *         signedness of type that cannot overflow, double for 64 bit
+     *         integers and floating point types.
+     */
+    static epics::pvData::ScalarType getSumType(epics::pvData::ScalarType type,
+        std::size_t frameCount);
+
+    /**
+     * Adds a frame.
+     * @param frame the frame.
+     * @return the result if the frame completes one, null otherwise.
+     * @throws std::runtime_error if the frame has no numeric value or its
+     *         type or dimensions differ from the frames accumulated so far.
+     */
+    NTNDArrayPtr add(NTNDArrayPtr const & frame);
+
+    /**
+     * Returns the result of the frames added since the last result.
+     * The accumulation goes on.
+     * @return the result, or null if no frame was added.
+     */
+    NTNDArrayPtr getResult();
+
+    /**
+     * Discards the frames added so far.
+     */
+    void reset();
+
+    /**
+     * Returns the number of frames added since the last result.
+     * In exponential mode, the number of frames added since reset().
+     * @return the number of frames.
+     */
+    std::size_t getCount() const;
+
+    /**
+     * Returns the accumulation mode.
+     * @return the mode.
+     */
+    Mode getMode() const;
+
+    /**
+     * Returns the number of frames per result, the inverse of the weight
+     * of a frame in exponential mode.
+     * @return the number of frames.
+     */
+    std::size_t getFrameCount() const;
+
+private:
+    NTNDArrayAccumulator(Mode mode, std::size_t frameCount,
+        NTNDArrayBufferPoolPtr const & pool);
+
+    NTNDArrayPtr result(bool final);
+
+    Mode mode;
+    std::size_t frameCount;
+    NTNDArrayBufferPoolPtr pool;
+    std::size_t resultCount;
+
+    // the frames accumulated since the last result
+    epics::pvData::ScalarType type;
+    std::vector<std::size_t> dimensions;
+    epics::pvData::ScalarType accumulatorType;
+    NTNDArrayPtr accumulator;
+    char *storage;
+    std::size_t elementCount;
+    std::size_t count;
+    NTNDArrayPtr first;
+    NTNDArrayPtr last;
+};
+
+/**
+ * @brief Node that accumulates frames.
+ *
+ * Passes on the results of an NTNDArrayAccumulator.
+ */
+class epicsShareClass NTNDArrayAccumulatorNode : public NTNDArrayNode
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayAccumulatorNode);
+
+    /**
+     * Constructor.
+     * @param name the name of the node.
+     * @param mode the accumulation mode.
+     * @param frameCount the number of frames per result, or the inverse
+     *        of the weight of a frame in exponential mode, at least 1.
+     * @param queueSize the capacity of the input queue.
+     * @throws std::runtime_error if frameCount is 0.
+     */
+    NTNDArrayAccumulatorNode(std::string const & name,
+        NTNDArrayAccumulator::Mode mode, std::size_t frameCount,
+        std::size_t queueSize = 16);
+
+    virtual NTNDArrayPtr process(NTNDArrayPtr const & frame,
+        NTNDArrayBufferPoolPtr const & pool);
+
+private:
+    NTNDArrayAccumulatorPtr accumulator;
+};
+
+}}
+#endif  /* NTNDARRAYACCUMULATOR_H */
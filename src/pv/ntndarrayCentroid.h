@@ -0,0 +1,201 @@
+/* ntndarrayCentroid.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTNDARRAYCENTROID_H
+#define NTNDARRAYCENTROID_H
+
+#include <string>
+#include <vector>
+
+#include <pv/ntndarray.h>
+#include <pv/ntndarrayGraph.h>
+#include <pv/nttable.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTNDArrayCentroid;
+typedef std::tr1::shared_ptr<NTNDArrayCentroid> NTNDArrayCentroidPtr;
+
+/**
+ * @brief Moments of the value of a frame.
+ *
+ * Coordinates are element indexes of the frame, x in dimension[0] and
+ * y in dimension[1].
+ */
+struct NTNDArrayMoments
+{
+    NTNDArrayMoments()
+    : uniqueId(0), count(0), total(0), min(0), max(0),
+      centroidX(0), centroidY(0), sigmaX(0), sigmaY(0), sigmaXY(0) {}
+
+    epics::pvData::int32 uniqueId;  ///< the uniqueId of the frame
+    std::size_t count;  ///< the number of elements of the region
+    double total;       ///< the sum of the elements at or above the threshold
+    double min;         ///< the smallest element of the region
+    double max;         ///< the largest element of the region
+    double centroidX;   ///< the mean x, weighted by the elements
+    double centroidY;   ///< the mean y, weighted by the elements
+    double sigmaX;      ///< the standard deviation of x
+    double sigmaY;      ///< the standard deviation of y
+    double sigmaXY;     ///< the covariance of x and y
+};
+
+/**
+ * @brief Local maximum of the value of a frame.
+ */
+struct NTNDArrayPeak
+{
+    NTNDArrayPeak() : x(0), y(0), value(0) {}
+
+    std::size_t x;  ///< the index in dimension[0]
+    std::size_t y;  ///< the index in dimension[1]
+    double value;   ///< the element
+};
+
+/**
+ * @brief Centroid, second moments and peaks of NTNDArray frames.
+ *
+ * Frames of one or two dimensions and any numeric type are analyzed in a
+ * region. The moments are summed in a single pass without branches, and
+ * peaks are then searched for only in the rows whose largest element can
+ * be one. Elements below a threshold do not count towards the moments and
+ * cannot be peaks. Elements of 8 and 16 bit types are summed in integers,
+ * so that the sums are exact.
+ *
+ * A peak is an element greater than its neighbours before it, in the
+ * previous row or to the left, and not less than its neighbours after it,
+ * within the region. The peakCount highest peaks are reported, highest first.
+ *
+ * analyze() can be called from several threads at once; the region must
+ * not be changed meanwhile.
+ */
+class epicsShareClass NTNDArrayCentroid
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayCentroid);
+
+    /**
+     * Creates an analyzer for whole frames.
+     * @param peakCount the number of peaks to find, 0 for none.
+     * @param threshold the lowest element that counts.
+     * @return the analyzer.
+     */
+    static shared_pointer create(std::size_t peakCount = 0, double threshold = 0);
+
+    /**
+     * Restricts the analysis to a region, clipped to each frame.
+     * @param x the first element in dimension[0].
+     * @param y the first element in dimension[1].
+     * @param width the number of elements in dimension[0].
+     * @param height the number of elements in dimension[1].
+     */
+    void setRegion(std::size_t x, std::size_t y, std::size_t width, std::size_t height);
+
+    /**
+     * Analyzes a frame.
+     * @param frame the frame.
+     * @param moments the moments of the frame.
+     * @param peaks the peaks of the frame.
+     * @throws std::runtime_error if the frame has no numeric value or
+     *         more than two dimensions.
+     */
+    void analyze(NTNDArrayPtr const & frame, NTNDArrayMoments & moments,
+        std::vector<NTNDArrayPeak> & peaks) const;
+
+    /**
+     * Returns the number of peaks to find.
+     * @return the number of peaks.
+     */
+    std::size_t getPeakCount() const;
+
+    /**
+     * Returns the threshold.
+     * @return the lowest element that counts.
+     */
+    double getThreshold() const;
+
+    /**
+     * Creates a table with a row for the moments of each frame.
+     * The columns are the fields of NTNDArrayMoments.
+     * @param moments the moments.
+     * @return the table.
+     */
+    static NTTablePtr createMomentsTable(std::vector<NTNDArrayMoments> const & moments);
+
+    /**
+     * Creates a table with a row for each peak and the columns x, y and value.
+     * @param peaks the peaks.
+     * @return the table.
+     */
+    static NTTablePtr createPeakTable(std::vector<NTNDArrayPeak> const & peaks);
+
+    /**
+     * Adds the moments and peaks to the attributes of a frame:
+     * CentroidTotal, CentroidX, CentroidY, SigmaX, SigmaY and SigmaXY
+     * as doubles, and PeakX, PeakY and PeakValue as double arrays.
+     * @param frame the frame.
+     * @param moments the moments.
+     * @param peaks the peaks.
+     */
+    static void setAttributes(NTNDArrayPtr const & frame, NTNDArrayMoments const & moments,
+        std::vector<NTNDArrayPeak> const & peaks);
+
+private:
+    NTNDArrayCentroid(std::size_t peakCount, double threshold);
+
+    std::size_t peakCount;
+    double threshold;
+    std::size_t regionX;
+    std::size_t regionY;
+    std::size_t regionWidth;
+    std::size_t regionHeight;
+};
+
+/**
+ * @brief Node that adds the moments and peaks of each frame to its attributes.
+ *
+ * See NTNDArrayCentroid::setAttributes(). The frames passed on are copies
+ * that share the value with the input frames.
+ */
+class epicsShareClass NTNDArrayCentroidNode : public NTNDArrayNode
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayCentroidNode);
+
+    /**
+     * Constructor.
+     * @param name the name of the node.
+     * @param centroid the analyzer.
+     * @param queueSize the capacity of the input queue.
+     */
+    NTNDArrayCentroidNode(std::string const & name,
+        NTNDArrayCentroidPtr const & centroid, std::size_t queueSize = 16);
+
+    virtual NTNDArrayPtr process(NTNDArrayPtr const & frame,
+        NTNDArrayBufferPoolPtr const & pool);
+
+    /**
+     * Returns the moments of the last processed frame.
+     * @return the moments.
+     */
+    NTNDArrayMoments getMoments() const;
+
+    /**
+     * Returns the peaks of the last processed frame.
+     * @return the peaks.
+     */
+    std::vector<NTNDArrayPeak> getPeaks() const;
+
+private:
+    NTNDArrayCentroidPtr centroid;
+    NTNDArrayMoments moments;
+    std::vector<NTNDArrayPeak> peaks;
+    mutable epicsMutex mutex;
+};
+
+}}
+#endif  /* NTNDARRAYCENTROID_H */
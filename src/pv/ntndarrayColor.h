@@ -0,0 +1,149 @@
+/* ntndarrayColor.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTNDARRAYCOLOR_H
+#define NTNDARRAYCOLOR_H
+
+#include <string>
+
+#include <pv/ntndarray.h>
+#include <pv/ntndarrayGraph.h>
+#include <pv/ntndarrayTiler.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+/**
+ * @brief Color modes of NTNDArray frames.
+ *
+ * The color mode of a frame is given by its integer ColorMode attribute,
+ * with the values used by areaDetector. Without the attribute, a frame
+ * with three dimensions one of which has size 3 is taken to be RGB and
+ * any other frame to be mono.
+ *
+ * Mono and Bayer frames have the dimensions (x, y). RGB frames have the
+ * dimensions (color, x, y) in RGB1, (x, color, y) in RGB2 and
+ * (x, y, color) in RGB3, where dimension[0] varies fastest.
+ * The Bayer pattern is given by the integer BayerPattern attribute,
+ * RGGB if it is missing.
+ */
+class epicsShareClass NTNDArrayColor
+{
+public:
+    /**
+     * Color modes.
+     */
+    enum Mode {
+        mono  = 0,  ///< one value per pixel
+        bayer = 1,  ///< one color per pixel in a Bayer pattern
+        rgb1  = 2,  ///< pixel interleaved RGB
+        rgb2  = 3,  ///< row interleaved RGB
+        rgb3  = 4   ///< planar RGB
+    };
+
+    /**
+     * Bayer patterns, named by the colors of the first two pixels of
+     * the first two rows.
+     */
+    enum BayerPattern {
+        rggb = 0,
+        gbrg = 1,
+        grbg = 2,
+        bggr = 3
+    };
+
+    /**
+     * Returns the color mode of a frame.
+     * @param frame the frame.
+     * @return the color mode.
+     * @throws std::runtime_error if the ColorMode attribute is not one
+     *         of the supported modes.
+     */
+    static Mode getColorMode(NTNDArrayPtr const & frame);
+
+    /**
+     * Sets the ColorMode attribute of a frame, adding it if needed.
+     * @param frame the frame.
+     * @param mode the color mode.
+     */
+    static void setColorMode(NTNDArrayPtr const & frame, Mode mode);
+
+    /**
+     * Returns the Bayer pattern of a frame.
+     * @param frame the frame.
+     * @return the Bayer pattern.
+     * @throws std::runtime_error if the BayerPattern attribute is not
+     *         one of the patterns.
+     */
+    static BayerPattern getBayerPattern(NTNDArrayPtr const & frame);
+
+    /**
+     * Sets the BayerPattern attribute of a frame, adding it if needed.
+     * @param frame the frame.
+     * @param pattern the Bayer pattern.
+     */
+    static void setBayerPattern(NTNDArrayPtr const & frame, BayerPattern pattern);
+
+    /**
+     * Converts a frame to another color mode.
+     * Bayer frames are demosaiced by bilinear interpolation, which rounds
+     * integers half away from zero and is exact for all of them, mono frames
+     * are copied to all three colors and RGB frames are converted to mono
+     * by their ITU-R BT.601 luma. The new frame has the fields of the input
+     * frame, the dimensions of the new mode and its ColorMode attribute.
+     * The element type is kept.
+     * @param frame the frame.
+     * @param mode the mode to convert to, mono or one of the RGB modes.
+     * @param tiler the tiler to spread the rows over, or null to convert
+     *        in the calling thread.
+     * @param pool the pool to allocate the value from, or null.
+     * @return the converted frame, or the frame itself if it is already
+     *         in the mode.
+     * @throws std::runtime_error if the frame has no numeric value,
+     *         its dimensions do not match its mode or the conversion is
+     *         not supported.
+     */
+    static NTNDArrayPtr convert(NTNDArrayPtr const & frame, Mode mode,
+        NTNDArrayTilerPtr const & tiler = NTNDArrayTilerPtr(),
+        NTNDArrayBufferPoolPtr const & pool = NTNDArrayBufferPoolPtr());
+
+private:
+    // disable object creation
+    NTNDArrayColor() {}
+};
+
+/**
+ * @brief Node that converts each frame to a color mode.
+ *
+ * See NTNDArrayColor::convert().
+ */
+class epicsShareClass NTNDArrayColorNode : public NTNDArrayNode
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayColorNode);
+
+    /**
+     * Constructor.
+     * @param name the name of the node.
+     * @param mode the mode to convert to, mono or one of the RGB modes.
+     * @param tiler the tiler to spread the rows over, or null.
+     * @param queueSize the capacity of the input queue.
+     * @throws std::runtime_error if frames cannot be converted to the mode.
+     */
+    NTNDArrayColorNode(std::string const & name, NTNDArrayColor::Mode mode,
+        NTNDArrayTilerPtr const & tiler = NTNDArrayTilerPtr(),
+        std::size_t queueSize = 16);
+
+    virtual NTNDArrayPtr process(NTNDArrayPtr const & frame,
+        NTNDArrayBufferPoolPtr const & pool);
+
+private:
+    NTNDArrayColor::Mode mode;
+    NTNDArrayTilerPtr tiler;
+};
+
+}}
+#endif  /* NTNDARRAYCOLOR_H */
@@ -0,0 +1,217 @@
+/* ntndarrayDecoder.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTNDARRAYDECODER_H
+#define NTNDARRAYDECODER_H
+
+#include <vector>
+#include <string>
+
+#ifdef epicsExportSharedSymbols
+#   define ntndarrayDecoderEpicsExportSharedSymbols
+#   undef epicsExportSharedSymbols
+#endif
+
+#include <epicsEndian.h>
+#include <epicsTypes.h>
+
+#include <pv/pvData.h>
+
+#ifdef ntndarrayDecoderEpicsExportSharedSymbols
+#   define epicsExportSharedSymbols
+#	undef ntndarrayDecoderEpicsExportSharedSymbols
+#endif
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTNDArrayDecoder;
+typedef std::tr1::shared_ptr<NTNDArrayDecoder> NTNDArrayDecoderPtr;
+
+/**
+ * @brief Partial decoder of serialized NTNDArray values.
+ *
+ * scan() walks a buffer holding a serialized NTNDArray using only the
+ * introspection interface, recording where each top level field and each
+ * attribute starts without creating any PVField. Fields are then decoded
+ * on request, each at most once per scan.
+ *
+ * The value array is never decoded. Its elements are exposed as a byte
+ * range borrowed from the scanned buffer, in the byte order of that buffer,
+ * so that it can be forwarded without a copy.
+ *
+ * The scanned buffer is not copied and must outlive any use of the decoder
+ * until the next call to scan().
+ * Variant unions are expected to carry their full introspection data, as
+ * written by pvData's serializeToVector(). scan() skips that data in place
+ * without creating any Field, so that the values of attributes are only
+ * decoded by getAttribute().
+ * An instance of this object must not be used concurrently.
+ */
+class epicsShareClass NTNDArrayDecoder
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayDecoder);
+
+    /**
+     * Creates a decoder for NTNDArray values of the specified structure.
+     * @param structure the introspection interface of the serialized values.
+     * @return the decoder or null if the structure is not compatible with NTNDArray.
+     */
+    static shared_pointer create(epics::pvData::StructureConstPtr const & structure);
+
+    /**
+     * Indexes the fields of a serialized NTNDArray.
+     * @param data the serialized value, borrowed by the decoder.
+     * @param size the size of the serialized value in bytes.
+     * @param byteOrder the byte order of the serialized value.
+     * @throws std::runtime_error if the buffer is truncated or malformed.
+     */
+    void scan(const char *data, std::size_t size, int byteOrder = EPICS_BYTE_ORDER);
+
+    /**
+     * Indexes the fields of a serialized NTNDArray held in a vector.
+     * @param data the serialized value, borrowed by the decoder.
+     * @param byteOrder the byte order of the serialized value.
+     * @throws std::runtime_error if the buffer is truncated or malformed.
+     */
+    void scan(std::vector<epicsUInt8> const & data, int byteOrder = EPICS_BYTE_ORDER);
+
+    /**
+     * Returns the introspection interface of the decoded values.
+     * @return the Structure.
+     */
+    epics::pvData::StructureConstPtr getStructure() const;
+
+    /**
+     * Decodes a top level field of the scanned value.
+     * @param fieldName the name of the field.
+     * @return the field or null if there is no such field or nothing was scanned.
+     */
+    epics::pvData::PVFieldPtr decode(std::string const & fieldName);
+
+    /**
+     * Decodes a top level field of the scanned value, of the specified type.
+     * @param fieldName the name of the field.
+     * @return the field or null if there is no such field of the specified type.
+     */
+    template<typename PVT>
+    std::tr1::shared_ptr<PVT> decode(std::string const & fieldName)
+    {
+        return std::tr1::dynamic_pointer_cast<PVT>(decode(fieldName));
+    }
+
+    /**
+     * Decodes the uniqueId field.
+     * @return the uniqueId.
+     * @throws std::runtime_error if nothing was scanned.
+     */
+    epics::pvData::int32 getUniqueId();
+
+    /**
+     * Decodes the dataTimeStamp field.
+     * @return the dataTimeStamp.
+     */
+    epics::pvData::PVStructurePtr getDataTimeStamp();
+
+    /**
+     * Decodes the dimension field.
+     * @return the dimension.
+     */
+    epics::pvData::PVStructureArrayPtr getDimension();
+
+    /**
+     * Returns the number of attributes of the scanned value.
+     * @return the number of attributes.
+     */
+    std::size_t getNumberAttributes() const;
+
+    /**
+     * Returns the names of the attributes of the scanned value.
+     * @return the names, empty for null attribute elements.
+     */
+    epics::pvData::shared_vector<const std::string> getAttributeNames() const;
+
+    /**
+     * Decodes a single attribute.
+     * @param name the name of the attribute.
+     * @return the attribute or null if there is no attribute of this name.
+     */
+    epics::pvData::PVStructurePtr getAttribute(std::string const & name);
+
+    /**
+     * Returns whether the scanned value has a value array selected.
+     * @return (false,true) if a value array (is not, is) selected.
+     */
+    bool hasValue() const;
+
+    /**
+     * Returns the name of the selected value union field, e.g. "ushortValue".
+     * @return the name or an empty string if nothing is selected.
+     */
+    std::string getValueFieldName() const;
+
+    /**
+     * Returns the element type of the selected value array.
+     * @return the element type.
+     * @throws std::runtime_error if nothing is selected.
+     */
+    epics::pvData::ScalarType getValueType() const;
+
+    /**
+     * Returns the number of elements of the selected value array.
+     * @return the number of elements.
+     */
+    std::size_t getValueCount() const;
+
+    /**
+     * Returns the elements of the selected value array, borrowed from the
+     * scanned buffer and in its byte order.
+     * @return a pointer to the first element or null if nothing is selected.
+     */
+    const char *getValueData() const;
+
+    /**
+     * Returns the size of the elements of the selected value array in bytes.
+     * @return the size in bytes.
+     */
+    std::size_t getValueBytes() const;
+
+    /**
+     * Returns the byte order of the scanned buffer.
+     * @return EPICS_ENDIAN_BIG or EPICS_ENDIAN_LITTLE.
+     */
+    int getByteOrder() const;
+
+private:
+    NTNDArrayDecoder(epics::pvData::StructureConstPtr const & structure);
+
+    void scanAttributes(epics::pvData::ByteBuffer *buffer,
+        epics::pvData::DeserializableControl *control);
+
+    epics::pvData::StructureConstPtr structure;
+    std::size_t valueIndex;
+    std::size_t attributeIndex;
+
+    const char *data;
+    std::size_t size;
+    int byteOrder;
+    bool scanned;
+
+    std::vector<std::size_t> offsets;
+    std::vector<epics::pvData::PVFieldPtr> decoded;
+
+    epics::pvData::int32 valueSelector;
+    epics::pvData::ScalarType valueType;
+    std::size_t valueOffset;
+    std::size_t valueCount;
+
+    std::vector<std::string> attributeNames;
+    std::vector<std::size_t> attributeOffsets;
+};
+
+}}
+#endif  /* NTNDARRAYDECODER_H */
@@ -0,0 +1,138 @@
+/* ntndarrayFlatField.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTNDARRAYFLATFIELD_H
+#define NTNDARRAYFLATFIELD_H
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <pv/ntndarray.h>
+#include <pv/ntndarrayGraph.h>
+#include <pv/ntndarrayTiler.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTNDArrayFlatField;
+typedef std::tr1::shared_ptr<NTNDArrayFlatField> NTNDArrayFlatFieldPtr;
+
+/**
+ * @brief Background subtraction and flat-field correction of NTNDArray frames.
+ *
+ * Each element is corrected as scale*(raw - dark)/(flat - dark) and
+ * clamped to [minimum, maximum], in float. The reference frames are
+ * converted once into a float dark frame and a gain map
+ * scale/(flat - dark), so a frame is corrected in a single pass of one
+ * subtraction and one multiplication per element. Elements whose flat
+ * is not above their dark have a gain of 0. Without a flat frame,
+ * only the dark frame is subtracted; without a dark frame, it is 0.
+ * With a single reference frame only its map is read when correcting.
+ *
+ * Frames of any numeric type are accepted; the output is float.
+ * The corrector can be used from several threads at once.
+ */
+class epicsShareClass NTNDArrayFlatField
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayFlatField);
+
+    /**
+     * Creates a corrector.
+     * @param dark the dark frame, or null.
+     * @param flat the flat frame, or null.
+     * @param tiler the tiler to spread frames over, or null to correct
+     *        in the calling thread.
+     * @param scale the factor applied to the corrected elements.
+     * @param minimum the lowest corrected element.
+     * @param maximum the highest corrected element.
+     * @return the corrector.
+     * @throws std::runtime_error if both reference frames are null,
+     *         they have no numeric value or their dimensions differ.
+     */
+    static shared_pointer create(NTNDArrayPtr const & dark, NTNDArrayPtr const & flat,
+        NTNDArrayTilerPtr const & tiler = NTNDArrayTilerPtr(),
+        double scale = 1, double minimum = 0,
+        double maximum = std::numeric_limits<float>::max());
+
+    /**
+     * Corrects a frame into a new frame.
+     * The new frame has the fields of the input frame and a floatValue.
+     * @param frame the frame.
+     * @param pool the pool to allocate the value from, a pool of the
+     *        corrector if null.
+     * @return the corrected frame.
+     * @throws std::runtime_error if the frame has no numeric value or
+     *         its dimensions differ from the reference frames.
+     */
+    NTNDArrayPtr correct(NTNDArrayPtr const & frame,
+        NTNDArrayBufferPoolPtr const & pool = NTNDArrayBufferPoolPtr());
+
+    /**
+     * Corrects a frame into a given buffer, for example one reused
+     * for every frame.
+     * @param frame the frame.
+     * @param output the buffer, of getElementCount() elements.
+     * @throws std::runtime_error if the frame has no numeric value or
+     *         its dimensions differ from the reference frames.
+     */
+    void correct(NTNDArrayPtr const & frame, float *output);
+
+    /**
+     * Returns the number of elements of the frames.
+     * @return the number of elements.
+     */
+    std::size_t getElementCount() const;
+
+    /**
+     * Returns the gain map, scale/(flat - dark) for each element.
+     * @return the gain map.
+     */
+    std::vector<float> const & getGain() const;
+
+private:
+    NTNDArrayFlatField(NTNDArrayPtr const & dark, NTNDArrayPtr const & flat,
+        NTNDArrayTilerPtr const & tiler, double scale, double minimum, double maximum);
+
+    std::vector<std::size_t> dimensions;
+    std::vector<float> dark;
+    std::vector<float> gain;
+    float scale;
+    float minimum;
+    float maximum;
+    bool hasDark;
+    bool hasFlat;
+    NTNDArrayTilerPtr tiler;
+    NTNDArrayBufferPoolPtr pool;
+};
+
+/**
+ * @brief Node that corrects each frame with an NTNDArrayFlatField.
+ */
+class epicsShareClass NTNDArrayFlatFieldNode : public NTNDArrayNode
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayFlatFieldNode);
+
+    /**
+     * Constructor.
+     * @param name the name of the node.
+     * @param flatField the corrector.
+     * @param queueSize the capacity of the input queue.
+     */
+    NTNDArrayFlatFieldNode(std::string const & name,
+        NTNDArrayFlatFieldPtr const & flatField, std::size_t queueSize = 16);
+
+    virtual NTNDArrayPtr process(NTNDArrayPtr const & frame,
+        NTNDArrayBufferPoolPtr const & pool);
+
+private:
+    NTNDArrayFlatFieldPtr flatField;
+};
+
+}}
+#endif  /* NTNDARRAYFLATFIELD_H */
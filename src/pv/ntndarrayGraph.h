@@ -0,0 +1,400 @@
+/* ntndarrayGraph.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTNDARRAYGRAPH_H
+#define NTNDARRAYGRAPH_H
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef epicsExportSharedSymbols
+#   define ntndarrayGraphEpicsExportSharedSymbols
+#   undef epicsExportSharedSymbols
+#endif
+
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+#include <pv/pvData.h>
+
+#ifdef ntndarrayGraphEpicsExportSharedSymbols
+#   define epicsExportSharedSymbols
+#	undef ntndarrayGraphEpicsExportSharedSymbols
+#endif
+
+#include <pv/ntndarray.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTNDArrayBufferPool;
+typedef std::tr1::shared_ptr<NTNDArrayBufferPool> NTNDArrayBufferPoolPtr;
+
+class NTNDArrayNode;
+typedef std::tr1::shared_ptr<NTNDArrayNode> NTNDArrayNodePtr;
+
+class NTNDArrayGraph;
+typedef std::tr1::shared_ptr<NTNDArrayGraph> NTNDArrayGraphPtr;
+
+/**
+ * @brief Pool of value array buffers.
+ *
+ * Arrays allocated from the pool return their memory to it when the
+ * last reference to them is dropped, so that the next frame of the same
+ * size reuses it instead of allocating. The pool lives for as long as any
+ * of its arrays. It may be used by several threads concurrently.
+ */
+class epicsShareClass NTNDArrayBufferPool :
+    public std::tr1::enable_shared_from_this<NTNDArrayBufferPool>
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayBufferPool);
+
+    /**
+     * Creates a pool.
+     * @param maxFree the maximum number of unused buffers kept for reuse.
+     * @return the pool.
+     */
+    static shared_pointer create(std::size_t maxFree = 16);
+
+    /**
+     * Destructor.
+     */
+    ~NTNDArrayBufferPool();
+
+    /**
+     * Allocates an array of a numeric type.
+     * The elements are not initialized.
+     * @param count the number of elements.
+     * @return the array.
+     */
+    template<typename T>
+    epics::pvData::shared_vector<T> allocate(std::size_t count)
+    {
+        std::size_t size = count*sizeof(T);
+        return epics::pvData::shared_vector<T>(
+            reinterpret_cast<T*>(allocateBlock(size)),
+            BlockRelease(shared_from_this(), size), 0, count);
+    }
+
+    /**
+     * Returns the number of buffers allocated from the heap.
+     * @return the number of buffers.
+     */
+    std::size_t getAllocated() const;
+
+    /**
+     * Returns the number of allocations served by a reused buffer.
+     * @return the number of allocations.
+     */
+    std::size_t getReused() const;
+
+    /**
+     * Returns the number of unused buffers kept for reuse.
+     * @return the number of buffers.
+     */
+    std::size_t getFree() const;
+
+private:
+    struct BlockRelease {
+        BlockRelease(shared_pointer const & pool, std::size_t size)
+        : pool(pool), size(size) {}
+
+        template<typename T>
+        void operator()(T *block) { pool->releaseBlock(reinterpret_cast<char*>(block), size); }
+
+        shared_pointer pool;
+        std::size_t size;
+    };
+
+    explicit NTNDArrayBufferPool(std::size_t maxFree);
+
+    char *allocateBlock(std::size_t size);
+    void releaseBlock(char *block, std::size_t size);
+
+    std::size_t maxFree;
+    std::multimap<std::size_t, char*> freeBlocks;
+    std::size_t allocated;
+    std::size_t reused;
+    mutable epicsMutex mutex;
+};
+
+/**
+ * @brief Node of an NTNDArray processing graph.
+ *
+ * A node transforms the frames it receives into the frames it passes on
+ * to its successors. Each node processes one frame at a time, in the
+ * order of arrival, so process() need not be reentrant; different nodes
+ * run in parallel. Frames are shared between the successors of a node
+ * and must not be modified: a node that changes a frame returns a new one.
+ *
+ * Frames wait for the node in a bounded input queue. A frame that arrives
+ * while the queue is full is dropped and counted. This also applies to
+ * the frames passed on by a predecessor, which never waits for a full
+ * successor; NTNDArrayGraph::getDropped() counts these per connection.
+ */
+class epicsShareClass NTNDArrayNode
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayNode);
+
+    /**
+     * Constructor.
+     * @param name the name of the node.
+     * @param queueSize the capacity of the input queue.
+     */
+    NTNDArrayNode(std::string const & name, std::size_t queueSize = 16);
+
+    /**
+     * Destructor.
+     */
+    virtual ~NTNDArrayNode();
+
+    /**
+     * Processes a frame.
+     * An exception thrown by this method drops the frame and is counted.
+     * @param frame the frame.
+     * @param pool the pool to allocate value arrays from.
+     * @return the frame to pass on or null to pass on nothing.
+     */
+    virtual NTNDArrayPtr process(NTNDArrayPtr const & frame,
+        NTNDArrayBufferPoolPtr const & pool) = 0;
+
+    /**
+     * Returns the name of the node.
+     * @return the name.
+     */
+    std::string getName() const;
+
+    /**
+     * Returns the capacity of the input queue.
+     * @return the queue size.
+     */
+    std::size_t getQueueSize() const;
+
+    /**
+     * Returns the number of frames waiting in the input queue.
+     * @return the depth.
+     */
+    std::size_t getDepth() const;
+
+    /**
+     * Returns the number of frames processed.
+     * @return the number of frames.
+     */
+    std::size_t getFrames() const;
+
+    /**
+     * Returns the number of frames dropped because the queue was full.
+     * @return the number of frames.
+     */
+    std::size_t getDropped() const;
+
+    /**
+     * Returns the number of frames for which process() threw an exception.
+     * @return the number of frames.
+     */
+    std::size_t getErrors() const;
+
+    /**
+     * Returns the mean time from the arrival of a frame to the end of
+     * its processing.
+     * @return the latency in seconds.
+     */
+    double getMeanLatency() const;
+
+    /**
+     * Returns the longest time from the arrival of a frame to the end of
+     * its processing.
+     * @return the latency in seconds.
+     */
+    double getMaxLatency() const;
+
+    /**
+     * Returns the mean time spent in process().
+     * @return the time in seconds.
+     */
+    double getMeanProcessTime() const;
+
+    /**
+     * Returns the number of frames processed per second, from the
+     * start of the first to the end of the last processed frame.
+     * @return the throughput.
+     */
+    double getThroughput() const;
+
+    /**
+     * Resets the counters and timings, including the frames dropped by
+     * the successors of this node.
+     */
+    void resetStatistics();
+
+private:
+    struct Input {
+        Input(NTNDArrayPtr const & frame, epicsTime const & arrival)
+        : frame(frame), arrival(arrival) {}
+
+        NTNDArrayPtr frame;
+        epicsTime arrival;
+    };
+
+    friend class NTNDArrayGraph;
+
+    std::string name;
+    std::size_t queueSize;
+    NTNDArrayGraph *graph;
+    std::vector<NTNDArrayNode*> successors;
+    // the frames dropped by each successor
+    std::vector<std::size_t> successorDropped;
+    std::size_t predecessors;
+
+    mutable epicsMutex mutex;
+    std::deque<Input> input;
+    bool scheduled;
+
+    std::size_t frames;
+    std::size_t dropped;
+    std::size_t errors;
+    double totalLatency;
+    double maxLatency;
+    double totalProcessTime;
+    epicsTime firstStart;
+    epicsTime lastEnd;
+};
+
+/**
+ * @brief Graph of NTNDArray processing nodes run by a thread pool.
+ *
+ * Frames pushed into the graph go to every node without predecessors and
+ * flow along the connections. Each worker thread of the pool keeps a
+ * double ended queue of nodes that have frames to process: it runs the
+ * most recently scheduled node of its own queue, which is likely to find
+ * the frame in the cache, and when its queue is empty it steals the
+ * oldest node from the queue of another worker.
+ *
+ * push() applies back-pressure: it waits while the number of frames
+ * queued at the nodes reaches the limit of the graph. Within the graph
+ * frames are not held back: a node whose input queue is full drops the
+ * frames its predecessors pass on.
+ *
+ * Nodes are added and connected before frames are pushed.
+ */
+class epicsShareClass NTNDArrayGraph
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayGraph);
+
+    /**
+     * Creates a graph.
+     * @param threadCount the number of worker threads,
+     *        the number of CPUs if 0.
+     * @param maxInFlight the maximum number of frames queued at the nodes
+     *        before push() waits.
+     * @param pool the pool of value arrays for the nodes,
+     *        a new pool if null.
+     * @return the graph.
+     */
+    static shared_pointer create(std::size_t threadCount = 0,
+        std::size_t maxInFlight = 64,
+        NTNDArrayBufferPoolPtr const & pool = NTNDArrayBufferPoolPtr());
+
+    /**
+     * Destructor. Stops the worker threads, discarding queued frames.
+     */
+    ~NTNDArrayGraph();
+
+    /**
+     * Adds a node.
+     * @param node the node.
+     * @throws std::runtime_error if the node belongs to another graph.
+     */
+    void addNode(NTNDArrayNodePtr const & node);
+
+    /**
+     * Connects two nodes, adding them if necessary.
+     * @param from the node whose output is passed on.
+     * @param to the node that receives it.
+     * @throws std::runtime_error if the connection would create a cycle.
+     */
+    void connect(NTNDArrayNodePtr const & from, NTNDArrayNodePtr const & to);
+
+    /**
+     * Returns the nodes.
+     * @return the nodes in the order they were added.
+     */
+    std::vector<NTNDArrayNodePtr> getNodes() const;
+
+    /**
+     * Pushes a frame into the graph.
+     * @param frame the frame.
+     * @param wait (false,true) to (return, wait) if the graph is at its limit.
+     * @return (false,true) if the frame (was not, was) pushed.
+     */
+    bool push(NTNDArrayPtr const & frame, bool wait = true);
+
+    /**
+     * Returns the number of frames passed on by a node that its successor
+     * dropped because its input queue was full.
+     * @param from the node that passes frames on.
+     * @param to the successor.
+     * @return the number of frames, 0 if the nodes are not connected.
+     */
+    std::size_t getDropped(NTNDArrayNodePtr const & from, NTNDArrayNodePtr const & to) const;
+
+    /**
+     * Waits until all frames pushed so far are processed.
+     */
+    void waitIdle();
+
+    /**
+     * Returns the number of frames queued at the nodes.
+     * @return the number of frames.
+     */
+    std::size_t getInFlight() const;
+
+    /**
+     * Returns the number of worker threads.
+     * @return the number of threads.
+     */
+    std::size_t getThreadCount() const;
+
+    /**
+     * Returns the pool the nodes allocate value arrays from.
+     * @return the pool.
+     */
+    NTNDArrayBufferPoolPtr getBufferPool() const;
+
+private:
+    class Worker;
+    friend class Worker;
+
+    NTNDArrayGraph(std::size_t threadCount, std::size_t maxInFlight,
+        NTNDArrayBufferPoolPtr const & pool);
+
+    bool deliver(NTNDArrayNode *node, NTNDArrayPtr const & frame, std::size_t worker);
+    void release();
+    void schedule(NTNDArrayNode *node, std::size_t worker, bool front);
+    NTNDArrayNode *take(std::size_t worker);
+    void run(NTNDArrayNode *node, std::size_t worker);
+    bool reaches(NTNDArrayNode *from, NTNDArrayNode *to) const;
+
+    std::vector<NTNDArrayNodePtr> nodes;
+    std::size_t maxInFlight;
+    NTNDArrayBufferPoolPtr pool;
+    std::vector<Worker*> workers;
+    std::size_t nextWorker;
+
+    std::size_t inFlight;
+    epicsEvent space;
+    epicsEvent idle;
+    int stopping;
+};
+
+}}
+#endif  /* NTNDARRAYGRAPH_H */
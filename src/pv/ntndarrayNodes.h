@@ -0,0 +1,131 @@
+/* ntndarrayNodes.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTNDARRAYNODES_H
+#define NTNDARRAYNODES_H
+
+#include <string>
+#include <vector>
+
+#include <pv/ntndarrayGraph.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+/**
+ * @brief Node that passes on a region of interest of each frame.
+ *
+ * The region is given per dimension, in the order of the dimension
+ * field, where dimension[0] varies fastest. Dimensions without an entry
+ * are passed on whole and regions are clipped to the frame. The offset
+ * of each dimension of the output is that of the input plus the offset
+ * of the region. Frames without a numeric value or outside the region
+ * are not passed on. Frames compressed by a codec are rejected as errors.
+ */
+class epicsShareClass NTNDArrayROINode : public NTNDArrayNode
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayROINode);
+
+    /**
+     * Constructor.
+     * @param name the name of the node.
+     * @param offset the first element of the region in each dimension.
+     * @param size the number of elements of the region in each dimension.
+     * @param queueSize the capacity of the input queue.
+     */
+    NTNDArrayROINode(std::string const & name,
+        std::vector<std::size_t> const & offset,
+        std::vector<std::size_t> const & size,
+        std::size_t queueSize = 16);
+
+    virtual NTNDArrayPtr process(NTNDArrayPtr const & frame,
+        NTNDArrayBufferPoolPtr const & pool);
+
+private:
+    std::vector<std::size_t> offset;
+    std::vector<std::size_t> size;
+};
+
+/**
+ * @brief Node that converts the value of each frame to another type.
+ *
+ * Elements are converted as by static_cast. Frames that already have
+ * the type are passed on unchanged. Frames compressed by a codec are
+ * rejected as errors.
+ */
+class epicsShareClass NTNDArrayConvertNode : public NTNDArrayNode
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayConvertNode);
+
+    /**
+     * Constructor.
+     * @param name the name of the node.
+     * @param type the numeric type to convert to.
+     * @param queueSize the capacity of the input queue.
+     * @throws std::runtime_error if the type is not numeric.
+     */
+    NTNDArrayConvertNode(std::string const & name,
+        epics::pvData::ScalarType type, std::size_t queueSize = 16);
+
+    virtual NTNDArrayPtr process(NTNDArrayPtr const & frame,
+        NTNDArrayBufferPoolPtr const & pool);
+
+private:
+    epics::pvData::ScalarType type;
+};
+
+/**
+ * @brief Statistics of the value of a frame.
+ */
+struct NTNDArrayStatistics
+{
+    NTNDArrayStatistics()
+    : count(0), min(0), max(0), mean(0), sigma(0), total(0) {}
+
+    std::size_t count;  ///< the number of elements
+    double min;         ///< the smallest element
+    double max;         ///< the largest element
+    double mean;        ///< the mean of the elements
+    double sigma;       ///< the standard deviation of the elements
+    double total;       ///< the sum of the elements
+};
+
+/**
+ * @brief Node that computes statistics of the value of each frame.
+ *
+ * The frames are passed on unchanged. Statistics are not computed for
+ * frames compressed by a codec.
+ */
+class epicsShareClass NTNDArrayStatisticsNode : public NTNDArrayNode
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayStatisticsNode);
+
+    /**
+     * Constructor.
+     * @param name the name of the node.
+     * @param queueSize the capacity of the input queue.
+     */
+    NTNDArrayStatisticsNode(std::string const & name, std::size_t queueSize = 16);
+
+    virtual NTNDArrayPtr process(NTNDArrayPtr const & frame,
+        NTNDArrayBufferPoolPtr const & pool);
+
+    /**
+     * Returns the statistics of the last processed frame.
+     * @return the statistics.
+     */
+    NTNDArrayStatistics getStatistics() const;
+
+private:
+    NTNDArrayStatistics statistics;
+    mutable epicsMutex mutex;
+};
+
+}}
+#endif  /* NTNDARRAYNODES_H */
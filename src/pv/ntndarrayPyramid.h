@@ -0,0 +1,166 @@
+/* ntndarrayPyramid.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTNDARRAYPYRAMID_H
+#define NTNDARRAYPYRAMID_H
+
+#include <string>
+#include <vector>
+
+#include <pv/ntndarray.h>
+#include <pv/ntndarrayGraph.h>
+#include <pv/ntndarrayTiler.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTNDArrayPyramid;
+typedef std::tr1::shared_ptr<NTNDArrayPyramid> NTNDArrayPyramidPtr;
+
+/**
+ * @brief Downscaled previews of NTNDArray frames.
+ *
+ * Level k of the pyramid of a frame is the frame downscaled 2^k times
+ * in x and y by a box filter: each element is the average of a
+ * 2^k x 2^k block, rounded for integer types. Partial blocks at the
+ * right and bottom edges are dropped. The levels keep the element type,
+ * uniqueId, timeStamps and attributes of the frame; the size of their
+ * x and y dimensions is divided by 2^k, the binning multiplied by 2^k,
+ * and the fullSize is that of the frame.
+ *
+ * Only levels with subscribers are generated. All of them are computed
+ * in a single pass over bands of 2^k rows of the frame, each level from
+ * the block sums of the level below while they are in cache. Sums of
+ * 8 and 16 bit elements are kept in 32 bit integers and sums of 32 bit
+ * elements in 64 bit integers, so that they are exact.
+ *
+ * Mono frames with two dimensions and pixel interleaved RGB1 frames are
+ * accepted. The pyramid can be used from several threads at once.
+ */
+class epicsShareClass NTNDArrayPyramid
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayPyramid);
+
+    /**
+     * Creates a pyramid generator.
+     * @param levelCount the number of levels, downscaled 2, 4, ... 2^levelCount times.
+     * @param tiler the tiler to spread frames over, or null to generate
+     *        in the calling thread.
+     * @return the generator.
+     * @throws std::runtime_error if levelCount is 0 or above 6.
+     */
+    static shared_pointer create(std::size_t levelCount = 3,
+        NTNDArrayTilerPtr const & tiler = NTNDArrayTilerPtr());
+
+    /**
+     * Adds a subscriber to a level.
+     * @param level the level, 1 to getLevelCount().
+     * @throws std::runtime_error if the level does not exist.
+     */
+    void subscribe(std::size_t level);
+
+    /**
+     * Removes a subscriber from a level.
+     * @param level the level, 1 to getLevelCount().
+     * @throws std::runtime_error if the level does not exist.
+     */
+    void unsubscribe(std::size_t level);
+
+    /**
+     * Returns the number of subscribers of a level.
+     * @param level the level, 1 to getLevelCount().
+     * @return the number of subscribers.
+     * @throws std::runtime_error if the level does not exist.
+     */
+    std::size_t getSubscribers(std::size_t level) const;
+
+    /**
+     * Generates the subscribed levels of a frame.
+     * @param frame the frame.
+     * @param pool the pool to allocate values from, or null.
+     * @return getLevelCount() frames, element k-1 for level k, null for
+     *         levels without subscribers or smaller than one element.
+     * @throws std::runtime_error if the frame has no numeric value or
+     *         is neither mono nor RGB1.
+     */
+    std::vector<NTNDArrayPtr> generate(NTNDArrayPtr const & frame,
+        NTNDArrayBufferPoolPtr const & pool = NTNDArrayBufferPoolPtr());
+
+    /**
+     * Returns one level of a frame. The subscribed levels of the last
+     * frame are kept, so that they are generated once for all of them.
+     * @param frame the frame.
+     * @param level the level, 1 to getLevelCount().
+     * @param pool the pool to allocate values from, or null.
+     * @return the level, null if it has no subscribers or is smaller than one element.
+     * @throws std::runtime_error if the level does not exist, the frame
+     *         has no numeric value or is neither mono nor RGB1.
+     */
+    NTNDArrayPtr getLevel(NTNDArrayPtr const & frame, std::size_t level,
+        NTNDArrayBufferPoolPtr const & pool = NTNDArrayBufferPoolPtr());
+
+    /**
+     * Returns the number of levels.
+     * @return the number of levels.
+     */
+    std::size_t getLevelCount() const;
+
+private:
+    NTNDArrayPyramid(std::size_t levelCount, NTNDArrayTilerPtr const & tiler);
+
+    void checkLevel(std::size_t level) const;
+
+    std::size_t levelCount;
+    NTNDArrayTilerPtr tiler;
+
+    mutable epicsMutex mutex;
+    std::vector<std::size_t> subscribers;
+
+    // the levels of the last frame
+    epicsMutex lastMutex;
+    std::tr1::weak_ptr<NTNDArray> lastFrame;
+    std::vector<NTNDArrayPtr> lastLevels;
+    std::vector<bool> lastSubscribed;
+};
+
+/**
+ * @brief Node that passes on one level of the pyramid of each frame.
+ *
+ * The node subscribes to its level for its lifetime. The nodes of the
+ * levels of a pyramid share the generation of the levels of a frame.
+ */
+class epicsShareClass NTNDArrayPyramidNode : public NTNDArrayNode
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayPyramidNode);
+
+    /**
+     * Constructor.
+     * @param name the name of the node.
+     * @param pyramid the pyramid generator.
+     * @param level the level, 1 to pyramid->getLevelCount().
+     * @param queueSize the capacity of the input queue.
+     * @throws std::runtime_error if the level does not exist.
+     */
+    NTNDArrayPyramidNode(std::string const & name, NTNDArrayPyramidPtr const & pyramid,
+        std::size_t level, std::size_t queueSize = 16);
+
+    /**
+     * Destructor.
+     */
+    virtual ~NTNDArrayPyramidNode();
+
+    virtual NTNDArrayPtr process(NTNDArrayPtr const & frame,
+        NTNDArrayBufferPoolPtr const & pool);
+
+private:
+    NTNDArrayPyramidPtr pyramid;
+    std::size_t level;
+};
+
+}}
+#endif  /* NTNDARRAYPYRAMID_H */
@@ -0,0 +1,189 @@
+/* ntndarrayReorder.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTNDARRAYREORDER_H
+#define NTNDARRAYREORDER_H
+
+#include <vector>
+
+#ifdef epicsExportSharedSymbols
+#   define ntndarrayReorderEpicsExportSharedSymbols
+#   undef epicsExportSharedSymbols
+#endif
+
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+#include <pv/pvData.h>
+
+#ifdef ntndarrayReorderEpicsExportSharedSymbols
+#   define epicsExportSharedSymbols
+#	undef ntndarrayReorderEpicsExportSharedSymbols
+#endif
+
+#include <pv/ntndarray.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTNDArrayReorder;
+typedef std::tr1::shared_ptr<NTNDArrayReorder> NTNDArrayReorderPtr;
+
+/**
+ * @brief Reorder buffer releasing NTNDArray frames in uniqueId order.
+ *
+ * Frames pushed out of order are held until the frames before them
+ * arrive, then released in order of consecutive uniqueIds. Frames are
+ * held in a ring of window slots indexed by uniqueId, allocated once,
+ * and released by pointer; nothing is copied or allocated per frame.
+ *
+ * The first frames pushed are held for the timeout, or until a frame
+ * arrives window or more uniqueIds ahead of them, so that a frame with
+ * a lower uniqueId that another producer thread pushes shortly after is
+ * not late; the lowest uniqueId held sets the one expected next.
+ *
+ * A missing uniqueId is skipped, and counted as a gap, when the next
+ * frame has waited for it for the timeout, on poll(), or when a frame
+ * arrives window or more uniqueIds ahead. Frames arriving after their
+ * uniqueId was released or skipped are dropped and counted as late;
+ * frames whose uniqueId is already held are dropped and counted as
+ * duplicates. A frame window or more uniqueIds behind the next one
+ * starts a new sequence, as when an acquisition restarts from 1: the
+ * held frames are released, the restart is counted and the frame is
+ * released as the first of the sequence. uniqueIds may wrap around.
+ *
+ * Released frames are appended to a vector of the caller, which can be
+ * reused for every call. The buffer can be used from several threads
+ * at once; the frames released to a call follow those released to
+ * earlier calls, so threads that pass them on must keep the order of
+ * their calls, for example by pushing under a lock of their own.
+ */
+class epicsShareClass NTNDArrayReorder
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayReorder);
+
+    /**
+     * Creates a reorder buffer.
+     * @param window the number of uniqueIds from the next one that frames are held for.
+     * @param timeout the time in seconds a frame waits for a missing one before it.
+     * @return the reorder buffer.
+     * @throws std::runtime_error if window is 0.
+     */
+    static shared_pointer create(std::size_t window = 64, double timeout = 1.0);
+
+    /**
+     * Pushes a frame.
+     * @param frame the frame.
+     * @param released the vector the frames released in order are appended to.
+     */
+    void push(NTNDArrayPtr const & frame, std::vector<NTNDArrayPtr> & released);
+
+    /**
+     * Skips missing uniqueIds that frames have waited for the timeout.
+     * To be called periodically while frames are held.
+     * @param released the vector the frames released in order are appended to.
+     */
+    void poll(std::vector<NTNDArrayPtr> & released);
+
+    /**
+     * Releases all held frames, skipping missing uniqueIds.
+     * @param released the vector the frames released in order are appended to.
+     */
+    void flush(std::vector<NTNDArrayPtr> & released);
+
+    /**
+     * Discards the held frames and the counters.
+     * The next frames pushed are held as the first ones.
+     */
+    void reset();
+
+    /**
+     * Returns the uniqueId expected next.
+     * @return the uniqueId, 0 before the first frame.
+     */
+    epics::pvData::int32 getNext() const;
+
+    /**
+     * Returns the number of held frames.
+     * @return the number of frames.
+     */
+    std::size_t getPending() const;
+
+    /**
+     * Returns the number of skipped uniqueIds.
+     * @return the number of uniqueIds.
+     */
+    std::size_t getGaps() const;
+
+    /**
+     * Returns the number of frames dropped because their uniqueId was held.
+     * @return the number of frames.
+     */
+    std::size_t getDuplicates() const;
+
+    /**
+     * Returns the number of frames dropped because their uniqueId was
+     * released or skipped.
+     * @return the number of frames.
+     */
+    std::size_t getLate() const;
+
+    /**
+     * Returns the number of new sequences started by a frame
+     * window or more uniqueIds behind the next one.
+     * @return the number of sequences.
+     */
+    std::size_t getRestarts() const;
+
+    /**
+     * Returns the number of frames released.
+     * @return the number of frames.
+     */
+    std::size_t getReleased() const;
+
+    /**
+     * Returns the window.
+     * @return the number of uniqueIds frames are held for.
+     */
+    std::size_t getWindow() const;
+
+    /**
+     * Returns the timeout.
+     * @return the timeout in seconds.
+     */
+    double getTimeout() const;
+
+private:
+    NTNDArrayReorder(std::size_t window, double timeout);
+
+    NTNDArrayPtr & slot(std::size_t ahead);
+    std::size_t extent() const;
+    void advance(std::vector<NTNDArrayPtr> & released);
+    void release(std::vector<NTNDArrayPtr> & released);
+
+    std::size_t window;
+    double timeout;
+
+    mutable epicsMutex mutex;
+    std::vector<NTNDArrayPtr> slots;
+    bool started;
+    bool settling;
+    epics::pvData::int32 next;
+    std::size_t head;
+    std::size_t pending;
+    bool blocked;
+    epicsTime blockedSince;
+
+    std::size_t gaps;
+    std::size_t duplicates;
+    std::size_t late;
+    std::size_t restarts;
+    std::size_t releasedCount;
+};
+
+}}
+#endif  /* NTNDARRAYREORDER_H */
@@ -0,0 +1,219 @@
+/* ntndarrayShm.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTNDARRAYSHM_H
+#define NTNDARRAYSHM_H
+
+#include <string>
+#include <vector>
+
+#ifdef epicsExportSharedSymbols
+#   define ntndarrayShmEpicsExportSharedSymbols
+#   undef epicsExportSharedSymbols
+#endif
+
+#include <pv/pvData.h>
+
+#ifdef ntndarrayShmEpicsExportSharedSymbols
+#   define epicsExportSharedSymbols
+#	undef ntndarrayShmEpicsExportSharedSymbols
+#endif
+
+#include <pv/ntndarray.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTNDArrayShmRing;
+typedef std::tr1::shared_ptr<NTNDArrayShmRing> NTNDArrayShmRingPtr;
+
+/**
+ * @brief Ring of NTNDArray frames in POSIX shared memory.
+ *
+ * One producer process creates the ring and publishes frames into it,
+ * any number of consumer processes on the same host open it by name and
+ * receive the frames. The ring is made of a fixed number of slots, each
+ * holding the value array of one frame next to its other fields, which
+ * are serialized compactly with their introspection data.
+ *
+ * A producer that fills arrays obtained from allocate() publishes them
+ * without copying. Consumers get an NTNDArray whose value array points
+ * into the shared segment. The slot stays valid for as long as any
+ * process holds that array: every holder is counted in the slot, and
+ * the producer only reuses slots that nobody refers to any more.
+ * When all slots are referenced, publishing fails instead of blocking.
+ *
+ * Each consumer registers its process id in the ring, and counts the
+ * references it holds per slot. When all slots are referenced, the
+ * producer returns the references of consumers whose process no longer
+ * exists, so a consumer that terminates abnormally while holding frames
+ * does not leak their slots. This needs the processes to see each
+ * other's ids, i.e. to share a PID namespace. At most 64 consumers can
+ * have a ring open at once.
+ *
+ * An instance of this object must not be used concurrently.
+ */
+class epicsShareClass NTNDArrayShmRing :
+    public std::tr1::enable_shared_from_this<NTNDArrayShmRing>
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayShmRing);
+
+    /**
+     * Creates a ring.
+     * The segment is removed when the producer destroys the ring;
+     * consumers keep access to it until they destroy theirs.
+     * @param name the name of the shared memory segment.
+     * @param slotCount the number of slots.
+     * @param slotSize the maximum size of a value array in bytes.
+     * @param metadataSize the maximum size of the other fields of a frame,
+     *        serialized, in bytes.
+     * @param replace whether a segment of the same name, e.g. left over by
+     *        a producer that terminated abnormally, is removed first.
+     * @return the producer side of the ring.
+     * @throws std::runtime_error if the segment cannot be created,
+     *         or exists and is not replaced.
+     */
+    static shared_pointer create(std::string const & name,
+        std::size_t slotCount, std::size_t slotSize,
+        std::size_t metadataSize = 65536, bool replace = false);
+
+    /**
+     * Opens an existing ring.
+     * @param name the name of the shared memory segment.
+     * @return the consumer side of the ring.
+     * @throws std::runtime_error if there is no such ring, it is not
+     *         created completely yet, or it has too many consumers.
+     */
+    static shared_pointer open(std::string const & name);
+
+    /**
+     * Destructor.
+     */
+    ~NTNDArrayShmRing();
+
+    /**
+     * Returns the name of the shared memory segment.
+     * @return the name.
+     */
+    std::string getName() const;
+
+    /**
+     * Returns the number of slots.
+     * @return the number of slots.
+     */
+    std::size_t getSlotCount() const;
+
+    /**
+     * Returns the maximum size of a value array in bytes.
+     * @return the slot size.
+     */
+    std::size_t getSlotSize() const;
+
+    /**
+     * Allocates an array in a free slot, to be filled and published by the producer.
+     * @param count the number of elements.
+     * @return the array or an empty array if all slots are referenced.
+     * @throws std::runtime_error if this is not the producer side
+     *         or if the array would exceed the slot size.
+     */
+    template<typename T>
+    epics::pvData::shared_vector<T> allocate(std::size_t count)
+    {
+        std::size_t slot = allocateSlot(count*sizeof(T));
+        if (slot == (std::size_t)-1)
+            return epics::pvData::shared_vector<T>();
+        return epics::pvData::shared_vector<T>(static_cast<T*>(slotData(slot)),
+            SlotRelease(shared_from_this(), slot), 0, count);
+    }
+
+    /**
+     * Publishes a frame. A value array obtained from allocate() is
+     * published in place, any other value array is copied into a free slot.
+     * @param ntndArray the frame.
+     * @return (false,true) if the frame (was not, was) published.
+     *         It is not published if all slots are referenced.
+     * @throws std::runtime_error if this is not the producer side or
+     *         if the frame does not fit into a slot.
+     */
+    bool publish(NTNDArrayPtr const & ntndArray);
+
+    /**
+     * Returns the sequence number of the last published frame,
+     * starting from 1. No frame was published yet if it is 0.
+     * @return the sequence number.
+     */
+    std::size_t getLastSequence() const;
+
+    /**
+     * Receives a published frame.
+     * @param sequence the sequence number of the frame.
+     * @return the frame or null if it is no longer or not yet in the ring.
+     */
+    NTNDArrayPtr get(std::size_t sequence);
+
+    /**
+     * Receives the next published frame. Frames already replaced
+     * by newer ones are skipped and counted as missed.
+     * @return the frame or null if there is no new frame.
+     */
+    NTNDArrayPtr next();
+
+    /**
+     * Returns the number of frames skipped by next().
+     * @return the number of missed frames.
+     */
+    std::size_t getMissed() const;
+
+private:
+    struct Header;
+    struct Slot;
+
+    struct SlotRelease {
+        SlotRelease(shared_pointer const & ring, std::size_t slot)
+        : ring(ring), slot(slot) {}
+
+        template<typename T>
+        void operator()(T *) { ring->release(slot); }
+
+        shared_pointer ring;
+        std::size_t slot;
+    };
+    friend struct SlotRelease;
+
+    NTNDArrayShmRing(std::string const & name, bool producer,
+        void *base, std::size_t mappedSize);
+
+    std::size_t registerConsumer();
+    void reclaim();
+    std::size_t allocateSlot(std::size_t size);
+    void release(std::size_t slot);
+    void *slotData(std::size_t slot) const;
+    char *slotMetadata(std::size_t slot) const;
+    std::size_t findSlot(const char *data, std::size_t size, std::size_t &offset) const;
+    NTNDArrayPtr decodeSlot(std::size_t slot);
+
+    std::string name;
+    bool producer;
+    char *base;
+    std::size_t mappedSize;
+    Header *header;
+    Slot *slots;
+    int *holds;
+    char *slotArea;
+    std::size_t slotStride;
+
+    std::size_t nextSlot;
+    std::size_t readSequence;
+    std::size_t missed;
+    std::size_t consumer;
+
+    std::vector<char> introspection;
+    epics::pvData::StructureConstPtr structure;
+};
+
+}}
+#endif  /* NTNDARRAYSHM_H */
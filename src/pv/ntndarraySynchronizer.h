@@ -0,0 +1,166 @@
+/* ntndarraySynchronizer.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTNDARRAYSYNCHRONIZER_H
+#define NTNDARRAYSYNCHRONIZER_H
+
+#include <string>
+#include <vector>
+
+#ifdef epicsExportSharedSymbols
+#   define ntndarraySynchronizerEpicsExportSharedSymbols
+#   undef epicsExportSharedSymbols
+#endif
+
+#include <epicsMutex.h>
+
+#include <pv/pvData.h>
+
+#ifdef ntndarraySynchronizerEpicsExportSharedSymbols
+#   define epicsExportSharedSymbols
+#	undef ntndarraySynchronizerEpicsExportSharedSymbols
+#endif
+
+#include <pv/ntndarray.h>
+#include <pv/ntmultiChannel.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTNDArraySynchronizer;
+typedef std::tr1::shared_ptr<NTNDArraySynchronizer> NTNDArraySynchronizerPtr;
+
+/**
+ * @brief Groups frames of several NTNDArray streams on dataTimeStamp.
+ *
+ * A group holds one frame of each stream. It is formed when a frame is
+ * pushed for which every other stream holds a frame whose dataTimeStamp
+ * is within the tolerance; of several, the closest is taken. Otherwise
+ * the frame is held in a ring of its stream, sorted by dataTimeStamp,
+ * which is searched by bisection.
+ *
+ * The frames of each stream are expected in about dataTimeStamp order:
+ * when a group is formed, the frames held before its frames can no
+ * longer be grouped and are dropped. Frames are also dropped when a
+ * ring is full. Nothing is copied or allocated per frame.
+ *
+ * The synchronizer can be used from several threads at once; threads
+ * that pass groups on must keep the order of their calls, for example by
+ * pushing under a lock of their own.
+ */
+class epicsShareClass NTNDArraySynchronizer
+{
+public:
+    POINTER_DEFINITIONS(NTNDArraySynchronizer);
+
+    /**
+     * Creates a synchronizer.
+     * @param streamCount the number of streams.
+     * @param tolerance the largest difference of dataTimeStamps in a
+     *        group from the frame that completes it, in seconds.
+     * @param depth the number of frames held per stream.
+     * @return the synchronizer.
+     * @throws std::runtime_error if streamCount or depth is 0.
+     */
+    static shared_pointer create(std::size_t streamCount, double tolerance,
+        std::size_t depth = 64);
+
+    /**
+     * Pushes a frame of a stream.
+     * @param stream the stream, 0 to getStreamCount() - 1.
+     * @param frame the frame.
+     * @param group set to the frames of the group, by stream, if the frame completes one.
+     * @return (false,true) if the frame (does not complete,completes) a group.
+     * @throws std::runtime_error if the stream does not exist.
+     */
+    bool push(std::size_t stream, NTNDArrayPtr const & frame,
+        std::vector<NTNDArrayPtr> & group);
+
+    /**
+     * Discards the held frames and the counters.
+     */
+    void reset();
+
+    /**
+     * Returns the number of frames held for a stream.
+     * @param stream the stream, 0 to getStreamCount() - 1.
+     * @return the number of frames.
+     * @throws std::runtime_error if the stream does not exist.
+     */
+    std::size_t getPending(std::size_t stream) const;
+
+    /**
+     * Returns the number of groups formed.
+     * @return the number of groups.
+     */
+    std::size_t getGroups() const;
+
+    /**
+     * Returns the number of frames dropped without a group.
+     * @return the number of frames.
+     */
+    std::size_t getDropped() const;
+
+    /**
+     * Returns the number of streams.
+     * @return the number of streams.
+     */
+    std::size_t getStreamCount() const;
+
+    /**
+     * Returns the tolerance.
+     * @return the tolerance in seconds.
+     */
+    double getTolerance() const;
+
+    /**
+     * Returns the number of frames held per stream.
+     * @return the number of frames.
+     */
+    std::size_t getDepth() const;
+
+    /**
+     * Bundles a group into an NTMultiChannel.
+     * The value holds the frames, which are shared, not copied.
+     * secondsPastEpoch and nanoseconds hold their dataTimeStamps and
+     * timeStamp the earliest of them.
+     * @param group the frames, none null.
+     * @param names the channelNames, one per frame, or empty for "0", "1", ...
+     * @return the bundle.
+     * @throws std::runtime_error if the number of names differs from the number of frames.
+     */
+    static NTMultiChannelPtr createBundle(std::vector<NTNDArrayPtr> const & group,
+        std::vector<std::string> const & names = std::vector<std::string>());
+
+private:
+    NTNDArraySynchronizer(std::size_t streamCount, double tolerance, std::size_t depth);
+
+    struct Stream
+    {
+        std::vector<epics::pvData::int64> times;
+        std::vector<NTNDArrayPtr> frames;
+        std::size_t first;
+        std::size_t count;
+    };
+
+    void checkStream(std::size_t stream) const;
+    std::size_t find(Stream const & stream, epics::pvData::int64 time) const;
+    void insert(Stream & stream, epics::pvData::int64 time, NTNDArrayPtr const & frame);
+    void drop(Stream & stream, std::size_t count);
+
+    std::size_t depth;
+    double tolerance;
+    epics::pvData::int64 toleranceNanoseconds;
+
+    mutable epicsMutex mutex;
+    std::vector<Stream> streams;
+    std::vector<std::size_t> matches;
+    std::size_t groups;
+    std::size_t dropped;
+};
+
+}}
+#endif  /* NTNDARRAYSYNCHRONIZER_H */
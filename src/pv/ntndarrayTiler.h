@@ -0,0 +1,246 @@
+/* ntndarrayTiler.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTNDARRAYTILER_H
+#define NTNDARRAYTILER_H
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef epicsExportSharedSymbols
+#   define ntndarrayTilerEpicsExportSharedSymbols
+#   undef epicsExportSharedSymbols
+#endif
+
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+
+#include <pv/pvData.h>
+
+#ifdef ntndarrayTilerEpicsExportSharedSymbols
+#   define epicsExportSharedSymbols
+#	undef ntndarrayTilerEpicsExportSharedSymbols
+#endif
+
+#include <pv/ntndarray.h>
+#include <pv/ntndarrayGraph.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTNDArrayTiler;
+typedef std::tr1::shared_ptr<NTNDArrayTiler> NTNDArrayTilerPtr;
+
+/**
+ * @brief Rectangular part of a frame.
+ *
+ * A tile covers width elements of dimension[0] in each of height
+ * consecutive rows of dimension[1], in one plane of the remaining
+ * dimensions. Rows of the input and the output are given by a pointer
+ * to their first element in the tile and the distance between rows.
+ */
+struct NTNDArrayTile
+{
+    std::size_t x;          ///< the first element in dimension[0]
+    std::size_t y;          ///< the first row in dimension[1]
+    std::size_t plane;      ///< the index over the remaining dimensions
+    std::size_t width;      ///< the number of elements per row
+    std::size_t height;     ///< the number of rows
+
+    epics::pvData::ScalarType inputType;   ///< the element type of the input
+    const char *input;                     ///< the first input element of the tile
+    std::size_t inputStride;               ///< the input row distance in bytes
+
+    epics::pvData::ScalarType outputType;  ///< the element type of the output
+    char *output;                          ///< the first output element of the tile, or null
+    std::size_t outputStride;              ///< the output row distance in bytes
+};
+
+/**
+ * @brief Kernel applied to the tiles of a frame.
+ *
+ * apply() is called concurrently for different tiles of a frame.
+ */
+class epicsShareClass NTNDArrayKernel
+{
+public:
+    virtual ~NTNDArrayKernel() {}
+
+    /**
+     * Processes a tile.
+     * @param tile the tile.
+     */
+    virtual void apply(NTNDArrayTile const & tile) = 0;
+};
+
+/**
+ * @brief Kernel computing each output element from the input element
+ * at the same position.
+ *
+ * Op is a function object mapping an In to an Out.
+ */
+template<typename In, typename Out, typename Op>
+class NTNDArrayPixelKernel : public NTNDArrayKernel
+{
+public:
+    /**
+     * Constructor.
+     * @param op the function object.
+     */
+    explicit NTNDArrayPixelKernel(Op const & op = Op()) : op(op) {}
+
+    virtual void apply(NTNDArrayTile const & tile)
+    {
+        if (tile.inputType != (epics::pvData::ScalarType)epics::pvData::ScalarTypeID<In>::value ||
+            tile.outputType != (epics::pvData::ScalarType)epics::pvData::ScalarTypeID<Out>::value ||
+            !tile.output)
+            throw std::runtime_error("tile types do not match the kernel");
+
+        for (std::size_t row = 0; row < tile.height; ++row) {
+            const In *in = reinterpret_cast<const In*>(tile.input + row*tile.inputStride);
+            Out *out = reinterpret_cast<Out*>(tile.output + row*tile.outputStride);
+            for (std::size_t i = 0; i < tile.width; ++i)
+                out[i] = op(in[i]);
+        }
+    }
+
+    Op op;
+};
+
+/**
+ * @brief Linear map out = scale*in + offset, for NTNDArrayPixelKernel.
+ */
+template<typename In, typename Out>
+struct NTNDArrayLinearOp
+{
+    NTNDArrayLinearOp(double scale = 1, double offset = 0) : scale(scale), offset(offset) {}
+
+    Out operator()(In in) const { return static_cast<Out>(scale*in + offset); }
+
+    double scale;
+    double offset;
+};
+
+/**
+ * @brief Runs kernels over the tiles of frames on a thread pool.
+ *
+ * A frame is split into tiles of dimension[0] by dimension[1] elements
+ * that fit, input and output together, into a given number of bytes,
+ * chosen to fit the L2 cache. The tiles are spread over the worker threads
+ * and the calling thread. Kernels write straight into the value array of
+ * the output frame, so no stitching copy is needed.
+ *
+ * Calls from several threads are serialized. A kernel may itself call
+ * the tiler from apply(): such a nested call runs its tiles serially on
+ * the thread that made it, since the workers are busy with the outer
+ * call and would otherwise be waited for forever.
+ */
+class epicsShareClass NTNDArrayTiler
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayTiler);
+
+    /**
+     * Creates a tiler.
+     * @param threadCount the number of threads running kernels,
+     *        including the calling thread; the number of CPUs if 0.
+     * @param tileBytes the size of a tile, input and output together.
+     * @return the tiler.
+     */
+    static shared_pointer create(std::size_t threadCount = 0,
+        std::size_t tileBytes = 256*1024);
+
+    /**
+     * Destructor.
+     */
+    ~NTNDArrayTiler();
+
+    /**
+     * Applies a kernel to a frame, producing a new frame.
+     * The new frame has the fields of the input frame and a value of
+     * the same dimensions allocated from the pool.
+     * @param frame the input frame.
+     * @param kernel the kernel.
+     * @param outputType the element type of the output value.
+     * @param pool the pool to allocate the output value from,
+     *        a pool of the tiler if null.
+     * @return the output frame.
+     * @throws std::runtime_error if the frame has no numeric value
+     *         or the kernel threw an exception.
+     */
+    NTNDArrayPtr transform(NTNDArrayPtr const & frame, NTNDArrayKernel & kernel,
+        epics::pvData::ScalarType outputType,
+        NTNDArrayBufferPoolPtr const & pool = NTNDArrayBufferPoolPtr());
+
+    /**
+     * Applies a kernel to a frame without output, for example to
+     * compute a reduction. The output of the tiles is null.
+     * @param frame the frame.
+     * @param kernel the kernel.
+     * @throws std::runtime_error if the frame has no numeric value
+     *         or the kernel threw an exception.
+     */
+    void visit(NTNDArrayPtr const & frame, NTNDArrayKernel & kernel);
+
+    /**
+     * Applies a kernel to given tiles, for example tiles that split
+     * the output of a kernel rather than its input.
+     * @param tiles the tiles.
+     * @param kernel the kernel.
+     * @throws std::runtime_error if the kernel threw an exception.
+     */
+    void run(std::vector<NTNDArrayTile> const & tiles, NTNDArrayKernel & kernel);
+
+    /**
+     * Splits a frame into tiles.
+     * @param frame the frame.
+     * @param outputType the element type of the output.
+     * @param output the output value, or null.
+     * @return the tiles.
+     * @throws std::runtime_error if the frame has no numeric value.
+     */
+    std::vector<NTNDArrayTile> split(NTNDArrayPtr const & frame,
+        epics::pvData::ScalarType outputType, char *output = 0) const;
+
+    /**
+     * Returns the number of threads running kernels.
+     * @return the number of threads.
+     */
+    std::size_t getThreadCount() const;
+
+    /**
+     * Returns the size of a tile, input and output together.
+     * @return the size in bytes.
+     */
+    std::size_t getTileBytes() const;
+
+private:
+    struct Job;
+    class Worker;
+    friend class Worker;
+
+    NTNDArrayTiler(std::size_t threadCount, std::size_t tileBytes);
+
+    bool isNested();
+    void runTiles(Job & job);
+
+    std::size_t tileBytes;
+    NTNDArrayBufferPoolPtr pool;
+    std::vector<Worker*> workers;
+
+    epicsMutex runMutex;
+    epicsMutex mutex;
+    Job *job;
+    epicsThreadId runner;
+    std::size_t active;
+    epicsEvent done;
+    int stopping;
+};
+
+}}
+#endif  /* NTNDARRAYTILER_H */
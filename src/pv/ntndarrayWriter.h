@@ -0,0 +1,184 @@
+/* ntndarrayWriter.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTNDARRAYWRITER_H
+#define NTNDARRAYWRITER_H
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#ifdef epicsExportSharedSymbols
+#   define ntndarrayWriterEpicsExportSharedSymbols
+#   undef epicsExportSharedSymbols
+#endif
+
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+
+#include <pv/pvData.h>
+
+#ifdef ntndarrayWriterEpicsExportSharedSymbols
+#   define epicsExportSharedSymbols
+#	undef ntndarrayWriterEpicsExportSharedSymbols
+#endif
+
+#include <pv/ntndarray.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTNDArrayWriter;
+typedef std::tr1::shared_ptr<NTNDArrayWriter> NTNDArrayWriterPtr;
+
+/**
+ * @brief Streaming writer of NTNDArray frames to a file.
+ *
+ * All frames of a stream must have the same value type and dimensions.
+ * They are written as one C ordered array whose first index is the frame
+ * number and whose last index is dimension[0], the fastest varying one.
+ * In npy format the file is a NumPy .npy file. In raw format it holds the
+ * bare value data and a sidecar file, named after it with ".json"
+ * appended, describes the element type and shape with NumPy conventions.
+ *
+ * write() only copies the value array into one of a set of large,
+ * page aligned buffers; a background thread writes full buffers to the
+ * file. The file can be opened with O_DIRECT (F_NOCACHE on Darwin) to
+ * bypass the page cache, where the file system supports it.
+ *
+ * write() and close() must not be called concurrently, while the
+ * counters may be read from any thread.
+ */
+class epicsShareClass NTNDArrayWriter : private epicsThreadRunable
+{
+public:
+    POINTER_DEFINITIONS(NTNDArrayWriter);
+
+    /**
+     * File formats.
+     */
+    enum Format {
+        npyFormat,  ///< NumPy .npy file
+        rawFormat   ///< value data with a JSON sidecar file
+    };
+
+    /**
+     * Creates a writer, truncating the file if it exists.
+     * @param fileName the name of the file.
+     * @param format the file format.
+     * @param bufferSize the size of each buffer in bytes,
+     *        rounded up to a multiple of the page size.
+     * @param bufferCount the number of buffers, at least 2.
+     * @param direct (false,true) to (not bypass, bypass) the page cache.
+     * @return the writer.
+     * @throws std::runtime_error if the file cannot be opened.
+     */
+    static shared_pointer create(std::string const & fileName,
+        Format format = npyFormat,
+        std::size_t bufferSize = 16*1024*1024, std::size_t bufferCount = 4,
+        bool direct = false);
+
+    /**
+     * Destructor. Closes the file, ignoring any error.
+     */
+    ~NTNDArrayWriter();
+
+    /**
+     * Appends a frame to the stream.
+     * @param ntndArray the frame.
+     * @param wait (false,true) to (drop the frame, wait for the I/O thread)
+     *        if the buffers cannot take the frame.
+     * @return (false,true) if the frame (was dropped, was queued).
+     * @throws std::runtime_error if the frame has no numeric value,
+     *         if its type or dimensions differ from the first frame,
+     *         if the writer is closed or if writing failed.
+     */
+    bool write(NTNDArrayPtr const & ntndArray, bool wait = false);
+
+    /**
+     * Writes all queued frames, completes the file header or the
+     * sidecar file and closes the file. Does nothing if already closed.
+     * @throws std::runtime_error if writing failed.
+     */
+    void close();
+
+    /**
+     * Returns the name of the file.
+     * @return the file name.
+     */
+    std::string getFileName() const;
+
+    /**
+     * Returns whether the file bypasses the page cache.
+     * @return (false,true) if it (does not, does).
+     */
+    bool isDirect() const;
+
+    /**
+     * Returns the number of frames queued.
+     * @return the number of frames.
+     */
+    std::size_t getFrameCount() const;
+
+    /**
+     * Returns the number of frames dropped by write().
+     * @return the number of frames.
+     */
+    std::size_t getDropped() const;
+
+    /**
+     * Returns the number of value bytes written to the file so far.
+     * @return the number of bytes.
+     */
+    epics::pvData::uint64 getBytesWritten() const;
+
+private:
+    NTNDArrayWriter(std::string const & fileName, Format format, int fd,
+        bool direct, std::size_t bufferSize, std::size_t bufferCount);
+
+    virtual void run();
+
+    void setShape(epics::pvData::ScalarType type,
+        std::vector<std::size_t> const & shape);
+    std::string descr() const;
+    std::string shapeText() const;
+    std::string npyHeader() const;
+    void submit(bool last);
+    void checkError();
+    void writeSidecar();
+
+    std::string fileName;
+    Format format;
+    int fd;
+    bool direct;
+    std::size_t bufferSize;
+    std::size_t headerSize;
+
+    std::vector<char*> buffers;
+    std::vector<std::size_t> freeBuffers;
+    std::deque<std::pair<std::size_t, std::size_t> > fullBuffers;
+    std::size_t current;
+    std::size_t fill;
+
+    epics::pvData::ScalarType type;
+    std::vector<std::size_t> frameShape;
+    std::size_t frameBytes;
+    std::size_t frames;
+    std::size_t dropped;
+    epics::pvData::uint64 written;
+
+    mutable epicsMutex mutex;
+    epicsEvent work;
+    epicsEvent done;
+    bool stopping;
+    bool closed;
+    std::string error;
+    epicsThread thread;
+};
+
+}}
+#endif  /* NTNDARRAYWRITER_H */
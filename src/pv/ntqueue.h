@@ -0,0 +1,361 @@
+/* ntqueue.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTQUEUE_H
+#define NTQUEUE_H
+
+#include <vector>
+
+#ifdef epicsExportSharedSymbols
+#   define ntqueueEpicsExportSharedSymbols
+#   undef epicsExportSharedSymbols
+#endif
+
+#include <epicsAtomic.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include <pv/sharedPtr.h>
+
+#ifdef ntqueueEpicsExportSharedSymbols
+#   define epicsExportSharedSymbols
+#	undef ntqueueEpicsExportSharedSymbols
+#endif
+
+#include <pv/ntndarray.h>
+
+namespace epics { namespace nt {
+
+/**
+ * @brief Bounded lock-free queue of NT instance pointers.
+ *
+ * Any number of threads may push and pop concurrently. push() and pop()
+ * do not take a lock: each slot of the ring carries a sequence number
+ * that tells producers and consumers whether it is free or filled, and
+ * positions are claimed with compare and swap. Only a thread that has to
+ * wait, for a frame or for space, sleeps on an event.
+ *
+ * When the queue is full, push() either waits for space or drops the
+ * oldest queued pointer, depending on the policy of the queue.
+ *
+ * @tparam T the NT type, such as NTNDArray.
+ */
+template<typename T>
+class NTQueue
+{
+public:
+    POINTER_DEFINITIONS(NTQueue);
+
+    typedef std::tr1::shared_ptr<T> value_pointer;
+
+    /**
+     * What push() does when the queue is full.
+     */
+    enum Policy {
+        block,      ///< wait until there is space
+        dropOldest  ///< drop the oldest queued pointer
+    };
+
+    /**
+     * Creates a queue.
+     * @param capacity the maximum number of queued pointers,
+     *        rounded up to a power of two.
+     * @param policy what push() does when the queue is full.
+     * @return the queue.
+     */
+    static shared_pointer create(std::size_t capacity, Policy policy = block)
+    {
+        return shared_pointer(new NTQueue(capacity, policy));
+    }
+
+    /**
+     * Returns the maximum number of queued pointers.
+     * @return the capacity.
+     */
+    std::size_t getCapacity() const { return mask + 1; }
+
+    /**
+     * Returns the policy of the queue.
+     * @return the policy.
+     */
+    Policy getPolicy() const { return policy; }
+
+    /**
+     * Returns the number of queued pointers.
+     * The value is approximate while other threads use the queue.
+     * @return the depth.
+     */
+    std::size_t getDepth() const
+    {
+        std::size_t tail = epicsAtomicGetSizeT(&dequeuePos);
+        std::size_t head = epicsAtomicGetSizeT(&enqueuePos);
+        return head - tail > mask + 1 ? 0 : head - tail;
+    }
+
+    /**
+     * Returns the number of pointers dropped by push().
+     * @return the number of dropped pointers.
+     */
+    std::size_t getDropped() const { return epicsAtomicGetSizeT(&dropped); }
+
+    /**
+     * Appends a pointer, applying the policy of the queue if it is full.
+     * @param value the pointer, which must not be null.
+     * @return false if the queue was closed, true otherwise.
+     */
+    bool push(value_pointer const & value)
+    {
+        while (!tryPush(value))
+        {
+            if (isClosed())
+                return false;
+
+            if (policy == dropOldest) {
+                value_pointer oldest;
+                if (tryPop(oldest))
+                    epicsAtomicIncrSizeT(&dropped);
+                continue;
+            }
+
+            bool pushed = false;
+            for (int spin = 0; spin < spinCount && !pushed; ++spin)
+                pushed = tryPush(value);
+            if (pushed)
+                break;
+
+            epicsAtomicIncrSizeT(&producersWaiting);
+            pushed = tryPush(value);
+            while (!pushed && !isClosed()) {
+                notFull.wait(waitSlice);
+                pushed = tryPush(value);
+            }
+            std::size_t waiting = epicsAtomicDecrSizeT(&producersWaiting);
+            // a woken up producer wakes up the next one
+            if (waiting && (isClosed() || getDepth() <= mask/2))
+                notFull.signal();
+            if (pushed)
+                break;
+        }
+        return true;
+    }
+
+    /**
+     * Appends a pointer if the queue is not full, never waiting or dropping.
+     * @param value the pointer, which must not be null.
+     * @return (false,true) if the pointer (was not, was) appended.
+     */
+    bool tryPush(value_pointer const & value)
+    {
+        if (isClosed())
+            return false;
+
+        std::size_t pos = epicsAtomicGetSizeT(&enqueuePos);
+        while (true)
+        {
+            Cell & cell = cells[pos & mask];
+            std::size_t sequence = epicsAtomicGetSizeT(&cell.sequence);
+            if (sequence == pos) {
+                std::size_t claimed = epicsAtomicCmpAndSwapSizeT(&enqueuePos, pos, pos + 1);
+                if (claimed == pos) {
+                    cell.value = value;
+                    // publishes the value, the add is a full barrier
+                    epicsAtomicIncrSizeT(&cell.sequence);
+                    break;
+                }
+                pos = claimed;
+            } else if (sequence - pos > mask + 1) {
+                // the slot still holds the value of the previous round
+                return false;
+            } else {
+                pos = epicsAtomicGetSizeT(&enqueuePos);
+            }
+        }
+
+        if (epicsAtomicGetSizeT(&consumersWaiting))
+            notEmpty.signal();
+        return true;
+    }
+
+    /**
+     * Removes the oldest pointer, waiting until there is one.
+     * @return the pointer or null if the queue was closed and is empty.
+     */
+    value_pointer pop()
+    {
+        return pop(-1.0);
+    }
+
+    /**
+     * Removes the oldest pointer, waiting for at most a given time.
+     * @param timeout the time to wait in seconds, forever if negative.
+     * @return the pointer or null if there was none in time or
+     *         the queue was closed and is empty.
+     */
+    value_pointer pop(double timeout)
+    {
+        value_pointer value;
+        if (tryPop(value) || timeout == 0.0)
+            return value;
+        for (int spin = 0; spin < spinCount; ++spin)
+            if (tryPop(value))
+                return value;
+
+        epicsTime deadline(epicsTime::getCurrent() + (timeout > 0.0 ? timeout : 0.0));
+        epicsAtomicIncrSizeT(&consumersWaiting);
+        while (!tryPop(value) && !isClosed()) {
+            double wait = waitSlice;
+            if (timeout > 0.0) {
+                double remaining = deadline - epicsTime::getCurrent();
+                if (remaining <= 0.0)
+                    break;
+                if (remaining < wait)
+                    wait = remaining;
+            }
+            notEmpty.wait(wait);
+        }
+        std::size_t waiting = epicsAtomicDecrSizeT(&consumersWaiting);
+
+        // several pushes may have been collapsed into one signal
+        if (waiting && (getDepth() || isClosed()))
+            notEmpty.signal();
+        return value;
+    }
+
+    /**
+     * Removes the oldest pointer if there is one, never waiting.
+     * @param value the pointer, unchanged if the queue is empty.
+     * @return (false,true) if a pointer (was not, was) removed.
+     */
+    bool tryPop(value_pointer & value)
+    {
+        std::size_t pos = epicsAtomicGetSizeT(&dequeuePos);
+        while (true)
+        {
+            Cell & cell = cells[pos & mask];
+            std::size_t sequence = epicsAtomicGetSizeT(&cell.sequence);
+            if (sequence == pos + 1) {
+                std::size_t claimed = epicsAtomicCmpAndSwapSizeT(&dequeuePos, pos, pos + 1);
+                if (claimed == pos) {
+                    value.swap(cell.value);
+                    cell.value.reset();
+                    // releases the slot for the next round
+                    epicsAtomicAddSizeT(&cell.sequence, mask);
+                    break;
+                }
+                pos = claimed;
+            } else if (sequence - (pos + 1) > mask + 1) {
+                // the slot is not filled yet
+                return false;
+            } else {
+                pos = epicsAtomicGetSizeT(&dequeuePos);
+            }
+        }
+
+        // waiting producers are woken up once the queue is half empty,
+        // rather than for every free slot
+        if (epicsAtomicGetSizeT(&producersWaiting) && getDepth() <= mask/2)
+            notFull.signal();
+        return true;
+    }
+
+    /**
+     * Removes several pointers at once, waiting for the first one.
+     * A consumer that takes its work in batches is woken up less often.
+     * @param values the vector the pointers are appended to.
+     * @param maxCount the maximum number of pointers to remove.
+     * @param timeout the time to wait for the first pointer in seconds,
+     *        forever if negative.
+     * @return the number of pointers removed.
+     */
+    std::size_t popBatch(std::vector<value_pointer> & values,
+        std::size_t maxCount, double timeout = -1.0)
+    {
+        if (maxCount == 0)
+            return 0;
+
+        value_pointer value(pop(timeout));
+        if (!value)
+            return 0;
+
+        std::size_t count = 0;
+        do {
+            values.push_back(value_pointer());
+            values.back().swap(value);
+            ++count;
+        } while (count < maxCount && tryPop(value));
+        return count;
+    }
+
+    /**
+     * Closes the queue. Further pushes fail, waiting producers return and
+     * consumers receive the queued pointers, then null.
+     */
+    void close()
+    {
+        epicsAtomicSetIntT(&closed, 1);
+        notEmpty.signal();
+        notFull.signal();
+    }
+
+    /**
+     * Returns whether the queue was closed.
+     * @return (false,true) if it (was not, was) closed.
+     */
+    bool isClosed() const { return epicsAtomicGetIntT(&closed) != 0; }
+
+private:
+    struct Cell {
+        std::size_t sequence;
+        value_pointer value;
+    };
+
+    // the longest a waiting thread sleeps before it checks the queue again
+    static const double waitSlice;
+
+    NTQueue(std::size_t capacity, Policy policy) :
+        policy(policy), closed(0), dropped(0),
+        producersWaiting(0), consumersWaiting(0),
+        // spinning only helps if the other side runs meanwhile
+        spinCount(epicsThreadGetCPUs() > 1 ? 1000 : 0),
+        enqueuePos(0), dequeuePos(0)
+    {
+        std::size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        mask = size - 1;
+        cells.resize(size);
+        for (std::size_t i = 0; i < size; ++i)
+            cells[i].sequence = i;
+    }
+
+    std::vector<Cell> cells;
+    std::size_t mask;
+    Policy policy;
+    int closed;
+    std::size_t dropped;
+    std::size_t producersWaiting;
+    std::size_t consumersWaiting;
+    // the number of retries before a thread goes to sleep
+    int spinCount;
+    epicsEvent notEmpty;
+    epicsEvent notFull;
+
+    // producers and consumers update their positions on separate cache lines
+    char pad0[64];
+    std::size_t enqueuePos;
+    char pad1[64];
+    std::size_t dequeuePos;
+    char pad2[64];
+};
+
+template<typename T>
+const double NTQueue<T>::waitSlice = 0.1;
+
+typedef NTQueue<NTNDArray> NTNDArrayQueue;
+typedef std::tr1::shared_ptr<NTNDArrayQueue> NTNDArrayQueuePtr;
+
+}}
+#endif  /* NTQUEUE_H */
@@ -0,0 +1,180 @@
+/* ntserializer.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTSERIALIZER_H
+#define NTSERIALIZER_H
+
+#include <vector>
+
+#ifdef epicsExportSharedSymbols
+#   define ntserializerEpicsExportSharedSymbols
+#   undef epicsExportSharedSymbols
+#endif
+
+#include <epicsEndian.h>
+#include <epicsTypes.h>
+
+#include <pv/pvData.h>
+#include <pv/serialize.h>
+
+#ifdef ntserializerEpicsExportSharedSymbols
+#   define epicsExportSharedSymbols
+#	undef ntserializerEpicsExportSharedSymbols
+#endif
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTSerializer;
+typedef std::tr1::shared_ptr<NTSerializer> NTSerializerPtr;
+
+/**
+ * @brief Serializer with a precomputed layout for fixed-shape normative types.
+ *
+ * Generic PVField serialization walks the structure recursively with a
+ * virtual call per field. For structures made only of scalar, scalar
+ * array and nested structure fields (NTScalar, NTScalarArray, NTTable,
+ * NTNameValue and the like) the order and type of every leaf field is
+ * known as soon as the structure exists. NTSerializer flattens the
+ * structure into a list of leaf fields once, when it is created, and
+ * writes the wire format with a single loop over that list.
+ * Structures made of a double or scalar array value, an optional
+ * descriptor, alarm and timeStamp, which is the common shape of NTScalar
+ * and NTScalarArray, are written and read by straight-line code instead.
+ * The output is byte-identical to that of PVStructure::serialize().
+ *
+ * Regular unions (such as the value of NTNDArray) are laid out too, with
+ * a fast path when the selected field is a scalar array. Other fields
+ * (variant unions, structure and union arrays, fixed size arrays) are
+ * handled by their own serialize() and deserialize().
+ *
+ * deserialize() reads into the bound PVStructure in place: a scalar array
+ * keeps its storage when that storage is not shared with anyone else and
+ * is large enough, so that a stream of equally sized updates is received
+ * without allocating. Storage still referenced elsewhere is left untouched
+ * and a new array is allocated instead.
+ * As with PVStructure::deserialize(), scalar fields are updated without
+ * posting a put.
+ *
+ * An instance is bound to one PVStructure and always serializes its
+ * current contents. It must not be used concurrently with changes to
+ * that PVStructure.
+ */
+class epicsShareClass NTSerializer : public epics::pvData::Serializable
+{
+public:
+    POINTER_DEFINITIONS(NTSerializer);
+
+    /**
+     * Returns whether the specified Structure is laid out completely flat,
+     * that is without falling back to the serialization of any of its fields.
+     * @param structure the Structure to test.
+     * @return (false,true) if the structure (does not, does) consist only of
+     *         scalar, variable size scalar array and structure fields.
+     */
+    static bool isSupported(epics::pvData::StructureConstPtr const & structure);
+
+    /**
+     * Creates an NTSerializer bound to the specified PVStructure.
+     * @param pvStructure the PVStructure to serialize.
+     * @return the serializer or null if pvStructure is null.
+     */
+    static shared_pointer create(epics::pvData::PVStructurePtr const & pvStructure);
+
+    /**
+     * Destructor.
+     */
+    virtual ~NTSerializer() {}
+
+    /**
+     * Returns the PVStructure this serializer is bound to.
+     * @return the PVStructure.
+     */
+    epics::pvData::PVStructurePtr getPVStructure() const;
+
+    /**
+     * Returns the number of bytes the current contents of the bound
+     * PVStructure serialize to.
+     * @return the size in bytes.
+     */
+    std::size_t getSerializedSize() const;
+
+    /**
+     * Serializes the bound PVStructure.
+     * @param buffer the buffer to serialize into.
+     * @param flusher the control used to flush the buffer when full.
+     */
+    virtual void serialize(epics::pvData::ByteBuffer *buffer,
+        epics::pvData::SerializableControl *flusher) const;
+
+    /**
+     * Serializes the bound PVStructure into a vector sized to fit exactly.
+     * @param out the vector to fill.
+     * @param byteOrder the byte order to use.
+     */
+    void serialize(std::vector<epicsUInt8>& out,
+        int byteOrder = EPICS_BYTE_ORDER) const;
+
+    /**
+     * Deserializes into the bound PVStructure, reusing its array storage
+     * where possible.
+     * @param buffer the buffer to deserialize from.
+     * @param flusher the control used to refill the buffer.
+     */
+    virtual void deserialize(epics::pvData::ByteBuffer *buffer,
+        epics::pvData::DeserializableControl *flusher);
+
+private:
+    NTSerializer(epics::pvData::PVStructurePtr const & pvStructure);
+
+    void addFields(epics::pvData::PVStructure const & pvStructure);
+    bool addFixed();
+    void serializeFixed(epics::pvData::ByteBuffer *buffer,
+        epics::pvData::SerializableControl *flusher) const;
+    void deserializeFixed(epics::pvData::ByteBuffer *buffer,
+        epics::pvData::DeserializableControl *flusher);
+
+    struct Entry {
+        enum Kind {
+            scalarEntry,
+            stringEntry,
+            arrayEntry,
+            stringArrayEntry,
+            unionEntry,
+            fieldEntry
+        } kind;
+        epics::pvData::ScalarType type;
+        epics::pvData::PVField *field;
+        // bytes taken by the run of fixed size scalars starting here
+        std::size_t run;
+    };
+
+    // the fields of the NTScalar and NTScalarArray shape, a null
+    // descriptor if there is none
+    struct Fixed {
+        epics::pvData::PVDouble *value;
+        epics::pvData::PVScalarArray *array;
+        void (*putArray)(epics::pvData::ByteBuffer *buffer,
+            epics::pvData::SerializableControl *flusher, epics::pvData::PVField *field);
+        void (*getArray)(epics::pvData::ByteBuffer *buffer,
+            epics::pvData::DeserializableControl *control, epics::pvData::PVField *field);
+        epics::pvData::PVString *descriptor;
+        epics::pvData::PVInt *severity;
+        epics::pvData::PVInt *status;
+        epics::pvData::PVString *message;
+        epics::pvData::PVLong *secondsPastEpoch;
+        epics::pvData::PVInt *nanoseconds;
+        epics::pvData::PVInt *userTag;
+    };
+
+    epics::pvData::PVStructurePtr pvStructure;
+    std::vector<Entry> entries;
+    bool isFixed;
+    Fixed fixed;
+};
+
+}}
+#endif  /* NTSERIALIZER_H */
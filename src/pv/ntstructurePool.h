@@ -0,0 +1,144 @@
+/* ntstructurePool.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTSTRUCTUREPOOL_H
+#define NTSTRUCTUREPOOL_H
+
+#include <vector>
+
+#ifdef epicsExportSharedSymbols
+#   define ntstructurePoolEpicsExportSharedSymbols
+#   undef epicsExportSharedSymbols
+#endif
+
+#include <epicsMutex.h>
+
+#include <pv/pvData.h>
+
+#ifdef ntstructurePoolEpicsExportSharedSymbols
+#   define epicsExportSharedSymbols
+#	undef ntstructurePoolEpicsExportSharedSymbols
+#endif
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTStructurePool;
+typedef std::tr1::shared_ptr<NTStructurePool> NTStructurePoolPtr;
+
+/**
+ * @brief Pool of NT instances of one structure.
+ *
+ * pvData allocates every field of a PVStructure separately, so creating
+ * an NT instance takes one allocation per field. The pool instead keeps
+ * the PVStructures of released instances and hands them out again,
+ * reset to the values of a prototype. Creating an instance from the
+ * pool then allocates only the NT wrapper and its reference counts.
+ *
+ * An instance returns its PVStructure to the pool when the last
+ * reference to it is dropped, unless a reference to the PVStructure or
+ * to one of its sub-structures or fields is still held elsewhere; such
+ * a PVStructure is left to those references and freed with them.
+ * Arrays, union values and structure array elements are replaced when
+ * a PVStructure is reset, so references to them stay valid. As with
+ * PVDataCreate::createPVStructure(), the elements of structure arrays
+ * of the prototype are shared by the instances, not copied.
+ *
+ * Instances whose fields get a post handler, as the fields of a
+ * pvDatabase record do, must not come from a pool.
+ *
+ * The pool lives for as long as any of its instances. It may be used
+ * by several threads concurrently.
+ */
+class epicsShareClass NTStructurePool :
+    public std::tr1::enable_shared_from_this<NTStructurePool>
+{
+public:
+    POINTER_DEFINITIONS(NTStructurePool);
+
+    /**
+     * Creates a pool.
+     * @param prototype the instance whose structure and values new and
+     * reused instances get; the pool keeps a copy of it.
+     * @param maxFree the maximum number of unused PVStructures kept for reuse.
+     * @return the pool.
+     */
+    static shared_pointer create(epics::pvData::PVStructurePtr const & prototype,
+        std::size_t maxFree = 16);
+
+    /**
+     * Creates an instance, reusing the PVStructure of a released one
+     * when there is one. The instance is wrapped without validation,
+     * so the prototype must be a valid NT.
+     * @return the instance.
+     */
+    template<typename NT>
+    typename NT::shared_pointer createInstance()
+    {
+        typename NT::shared_pointer instance = NT::wrapUnsafe(acquire());
+        return typename NT::shared_pointer(instance.get(),
+            Release<NT>(shared_from_this(), instance));
+    }
+
+    /**
+     * Returns the structure of the instances.
+     * @return the introspection interface.
+     */
+    epics::pvData::StructureConstPtr getStructure() const;
+
+    /**
+     * Returns the number of PVStructures created by pvData.
+     * @return the number of PVStructures.
+     */
+    std::size_t getAllocated() const;
+
+    /**
+     * Returns the number of instances served by a reused PVStructure.
+     * @return the number of instances.
+     */
+    std::size_t getReused() const;
+
+    /**
+     * Returns the number of unused PVStructures kept for reuse.
+     * @return the number of PVStructures.
+     */
+    std::size_t getFree() const;
+
+private:
+    template<typename NT>
+    struct Release {
+        Release(shared_pointer const & pool, typename NT::shared_pointer const & instance)
+        : pool(pool), instance(instance) {}
+
+        void operator()(NT *)
+        {
+            epics::pvData::PVStructurePtr pvStructure(instance->getPVStructure());
+            instance.reset();
+            shared_pointer owner;
+            owner.swap(pool);
+            owner->release(pvStructure);
+        }
+
+        shared_pointer pool;
+        typename NT::shared_pointer instance;
+    };
+
+    NTStructurePool(epics::pvData::PVStructurePtr const & prototype, std::size_t maxFree);
+
+    epics::pvData::PVStructurePtr acquire();
+    void release(epics::pvData::PVStructurePtr const & pvStructure);
+
+    epics::pvData::PVStructurePtr prototype;
+    std::size_t maxFree;
+    std::vector<epics::pvData::PVStructurePtr> freeStructures;
+    std::size_t allocated;
+    std::size_t reused;
+    mutable epicsMutex mutex;
+};
+
+}}
+
+#endif  /* NTSTRUCTUREPOOL_H */
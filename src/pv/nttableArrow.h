@@ -0,0 +1,106 @@
+/* nttableArrow.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTTABLEARROW_H
+#define NTTABLEARROW_H
+
+#include <stdint.h>
+
+#include <pv/nttable.h>
+
+#include <shareLib.h>
+
+/*
+ * Structures of the Apache Arrow C data interface, as specified by
+ * https://arrow.apache.org/docs/format/CDataInterface.html
+ * They are defined by every producer and consumer, under the same guard.
+ */
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+
+    void (*release)(struct ArrowSchema*);
+    void* private_data;
+};
+
+struct ArrowArray {
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+
+    void (*release)(struct ArrowArray*);
+    void* private_data;
+};
+
+#endif  /* ARROW_C_DATA_INTERFACE */
+
+namespace epics { namespace nt {
+
+/**
+ * @brief Conversion of NTTable to and from the Arrow C data interface.
+ *
+ * A table is represented as an Arrow struct array with one child per
+ * column. Columns of numeric types are exchanged without copying:
+ * exported arrays point into the column storage, which they keep alive
+ * until released, and imported columns point into the Arrow buffers,
+ * which are released when the last column referring to them is dropped.
+ *
+ * Boolean columns are converted between bytes and Arrow's bit-packed
+ * booleans and string columns between std::string and Arrow utf8 arrays,
+ * both of which copy. The column labels are carried as field metadata
+ * under the key "epics:label".
+ */
+class epicsShareClass NTTableArrow {
+public:
+
+    /**
+     * Exports the value columns of a table.
+     * @param table the table.
+     * @param array the struct array to fill, to be released by the consumer.
+     * @param schema the schema to fill, to be released by the consumer.
+     * @throws std::runtime_error if the columns differ in length.
+     */
+    static void exportTable(NTTablePtr const & table,
+        struct ArrowArray *array, struct ArrowSchema *schema);
+
+    /**
+     * Imports a struct array as a table, taking ownership of the array.
+     * On return the release callback of array is null. The schema
+     * remains owned by the caller.
+     * Null entries become 0, NaN or an empty string.
+     * @param array the struct array.
+     * @param schema the schema of the struct array.
+     * @return the table.
+     * @throws std::runtime_error if a column type cannot be represented,
+     *         in which case the array is left untouched.
+     */
+    static NTTablePtr importTable(struct ArrowArray *array,
+        struct ArrowSchema const *schema);
+
+private:
+    // disable object creation
+    NTTableArrow() {}
+};
+
+}}
+
+#endif  /* NTTABLEARROW_H */
@@ -0,0 +1,109 @@
+/* nttableCSV.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTTABLECSV_H
+#define NTTABLECSV_H
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <pv/nttable.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+/**
+ * @brief Options of NTTableCSV.
+ */
+struct epicsShareClass NTTableCSVOptions
+{
+    NTTableCSVOptions()
+    : delimiter(','), header(true), inferRows(1000),
+      threadCount(0), blockSize(64*1024*1024) {}
+
+    char delimiter;         ///< the field delimiter
+    bool header;            ///< whether the first row holds the labels
+    std::vector<epics::pvData::ScalarType> types;  ///< the column types, inferred if empty
+    std::size_t inferRows;  ///< the number of rows the column types are inferred from
+    std::size_t threadCount;  ///< the number of parsing threads, the number of CPUs if 0
+    std::size_t blockSize;  ///< the number of bytes read from a stream at a time
+};
+
+/**
+ * @brief Conversion of NTTable to and from CSV.
+ *
+ * The CSV dialect is that of RFC 4180: fields containing the delimiter,
+ * a quote or a line break are quoted, and quotes in them doubled. Lines
+ * may end in CRLF or LF; empty lines are skipped.
+ *
+ * When reading, the labels are the fields of the header row, and the
+ * column names are the labels with characters other than letters,
+ * digits and underscores replaced by underscores, made unique. Without a
+ * header row the columns are named column0, column1, ... Column types
+ * not given are inferred from the first rows: boolean if all fields
+ * are true or false, long if all are integers, double if all are
+ * numbers and string otherwise. A column inferred as long becomes
+ * double if a later field holds a number that is not an integer. Empty
+ * numeric fields are 0, or NaN for floating point columns.
+ *
+ * Input is read in blocks of whole rows, each split at row boundaries
+ * into chunks that are parsed in parallel, and the columns are filled
+ * once at the end. Numbers are parsed by a fast path that is exact for
+ * up to 19 digits and exponents within the range of exact powers of
+ * ten, with strtod as a fallback.
+ *
+ * When writing, the header row holds the labels, or the column name of
+ * columns without a label. Numbers are written with the fewest digits
+ * that read back the same value, negative zero as -0. Numbers are read
+ * and written with a '.' as the decimal point whatever the locale.
+ */
+class epicsShareClass NTTableCSV
+{
+public:
+    /**
+     * Reads a table from a stream.
+     * @param in the stream.
+     * @param options the options.
+     * @return the table.
+     * @throws std::runtime_error if a field cannot be converted to the
+     *         type of its column, or the number of types given differs
+     *         from the number of columns.
+     */
+    static NTTablePtr read(std::istream & in,
+        NTTableCSVOptions const & options = NTTableCSVOptions());
+
+    /**
+     * Reads a table from memory.
+     * @param data the CSV text.
+     * @param size the number of bytes of the text.
+     * @param options the options.
+     * @return the table.
+     * @throws std::runtime_error if a field cannot be converted to the
+     *         type of its column, or the number of types given differs
+     *         from the number of columns.
+     */
+    static NTTablePtr read(const char *data, std::size_t size,
+        NTTableCSVOptions const & options = NTTableCSVOptions());
+
+    /**
+     * Writes a table to a stream.
+     * @param out the stream.
+     * @param table the table.
+     * @param options the options; only delimiter and header are used.
+     * @throws std::runtime_error if the columns differ in length.
+     */
+    static void write(std::ostream & out, NTTablePtr const & table,
+        NTTableCSVOptions const & options = NTTableCSVOptions());
+
+private:
+    // disable object creation
+    NTTableCSV() {}
+};
+
+}}
+#endif  /* NTTABLECSV_H */
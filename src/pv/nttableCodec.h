@@ -0,0 +1,109 @@
+/* nttableCodec.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTTABLECODEC_H
+#define NTTABLECODEC_H
+
+#include <vector>
+
+#ifdef epicsExportSharedSymbols
+#   define nttableCodecEpicsExportSharedSymbols
+#   undef epicsExportSharedSymbols
+#endif
+
+#include <epicsTypes.h>
+
+#include <pv/pvData.h>
+
+#ifdef nttableCodecEpicsExportSharedSymbols
+#   define epicsExportSharedSymbols
+#	undef nttableCodecEpicsExportSharedSymbols
+#endif
+
+#include <pv/nttable.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+/**
+ * @brief Compact binary form of NTTable, with an encoding per column.
+ *
+ * Each column is encoded with the encoding that is smallest for windows
+ * of rows sampled from it:
+ * - plain: the elements, little endian; strings preceded by their length.
+ * - run length: each run of equal elements as its length and one element.
+ * - bit packed (integer columns): blocks of 128 elements, each stored as
+ *   the offset from the smallest element of the block in as many bits as
+ *   the largest offset needs.
+ * - delta (integer columns): the differences between consecutive
+ *   elements, bit packed. Timestamps, counters and IDs that grow steadily
+ *   take a few bits per element, or none if they grow at a constant rate.
+ *
+ * The binary form holds the columns, labels, descriptor, alarm and
+ * timeStamp of the table; other optional fields are not kept.
+ * Integers in it are LEB128 varints and strings are preceded by their
+ * length, so that it reads the same on hosts of either byte order.
+ */
+class epicsShareClass NTTableCodec
+{
+public:
+    /**
+     * Encodings of a column.
+     */
+    enum Encoding {
+        plainEncoding,      ///< the elements
+        runLengthEncoding,  ///< runs of equal elements
+        bitPackedEncoding,  ///< blocks of offsets from the block minimum
+        deltaEncoding       ///< bit packed differences of consecutive elements
+    };
+
+    /**
+     * Returns the encoding a column would be encoded with.
+     * @param column the column.
+     * @return the encoding.
+     */
+    static Encoding chooseEncoding(epics::pvData::PVScalarArrayPtr const & column);
+
+    /**
+     * Encodes a table.
+     * @param table the table.
+     * @param out the vector to fill, sized to fit exactly.
+     * @throws std::runtime_error if the columns differ in length.
+     */
+    static void encode(NTTablePtr const & table, std::vector<epicsUInt8> & out);
+
+    /**
+     * Decodes a table.
+     * @param data the binary form.
+     * @param size the number of bytes.
+     * @return the table.
+     * @throws std::runtime_error if the data is not a valid binary form.
+     */
+    static NTTablePtr decode(const epicsUInt8 *data, std::size_t size);
+
+    /**
+     * Decodes a table.
+     * @param data the binary form.
+     * @return the table.
+     * @throws std::runtime_error if the data is not a valid binary form.
+     */
+    static NTTablePtr decode(std::vector<epicsUInt8> const & data);
+
+    /**
+     * Returns the encodings of the columns of a binary form.
+     * @param data the binary form.
+     * @return the encoding of each column.
+     * @throws std::runtime_error if the data is not a valid binary form.
+     */
+    static std::vector<Encoding> getEncodings(std::vector<epicsUInt8> const & data);
+
+private:
+    // disable object creation
+    NTTableCodec() {}
+};
+
+}}
+#endif  /* NTTABLECODEC_H */
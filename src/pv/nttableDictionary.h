@@ -0,0 +1,225 @@
+/* nttableDictionary.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTTABLEDICTIONARY_H
+#define NTTABLEDICTIONARY_H
+
+#include <string>
+#include <vector>
+
+#ifdef epicsExportSharedSymbols
+#   define nttableDictionaryEpicsExportSharedSymbols
+#   undef epicsExportSharedSymbols
+#endif
+
+#include <epicsMutex.h>
+#include <pv/pvData.h>
+
+#ifdef nttableDictionaryEpicsExportSharedSymbols
+#   define epicsExportSharedSymbols
+#	undef nttableDictionaryEpicsExportSharedSymbols
+#endif
+
+#include <pv/nttable.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTStringDictionary;
+typedef std::tr1::shared_ptr<NTStringDictionary> NTStringDictionaryPtr;
+
+class NTTableDictionary;
+typedef std::tr1::shared_ptr<NTTableDictionary> NTTableDictionaryPtr;
+
+/**
+ * @brief Dictionary of strings, each given an integer code.
+ *
+ * Codes are given in order, starting at 0, and never change, so that a
+ * dictionary can be shared by several tables and grow meanwhile.
+ * A dictionary can be used from several threads at once.
+ */
+class epicsShareClass NTStringDictionary
+{
+public:
+    POINTER_DEFINITIONS(NTStringDictionary);
+
+    /**
+     * Creates an empty dictionary.
+     * @return the dictionary.
+     */
+    static shared_pointer create();
+
+    /**
+     * Returns the code of a string, adding the string if it is new.
+     * @param value the string.
+     * @return the code.
+     */
+    epics::pvData::int32 encode(std::string const & value);
+
+    /**
+     * Encodes strings, adding those that are new.
+     * @param values the strings.
+     * @param count the number of strings.
+     * @param codes the codes, count of them.
+     */
+    void encode(std::string const *values, std::size_t count, epics::pvData::int32 *codes);
+
+    /**
+     * Returns the code of a string.
+     * @param value the string.
+     * @return the code, or -1 if the string is not in the dictionary.
+     */
+    epics::pvData::int32 find(std::string const & value) const;
+
+    /**
+     * Returns the string of a code.
+     * @param code the code.
+     * @return the string.
+     * @throws std::runtime_error if there is no such code.
+     */
+    std::string decode(epics::pvData::int32 code) const;
+
+    /**
+     * Decodes codes.
+     * @param codes the codes.
+     * @param count the number of codes.
+     * @param values the strings, count of them.
+     * @throws std::runtime_error if a code does not exist.
+     */
+    void decode(epics::pvData::int32 const *codes, std::size_t count, std::string *values) const;
+
+    /**
+     * Returns the number of strings.
+     * @return the number of strings.
+     */
+    std::size_t size() const;
+
+private:
+    NTStringDictionary();
+
+    std::size_t slot(std::string const & value) const;
+    void grow();
+
+    // each string is held once, the table holds codes by hash, -1 if empty
+    std::vector<std::string> values;
+    std::vector<epics::pvData::int32> slots;
+    mutable epicsMutex mutex;
+};
+
+/**
+ * @brief NTTable with dictionary-encoded string columns.
+ *
+ * The encoded columns are held as arrays of int32 codes of a dictionary,
+ * each repeated string being stored once. Equality filters and grouping
+ * compare the codes instead of the strings. The other columns, and the
+ * rest of the table, are shared with the table the encoding was made from.
+ *
+ * toNTTable() decodes the columns into a plain NTTable, to be sent
+ * where the dictionary is not known.
+ *
+ * An instance is immutable and can be used from several threads at once.
+ */
+class epicsShareClass NTTableDictionary
+{
+public:
+    POINTER_DEFINITIONS(NTTableDictionary);
+
+    /**
+     * Encodes string columns of a table.
+     * @param table the table.
+     * @param columns the names of the columns to encode, all string
+     *        columns if empty.
+     * @param dictionary the dictionary to encode with, a new dictionary
+     *        if null.
+     * @return the encoded table.
+     * @throws std::runtime_error if a column is not a string column, or
+     *         the columns differ in length.
+     */
+    static shared_pointer create(NTTablePtr const & table,
+        std::vector<std::string> const & columns = std::vector<std::string>(),
+        NTStringDictionaryPtr const & dictionary = NTStringDictionaryPtr());
+
+    /**
+     * Returns the dictionary.
+     * @return the dictionary.
+     */
+    NTStringDictionaryPtr getDictionary() const;
+
+    /**
+     * Returns the names of the encoded columns.
+     * @return the names.
+     */
+    std::vector<std::string> const & getEncodedColumns() const;
+
+    /**
+     * Returns whether a column is encoded.
+     * @param column the name of the column.
+     * @return (false,true) if the column (is not,is) encoded.
+     */
+    bool isEncoded(std::string const & column) const;
+
+    /**
+     * Returns the number of rows.
+     * @return the number of rows.
+     */
+    std::size_t getRowCount() const;
+
+    /**
+     * Returns the codes of an encoded column.
+     * @param column the name of the column.
+     * @return the codes.
+     * @throws std::runtime_error if the column is not encoded.
+     */
+    epics::pvData::shared_vector<const epics::pvData::int32> getCodes(std::string const & column) const;
+
+    /**
+     * Returns the strings of an encoded column.
+     * @param column the name of the column.
+     * @return the strings.
+     * @throws std::runtime_error if the column is not encoded.
+     */
+    epics::pvData::PVStringArray::const_svector getValues(std::string const & column) const;
+
+    /**
+     * Finds the rows whose element of an encoded column equals a string.
+     * @param column the name of the column.
+     * @param value the string.
+     * @return the rows, in ascending order.
+     * @throws std::runtime_error if the column is not encoded.
+     */
+    std::vector<std::size_t> findEqual(std::string const & column, std::string const & value) const;
+
+    /**
+     * Groups the rows by the element of an encoded column.
+     * @param column the name of the column.
+     * @param keys the string of each group, in the order of its first row.
+     * @param groups the rows of each group, in ascending order.
+     * @throws std::runtime_error if the column is not encoded.
+     */
+    void groupBy(std::string const & column, std::vector<std::string> & keys,
+        std::vector<std::vector<std::size_t> > & groups) const;
+
+    /**
+     * Creates a plain NTTable, with the encoded columns decoded.
+     * @return the table.
+     */
+    NTTablePtr toNTTable() const;
+
+private:
+    NTTableDictionary(NTTablePtr const & table, std::vector<std::string> const & columns,
+        NTStringDictionaryPtr const & dictionary);
+
+    std::size_t getColumnIndex(std::string const & column) const;
+
+    NTTablePtr table;
+    NTStringDictionaryPtr dictionary;
+    std::vector<std::string> columns;
+    std::vector<epics::pvData::shared_vector<const epics::pvData::int32> > codes;
+    std::size_t rows;
+};
+
+}}
+#endif  /* NTTABLEDICTIONARY_H */
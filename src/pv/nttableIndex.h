@@ -0,0 +1,182 @@
+/* nttableIndex.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTTABLEINDEX_H
+#define NTTABLEINDEX_H
+
+#include <string>
+#include <vector>
+
+#ifdef epicsExportSharedSymbols
+#   define nttableIndexEpicsExportSharedSymbols
+#   undef epicsExportSharedSymbols
+#endif
+
+#include <epicsMutex.h>
+
+#ifdef nttableIndexEpicsExportSharedSymbols
+#   define epicsExportSharedSymbols
+#	undef nttableIndexEpicsExportSharedSymbols
+#endif
+
+#include <pv/nttable.h>
+#include <pv/ntndarrayTiler.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTTableIndex;
+typedef std::tr1::shared_ptr<NTTableIndex> NTTableIndexPtr;
+
+/**
+ * @brief Index of a column of an NTTable.
+ *
+ * A hash index finds the rows whose element equals a key. A sorted
+ * index holds the rows ordered by their element, and finds the rows
+ * equal to a key or within a range. NaN elements are never found.
+ *
+ * The index refers to the array the column held when it was built.
+ * When the column is given a new array, the index is stale and is
+ * rebuilt by the next query. Changing the elements of the array in
+ * place, which pvData does not allow for a frozen array, is not detected.
+ *
+ * Hashes are computed, and the rows of a sorted index sorted and
+ * merged, in parallel on the workers of an NTNDArrayTiler. The workers
+ * are started by the first build that needs them and kept for rebuilds.
+ *
+ * Keys are numbers for numeric and boolean columns and strings for
+ * string columns. A numeric key is converted to the element type of
+ * the column; an integer column has no rows equal to a key that is not
+ * an integer. Range bounds are compared with the elements as doubles.
+ *
+ * An index can be used from several threads at once.
+ */
+class epicsShareClass NTTableIndex
+{
+public:
+    POINTER_DEFINITIONS(NTTableIndex);
+
+    /**
+     * Kinds of index.
+     */
+    enum Kind {
+        hashIndex,   ///< equality lookups
+        sortedIndex  ///< equality and range lookups
+    };
+
+    /**
+     * Creates and builds an index.
+     * @param table the table.
+     * @param column the name of the column.
+     * @param kind the kind of index.
+     * @param threadCount the number of threads to build with, the
+     *        number of CPUs if 0.
+     * @return the index.
+     * @throws std::runtime_error if the table has no scalar array
+     *         column of that name.
+     */
+    static shared_pointer create(NTTablePtr const & table, std::string const & column,
+        Kind kind = hashIndex, std::size_t threadCount = 0);
+
+    /**
+     * Returns the kind of index.
+     * @return the kind.
+     */
+    Kind getKind() const;
+
+    /**
+     * Returns the name of the indexed column.
+     * @return the name.
+     */
+    std::string getColumn() const;
+
+    /**
+     * Returns whether the index refers to the array the column holds.
+     * @return (false,true) if the index (is,is not) stale.
+     */
+    bool isValid() const;
+
+    /**
+     * Returns the number of times the index has been built.
+     * @return the number of builds.
+     */
+    std::size_t getBuildCount() const;
+
+    /**
+     * Builds the index again.
+     */
+    void rebuild();
+
+    /**
+     * Finds the rows equal to a numeric key.
+     * @param key the key.
+     * @return the rows, in ascending order.
+     * @throws std::runtime_error if the column holds strings.
+     */
+    std::vector<std::size_t> find(double key);
+
+    /**
+     * Finds the rows equal to a string key.
+     * @param key the key.
+     * @return the rows, in ascending order.
+     * @throws std::runtime_error if the column does not hold strings.
+     */
+    std::vector<std::size_t> find(std::string const & key);
+
+    /**
+     * Finds the rows within a numeric range.
+     * @param low the lowest element.
+     * @param high the highest element.
+     * @return the rows, in ascending order of their elements and of
+     *         the rows for equal elements.
+     * @throws std::runtime_error if the index is not sorted or the
+     *         column holds strings.
+     */
+    std::vector<std::size_t> findRange(double low, double high);
+
+    /**
+     * Finds the rows within a string range.
+     * @param low the lowest element.
+     * @param high the highest element.
+     * @return the rows, in ascending order of their elements and of
+     *         the rows for equal elements.
+     * @throws std::runtime_error if the index is not sorted or the
+     *         column does not hold strings.
+     */
+    std::vector<std::size_t> findRange(std::string const & low, std::string const & high);
+
+    /**
+     * Creates a table of some rows and columns of a table.
+     * @param table the table.
+     * @param rows the rows, in the order of the new table.
+     * @param columns the names of the columns, all columns if empty.
+     * @return a table with the labels and the types of those columns.
+     * @throws std::runtime_error if a row or a column does not exist.
+     */
+    static NTTablePtr project(NTTablePtr const & table, std::vector<std::size_t> const & rows,
+        std::vector<std::string> const & columns = std::vector<std::string>());
+
+    class Column;
+
+private:
+    NTTableIndex(NTTablePtr const & table, std::string const & column,
+        Kind kind, std::size_t threadCount);
+
+    void build();
+    Column const & current();
+
+    NTTablePtr table;
+    std::string column;
+    Kind kind;
+    std::size_t threadCount;
+    NTNDArrayTilerPtr tiler;
+    std::tr1::shared_ptr<Column> index;
+    std::size_t buildCount;
+    mutable epicsMutex mutex;
+};
+
+}}
+#endif  /* NTTABLEINDEX_H */
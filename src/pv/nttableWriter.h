@@ -0,0 +1,261 @@
+/* nttableWriter.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NTTABLEWRITER_H
+#define NTTABLEWRITER_H
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <pv/nttable.h>
+
+#include <shareLib.h>
+
+namespace epics { namespace nt {
+
+class NTTableWriter;
+typedef std::tr1::shared_ptr<NTTableWriter> NTTableWriterPtr;
+
+namespace detail {
+
+    /**
+     * @brief Growable buffer of a column of an NTTableWriter.
+     */
+    class epicsShareClass NTTableWriterColumn
+    {
+    public:
+        POINTER_DEFINITIONS(NTTableWriterColumn);
+
+        NTTableWriterColumn(epics::pvData::ScalarType type) : type(type), size(0) {}
+        virtual ~NTTableWriterColumn() {}
+
+        virtual std::size_t capacity() const = 0;
+        virtual void reserve(std::size_t capacity) = 0;
+        virtual void appendDouble(double value) = 0;
+        virtual void appendString(std::string const & value) = 0;
+        virtual void appendArray(epics::pvData::PVScalarArrayPtr const & array) = 0;
+        virtual void publish(epics::pvData::PVScalarArrayPtr const & array, std::size_t rows) = 0;
+        virtual void clear() = 0;
+
+        epics::pvData::ScalarType type;
+        std::size_t size;
+    };
+
+    template<typename T>
+    class NTTableWriterTypedColumn : public NTTableWriterColumn
+    {
+    public:
+        typedef epics::pvData::PVValueArray<T> PVArray;
+
+        NTTableWriterTypedColumn() :
+            NTTableWriterColumn(static_cast<epics::pvData::ScalarType>(
+                epics::pvData::ScalarTypeID<T>::value))
+        {
+        }
+
+        void push(T const & value)
+        {
+            if (size == data.size())
+                grow(size + 1);
+            data[size++] = value;
+        }
+
+        // only elements past size are ever written, so published snapshots,
+        // which share the buffer up to their row count, never change
+        void grow(std::size_t needed)
+        {
+            if (needed > data.size())
+                reserve(std::max(needed, std::max<std::size_t>(16, 2*data.size())));
+        }
+
+        virtual std::size_t capacity() const
+        {
+            return data.size();
+        }
+
+        virtual void reserve(std::size_t capacity)
+        {
+            if (capacity <= data.size())
+                return;
+            typename PVArray::svector bigger(capacity);
+            std::copy(data.begin(), data.begin() + size, bigger.begin());
+            data.swap(bigger);
+        }
+
+        virtual void appendDouble(double value)
+        {
+            push(epics::pvData::castUnsafe<T>(value));
+        }
+
+        virtual void appendString(std::string const & value)
+        {
+            push(epics::pvData::castUnsafe<T>(value));
+        }
+
+        virtual void appendArray(epics::pvData::PVScalarArrayPtr const & array)
+        {
+            typename PVArray::const_svector values;
+            array->getAs<T>(values);
+            grow(size + values.size());
+            std::copy(values.begin(), values.end(), data.begin() + size);
+            size += values.size();
+        }
+
+        virtual void publish(epics::pvData::PVScalarArrayPtr const & array, std::size_t rows)
+        {
+            typename PVArray::const_svector values(
+                epics::pvData::const_shared_vector_cast<const T>(data));
+            values.slice(0, rows);
+            std::tr1::static_pointer_cast<PVArray>(array)->replace(values);
+        }
+
+        virtual void clear()
+        {
+            data.clear();
+            size = 0;
+        }
+
+    private:
+        typename PVArray::svector data;
+    };
+
+}
+
+/**
+ * @brief Builds an NTTable by appending rows.
+ *
+ * Each column is kept in a buffer whose capacity doubles when it is
+ * full, so appending n rows costs O(n). snapshot() publishes the rows
+ * appended so far as an NTTable whose columns share the buffers instead
+ * of copying them. Rows are never changed once appended, so snapshots
+ * stay valid while appending goes on.
+ *
+ * A row is appended by appending a value to every column, then calling
+ * endRow(). Several rows at a time can be appended from another NTTable.
+ *
+ * An instance of this object must not be used concurrently.
+ */
+class epicsShareClass NTTableWriter
+{
+public:
+    POINTER_DEFINITIONS(NTTableWriter);
+
+    /**
+     * Creates a writer for tables like a prototype.
+     * The rows of the prototype are not appended.
+     * @param prototype the table whose structure, columns and labels are used.
+     * @param capacity the number of rows to reserve.
+     * @return the writer.
+     */
+    static shared_pointer create(NTTablePtr const & prototype, std::size_t capacity = 0);
+
+    /**
+     * Returns the number of columns.
+     * @return the number of columns.
+     */
+    std::size_t getColumnCount() const;
+
+    /**
+     * Returns the index of a column.
+     * @param name the name of the column.
+     * @return the index.
+     * @throws std::runtime_error if there is no such column.
+     */
+    std::size_t getColumnIndex(std::string const & name) const;
+
+    /**
+     * Returns the number of complete rows.
+     * @return the number of rows.
+     */
+    std::size_t getRowCount() const;
+
+    /**
+     * Returns the number of rows that fit the buffers without growing them.
+     * @return the number of rows.
+     */
+    std::size_t getCapacity() const;
+
+    /**
+     * Reserves room for a number of rows.
+     * @param rows the number of rows.
+     */
+    void reserve(std::size_t rows);
+
+    /**
+     * Appends a value to a column of the row being appended.
+     * @param column the index of the column.
+     * @param value the value.
+     * @throws std::runtime_error if the column does not exist or its type is not PVT.
+     */
+    template<typename PVT>
+    void append(std::size_t column, typename PVT::value_type const & value)
+    {
+        typedef detail::NTTableWriterTypedColumn<typename PVT::value_type> Column;
+        if (column >= columns.size() || columns[column]->type != PVT::typeCode)
+            throw std::runtime_error("no such NTTable column of this type");
+        static_cast<Column*>(columns[column].get())->push(value);
+    }
+
+    /**
+     * Appends a value to a column of the row being appended, converted
+     * to the type of the column.
+     * @param column the index of the column.
+     * @param value the value.
+     * @throws std::runtime_error if the column does not exist.
+     */
+    void appendValue(std::size_t column, double value);
+
+    /**
+     * Appends a value to a column of the row being appended, converted
+     * to the type of the column.
+     * @param column the index of the column.
+     * @param value the value.
+     * @throws std::runtime_error if the column does not exist or the
+     *         value cannot be converted.
+     */
+    void appendValue(std::size_t column, std::string const & value);
+
+    /**
+     * Completes the row being appended.
+     * @throws std::runtime_error if not every column has a value,
+     *         in which case the row is discarded.
+     */
+    void endRow();
+
+    /**
+     * Appends all rows of a table, discarding an incomplete row.
+     * Columns are matched by name and converted to the types of the columns.
+     * @param rows the table.
+     * @throws std::runtime_error if a column is missing or the columns
+     *         of the table differ in length.
+     */
+    void appendRows(NTTablePtr const & rows);
+
+    /**
+     * Publishes the rows appended so far.
+     * @return a table with the structure and labels of the prototype,
+     *         whose columns share the buffers of the writer.
+     */
+    NTTablePtr snapshot() const;
+
+    /**
+     * Discards all rows. Snapshots are not affected.
+     */
+    void clear();
+
+private:
+    NTTableWriter(NTTablePtr const & prototype, std::size_t capacity);
+
+    epics::pvData::StructureConstPtr structure;
+    epics::pvData::StringArray columnNames;
+    epics::pvData::PVStringArray::const_svector labels;
+    std::vector<detail::NTTableWriterColumn::shared_pointer> columns;
+    std::size_t rows;
+};
+
+}}
+#endif  /* NTTABLEWRITER_H */
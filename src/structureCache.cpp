@@ -0,0 +1,108 @@
+/* structureCache.cpp */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <map>
+#include <utility>
+
+#include <pv/lock.h>
+
+#include "structureCache.h"
+
+#define epicsExportSharedSymbols
+#include <pv/ntfield.h>
+
+using namespace std;
+using namespace epics::pvData;
+
+namespace epics { namespace nt { namespace detail {
+
+namespace {
+
+enum
+{
+    DESCRIPTOR_INDEX,
+    ALARM_INDEX,
+    TIMESTAMP_INDEX,
+    DISPLAY_INDEX,
+    CONTROL_INDEX
+};
+
+const size_t NUMBER_OF_INDICES = CONTROL_INDEX+1;
+
+// the id and (value type, array flag, options) of a structure
+typedef pair<string, size_t> Key;
+
+Mutex mutex;
+map<Key, StructureConstPtr> structures;
+
+}
+
+StructureConstPtr createValueStructure(
+    string const & id, bool isArray, ScalarType valueType,
+    bool descriptor, bool alarm, bool timeStamp, bool display, bool control,
+    StringArray const & extraFieldNames, FieldConstPtrArray const & extraFields)
+{
+    size_t index = 0;
+    if (descriptor) index |= 1 << DESCRIPTOR_INDEX;
+    if (alarm)      index |= 1 << ALARM_INDEX;
+    if (timeStamp)  index |= 1 << TIMESTAMP_INDEX;
+    if (display)    index |= 1 << DISPLAY_INDEX;
+    if (control)    index |= 1 << CONTROL_INDEX;
+
+    index |= (isArray ? 1 : 0) << NUMBER_OF_INDICES;
+    index |= static_cast<size_t>(valueType) << (NUMBER_OF_INDICES+1);
+
+    bool isExtended = !extraFieldNames.empty();
+    Key key(id, index);
+
+    Lock xx(mutex);
+
+    if (!isExtended)
+    {
+        map<Key, StructureConstPtr>::const_iterator it = structures.find(key);
+        if (it != structures.end())
+            return it->second;
+    }
+
+    NTFieldPtr ntField = NTField::get();
+
+    FieldBuilderPtr builder =
+            getFieldCreate()->createFieldBuilder()->
+               setId(id);
+
+    if (isArray)
+        builder->addArray("value", valueType);
+    else
+        builder->add("value", valueType);
+
+    if (descriptor)
+        builder->add("descriptor", pvString);
+
+    if (alarm)
+        builder->add("alarm", ntField->createAlarm());
+
+    if (timeStamp)
+        builder->add("timeStamp", ntField->createTimeStamp());
+
+    if (display)
+        builder->add("display", ntField->createDisplay());
+
+    if (control)
+        builder->add("control", ntField->createControl());
+
+    size_t extraCount = extraFieldNames.size();
+    for (size_t i = 0; i< extraCount; i++)
+        builder->add(extraFieldNames[i], extraFields[i]);
+
+    StructureConstPtr s = builder->createStructure();
+
+    if (!isExtended)
+        structures[key] = s;
+
+    return s;
+}
+
+}}}
@@ -0,0 +1,31 @@
+/* structureCache.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef STRUCTURECACHE_H
+#define STRUCTURECACHE_H
+
+#include <string>
+
+#include <pv/pvIntrospect.h>
+
+namespace epics { namespace nt { namespace detail {
+
+/*
+ * Creates the structure of a type with a scalar or scalar array value
+ * and the optional descriptor, alarm, timeStamp, display and control
+ * fields, as NTScalar and NTScalarArray have.
+ * Introspection interfaces are immutable, so structures without extra
+ * fields are built once per id, value type and set of options and
+ * shared by all later calls.
+ */
+epics::pvData::StructureConstPtr createValueStructure(
+    std::string const & id, bool isArray, epics::pvData::ScalarType valueType,
+    bool descriptor, bool alarm, bool timeStamp, bool display, bool control,
+    epics::pvData::StringArray const & extraFieldNames,
+    epics::pvData::FieldConstPtrArray const & extraFields);
+
+}}}
+
+#endif  /* STRUCTURECACHE_H */
@@ -0,0 +1,89 @@
+/* ndarrayTestFrame.h */
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+#ifndef NDARRAYTESTFRAME_H
+#define NDARRAYTESTFRAME_H
+
+#include <string>
+#include <vector>
+
+#include <pv/pvData.h>
+
+#include <pv/ntndarray.h>
+
+/*
+ * The sizes of two or three dimensions, dimension[0] first.
+ */
+inline std::vector<std::size_t> frameSizes(std::size_t x, std::size_t y, std::size_t z = 0)
+{
+    std::vector<std::size_t> sizes;
+    sizes.push_back(x);
+    sizes.push_back(y);
+    if (z)
+        sizes.push_back(z);
+    return sizes;
+}
+
+/*
+ * A frame for the tests of the NTNDArray modules. Each size gives a
+ * dimension of that size and fullSize with a binning of 1. The value
+ * holds the values as elements of PVT, and is left unselected if there
+ * are none. The frame is created by builder, or by a new NTNDArray
+ * builder without optional fields if it is null.
+ */
+template<typename PVT>
+epics::nt::NTNDArrayPtr createFrame(std::vector<std::size_t> const & sizes,
+    std::vector<double> const & values, epics::pvData::int32 uniqueId = 0,
+    epics::nt::NTNDArrayBuilderPtr const & builder = epics::nt::NTNDArrayBuilderPtr())
+{
+    using namespace epics::pvData;
+
+    epics::nt::NTNDArrayPtr ntndArray = builder ? builder->create() :
+        epics::nt::NTNDArray::createBuilder()->create();
+
+    PVStructureArrayPtr dimension = ntndArray->getDimension();
+    PVStructureArray::svector dims(sizes.size());
+    for (std::size_t i = 0; i < dims.size(); ++i) {
+        dims[i] = getPVDataCreate()->createPVStructure(
+            dimension->getStructureArray()->getStructure());
+        dims[i]->getSubField<PVInt>("size")->put(static_cast<int32>(sizes[i]));
+        dims[i]->getSubField<PVInt>("fullSize")->put(static_cast<int32>(sizes[i]));
+        dims[i]->getSubField<PVInt>("binning")->put(1);
+    }
+    dimension->replace(freeze(dims));
+
+    if (!values.empty()) {
+        typename PVT::svector pixels(values.size());
+        for (std::size_t i = 0; i < pixels.size(); ++i)
+            pixels[i] = static_cast<typename PVT::value_type>(values[i]);
+        std::string fieldName = std::string(ScalarTypeFunc::name(PVT::typeCode)) + "Value";
+        ntndArray->getValue()->select<PVT>(fieldName)->replace(freeze(pixels));
+    }
+
+    ntndArray->getUniqueId()->put(uniqueId);
+    return ntndArray;
+}
+
+/*
+ * A frame without dimensions or value, for tests that only look at
+ * the uniqueId.
+ */
+inline epics::nt::NTNDArrayPtr createFrame(epics::pvData::int32 uniqueId)
+{
+    return createFrame<epics::pvData::PVUShortArray>(std::vector<std::size_t>(),
+        std::vector<double>(), uniqueId);
+}
+
+/*
+ * A field of a dimension of a frame.
+ */
+inline epics::pvData::int32 dimensionField(epics::nt::NTNDArrayPtr const & frame,
+    std::size_t index, const char *name)
+{
+    return frame->getDimension()->view()[index]->
+        getSubField<epics::pvData::PVInt>(name)->get();
+}
+
+#endif  /* NDARRAYTESTFRAME_H */
@@ -0,0 +1,254 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/nteventBuilder.h>
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+static std::vector<std::string> names(size_t count)
+{
+    const char *all[] = { "a", "b", "c", "d" };
+    return std::vector<std::string>(all, all + count);
+}
+
+void test_interpolation()
+{
+    testDiag("test_interpolation");
+
+    NTEventBuilderPtr builder = NTEventBuilder::create(names(3));
+    builder->setInterpolation(1, NTEventBuilder::previous);
+    builder->setInterpolation(2, NTEventBuilder::linear);
+    testOk1(builder->getInterpolation(0) == NTEventBuilder::nearest);
+    testOk1(builder->getInterpolation(2) == NTEventBuilder::linear);
+
+    for (size_t c = 0; c < 3; ++c) {
+        builder->add(c, 100, 0, 10);
+        builder->add(c, 100, 400000000, 20);
+        builder->add(c, 101, 0, 50);
+    }
+
+    std::vector<double> values;
+    std::vector<bool> connected;
+    builder->align(100, 300000000, values, connected);
+    testOk1(values.size() == 3 && connected[0] && connected[1] && connected[2]);
+    testOk1(values[0] == 20);
+    testOk1(values[1] == 10);
+    testOk1(fabs(values[2] - 17.5) < 1e-12);
+
+    builder->align(100, 700000000, values, connected);
+    testOk1(values[0] == 20 && values[1] == 20 && fabs(values[2] - 35) < 1e-12);
+
+    // at a sample, every interpolation gives it
+    builder->align(100, 400000000, values, connected);
+    testOk1(values[0] == 20 && values[1] == 20 && values[2] == 20);
+
+    // before the history only nearest and linear have a value
+    builder->align(99, 0, values, connected);
+    testOk1(connected[0] && !connected[1] && connected[2]);
+    testOk1(values[0] == 10 && values[1] == 0 && values[2] == 10);
+
+    // after the history all hold the last sample
+    builder->align(102, 0, values, connected);
+    testOk1(values[0] == 50 && values[1] == 50 && values[2] == 50);
+
+    // a sample at the time of another replaces it
+    builder->add(2, 101, 0, 60);
+    builder->align(100, 700000000, values, connected);
+    testOk1(fabs(values[2] - 40) < 1e-12);
+
+    try {
+        builder->add(3, 0, 0, 0);
+        testFail("channel 3 of 3 not rejected");
+    } catch (std::runtime_error &) {
+        testPass("channel 3 of 3 rejected");
+    }
+}
+
+void test_events()
+{
+    testDiag("test_events");
+
+    NTEventBuilderPtr builder = NTEventBuilder::create(names(2), pvInt, 4);
+    builder->setInterpolation(1, NTEventBuilder::linear);
+
+    builder->trigger(10, 500000000);
+    builder->trigger(11, 500000000);
+    builder->add(0, 10, 0, 1);
+    builder->add(1, 10, 0, 100);
+    builder->add(0, 11, 0, 2);
+
+    std::vector<NTScalarMultiChannelPtr> events;
+    testOk1(builder->poll(events) == 0 && builder->getPending() == 2);
+    testOk1(!builder->isReady(10, 500000000));
+
+    builder->add(1, 11, 0, 200);
+    testOk1(builder->poll(events) == 1 && builder->getPending() == 1);
+
+    NTScalarMultiChannelPtr event = events.at(0);
+    PVIntArray::const_svector values(event->getValue<PVIntArray>()->view());
+    testOk1(values.size() == 2 && values[0] == 1 && values[1] == 150);
+    testOk1(event->getChannelName()->view()[1] == "b");
+    testOk1(event->getNanoseconds()->view()[0] == 500000000 &&
+            event->getSecondsPastEpoch()->view()[1] == 10);
+    testOk1(event->getTimeStamp()->getSubField<PVLong>("secondsPastEpoch")->get() == 10);
+    testOk1(event->getIsConnected()->view()[0] && event->getIsConnected()->view()[1]);
+
+    // the history keeps the last 4 samples
+    for (int i = 0; i < 6; ++i)
+        builder->add(0, 20 + i, 0, i);
+    std::vector<double> aligned;
+    std::vector<bool> connected;
+    builder->align(19, 0, aligned, connected);
+    testOk1(aligned[0] == 2);
+
+    NTScalarMultiChannelPtr snapshot = builder->snapshot(11, 250000000);
+    testOk1(snapshot->getValue<PVIntArray>()->view()[1] == 200);
+}
+
+void test_timeout()
+{
+    testDiag("test_timeout");
+
+    NTEventBuilderPtr builder = NTEventBuilder::create(names(3), pvDouble, 16, 0.05, 2);
+
+    // channel c never delivers a sample
+    builder->add(0, 10, 0, 1);
+    builder->add(1, 10, 0, 2);
+    builder->add(0, 12, 0, 3);
+    builder->add(1, 12, 0, 4);
+    builder->trigger(11, 0);
+
+    std::vector<NTScalarMultiChannelPtr> events;
+    testOk1(builder->poll(events) == 0);
+    epicsThreadSleep(0.1);
+    testOk(builder->poll(events) == 1, "event built after the timeout");
+    testOk1(builder->getTimedOut() == 1 && builder->getPending() == 0);
+    PVBooleanArray::const_svector connected(events.at(0)->getIsConnected()->view());
+    testOk1(connected.size() == 3 && connected[0] && connected[1] && !connected[2]);
+    testOk1(events[0]->getValue<PVDoubleArray>()->view()[2] == 0);
+
+    // channel b falls behind the second trigger
+    builder->add(2, 12, 0, 5);
+    builder->trigger(12, 500000000);
+    builder->add(0, 13, 0, 6);
+    builder->add(2, 13, 0, 7);
+    epicsThreadSleep(0.1);
+    events.clear();
+    testOk1(builder->poll(events) == 1);
+    connected = events.at(0)->getIsConnected()->view();
+    testOk1(connected[0] && !connected[1] && connected[2]);
+
+    // the oldest waiting trigger is dropped
+    builder->trigger(20, 0);
+    builder->trigger(21, 0);
+    builder->trigger(22, 0);
+    testOk1(builder->getPending() == 2 && builder->getDropped() == 1);
+    epicsThreadSleep(0.1);
+    events.clear();
+    builder->poll(events);
+    testOk1(events.size() == 2 &&
+            events[0]->getTimeStamp()->getSubField<PVLong>("secondsPastEpoch")->get() == 21);
+
+    try {
+        NTEventBuilder::create(names(1), pvDouble, 16, 1.0, 0);
+        testFail("no pending triggers accepted");
+    } catch (std::runtime_error&) {
+        testPass("no pending triggers rejected");
+    }
+}
+
+void test_update()
+{
+    testDiag("test_update");
+
+    NTScalarMultiChannelPtr update = NTScalarMultiChannel::createBuilder()->
+        value(pvDouble)->addSecondsPastEpoch()->addNanoseconds()->addIsConnected()->create();
+    PVDoubleArray::svector values(3);
+    values[0] = 1.5;
+    values[1] = 2.5;
+    values[2] = 3.5;
+    PVStringArray::svector channels(3);
+    channels[0] = "b";
+    channels[1] = "x";
+    channels[2] = "a";
+    PVLongArray::svector seconds(3, 7);
+    PVIntArray::svector nanoseconds(3, 0);
+    nanoseconds[2] = 5;
+    PVBooleanArray::svector connected(3, true);
+    update->getValue<PVDoubleArray>()->replace(freeze(values));
+    update->getChannelName()->replace(freeze(channels));
+    update->getSecondsPastEpoch()->replace(freeze(seconds));
+    update->getNanoseconds()->replace(freeze(nanoseconds));
+    update->getIsConnected()->replace(freeze(connected));
+
+    NTEventBuilderPtr builder = NTEventBuilder::create(names(2));
+    builder->setInterpolation(0, NTEventBuilder::previous);
+    builder->setInterpolation(1, NTEventBuilder::previous);
+    builder->add(update);
+
+    std::vector<double> aligned;
+    std::vector<bool> alignedConnected;
+    builder->align(7, 2, aligned, alignedConnected);
+    testOk1(!alignedConnected[0] && alignedConnected[1] && aligned[1] == 1.5);
+    builder->align(7, 5, aligned, alignedConnected);
+    testOk1(alignedConnected[0] && aligned[0] == 3.5);
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    const size_t channelCount = 64;
+    std::vector<std::string> channels;
+    for (size_t i = 0; i < channelCount; ++i)
+        channels.push_back(std::string(1, 'a' + i % 26) + std::string(i/26 + 1, 'x'));
+    NTEventBuilderPtr builder = NTEventBuilder::create(channels);
+    for (size_t c = 0; c < channelCount; ++c)
+        builder->setInterpolation(c, static_cast<NTEventBuilder::Interpolation>(c % 3));
+
+    // channels sampled at 100 Hz with their own phases
+    for (int i = 0; i < 256; ++i)
+        for (size_t c = 0; c < channelCount; ++c)
+            builder->add(c, 1000 + i/100, static_cast<int32>((i % 100)*10000000 + c*100000), i + c);
+
+    std::vector<double> values;
+    std::vector<bool> connected;
+    // the fastest of batches of alignments, which is what a dedicated core reaches
+    const int count = 100;
+    double elapsed = 1e9;
+    for (int batch = 0; batch < 100; ++batch) {
+        epicsTime begin(epicsTime::getCurrent());
+        for (int i = 0; i < count; ++i)
+            builder->align(1001, static_cast<int32>(((batch*count + i) % 1000)*1000000),
+                values, connected);
+        elapsed = std::min(elapsed, (epicsTime::getCurrent() - begin)/count);
+    }
+
+    testOk1(values.size() == channelCount && connected[channelCount - 1]);
+    testDiag("%u channels aligned in %.2f us", (unsigned)channelCount, elapsed*1e6);
+    testOk(elapsed <= 20e-6, "%u channels aligned in at most 20 us", (unsigned)channelCount);
+}
+
+MAIN(testNTEventBuilder) {
+    testPlan(37);
+    test_interpolation();
+    test_events();
+    test_timeout();
+    test_update();
+    test_benchmark();
+    return testDone();
+}
@@ -0,0 +1,231 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <stdexcept>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/ntfft.h>
+
+#include "ndarrayTestFrame.h"
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+typedef std::complex<double> Complex;
+
+static const double pi = 3.14159265358979323846;
+
+static std::vector<Complex> signal(size_t n)
+{
+    std::vector<Complex> data(n);
+    for (size_t i = 0; i < n; ++i)
+        data[i] = Complex(sin(0.3*i) + 0.01*(i % 7), cos(0.7*i));
+    return data;
+}
+
+static std::vector<Complex> dft(std::vector<Complex> const & data)
+{
+    size_t n = data.size();
+    std::vector<Complex> result(n);
+    for (size_t k = 0; k < n; ++k)
+        for (size_t j = 0; j < n; ++j)
+            result[k] += data[j]*std::polar(1.0, -2*pi*((j*k) % n)/n);
+    return result;
+}
+
+static double maxError(std::vector<Complex> const & a, std::vector<Complex> const & b)
+{
+    double error = 0;
+    for (size_t i = 0; i < a.size(); ++i)
+        error = std::max(error, std::abs(a[i] - b[i]));
+    return error;
+}
+
+// pixels of a fixed pattern
+static std::vector<double> pattern(size_t count)
+{
+    std::vector<double> values(count);
+    for (size_t i = 0; i < count; ++i)
+        values[i] = static_cast<double>((i*i + 3*i) % 1000);
+    return values;
+}
+
+void test_plan()
+{
+    testDiag("test_plan");
+
+    const size_t sizes[] = { 1, 2, 4, 8, 16, 32, 1024, 3, 5, 6, 12, 100, 1000 };
+    bool forward = true, inverse = true;
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s) {
+        std::vector<Complex> data(signal(sizes[s]));
+        std::vector<Complex> expected(dft(data));
+        std::vector<Complex> result(data);
+        NTFFT::transform(result);
+        double error = maxError(result, expected);
+        if (error > 1e-9*sizes[s]) {
+            testDiag("forward transform of %u elements off by %g", (unsigned)sizes[s], error);
+            forward = false;
+        }
+        NTFFT::transform(result, true);
+        error = maxError(result, data);
+        if (error > 1e-12*sizes[s]) {
+            testDiag("inverse transform of %u elements off by %g", (unsigned)sizes[s], error);
+            inverse = false;
+        }
+    }
+    testOk(forward, "forward transforms match the DFT");
+    testOk(inverse, "inverse transforms restore the data");
+
+    testOk(NTFFTPlan::get(1000) == NTFFTPlan::get(1000), "plans are cached");
+    testOk1(NTFFTPlan::get(1000)->isBluestein() && !NTFFTPlan::get(1024)->isBluestein());
+    testOk1(NTFFTPlan::get(100)->getSize() == 100);
+
+    NTFFTPlanPtr plan = NTFFTPlan::get(999);
+    std::tr1::weak_ptr<NTFFTPlan> released(NTFFTPlan::get(997));
+    for (size_t n = 3; n < 100; n += 2)
+        NTFFTPlan::get(n);
+    testOk(released.expired(), "least recently used plans are dropped");
+    testOk(plan->getSize() == 999 && plan.use_count() == 1, "plans stay valid for their holders");
+}
+
+void test_waveform()
+{
+    testDiag("test_waveform");
+
+    NTScalarArrayPtr waveform = NTScalarArray::createBuilder()->
+        value(pvFloat)->addTimeStamp()->create();
+    PVFloatArray::svector samples(100);
+    for (size_t i = 0; i < samples.size(); ++i)
+        samples[i] = static_cast<float>(2 + 3*cos(2*pi*5*i/100.0));
+    waveform->getValue<PVFloatArray>()->replace(freeze(samples));
+    waveform->getTimeStamp()->getSubField<PVLong>("secondsPastEpoch")->put(77);
+
+    NTScalarArrayPtr spectrum = NTFFT::spectrum(waveform);
+    PVDoubleArray::const_svector bins(spectrum->getValue<PVDoubleArray>()->view());
+    testOk1(bins.size() == 51);
+    testOk(fabs(bins[0] - 200) < 1e-3 && fabs(bins[5] - 150) < 1e-3 && bins[4] < 1e-3,
+           "magnitude of the constant and the cosine");
+    testOk1(spectrum->getTimeStamp() &&
+            spectrum->getTimeStamp()->getSubField<PVLong>("secondsPastEpoch")->get() == 77);
+
+    NTScalarArrayPtr power = NTFFT::spectrum(waveform, NTFFT::power);
+    testOk1(fabs(power->getValue<PVDoubleArray>()->view()[5] - 22500) < 0.1);
+
+    PVDoubleArray::svector shifted(8);
+    for (size_t i = 0; i < shifted.size(); ++i)
+        shifted[i] = sin(2*pi*i/8);
+    NTScalarArrayPtr sine = NTScalarArray::createBuilder()->value(pvDouble)->create();
+    sine->getValue<PVDoubleArray>()->replace(freeze(shifted));
+    NTScalarArrayPtr phase = NTFFT::spectrum(sine, NTFFT::phase);
+    testOk(fabs(phase->getValue<PVDoubleArray>()->view()[1] + pi/2) < 1e-9,
+           "a sine has phase -pi/2");
+    testOk1(!phase->getTimeStamp());
+}
+
+void test_frame()
+{
+    testDiag("test_frame");
+
+    const size_t width = 8, height = 6;
+    NTNDArrayPtr frame = createFrame<PVUShortArray>(frameSizes(width, height),
+        pattern(width*height), 4);
+    PVUShortArray::const_svector pixels(frame->getValue()->get<PVUShortArray>()->view());
+
+    // the two dimensional DFT, by rows and columns
+    std::vector<Complex> expected(width*height);
+    for (size_t v = 0; v < height; ++v)
+        for (size_t u = 0; u < width; ++u)
+            for (size_t y = 0; y < height; ++y)
+                for (size_t x = 0; x < width; ++x)
+                    expected[v*width + u] += static_cast<double>(pixels[y*width + x])*
+                        std::polar(1.0, -2*pi*((double)(u*x)/width + (double)(v*y)/height));
+
+    NTNDArrayPtr magnitude = NTFFT::spectrum(frame);
+    PVDoubleArray::const_svector value(magnitude->getValue()->get<PVDoubleArray>()->view());
+    bool correct = value.size() == width*height;
+    for (size_t i = 0; correct && i < value.size(); ++i)
+        correct = fabs(value[i] - std::abs(expected[i])) < 1e-6;
+    testOk(correct, "two dimensional magnitude matches the DFT");
+    testOk1(magnitude->getUniqueId()->get() == 4 && magnitude->getDimension()->view().size() == 2);
+
+    NTNDArrayTilerPtr tiler = NTNDArrayTiler::create(3, 64);
+    NTNDArrayPtr tiled = NTFFT::spectrum(frame, NTFFT::phase, tiler);
+    NTNDArrayPtr plain = NTFFT::spectrum(frame, NTFFT::phase);
+    PVDoubleArray::const_svector a(tiled->getValue()->get<PVDoubleArray>()->view());
+    PVDoubleArray::const_svector b(plain->getValue()->get<PVDoubleArray>()->view());
+    bool same = a.size() == b.size();
+    for (size_t i = 0; same && i < a.size(); ++i)
+        same = a[i] == b[i];
+    testOk(same, "tiled transform matches");
+
+    NTNDArrayPtr cube = createFrame<PVUShortArray>(frameSizes(2, 2, 2), pattern(8));
+    try {
+        NTFFT::spectrum(cube);
+        testFail("three dimensional frame transformed");
+    } catch (std::runtime_error&) {
+        testPass("three dimensional frame rejected");
+    }
+
+    // rows without any element
+    NTNDArrayPtr rows = createFrame<PVUShortArray>(frameSizes(width, 0), pattern(0));
+    rows->getValue()->select<PVUShortArray>("ushortValue");
+    NTNDArrayPtr empty = NTFFT::spectrum(rows, NTFFT::magnitude, tiler);
+    PVDoubleArrayPtr emptyValue = empty->getValue()->get<PVDoubleArray>();
+    testOk(emptyValue && emptyValue->view().empty(), "empty frame has an empty spectrum");
+}
+
+// the fastest of count transforms of a signal, which is what a dedicated core reaches
+static double transformTime(size_t n, int count)
+{
+    std::vector<Complex> input(signal(n)), data;
+    NTFFTPlanPtr plan = NTFFTPlan::get(n);
+    double elapsed = 1e9;
+    for (int i = 0; i < count; ++i) {
+        data = input;
+        epicsTime begin(epicsTime::getCurrent());
+        plan->transform(&data[0]);
+        elapsed = std::min(elapsed, epicsTime::getCurrent() - begin);
+    }
+    return elapsed;
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    double radixTime = transformTime(4096, 1000);
+    double bluesteinTime = transformTime(4000, 1000);
+
+    NTNDArrayPtr frame = createFrame<PVUShortArray>(frameSizes(1024, 1024),
+        pattern(1024*1024), 4);
+    NTNDArrayTilerPtr tiler = NTNDArrayTiler::create();
+    epicsTime begin(epicsTime::getCurrent());
+    NTNDArrayPtr spectrum = NTFFT::spectrum(frame, NTFFT::magnitude, tiler);
+    double imageTime = epicsTime::getCurrent() - begin;
+
+    testOk1(spectrum->getValue()->get<PVDoubleArray>()->view().size() == 1024*1024);
+    testDiag("4096 points %.1f us, 4000 points %.1f us, 1024x1024 image %.1f ms with %u threads",
+             radixTime*1e6, bluesteinTime*1e6, imageTime*1e3, (unsigned)tiler->getThreadCount());
+    // 5 n log2 n operations
+    testOk(radixTime <= 100e-6, "4096 points transformed at %.1f GFLOP/s",
+           5*4096*12/radixTime/1e9);
+}
+
+MAIN(testNTFFT) {
+    testPlan(20);
+    test_plan();
+    test_waveform();
+    test_frame();
+    test_benchmark();
+    return testDone();
+}
@@ -9,8 +9,14 @@
  *      Author: Marty Kraimer
  */
 
+#include <algorithm>
+#include <vector>
+
 #include <epicsUnitTest.h>
 #include <testMain.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
 
 #include <pv/nt.h>
 
@@ -112,9 +118,80 @@ void testPVNTField()
     cout << *pvStructureArray->getStructureArray()->getStructure();
 }
 
+namespace {
+
+const size_t callsPerThread = 1000000;
+
+class GetWorker : public epicsThreadRunable
+{
+public:
+    GetWorker() :
+        same(true),
+        thread(*this, "ntfieldGet",
+            epicsThreadGetStackSize(epicsThreadStackSmall), epicsThreadPriorityMedium)
+    {
+        thread.start();
+    }
+
+    virtual void run()
+    {
+        start.wait();
+        for (size_t i = 0; i < callsPerThread; i++) {
+            if (NTField::get() != ntField || PVNTField::get() != pvntField)
+                same = false;
+        }
+    }
+
+    epicsEvent start;
+    bool same;
+    epicsThread thread;
+};
+
+}
+
+void testConcurrentGet()
+{
+    testDiag("testConcurrentGet");
+
+    const size_t maxThreads = 8;
+    const size_t cpus = std::max(epicsThreadGetCPUs(), 1);
+    double singleRate = 0;
+
+    for (size_t nthreads = 1; nthreads <= maxThreads; nthreads *= 2)
+    {
+        std::vector<GetWorker *> workers;
+        for (size_t i = 0; i < nthreads; i++)
+            workers.push_back(new GetWorker());
+
+        epicsTime begin(epicsTime::getCurrent());
+        for (size_t i = 0; i < nthreads; i++)
+            workers[i]->start.signal();
+        bool same = true;
+        for (size_t i = 0; i < nthreads; i++) {
+            workers[i]->thread.exitWait();
+            same = same && workers[i]->same;
+            delete workers[i];
+        }
+        double rate = nthreads*callsPerThread/(epicsTime::getCurrent() - begin);
+
+        testOk(same, "%u threads see the same instances", (unsigned)nthreads);
+        testDiag("%u threads: %.0f get() pairs/s in total", (unsigned)nthreads, rate);
+        if (nthreads == 1) {
+            singleRate = rate;
+            continue;
+        }
+        // linear up to the number of CPUs, allowing for half of it
+        size_t parallel = std::min(nthreads, cpus);
+        testOk(rate >= 0.5*parallel*singleRate,
+               "%u threads on %u CPUs: %.2f times the rate of one thread",
+               (unsigned)nthreads, (unsigned)cpus, rate/singleRate);
+    }
+}
+
 MAIN(testNTField) {
-    testPlan(11);
+    testPlan(18);
     testNTField();
     testPVNTField();
+    testConcurrentGet();
     return testDone();
 }
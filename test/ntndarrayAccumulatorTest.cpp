@@ -0,0 +1,215 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/ntndarrayAccumulator.h>
+
+#include "ndarrayTestFrame.h"
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+// a frame of x by y pixels whose value is base + index
+static NTNDArrayPtr rampFrame(size_t x, size_t y, uint16 base, int32 uniqueId)
+{
+    std::vector<double> values(x*y);
+    for (size_t i = 0; i < values.size(); ++i)
+        values[i] = static_cast<uint16>(base + i);
+    NTNDArrayPtr frame = createFrame<PVUShortArray>(frameSizes(x, y), values, uniqueId);
+    frame->getDataTimeStamp()->getSubField<PVLong>("secondsPastEpoch")->put(1000 + uniqueId);
+    return frame;
+}
+
+static PVStructurePtr attribute(NTNDArrayPtr const & frame, std::string const & name)
+{
+    PVStructureArray::const_svector attributes(frame->getAttribute()->view());
+    for (size_t i = 0; i < attributes.size(); ++i)
+        if (attributes[i]->getSubField<PVString>("name")->get() == name)
+            return attributes[i];
+    return PVStructurePtr();
+}
+
+static int32 intAttribute(NTNDArrayPtr const & frame, std::string const & name)
+{
+    PVStructurePtr attr = attribute(frame, name);
+    if (!attr)
+        return -1;
+    return attr->getSubField<PVUnion>("value")->get<PVScalar>()->getAs<int32>();
+}
+
+static int64 timeStampAttribute(NTNDArrayPtr const & frame, std::string const & name)
+{
+    PVStructurePtr attr = attribute(frame, name);
+    PVStructurePtr timeStamp = attr ? attr->getSubField<PVUnion>("value")->get<PVStructure>() :
+        PVStructurePtr();
+    return timeStamp ? timeStamp->getSubField<PVLong>("secondsPastEpoch")->get() : -1;
+}
+
+void test_sumType()
+{
+    testDiag("test_sumType");
+
+    testOk1(NTNDArrayAccumulator::getSumType(pvUShort, 10) == pvUInt);
+    testOk1(NTNDArrayAccumulator::getSumType(pvUShort, 65537) == pvUInt);
+    testOk1(NTNDArrayAccumulator::getSumType(pvUShort, 65538) == pvULong);
+    testOk1(NTNDArrayAccumulator::getSumType(pvUShort, 0) == pvULong);
+    testOk1(NTNDArrayAccumulator::getSumType(pvShort, 65535) == pvInt);
+    testOk1(NTNDArrayAccumulator::getSumType(pvShort, 65536) == pvLong);
+    testOk1(NTNDArrayAccumulator::getSumType(pvByte, 1000000) == pvInt);
+    testOk1(NTNDArrayAccumulator::getSumType(pvInt, 2) == pvLong);
+    testOk1(NTNDArrayAccumulator::getSumType(pvULong, 2) == pvDouble);
+    testOk1(NTNDArrayAccumulator::getSumType(pvFloat, 2) == pvDouble);
+}
+
+void test_sum()
+{
+    testDiag("test_sum");
+
+    NTNDArrayAccumulatorPtr accumulator =
+        NTNDArrayAccumulator::create(NTNDArrayAccumulator::sumMode, 3);
+    testOk1(!accumulator->getResult());
+    testOk1(!accumulator->add(rampFrame(4, 3, 65000, 10)));
+    testOk1(!accumulator->add(rampFrame(4, 3, 65000, 11)));
+    testOk1(accumulator->getCount() == 2);
+    NTNDArrayPtr sum = accumulator->add(rampFrame(4, 3, 65000, 12));
+    testOk1(sum && accumulator->getCount() == 0);
+
+    PVUIntArrayPtr value = sum->getValue()->get<PVUIntArray>();
+    testOk(value && value->view().size() == 12, "ushort frames are summed as uint");
+    testOk(value && value->view()[11] == 3*65011u, "the sum does not overflow");
+    testOk1(sum->getUncompressedDataSize()->get() == 12*4);
+    testOk1(sum->getUniqueId()->get() == 1);
+    testOk1(intAttribute(sum, "NumAccumulated") == 3);
+    testOk1(intAttribute(sum, "FirstUniqueId") == 10 && intAttribute(sum, "LastUniqueId") == 12);
+    testOk1(timeStampAttribute(sum, "FirstDataTimeStamp") == 1010 &&
+            timeStampAttribute(sum, "LastDataTimeStamp") == 1012);
+    testOk1(sum->getDataTimeStamp()->getSubField<PVLong>("secondsPastEpoch")->get() == 1012);
+
+    for (int32 i = 0; i < 3; ++i)
+        sum = accumulator->add(rampFrame(4, 3, 1, 13 + i));
+    testOk1(sum && sum->getUniqueId()->get() == 2 && intAttribute(sum, "FirstUniqueId") == 13);
+    testOk1(sum->getValue()->get<PVUIntArray>()->view()[0] == 3);
+
+    accumulator->add(rampFrame(4, 3, 1, 16));
+    try {
+        accumulator->add(rampFrame(3, 4, 1, 17));
+        testFail("frame of other dimensions accumulated");
+    } catch (std::runtime_error&) {
+        testPass("frame of other dimensions rejected");
+    }
+    accumulator->reset();
+    testOk1(accumulator->getCount() == 0 && !accumulator->getResult());
+
+    // without a frame count, sums are taken on request
+    accumulator = NTNDArrayAccumulator::create(NTNDArrayAccumulator::sumMode, 0);
+    accumulator->add(rampFrame(4, 3, 100, 1));
+    accumulator->add(rampFrame(4, 3, 100, 2));
+    NTNDArrayPtr partial = accumulator->getResult();
+    accumulator->add(rampFrame(4, 3, 100, 3));
+    testOk(partial->getValue()->get<PVULongArray>()->view()[0] == 200 &&
+           accumulator->getResult()->getValue()->get<PVULongArray>()->view()[0] == 300,
+           "partial results are not changed by later frames");
+}
+
+void test_average()
+{
+    testDiag("test_average");
+
+    NTNDArrayAccumulatorPtr accumulator =
+        NTNDArrayAccumulator::create(NTNDArrayAccumulator::averageMode, 4);
+    NTNDArrayPtr average;
+    for (int32 i = 0; i < 4; ++i)
+        average = accumulator->add(rampFrame(5, 2, static_cast<uint16>(i), i));
+    PVDoubleArrayPtr value = average ? average->getValue()->get<PVDoubleArray>() : PVDoubleArrayPtr();
+    testOk(value && value->view().size() == 10, "averages are double");
+    testOk1(value && value->view()[0] == 1.5 && value->view()[9] == 10.5);
+
+    accumulator = NTNDArrayAccumulator::create(NTNDArrayAccumulator::exponentialMode, 4);
+    const double inputs[] = { 8, 0, 4, 12, 20, 20 };
+    double expected = 0;
+    bool correct = true;
+    for (size_t i = 0; i < 6; ++i) {
+        double weight = 1.0/std::min(i + 1, (size_t)4);
+        expected += weight*(inputs[i] - expected);
+        NTNDArrayPtr output = accumulator->add(
+            rampFrame(2, 2, static_cast<uint16>(inputs[i]), static_cast<int32>(i)));
+        correct = correct && output &&
+            fabs(output->getValue()->get<PVDoubleArray>()->view()[0] - expected) < 1e-9;
+    }
+    testOk(correct, "exponential moving average");
+    testOk1(accumulator->getCount() == 6);
+
+    try {
+        NTNDArrayAccumulator::create(NTNDArrayAccumulator::exponentialMode, 0);
+        testFail("exponential mode without frame count accepted");
+    } catch (std::runtime_error&) {
+        testPass("exponential mode without frame count rejected");
+    }
+
+    // sums of 64 bit integers are double, rounded once per element
+    accumulator = NTNDArrayAccumulator::create(NTNDArrayAccumulator::averageMode, 2);
+    const uint64 large[] = { 0xfffffffffffff801ull, 0x8000000000000401ull };
+    for (size_t i = 0; i < 2; ++i) {
+        PVULongArray::svector pixels(2, large[i]);
+        pixels[1] = i + 3;
+        NTNDArrayPtr frame = createFrame<PVULongArray>(frameSizes(2, 1),
+            std::vector<double>(), static_cast<int32>(i));
+        frame->getValue()->select<PVULongArray>("ulongValue")->replace(freeze(pixels));
+        average = accumulator->add(frame);
+    }
+    value = average ? average->getValue()->get<PVDoubleArray>() : PVDoubleArrayPtr();
+    testOk(value && value->view()[0] == (static_cast<double>(large[0]) +
+           static_cast<double>(large[1]))/2 && value->view()[1] == 3.5,
+           "large 64 bit integers averaged");
+
+    NTNDArrayAccumulatorNode node("sum", NTNDArrayAccumulator::sumMode, 2);
+    NTNDArrayBufferPoolPtr pool = NTNDArrayBufferPool::create();
+    testOk1(!node.process(rampFrame(2, 2, 1, 1), pool));
+    NTNDArrayPtr output = node.process(rampFrame(2, 2, 1, 2), pool);
+    testOk1(output && output->getValue()->get<PVUIntArray>()->view()[3] == 8);
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    NTNDArrayPtr frame = rampFrame(1024, 1024, 0, 1);
+    NTNDArrayAccumulatorPtr accumulator =
+        NTNDArrayAccumulator::create(NTNDArrayAccumulator::sumMode, 100);
+
+    // the fastest of the frames, which is what a dedicated core reaches
+    NTNDArrayPtr sum;
+    double elapsed = 1e9;
+    for (int i = 0; i < 100; ++i) {
+        epicsTime begin(epicsTime::getCurrent());
+        NTNDArrayPtr output = accumulator->add(frame);
+        elapsed = std::min(elapsed, epicsTime::getCurrent() - begin);
+        if (output)
+            sum = output;
+    }
+
+    testOk1(sum && sum->getValue()->get<PVUIntArray>()->view()[1] == 100);
+    testDiag("1024x1024 uint16 frames summed in %.2f ms, %.0f Mpixel/s",
+             elapsed*1e3, 1024*1024/elapsed/1e6);
+    testOk(elapsed <= 1e-3, "uint16 frames summed at %.0f Mpixel/s", 1024*1024/elapsed/1e6);
+}
+
+MAIN(testNTNDArrayAccumulator) {
+    testPlan(38);
+    test_sumType();
+    test_sum();
+    test_average();
+    test_benchmark();
+    return testDone();
+}
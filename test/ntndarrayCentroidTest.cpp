@@ -0,0 +1,255 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/ntndarrayCentroid.h>
+
+#include "ndarrayTestFrame.h"
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+static std::vector<double> gaussian(size_t width, size_t height, double cx, double cy,
+    double sx, double sy, double amplitude)
+{
+    std::vector<double> values(width*height);
+    for (size_t y = 0; y < height; ++y)
+        for (size_t x = 0; x < width; ++x) {
+            double dx = (x - cx)/sx, dy = (y - cy)/sy;
+            values[y*width + x] = floor(amplitude*exp(-(dx*dx + dy*dy)/2) + 0.5);
+        }
+    return values;
+}
+
+static double attributeValue(NTNDArrayPtr const & frame, std::string const & name)
+{
+    PVStructureArray::const_svector attributes(frame->getAttribute()->view());
+    for (size_t i = 0; i < attributes.size(); ++i) {
+        if (attributes[i]->getSubField<PVString>("name")->get() != name)
+            continue;
+        PVDoublePtr value = attributes[i]->getSubField<PVUnion>("value")->get<PVDouble>();
+        return value ? value->get() : -1;
+    }
+    return -1;
+}
+
+static PVDoubleArray::const_svector arrayAttribute(NTNDArrayPtr const & frame, std::string const & name)
+{
+    PVStructureArray::const_svector attributes(frame->getAttribute()->view());
+    for (size_t i = 0; i < attributes.size(); ++i) {
+        if (attributes[i]->getSubField<PVString>("name")->get() != name)
+            continue;
+        PVDoubleArrayPtr value = attributes[i]->getSubField<PVUnion>("value")->get<PVDoubleArray>();
+        if (value)
+            return value->view();
+    }
+    return PVDoubleArray::const_svector();
+}
+
+void test_moments()
+{
+    testDiag("test_moments");
+
+    std::vector<double> values(gaussian(64, 48, 20.3, 25.7, 3, 4, 1000));
+    NTNDArrayPtr frame = createFrame<PVUShortArray>(frameSizes(64, 48), values, 5);
+
+    double total = 0, sx = 0, sy = 0;
+    for (size_t i = 0; i < values.size(); ++i) {
+        total += values[i];
+        sx += values[i]*(i % 64);
+        sy += values[i]*(i / 64);
+    }
+
+    NTNDArrayCentroidPtr centroid = NTNDArrayCentroid::create();
+    NTNDArrayMoments moments;
+    std::vector<NTNDArrayPeak> peaks;
+    centroid->analyze(frame, moments, peaks);
+
+    testOk1(moments.uniqueId == 5);
+    testOk1(moments.count == 64*48);
+    testOk1(moments.total == total);
+    testOk1(moments.min == 0 && moments.max == *std::max_element(values.begin(), values.end()));
+    testOk1(fabs(moments.centroidX - sx/total) < 1e-9 && fabs(moments.centroidX - 20.3) < 0.01);
+    testOk1(fabs(moments.centroidY - sy/total) < 1e-9 && fabs(moments.centroidY - 25.7) < 0.01);
+    testOk1(fabs(moments.sigmaX - 3) < 0.05);
+    testOk1(fabs(moments.sigmaY - 4) < 0.05);
+    testOk1(fabs(moments.sigmaXY) < 0.01);
+    testOk1(peaks.empty());
+
+    // the same frame as double gives the same moments
+    NTNDArrayMoments doubleMoments;
+    centroid->analyze(createFrame<PVDoubleArray>(frameSizes(64, 48), values, 5), doubleMoments, peaks);
+    testOk1(doubleMoments.total == moments.total &&
+            fabs(doubleMoments.sigmaX - moments.sigmaX) < 1e-9);
+
+    // a one dimensional frame
+    std::vector<size_t> line(1, 4);
+    centroid->analyze(createFrame<PVIntArray>(line, std::vector<double>(4, 2), 5), moments, peaks);
+    testOk1(moments.total == 8 && moments.centroidX == 1.5 && moments.centroidY == 0);
+    testOk1(fabs(moments.sigmaX - sqrt(1.25)) < 1e-12 && moments.sigmaY == 0);
+
+    try {
+        centroid->analyze(createFrame<PVIntArray>(std::vector<size_t>(3, 2),
+            std::vector<double>(8, 1), 5), moments, peaks);
+        testFail("three dimensions not rejected");
+    } catch (std::runtime_error &) {
+        testPass("three dimensions rejected");
+    }
+}
+
+void test_threshold_region()
+{
+    testDiag("test_threshold_region");
+
+    double raw[] = { 1, 2, 3, 4,
+                     5, 6, 7, 8,
+                     9, 10, 11, 12 };
+    std::vector<double> values(raw, raw + 12);
+    NTNDArrayPtr frame = createFrame<PVByteArray>(frameSizes(4, 3), values, 5);
+
+    NTNDArrayCentroidPtr centroid = NTNDArrayCentroid::create(0, 6.5);
+    NTNDArrayMoments moments;
+    std::vector<NTNDArrayPeak> peaks;
+    centroid->analyze(frame, moments, peaks);
+    testOk1(moments.total == 7 + 8 + 9 + 10 + 11 + 12);
+    testOk1(moments.min == 1 && moments.max == 12);
+    testOk1(fabs(moments.centroidY - (7*1 + 8*1 + 42*2)/57.0) < 1e-12);
+
+    centroid->setRegion(1, 1, 2, 100);
+    centroid->analyze(frame, moments, peaks);
+    testOk1(moments.count == 4);
+    testOk1(moments.total == 7 + 10 + 11);
+    testOk1(moments.min == 6 && moments.max == 11);
+    testOk1(fabs(moments.centroidX - (7*2 + 10*1 + 11*2)/28.0) < 1e-12);
+
+    centroid->setRegion(10, 0, 2, 2);
+    centroid->analyze(frame, moments, peaks);
+    testOk1(moments.count == 0 && moments.total == 0 && moments.centroidX == 0);
+
+    // nothing reaches a threshold above the type
+    centroid = NTNDArrayCentroid::create(4, 1000);
+    centroid->analyze(frame, moments, peaks);
+    testOk1(moments.total == 0 && moments.max == 12 && peaks.empty());
+}
+
+void test_peaks()
+{
+    testDiag("test_peaks");
+
+    std::vector<double> values(64*32, 0);
+    std::vector<double> spot(gaussian(64, 32, 10, 10, 2, 2, 500));
+    std::vector<double> other(gaussian(64, 32, 40, 20, 2, 2, 800));
+    for (size_t i = 0; i < values.size(); ++i)
+        values[i] = spot[i] + other[i];
+    // a plateau of two equal elements is one peak
+    values[5*64 + 60] = values[5*64 + 61] = 300;
+    NTNDArrayPtr frame = createFrame<PVUShortArray>(frameSizes(64, 32), values, 5);
+
+    NTNDArrayCentroidPtr centroid = NTNDArrayCentroid::create(5, 1);
+    NTNDArrayMoments moments;
+    std::vector<NTNDArrayPeak> peaks;
+    centroid->analyze(frame, moments, peaks);
+    testOk(peaks.size() == 3, "%u peaks", (unsigned)peaks.size());
+    testOk1(peaks.size() == 3 &&
+            peaks[0].x == 40 && peaks[0].y == 20 && peaks[0].value == 800 &&
+            peaks[1].x == 10 && peaks[1].y == 10 && peaks[1].value == 500 &&
+            peaks[2].x == 60 && peaks[2].y == 5 && peaks[2].value == 300);
+
+    centroid = NTNDArrayCentroid::create(1, 1);
+    centroid->analyze(frame, moments, peaks);
+    testOk1(peaks.size() == 1 && peaks[0].value == 800);
+
+    centroid = NTNDArrayCentroid::create(5, 600);
+    centroid->analyze(frame, moments, peaks);
+    testOk1(peaks.size() == 1 && peaks[0].x == 40);
+
+    NTTablePtr table = NTNDArrayCentroid::createPeakTable(peaks);
+    testOk1(table->getColumn<PVIntArray>("x")->view().at(0) == 40);
+    testOk1(table->getColumn<PVIntArray>("y")->view().at(0) == 20);
+    testOk1(table->getColumn<PVDoubleArray>("value")->view().at(0) == 800);
+
+    std::vector<NTNDArrayMoments> history(2);
+    history[1].uniqueId = 7;
+    history[1].count = 12;
+    history[1].centroidX = 1.5;
+    table = NTNDArrayCentroid::createMomentsTable(history);
+    testOk1(table->getColumn<PVIntArray>("uniqueId")->view().at(1) == 7);
+    testOk1(table->getColumn<PVLongArray>("count")->view().at(1) == 12);
+    testOk1(table->getColumn<PVDoubleArray>("centroidX")->view().at(1) == 1.5);
+    testOk1(table->getColumn<PVDoubleArray>("sigmaXY")->view().size() == 2);
+}
+
+void test_node()
+{
+    testDiag("test_node");
+
+    std::vector<double> values(gaussian(32, 32, 12, 18, 2, 2, 1000));
+    NTNDArrayPtr frame = createFrame<PVUShortArray>(frameSizes(32, 32), values, 5);
+
+    NTNDArrayCentroidNode node("centroid", NTNDArrayCentroid::create(2, 10));
+    NTNDArrayPtr output = node.process(frame, NTNDArrayBufferPoolPtr());
+
+    testOk1(output && output != frame);
+    testOk1(frame->getAttribute()->getLength() == 0);
+    testOk1(attributeValue(output, "CentroidX") == node.getMoments().centroidX);
+    testOk1(fabs(attributeValue(output, "CentroidY") - 18) < 1e-9);
+    testOk1(attributeValue(output, "SigmaXY") == node.getMoments().sigmaXY);
+    PVDoubleArray::const_svector peakX(arrayAttribute(output, "PeakX"));
+    PVDoubleArray::const_svector peakValue(arrayAttribute(output, "PeakValue"));
+    testOk1(peakX.size() == 1 && peakX[0] == 12 && peakValue[0] == 1000);
+    testOk1(node.getPeaks().size() == 1);
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    std::vector<double> values(gaussian(2048, 2048, 1000.5, 900.25, 100, 150, 60000));
+    NTNDArrayPtr frame = createFrame<PVUShortArray>(frameSizes(2048, 2048), values, 5);
+
+    NTNDArrayCentroidPtr centroid = NTNDArrayCentroid::create();
+    NTNDArrayCentroidPtr peakFinder = NTNDArrayCentroid::create(10, 100);
+    NTNDArrayMoments moments;
+    std::vector<NTNDArrayPeak> peaks;
+
+    // the fastest of several frames, which is what a dedicated core reaches
+    const int count = 10;
+    double elapsed = 1e9, peakElapsed = 1e9;
+    for (int i = 0; i < count; ++i) {
+        epicsTime begin(epicsTime::getCurrent());
+        centroid->analyze(frame, moments, peaks);
+        elapsed = std::min(elapsed, epicsTime::getCurrent() - begin);
+    }
+    for (int i = 0; i < count; ++i) {
+        epicsTime begin(epicsTime::getCurrent());
+        peakFinder->analyze(frame, moments, peaks);
+        peakElapsed = std::min(peakElapsed, epicsTime::getCurrent() - begin);
+    }
+
+    testOk1(fabs(moments.centroidX - 1000.5) < 0.01 && peaks.size() == 1);
+    testDiag("2048x2048 uint16 moments in %.2f ms, %.0f Mpixel/s; with peaks in %.2f ms",
+             elapsed*1e3, 2048*2048/elapsed/1e6, peakElapsed*1e3);
+    // 500 frames of 4 Mpixel a second
+    testOk(elapsed <= 2e-3, "moments of 4 Mpixel at %.0f Hz", 1/elapsed);
+}
+
+MAIN(testNTNDArrayCentroid) {
+    testPlan(43);
+    test_moments();
+    test_threshold_region();
+    test_peaks();
+    test_node();
+    test_benchmark();
+    return testDone();
+}
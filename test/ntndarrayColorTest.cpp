@@ -0,0 +1,277 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/ntndarrayColor.h>
+
+#include "ndarrayTestFrame.h"
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+static PVDataCreatePtr pvDataCreate = getPVDataCreate();
+
+// a ushort frame with the offset of each dimension set to its index
+static NTNDArrayPtr offsetFrame(std::vector<size_t> const & sizes,
+    PVUShortArray::svector const & pixels)
+{
+    NTNDArrayPtr ntndArray = createFrame<PVUShortArray>(sizes,
+        std::vector<double>(pixels.begin(), pixels.end()), 3);
+    PVStructureArray::const_svector dims(ntndArray->getDimension()->view());
+    for (size_t i = 0; i < dims.size(); ++i)
+        dims[i]->getSubField<PVInt>("offset")->put(static_cast<int32>(i));
+    return ntndArray;
+}
+
+// a Bayer frame of a ramp, the value of each pixel is 2*x + 20*y
+static NTNDArrayPtr createBayer(size_t width, size_t height,
+    NTNDArrayColor::BayerPattern pattern)
+{
+    PVUShortArray::svector pixels(width*height);
+    for (size_t y = 0; y < height; ++y)
+        for (size_t x = 0; x < width; ++x)
+            pixels[y*width + x] = static_cast<uint16>(2*x + 20*y);
+    NTNDArrayPtr frame = offsetFrame(frameSizes(width, height), pixels);
+    NTNDArrayColor::setColorMode(frame, NTNDArrayColor::bayer);
+    NTNDArrayColor::setBayerPattern(frame, pattern);
+    return frame;
+}
+
+static PVUShortArray::const_svector pixels(NTNDArrayPtr const & frame)
+{
+    return frame->getValue()->get<PVUShortArray>()->view();
+}
+
+static bool sameValues(NTNDArrayPtr const & a, NTNDArrayPtr const & b)
+{
+    PVUShortArray::const_svector first(pixels(a)), second(pixels(b));
+    return first.size() == second.size() &&
+        std::equal(first.begin(), first.end(), second.begin());
+}
+
+void test_attributes()
+{
+    testDiag("test_attributes");
+
+    PVUShortArray::svector values(3*4*5);
+    testOk1(NTNDArrayColor::getColorMode(offsetFrame(frameSizes(4, 5), values)) == NTNDArrayColor::mono);
+    testOk1(NTNDArrayColor::getColorMode(offsetFrame(frameSizes(3, 4, 5), values)) == NTNDArrayColor::rgb1);
+    testOk1(NTNDArrayColor::getColorMode(offsetFrame(frameSizes(4, 3, 5), values)) == NTNDArrayColor::rgb2);
+    testOk1(NTNDArrayColor::getColorMode(offsetFrame(frameSizes(4, 5, 3), values)) == NTNDArrayColor::rgb3);
+
+    NTNDArrayPtr frame = offsetFrame(frameSizes(3, 4, 5), values);
+    NTNDArrayColor::setColorMode(frame, NTNDArrayColor::rgb2);
+    testOk(NTNDArrayColor::getColorMode(frame) == NTNDArrayColor::rgb2,
+           "the attribute takes precedence");
+    testOk1(frame->getAttribute()->view().size() == 1);
+    testOk1(NTNDArrayColor::getBayerPattern(frame) == NTNDArrayColor::rggb);
+
+    NTNDArrayPtr copy = NTNDArray::wrapUnsafe(
+        pvDataCreate->createPVStructure(frame->getPVStructure()));
+    NTNDArrayColor::setColorMode(copy, NTNDArrayColor::rgb3);
+    testOk(NTNDArrayColor::getColorMode(copy) == NTNDArrayColor::rgb3 &&
+           NTNDArrayColor::getColorMode(frame) == NTNDArrayColor::rgb2,
+           "copies of a frame are not changed");
+    testOk1(copy->getAttribute()->view().size() == 1);
+
+    NTNDArrayColor::setColorMode(frame, static_cast<NTNDArrayColor::Mode>(6));
+    try {
+        NTNDArrayColor::getColorMode(frame);
+        testFail("YUV color mode accepted");
+    } catch (std::runtime_error&) {
+        testPass("YUV color mode rejected");
+    }
+}
+
+void test_demosaic()
+{
+    testDiag("test_demosaic");
+
+    NTNDArrayColor::BayerPattern patterns[] = {
+        NTNDArrayColor::rggb, NTNDArrayColor::gbrg,
+        NTNDArrayColor::grbg, NTNDArrayColor::bggr };
+    NTNDArrayColor::Mode modes[] = {
+        NTNDArrayColor::rgb1, NTNDArrayColor::rgb2, NTNDArrayColor::rgb3 };
+
+    // bilinear interpolation is exact for a ramp away from the edges
+    const size_t width = 9, height = 6;
+    bool exact = true;
+    for (size_t p = 0; p < 4; ++p) {
+        NTNDArrayPtr frame = createBayer(width, height, patterns[p]);
+        for (size_t m = 0; m < 3; ++m) {
+            NTNDArrayPtr rgb = NTNDArrayColor::convert(frame, modes[m]);
+            PVUShortArray::const_svector value(pixels(rgb));
+            exact = exact && value.size() == 3*width*height;
+            for (size_t y = 1; exact && y + 1 < height; ++y)
+                for (size_t x = 1; x + 1 < width; ++x)
+                    for (size_t c = 0; c < 3; ++c) {
+                        size_t index = modes[m] == NTNDArrayColor::rgb1 ? (y*width + x)*3 + c :
+                            modes[m] == NTNDArrayColor::rgb2 ? (y*3 + c)*width + x :
+                            (c*height + y)*width + x;
+                        exact = exact && value[index] == 2*x + 20*y;
+                    }
+        }
+    }
+    testOk(exact, "all patterns and modes demosaic a ramp");
+
+    // 64 bit sums of four elements would overflow, and doubles would round
+    PVULongArray::svector large(width*height);
+    const uint64 base = 0xfffffffffffff000ull;
+    for (size_t y = 0; y < height; ++y)
+        for (size_t x = 0; x < width; ++x)
+            large[y*width + x] = base + 2*x + 20*y + 1;
+    NTNDArrayPtr longFrame = createFrame<PVULongArray>(frameSizes(width, height),
+        std::vector<double>());
+    longFrame->getValue()->select<PVULongArray>("ulongValue")->replace(freeze(large));
+    NTNDArrayColor::setColorMode(longFrame, NTNDArrayColor::bayer);
+    PVULongArray::const_svector longValue(NTNDArrayColor::convert(longFrame,
+        NTNDArrayColor::rgb3)->getValue()->get<PVULongArray>()->view());
+    bool longExact = longValue.size() == 3*width*height;
+    for (size_t y = 1; longExact && y + 1 < height; ++y)
+        for (size_t x = 1; x + 1 < width; ++x)
+            for (size_t c = 0; c < 3; ++c)
+                longExact = longExact &&
+                    longValue[(c*height + y)*width + x] == base + 2*x + 20*y + 1;
+    testOk(longExact, "uint64 elements demosaic exactly");
+
+    // a flat color is kept at the edges
+    PVUShortArray::svector flat(4*4);
+    for (size_t y = 0; y < 4; ++y)
+        for (size_t x = 0; x < 4; ++x)
+            flat[y*4 + x] = (x & 1) == (y & 1) ? ((y & 1) ? 10 : 90) : 50;
+    NTNDArrayPtr frame = offsetFrame(frameSizes(4, 4), flat);
+    NTNDArrayColor::setColorMode(frame, NTNDArrayColor::bayer);
+    NTNDArrayPtr rgb = NTNDArrayColor::convert(frame, NTNDArrayColor::rgb1);
+    PVUShortArray::const_svector value(pixels(rgb));
+    bool uniform = true;
+    for (size_t i = 0; i < 16; ++i)
+        uniform = uniform && value[3*i] == 90 && value[3*i + 1] == 50 && value[3*i + 2] == 10;
+    testOk(uniform, "flat colors are kept at the edges");
+
+    testOk1(NTNDArrayColor::getColorMode(rgb) == NTNDArrayColor::rgb1);
+    testOk1(NTNDArrayColor::getColorMode(frame) == NTNDArrayColor::bayer);
+    testOk1(rgb->getDimension()->view().size() == 3);
+    testOk1(dimensionField(rgb, 0, "size") == 3 && dimensionField(rgb, 0, "offset") == 0);
+    testOk(dimensionField(rgb, 1, "size") == 4 && dimensionField(rgb, 1, "offset") == 0 &&
+           dimensionField(rgb, 2, "offset") == 1, "x and y keep their dimensions");
+    testOk1(rgb->getUniqueId()->get() == 3);
+    testOk1(rgb->getUncompressedDataSize()->get() == 3*16*2);
+}
+
+void test_convert()
+{
+    testDiag("test_convert");
+
+    const size_t width = 7, height = 5;
+    PVUShortArray::svector values(3*width*height);
+    for (size_t i = 0; i < values.size(); ++i)
+        values[i] = static_cast<uint16>(i*37 % 1000);
+    NTNDArrayPtr rgb1 = offsetFrame(frameSizes(3, width, height), values);
+
+    NTNDArrayPtr rgb2 = NTNDArrayColor::convert(rgb1, NTNDArrayColor::rgb2);
+    NTNDArrayPtr rgb3 = NTNDArrayColor::convert(rgb2, NTNDArrayColor::rgb3);
+    NTNDArrayPtr back = NTNDArrayColor::convert(rgb3, NTNDArrayColor::rgb1);
+    testOk1(dimensionField(rgb2, 1, "size") == 3 && dimensionField(rgb2, 2, "offset") == 2);
+    testOk1(dimensionField(rgb3, 2, "size") == 3 && dimensionField(rgb3, 0, "offset") == 1);
+    testOk1(pixels(rgb2)[width] == values[1] && pixels(rgb3)[width*height + 1] == values[4]);
+    testOk(sameValues(back, rgb1), "RGB modes convert without loss");
+    testOk1(NTNDArrayColor::convert(rgb1, NTNDArrayColor::rgb1) == rgb1);
+
+    NTNDArrayPtr mono = NTNDArrayColor::convert(rgb3, NTNDArrayColor::mono);
+    testOk1(mono->getDimension()->view().size() == 2 && pixels(mono).size() == width*height);
+    double luma = 0.299*values[3] + 0.587*values[4] + 0.114*values[5];
+    testOk1(pixels(mono)[1] == static_cast<uint16>(luma + 0.5));
+
+    NTNDArrayPtr gray = NTNDArrayColor::convert(mono, NTNDArrayColor::rgb1);
+    testOk1(pixels(gray)[3] == pixels(mono)[1] && pixels(gray)[5] == pixels(mono)[1]);
+
+    NTNDArrayTilerPtr tiler = NTNDArrayTiler::create(3, 64);
+    NTNDArrayPtr bayer = createBayer(64, 48, NTNDArrayColor::grbg);
+    testOk(sameValues(NTNDArrayColor::convert(bayer, NTNDArrayColor::rgb2, tiler),
+                      NTNDArrayColor::convert(bayer, NTNDArrayColor::rgb2)),
+           "tiled conversion matches");
+
+    NTNDArrayColorNode node("color", NTNDArrayColor::rgb3, tiler);
+    NTNDArrayPtr output = node.process(rgb1, NTNDArrayBufferPool::create());
+    testOk1(sameValues(output, rgb3));
+
+    try {
+        NTNDArrayColor::convert(bayer, NTNDArrayColor::mono);
+        testFail("Bayer to mono accepted");
+    } catch (std::runtime_error&) {
+        testPass("Bayer to mono rejected");
+    }
+
+    try {
+        NTNDArrayColor::convert(rgb1, NTNDArrayColor::bayer);
+        testFail("conversion to Bayer accepted");
+    } catch (std::runtime_error&) {
+        testPass("conversion to Bayer rejected");
+    }
+
+    NTNDArrayColor::setColorMode(mono, NTNDArrayColor::rgb1);
+    try {
+        NTNDArrayColor::convert(mono, NTNDArrayColor::rgb3);
+        testFail("dimensions not matching the mode accepted");
+    } catch (std::runtime_error&) {
+        testPass("dimensions not matching the mode rejected");
+    }
+}
+
+// the fastest of a few conversions, which is what a dedicated core reaches
+static double conversionTime(NTNDArrayPtr const & frame, NTNDArrayColor::Mode mode,
+    NTNDArrayTilerPtr const & tiler, NTNDArrayBufferPoolPtr const & pool)
+{
+    NTNDArrayColor::convert(frame, mode, tiler, pool);
+    double elapsed = 1e9;
+    for (int i = 0; i < 5; ++i) {
+        epicsTime begin(epicsTime::getCurrent());
+        NTNDArrayColor::convert(frame, mode, tiler, pool);
+        elapsed = std::min(elapsed, epicsTime::getCurrent() - begin);
+    }
+    return elapsed;
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    NTNDArrayPtr frame = createBayer(2048, 2048, NTNDArrayColor::rggb);
+    NTNDArrayTilerPtr tiler = NTNDArrayTiler::create();
+    NTNDArrayBufferPoolPtr pool = NTNDArrayBufferPool::create();
+    double demosaicTime = conversionTime(frame, NTNDArrayColor::rgb1, tiler, pool);
+    NTNDArrayPtr rgb = NTNDArrayColor::convert(frame, NTNDArrayColor::rgb1, tiler, pool);
+    double interleaveTime = conversionTime(rgb, NTNDArrayColor::rgb3, tiler, pool);
+
+    std::vector<double> values(2048*2048);
+    for (size_t i = 0; i < values.size(); ++i)
+        values[i] = static_cast<double>((i % 2048 + i/2048) & 0xff);
+    NTNDArrayPtr bytes = createFrame<PVUByteArray>(frameSizes(2048, 2048), values);
+    NTNDArrayColor::setColorMode(bytes, NTNDArrayColor::bayer);
+    double byteTime = conversionTime(bytes, NTNDArrayColor::rgb1, tiler, pool);
+
+    testPass("benchmark done");
+    testDiag("2048x2048 uint16, %u threads: Bayer to RGB1 %.1f ms, RGB1 to RGB3 %.1f ms",
+             (unsigned)tiler->getThreadCount(), demosaicTime*1e3, interleaveTime*1e3);
+    // 100 frames of 4 Mpixel a second from an 8 bit Bayer camera
+    testOk(byteTime <= 10e-3, "2048x2048 uint8 Bayer to RGB1 in %.1f ms", byteTime*1e3);
+}
+
+MAIN(testNTNDArrayColor) {
+    testPlan(35);
+    test_attributes();
+    test_demosaic();
+    test_convert();
+    test_benchmark();
+    return testDone();
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsEndian.h>
+#include <epicsTime.h>
+
+#include <pv/serialize.h>
+
+#include <pv/nt.h>
+#include <pv/ntndarrayDecoder.h>
+
+#include "ndarrayTestFrame.h"
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+static PVDataCreatePtr pvDataCreate = getPVDataCreate();
+
+// every allocation made by the test, counted to check that scan() creates
+// no introspection interfaces
+static size_t allocations;
+
+#if __cplusplus >= 201103L
+void *operator new(std::size_t size)
+#else
+void *operator new(std::size_t size) throw(std::bad_alloc)
+#endif
+{
+    ++allocations;
+    void *p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) throw()
+{
+    std::free(p);
+}
+
+// a frame with a descriptor, a timeStamp and attributes, which are all
+// carried through decoding
+static NTNDArrayPtr describedFrame(size_t width, size_t height)
+{
+    std::vector<double> pixels(width*height);
+    for (size_t i = 0; i < pixels.size(); ++i)
+        pixels[i] = static_cast<uint16>(i);
+    NTNDArrayPtr ntndArray = createFrame<PVUShortArray>(frameSizes(width, height), pixels, 1234,
+        NTNDArray::createBuilder()->
+            addDescriptor()->
+            addTimeStamp());
+
+    PVStructureArrayPtr attribute = ntndArray->getAttribute();
+    PVStructureArray::svector attrs(3);
+    const char *names[] = { "ColorMode", "", "Exposure" };
+    for (size_t i = 0; i < attrs.size(); ++i) {
+        if (!*names[i])
+            continue;
+        attrs[i] = pvDataCreate->createPVStructure(attribute->getStructureArray()->getStructure());
+        attrs[i]->getSubField<PVString>("name")->put(names[i]);
+    }
+    PVIntPtr colorMode = pvDataCreate->createPVScalar<PVInt>();
+    colorMode->put(0);
+    attrs[0]->getSubField<PVUnion>("value")->set(colorMode);
+    PVDoublePtr exposure = pvDataCreate->createPVScalar<PVDouble>();
+    exposure->put(0.25);
+    attrs[2]->getSubField<PVUnion>("value")->set(exposure);
+    attribute->replace(freeze(attrs));
+
+    ntndArray->getDataTimeStamp()->getSubField<PVLong>("secondsPastEpoch")->put(987654321);
+    ntndArray->getDescriptor()->put("frame");
+    return ntndArray;
+}
+
+void test_create()
+{
+    testDiag("test_create");
+
+    NTNDArrayPtr ntndArray = describedFrame(2, 2);
+    testOk1(NTNDArrayDecoder::create(ntndArray->getPVStructure()->getStructure()).get() != 0);
+
+    StructureConstPtr scalar = NTScalar::createBuilder()->value(pvDouble)->createStructure();
+    testOk1(NTNDArrayDecoder::create(scalar).get() == 0);
+    testOk1(NTNDArrayDecoder::create(StructureConstPtr()).get() == 0);
+}
+
+static void test_decode(int byteOrder)
+{
+    testDiag("test_decode %s", byteOrder == EPICS_ENDIAN_BIG ? "big endian" : "little endian");
+
+    NTNDArrayPtr ntndArray = describedFrame(64, 32);
+    std::vector<epicsUInt8> bytes;
+    serializeToVector(ntndArray->getPVStructure().get(), byteOrder, bytes);
+
+    NTNDArrayDecoderPtr decoder = NTNDArrayDecoder::create(ntndArray->getPVStructure()->getStructure());
+    decoder->scan(bytes, byteOrder);
+
+    testOk1(decoder->getUniqueId() == 1234);
+    testOk1(decoder->getDataTimeStamp()->getSubField<PVLong>("secondsPastEpoch")->get() == 987654321);
+    testOk1(*decoder->getDimension() == *ntndArray->getDimension());
+    testOk1(decoder->decode<PVString>("descriptor")->get() == "frame");
+    testOk1(decoder->decode("nonexistent").get() == 0);
+
+    testOk1(decoder->getNumberAttributes() == 3);
+    testOk1(decoder->getAttributeNames()[2] == "Exposure");
+    PVStructurePtr exposure = decoder->getAttribute("Exposure");
+    testOk1(exposure.get() != 0 &&
+        exposure->getSubField<PVUnion>("value")->get<PVDouble>()->get() == 0.25);
+    testOk1(decoder->getAttribute("Gain").get() == 0);
+
+    testOk1(decoder->hasValue());
+    testOk1(decoder->getValueFieldName() == "ushortValue");
+    testOk1(decoder->getValueType() == pvUShort);
+    testOk1(decoder->getValueCount() == 64*32);
+    testOk1(decoder->getValueBytes() == 64*32*sizeof(uint16));
+
+    const char *begin = reinterpret_cast<const char*>(&bytes[0]);
+    const char *valueData = decoder->getValueData();
+    testOk(valueData > begin && valueData + decoder->getValueBytes() <= begin + bytes.size(),
+           "value borrowed from the scanned buffer");
+
+    uint16 last;
+    memcpy(&last, valueData + decoder->getValueBytes() - sizeof(last), sizeof(last));
+    if (byteOrder != EPICS_BYTE_ORDER)
+        last = static_cast<uint16>((last >> 8) | (last << 8));
+    testOk1(last == 64*32 - 1);
+}
+
+void test_fixed()
+{
+    testDiag("test_fixed");
+
+    FieldCreatePtr fieldCreate = getFieldCreate();
+    NTNDArrayPtr ntndArray = NTNDArray::createBuilder()->
+        add("roi", fieldCreate->createFixedScalarArray(pvInt, 4))->
+        add("after", fieldCreate->createScalar(pvInt))->
+        create();
+
+    PVIntArray::svector roi(4);
+    for (size_t i = 0; i < roi.size(); ++i)
+        roi[i] = static_cast<int32>(10*i);
+    ntndArray->getPVStructure()->getSubField<PVIntArray>("roi")->replace(freeze(roi));
+    ntndArray->getPVStructure()->getSubField<PVInt>("after")->put(77);
+
+    PVStructureArrayPtr attribute = ntndArray->getAttribute();
+    PVStructureArray::svector attrs(2);
+    for (size_t i = 0; i < attrs.size(); ++i)
+        attrs[i] = pvDataCreate->createPVStructure(attribute->getStructureArray()->getStructure());
+    attrs[0]->getSubField<PVString>("name")->put("Corners");
+    PVIntArrayPtr corners = std::tr1::static_pointer_cast<PVIntArray>(
+        pvDataCreate->createPVScalarArray(fieldCreate->createFixedScalarArray(pvInt, 2)));
+    PVIntArray::svector cornerValues(2, 5);
+    corners->replace(freeze(cornerValues));
+    attrs[0]->getSubField<PVUnion>("value")->set(corners);
+    attrs[1]->getSubField<PVString>("name")->put("Gain");
+    PVDoublePtr gain = pvDataCreate->createPVScalar<PVDouble>();
+    gain->put(2.5);
+    attrs[1]->getSubField<PVUnion>("value")->set(gain);
+    attribute->replace(freeze(attrs));
+
+    std::vector<epicsUInt8> bytes;
+    serializeToVector(ntndArray->getPVStructure().get(), EPICS_BYTE_ORDER, bytes);
+    NTNDArrayDecoderPtr decoder = NTNDArrayDecoder::create(ntndArray->getPVStructure()->getStructure());
+    decoder->scan(bytes);
+
+    testOk1(decoder->decode<PVInt>("after")->get() == 77);
+    PVIntArrayPtr decoded = decoder->decode<PVIntArray>("roi");
+    testOk1(decoded.get() != 0 && decoded->view().size() == 4 && decoded->view()[3] == 30);
+    PVStructurePtr gainAttribute = decoder->getAttribute("Gain");
+    testOk1(gainAttribute.get() != 0 &&
+        gainAttribute->getSubField<PVUnion>("value")->get<PVDouble>()->get() == 2.5);
+}
+
+void test_lazy()
+{
+    testDiag("test_lazy");
+
+    NTNDArrayPtr ntndArray = describedFrame(16, 16);
+    PVStructureArray::svector attrs(ntndArray->getAttribute()->reuse());
+    PVStructurePtr roi = pvDataCreate->createPVStructure(getFieldCreate()->createFieldBuilder()->
+        add("offset", pvInt)->
+        addArray("size", pvInt)->
+        createStructure());
+    roi->getSubField<PVInt>("offset")->put(8);
+    attrs[1] = pvDataCreate->createPVStructure(attrs[0]->getStructure());
+    attrs[1]->getSubField<PVString>("name")->put("ROI");
+    attrs[1]->getSubField<PVUnion>("value")->set(roi);
+    ntndArray->getAttribute()->replace(freeze(attrs));
+
+    std::vector<epicsUInt8> bytes;
+    serializeToVector(ntndArray->getPVStructure().get(), EPICS_BYTE_ORDER, bytes);
+    NTNDArrayDecoderPtr decoder = NTNDArrayDecoder::create(ntndArray->getPVStructure()->getStructure());
+    decoder->scan(bytes);
+
+    // the attribute values are skipped without decoding their introspection data
+    size_t before = allocations;
+    for (size_t i = 0; i < 10; ++i)
+        decoder->scan(bytes);
+    testOk(allocations == before, "scan() allocates nothing");
+
+    PVStructurePtr decoded = decoder->getAttribute("ROI");
+    testOk1(decoded.get() != 0 &&
+        decoded->getSubField<PVUnion>("value")->get<PVStructure>()->getSubField<PVInt>("offset")->get() == 8);
+    testOk1(decoder->getAttribute("Exposure").get() != 0);
+}
+
+void test_truncated()
+{
+    testDiag("test_truncated");
+
+    NTNDArrayPtr ntndArray = describedFrame(16, 16);
+    std::vector<epicsUInt8> bytes;
+    serializeToVector(ntndArray->getPVStructure().get(), EPICS_BYTE_ORDER, bytes);
+    bytes.resize(bytes.size() - 1);
+
+    NTNDArrayDecoderPtr decoder = NTNDArrayDecoder::create(ntndArray->getPVStructure()->getStructure());
+    try {
+        decoder->scan(bytes);
+        testFail("truncated buffer accepted");
+    } catch (std::runtime_error&) {
+        testPass("truncated buffer rejected");
+    }
+    testOk1(!decoder->hasValue());
+    testOk1(decoder->decode("uniqueId").get() == 0);
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    NTNDArrayPtr ntndArray = describedFrame(1024, 1024);
+    std::vector<epicsUInt8> bytes;
+    serializeToVector(ntndArray->getPVStructure().get(), EPICS_BYTE_ORDER, bytes);
+
+    const size_t iterations = 100;
+    PVStructurePtr pvStructure = pvDataCreate->createPVStructure(ntndArray->getPVStructure()->getStructure());
+
+    epicsTime begin(epicsTime::getCurrent());
+    for (size_t i = 0; i < iterations; ++i)
+        deserializeFromVector(pvStructure.get(), EPICS_BYTE_ORDER, bytes);
+    double fullTime = epicsTime::getCurrent() - begin;
+
+    NTNDArrayDecoderPtr decoder = NTNDArrayDecoder::create(pvStructure->getStructure());
+    int32 uniqueId = 0;
+    begin = epicsTime::getCurrent();
+    for (size_t i = 0; i < iterations; ++i) {
+        decoder->scan(bytes);
+        uniqueId += decoder->getUniqueId();
+        decoder->getDimension();
+        decoder->getAttribute("ColorMode");
+    }
+    double partialTime = epicsTime::getCurrent() - begin;
+
+    testDiag("1024x1024 uint16 frame: full deserialization %.1f us, metadata only %.1f us (%d)",
+             1e6*fullTime/iterations, 1e6*partialTime/iterations, uniqueId);
+}
+
+MAIN(testNTNDArrayDecoder) {
+    testPlan(44);
+    test_create();
+    test_decode(EPICS_ENDIAN_BIG);
+    test_decode(EPICS_ENDIAN_LITTLE);
+    test_fixed();
+    test_lazy();
+    test_truncated();
+    test_benchmark();
+    return testDone();
+}
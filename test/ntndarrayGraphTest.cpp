@@ -0,0 +1,324 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <stdexcept>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsEvent.h>
+#include <epicsGuard.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/ntndarrayGraph.h>
+
+#include "ndarrayTestFrame.h"
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+// passes frames on, recording their unique ids
+class RecordNode : public NTNDArrayNode
+{
+public:
+    RecordNode(std::string const & name, size_t queueSize = 16, double delay = 0) :
+        NTNDArrayNode(name, queueSize), delay(delay) {}
+
+    virtual NTNDArrayPtr process(NTNDArrayPtr const & frame, NTNDArrayBufferPoolPtr const &)
+    {
+        if (delay > 0)
+            epicsThreadSleep(delay);
+        int32 id = frame->getUniqueId()->get();
+        if (id < 0)
+            throw std::runtime_error("negative unique id");
+        epicsGuard<epicsMutex> G(mutex);
+        ids.push_back(id);
+        return frame;
+    }
+
+    std::vector<int32> getIds()
+    {
+        epicsGuard<epicsMutex> G(mutex);
+        return ids;
+    }
+
+private:
+    double delay;
+    epicsMutex mutex;
+    std::vector<int32> ids;
+};
+
+// replaces the value by a scaled copy from the pool
+class ScaleNode : public NTNDArrayNode
+{
+public:
+    explicit ScaleNode(std::string const & name) : NTNDArrayNode(name, 64) {}
+
+    virtual NTNDArrayPtr process(NTNDArrayPtr const & frame, NTNDArrayBufferPoolPtr const & pool)
+    {
+        PVUShortArray::const_svector in(frame->getValue()->get<PVUShortArray>()->view());
+        PVUShortArray::svector out(pool->allocate<uint16>(in.size()));
+        for (size_t i = 0; i < in.size(); ++i)
+            out[i] = static_cast<uint16>(in[i]*3 + 1);
+
+        NTNDArrayPtr output = NTNDArray::wrapUnsafe(
+            getPVDataCreate()->createPVStructure(frame->getPVStructure()));
+        output->getValue()->select<PVUShortArray>("ushortValue")->replace(freeze(out));
+        return output;
+    }
+};
+
+void test_pool()
+{
+    testDiag("test_pool");
+
+    NTNDArrayBufferPoolPtr pool = NTNDArrayBufferPool::create(2);
+    const void *data;
+    {
+        shared_vector<uint16> a(pool->allocate<uint16>(100));
+        data = a.data();
+        testOk1(a.size() == 100 && pool->getAllocated() == 1);
+    }
+    testOk1(pool->getFree() == 1);
+    {
+        shared_vector<uint16> b(pool->allocate<uint16>(100));
+        testOk(b.data() == data, "buffer reused");
+        shared_vector<double> c(pool->allocate<double>(100));
+        testOk1(pool->getReused() == 1 && pool->getAllocated() == 2);
+    }
+
+    // the pool outlives its arrays
+    shared_vector<int8> d(pool->allocate<int8>(10));
+    pool.reset();
+    d[9] = 1;
+    d.clear();
+    testPass("array released after the pool");
+}
+
+void test_topology()
+{
+    testDiag("test_topology");
+
+    NTNDArrayGraphPtr graph = NTNDArrayGraph::create(2);
+    NTNDArrayNodePtr a(new RecordNode("a")), b(new RecordNode("b")), c(new RecordNode("c"));
+    graph->connect(a, b);
+    graph->connect(b, c);
+    testOk1(graph->getNodes().size() == 3);
+
+    try {
+        graph->connect(c, a);
+        testFail("cycle accepted");
+    } catch (std::runtime_error&) {
+        testPass("cycle rejected");
+    }
+
+    NTNDArrayGraphPtr other = NTNDArrayGraph::create(1);
+    try {
+        other->addNode(a);
+        testFail("node added to two graphs");
+    } catch (std::runtime_error&) {
+        testPass("node of another graph rejected");
+    }
+    testOk1(graph->getThreadCount() == 2 && other->getThreadCount() == 1);
+}
+
+void test_flow()
+{
+    testDiag("test_flow");
+
+    NTNDArrayGraphPtr graph = NTNDArrayGraph::create(4);
+    std::tr1::shared_ptr<RecordNode> source(new RecordNode("source", 256));
+    std::tr1::shared_ptr<RecordNode> left(new RecordNode("left", 256));
+    std::tr1::shared_ptr<RecordNode> right(new RecordNode("right", 256));
+    std::tr1::shared_ptr<RecordNode> sink(new RecordNode("sink", 512));
+    graph->connect(source, left);
+    graph->connect(source, right);
+    graph->connect(left, sink);
+    graph->connect(right, sink);
+
+    for (int32 i = 0; i < 100; ++i)
+        graph->push(createFrame(i));
+    graph->push(createFrame(-1));
+    graph->waitIdle();
+
+    std::vector<int32> ids(left->getIds());
+    bool ordered = ids.size() == 100;
+    for (size_t i = 0; ordered && i < ids.size(); ++i)
+        ordered = ids[i] == int32(i);
+    testOk(ordered, "each node sees the frames in order");
+    testOk(sink->getIds().size() == 200, "fan-out and fan-in");
+    testOk1(source->getFrames() == 100 && source->getErrors() == 1);
+    testOk1(graph->getInFlight() == 0);
+    testOk1(sink->getMeanLatency() > 0 && sink->getMaxLatency() >= sink->getMeanLatency());
+    testOk1(source->getThroughput() > 0 && source->getMeanProcessTime() > 0);
+
+    source->resetStatistics();
+    testOk1(source->getFrames() == 0 && source->getErrors() == 0);
+}
+
+void test_backpressure()
+{
+    testDiag("test_backpressure");
+
+    NTNDArrayGraphPtr graph = NTNDArrayGraph::create(1, 4);
+    std::tr1::shared_ptr<RecordNode> slow(new RecordNode("slow", 16, 0.01));
+    graph->addNode(slow);
+
+    size_t pushed = 0;
+    for (int32 i = 0; i < 20; ++i)
+        pushed += graph->push(createFrame(i), false);
+    testOk(pushed < 20, "push without waiting fails at the limit");
+    testOk1(graph->getInFlight() <= 4);
+
+    for (int32 i = 0; i < 10; ++i)
+        graph->push(createFrame(i));
+    testOk(graph->getInFlight() <= 4, "push waits at the limit");
+    graph->waitIdle();
+    testOk1(slow->getFrames() == pushed + 10 && slow->getDropped() == 0);
+
+    // a node whose queue is full drops frames
+    NTNDArrayGraphPtr dropping = NTNDArrayGraph::create(1, 100);
+    std::tr1::shared_ptr<RecordNode> small(new RecordNode("small", 2, 0.01));
+    dropping->addNode(small);
+    for (int32 i = 0; i < 10; ++i)
+        dropping->push(createFrame(i));
+    dropping->waitIdle();
+    testOk1(small->getDropped() > 0 && small->getFrames() + small->getDropped() == 10);
+
+    // so does a node fed by another node, counted per connection
+    NTNDArrayGraphPtr internal = NTNDArrayGraph::create(2, 100);
+    std::tr1::shared_ptr<RecordNode> fast(new RecordNode("fast", 100));
+    std::tr1::shared_ptr<RecordNode> full(new RecordNode("full", 2, 0.01));
+    std::tr1::shared_ptr<RecordNode> roomy(new RecordNode("roomy", 100));
+    internal->connect(fast, full);
+    internal->connect(fast, roomy);
+    for (int32 i = 0; i < 10; ++i)
+        internal->push(createFrame(i));
+    internal->waitIdle();
+    testOk1(full->getDropped() > 0 && internal->getDropped(fast, full) == full->getDropped());
+    testOk1(internal->getDropped(fast, roomy) == 0 && internal->getDropped(full, fast) == 0);
+    fast->resetStatistics();
+    testOk1(internal->getDropped(fast, full) == 0);
+}
+
+// waits for a gate before passing frames on
+class GateNode : public NTNDArrayNode
+{
+public:
+    GateNode() : NTNDArrayNode("gate", 256) {}
+
+    virtual NTNDArrayPtr process(NTNDArrayPtr const & frame, NTNDArrayBufferPoolPtr const &)
+    {
+        gate.wait();
+        gate.signal();
+        return frame;
+    }
+
+    epicsEvent gate;
+};
+
+class Pusher : public epicsThreadRunable
+{
+public:
+    Pusher(NTNDArrayGraphPtr const & graph, epicsEvent & start) :
+        graph(graph), start(start), pushed(0),
+        thread(*this, "pusher", epicsThreadGetStackSize(epicsThreadStackSmall))
+    {
+        thread.start();
+    }
+
+    virtual void run()
+    {
+        start.wait();
+        start.signal();
+        for (int32 i = 0; i < 100; ++i)
+            pushed += graph->push(createFrame(i), false);
+    }
+
+    NTNDArrayGraphPtr graph;
+    epicsEvent & start;
+    size_t pushed;
+    epicsThread thread;
+};
+
+void test_concurrentPush()
+{
+    testDiag("test_concurrentPush");
+
+    NTNDArrayGraphPtr graph = NTNDArrayGraph::create(1, 8);
+    std::tr1::shared_ptr<GateNode> gate(new GateNode);
+    graph->addNode(gate);
+
+    epicsEvent start;
+    std::vector<Pusher*> pushers;
+    for (size_t i = 0; i < 8; ++i)
+        pushers.push_back(new Pusher(graph, start));
+    start.signal();
+
+    size_t pushed = 0;
+    for (size_t i = 0; i < pushers.size(); ++i) {
+        pushers[i]->thread.exitWait();
+        pushed += pushers[i]->pushed;
+        delete pushers[i];
+    }
+    testOk(pushed == 8 && graph->getInFlight() == 8,
+           "%u frames admitted by concurrent pushes", (unsigned)pushed);
+
+    gate->gate.signal();
+    graph->waitIdle();
+    testOk1(gate->getFrames() == 8 && gate->getDropped() == 0);
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    const int32 frames = 200;
+    const size_t count = 512*512;
+    std::vector<NTNDArrayPtr> input;
+    for (int32 i = 0; i < frames; ++i)
+        input.push_back(createFrame<PVUShortArray>(std::vector<size_t>(1, count),
+            std::vector<double>(count, 1), i));
+
+    NTNDArrayBufferPoolPtr pool = NTNDArrayBufferPool::create();
+    ScaleNode sequential("sequential");
+    epicsTime begin(epicsTime::getCurrent());
+    for (int32 i = 0; i < frames; ++i)
+        sequential.process(sequential.process(input[i], pool), pool);
+    double sequentialTime = epicsTime::getCurrent() - begin;
+
+    NTNDArrayGraphPtr graph = NTNDArrayGraph::create(0, 64);
+    NTNDArrayNodePtr first(new ScaleNode("first")), second(new ScaleNode("second"));
+    graph->connect(first, second);
+    begin = epicsTime::getCurrent();
+    for (int32 i = 0; i < frames; ++i)
+        graph->push(input[i]);
+    graph->waitIdle();
+    double graphTime = epicsTime::getCurrent() - begin;
+
+    testOk1(second->getFrames() == size_t(frames));
+    testDiag("two 512x512 uint16 scaling nodes, %u threads: sequential %.1f us,"
+             " graph %.1f us per frame; second node latency %.1f us, %.0f frames/s;"
+             " %u buffers allocated, %u reused",
+             (unsigned)graph->getThreadCount(),
+             sequentialTime/frames*1e6, graphTime/frames*1e6,
+             second->getMeanLatency()*1e6, second->getThroughput(),
+             (unsigned)graph->getBufferPool()->getAllocated(),
+             (unsigned)graph->getBufferPool()->getReused());
+}
+
+MAIN(testNTNDArrayGraph) {
+    testPlan(27);
+    test_pool();
+    test_topology();
+    test_flow();
+    test_backpressure();
+    test_concurrentPush();
+    test_benchmark();
+    return testDone();
+}
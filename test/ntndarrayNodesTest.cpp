@@ -0,0 +1,148 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include <pv/nt.h>
+#include <pv/ntndarrayNodes.h>
+
+#include "ndarrayTestFrame.h"
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+// a frame of x by y pixels whose value is 100*row + column, offset by 5 rows
+static NTNDArrayPtr rampFrame(size_t x, size_t y)
+{
+    std::vector<double> pixels(x*y);
+    for (size_t row = 0; row < y; ++row)
+        for (size_t column = 0; column < x; ++column)
+            pixels[row*x + column] = static_cast<double>(100*row + column);
+    NTNDArrayPtr ntndArray = createFrame<PVUShortArray>(frameSizes(x, y), pixels, 7);
+    ntndArray->getDimension()->view()[1]->getSubField<PVInt>("offset")->put(5);
+    return ntndArray;
+}
+
+void test_roi()
+{
+    testDiag("test_roi");
+
+    NTNDArrayBufferPoolPtr pool = NTNDArrayBufferPool::create();
+    NTNDArrayPtr frame = rampFrame(10, 8);
+
+    std::vector<size_t> offset(2), size(2);
+    offset[0] = 2; size[0] = 3;
+    offset[1] = 4; size[1] = 10;
+    NTNDArrayROINode roi("roi", offset, size);
+    NTNDArrayPtr output = roi.process(frame, pool);
+
+    PVUShortArray::const_svector pixels(output->getValue()->get<PVUShortArray>()->view());
+    testOk1(pixels.size() == 3*4);
+    testOk1(pixels[0] == 402 && pixels[2] == 404 && pixels[3] == 502 && pixels[11] == 704);
+    testOk1(dimensionField(output, 0, "size") == 3 && dimensionField(output, 1, "size") == 4);
+    testOk(dimensionField(output, 0, "offset") == 2 && dimensionField(output, 1, "offset") == 9,
+           "offsets accumulate");
+    testOk1(dimensionField(output, 0, "fullSize") == 10);
+    testOk1(output->getUniqueId()->get() == 7);
+    testOk1(output->getUncompressedDataSize()->get() == 3*4*2);
+
+    testOk(dimensionField(frame, 0, "size") == 10 &&
+           frame->getValue()->get<PVUShortArray>()->view().size() == 80,
+           "input frame unchanged");
+
+    std::vector<size_t> outside(1, 20);
+    NTNDArrayROINode empty("empty", outside, std::vector<size_t>());
+    testOk(!empty.process(frame, pool), "region outside the frame passes nothing on");
+
+    NTNDArrayROINode whole("whole", std::vector<size_t>(), std::vector<size_t>());
+    testOk1(*whole.process(frame, pool)->getValue() == *frame->getValue());
+}
+
+void test_convert()
+{
+    testDiag("test_convert");
+
+    NTNDArrayBufferPoolPtr pool = NTNDArrayBufferPool::create();
+    NTNDArrayPtr frame = rampFrame(4, 2);
+
+    NTNDArrayConvertNode toDouble("toDouble", pvDouble);
+    NTNDArrayPtr output = toDouble.process(frame, pool);
+    PVDoubleArrayPtr value = output->getValue()->get<PVDoubleArray>();
+    testOk1(value && value->view().size() == 8 && value->view()[5] == 101.0);
+    testOk1(output->getUncompressedDataSize()->get() == 8*8);
+
+    NTNDArrayConvertNode toByte("toByte", pvByte);
+    PVByteArrayPtr bytes = toByte.process(output, pool)->getValue()->get<PVByteArray>();
+    testOk1(bytes && bytes->view()[7] == int8(103));
+
+    NTNDArrayConvertNode same("same", pvUShort);
+    testOk(same.process(frame, pool) == frame, "frame of the target type passed on unchanged");
+
+    try {
+        NTNDArrayConvertNode("string", pvString);
+        testFail("conversion to string accepted");
+    } catch (std::runtime_error&) {
+        testPass("conversion to string rejected");
+    }
+}
+
+void test_statistics()
+{
+    testDiag("test_statistics");
+
+    NTNDArrayBufferPoolPtr pool = NTNDArrayBufferPool::create();
+    NTNDArrayPtr frame = rampFrame(4, 2);
+    NTNDArrayStatisticsNode stats("stats");
+    testOk(stats.process(frame, pool) == frame, "frame passed on unchanged");
+
+    NTNDArrayStatistics s = stats.getStatistics();
+    testOk1(s.count == 8 && s.min == 0 && s.max == 103);
+    testOk1(s.total == 412 && s.mean == 51.5);
+    testOk1(std::fabs(s.sigma - std::sqrt(2501.25)) < 1e-9);
+}
+
+void test_codec()
+{
+    testDiag("test_codec");
+
+    NTNDArrayBufferPoolPtr pool = NTNDArrayBufferPool::create();
+    NTNDArrayPtr frame = rampFrame(4, 2);
+    frame->getCodec()->getSubField<PVString>("name")->put("lz4");
+
+    std::vector<size_t> offset(2, 1), size(2, 1);
+    NTNDArrayROINode roi("roi", offset, size);
+    try {
+        roi.process(frame, pool);
+        testFail("compressed frame cropped");
+    } catch (std::runtime_error&) {
+        testPass("compressed frame rejected by the ROI node");
+    }
+
+    NTNDArrayConvertNode toDouble("toDouble", pvDouble);
+    try {
+        toDouble.process(frame, pool);
+        testFail("compressed frame converted");
+    } catch (std::runtime_error&) {
+        testPass("compressed frame rejected by the convert node");
+    }
+
+    NTNDArrayStatisticsNode stats("stats");
+    testOk(stats.process(frame, pool) == frame, "compressed frame passed on");
+    testOk1(stats.getStatistics().count == 0);
+}
+
+MAIN(testNTNDArrayNodes) {
+    testPlan(23);
+    test_roi();
+    test_convert();
+    test_statistics();
+    test_codec();
+    return testDone();
+}
@@ -0,0 +1,256 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/ntndarrayPyramid.h>
+
+#include "ndarrayTestFrame.h"
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+// the box filtered level of a frame of width x height pixels of some channels
+static std::vector<double> expected(std::vector<double> const & values, size_t width,
+    size_t height, size_t channels, size_t factor, bool round)
+{
+    std::vector<double> result;
+    for (size_t y = 0; y < height/factor; ++y)
+        for (size_t x = 0; x < width/factor; ++x)
+            for (size_t c = 0; c < channels; ++c) {
+                double sum = 0;
+                for (size_t j = 0; j < factor; ++j)
+                    for (size_t i = 0; i < factor; ++i)
+                        sum += values[((y*factor + j)*width + x*factor + i)*channels + c];
+                sum /= factor*factor;
+                result.push_back(round ? floor(sum + 0.5) : sum);
+            }
+    return result;
+}
+
+template<typename PVT>
+static bool sameValues(NTNDArrayPtr const & frame, std::vector<double> const & values)
+{
+    typename PVT::const_svector data(frame->getValue()->get<PVT>()->view());
+    if (data.size() != values.size())
+        return false;
+    for (size_t i = 0; i < data.size(); ++i)
+        if (data[i] != values[i])
+            return false;
+    return true;
+}
+
+void test_levels()
+{
+    testDiag("test_levels");
+
+    std::vector<double> values;
+    for (size_t i = 0; i < 20*12; ++i)
+        values.push_back(static_cast<double>((i*7919) % 1000));
+    NTNDArrayPtr frame = createFrame<PVUShortArray>(frameSizes(20, 12), values, 3);
+
+    NTNDArrayPyramidPtr pyramid = NTNDArrayPyramid::create();
+    testOk1(pyramid->getLevelCount() == 3);
+    std::vector<NTNDArrayPtr> levels(pyramid->generate(frame));
+    testOk1(levels.size() == 3 && !levels[0] && !levels[1] && !levels[2]);
+
+    pyramid->subscribe(1);
+    pyramid->subscribe(3);
+    levels = pyramid->generate(frame);
+    testOk1(levels[0] && !levels[1] && levels[2]);
+    testOk1(sameValues<PVUShortArray>(levels[0], expected(values, 20, 12, 1, 2, true)));
+    testOk1(sameValues<PVUShortArray>(levels[2], expected(values, 20, 12, 1, 8, true)));
+    testOk1(dimensionField(levels[0], 0, "size") == 10 && dimensionField(levels[0], 1, "size") == 6);
+    testOk1(dimensionField(levels[2], 0, "size") == 2 && dimensionField(levels[2], 1, "size") == 1);
+    testOk1(dimensionField(levels[2], 0, "binning") == 8 && dimensionField(levels[2], 1, "binning") == 8);
+    testOk1(dimensionField(levels[2], 0, "fullSize") == 20 && dimensionField(levels[2], 1, "fullSize") == 12);
+    testOk1(levels[2]->getUniqueId()->get() == 3);
+    testOk1(dimensionField(frame, 0, "size") == 20 && dimensionField(frame, 0, "binning") == 1);
+
+    pyramid->subscribe(2);
+    levels = pyramid->generate(frame);
+    testOk1(sameValues<PVUShortArray>(levels[1], expected(values, 20, 12, 1, 4, true)));
+
+    // levels smaller than one element are not generated
+    levels = pyramid->generate(createFrame<PVUShortArray>(frameSizes(20, 6),
+        std::vector<double>(values.begin(), values.begin() + 20*6), 3));
+    testOk1(levels[0] && levels[1] && !levels[2]);
+
+    std::vector<double> real;
+    for (size_t i = 0; i < 16*16; ++i)
+        real.push_back(i*0.25 - 3);
+    levels = pyramid->generate(createFrame<PVDoubleArray>(frameSizes(16, 16), real, 3));
+    testOk1(sameValues<PVDoubleArray>(levels[0], expected(real, 16, 16, 1, 2, false)));
+    testOk1(sameValues<PVDoubleArray>(levels[2], expected(real, 16, 16, 1, 8, false)));
+
+    std::vector<double> negative;
+    for (size_t i = 0; i < 8*4; ++i)
+        negative.push_back(static_cast<double>(i % 5) - 2);
+    levels = pyramid->generate(createFrame<PVByteArray>(frameSizes(8, 4), negative, 3));
+    testOk1(sameValues<PVByteArray>(levels[0], expected(negative, 8, 4, 1, 2, true)));
+
+    // 32 bit sums need 64 bits
+    std::vector<double> wide, unsignedWide;
+    for (size_t i = 0; i < 16*8; ++i) {
+        wide.push_back((static_cast<double>(i % 5) - 2)*1000000007);
+        unsignedWide.push_back(4294967295.0 - static_cast<double>((i*7919) % 1000));
+    }
+    levels = pyramid->generate(createFrame<PVIntArray>(frameSizes(16, 8), wide, 3));
+    testOk1(sameValues<PVIntArray>(levels[0], expected(wide, 16, 8, 1, 2, true)) &&
+            sameValues<PVIntArray>(levels[2], expected(wide, 16, 8, 1, 8, true)));
+    levels = pyramid->generate(createFrame<PVUIntArray>(frameSizes(16, 8), unsignedWide, 3));
+    testOk1(sameValues<PVUIntArray>(levels[1], expected(unsignedWide, 16, 8, 1, 4, true)));
+}
+
+void test_rgb()
+{
+    testDiag("test_rgb");
+
+    std::vector<double> values;
+    for (size_t i = 0; i < 3*8*4; ++i)
+        values.push_back(static_cast<double>((i*37) % 256));
+    NTNDArrayPtr frame = createFrame<PVUByteArray>(frameSizes(3, 8, 4), values, 3);
+
+    NTNDArrayPyramidPtr pyramid = NTNDArrayPyramid::create(2);
+    pyramid->subscribe(1);
+    pyramid->subscribe(2);
+    std::vector<NTNDArrayPtr> levels(pyramid->generate(frame));
+    testOk1(sameValues<PVUByteArray>(levels[0], expected(values, 8, 4, 3, 2, true)));
+    testOk1(sameValues<PVUByteArray>(levels[1], expected(values, 8, 4, 3, 4, true)));
+    testOk1(dimensionField(levels[1], 0, "size") == 3 && dimensionField(levels[1], 1, "size") == 2 &&
+            dimensionField(levels[1], 2, "size") == 1);
+    testOk1(dimensionField(levels[1], 0, "binning") == 1 && dimensionField(levels[1], 1, "binning") == 4);
+
+    try {
+        pyramid->generate(createFrame<PVUByteArray>(frameSizes(8, 3, 4), values, 3));
+        testFail("RGB2 frame not rejected");
+    } catch (std::runtime_error &) {
+        testPass("RGB2 frame rejected");
+    }
+    try {
+        pyramid->generate(createFrame<PVUByteArray>(std::vector<size_t>(1, 96), values, 3));
+        testFail("one dimensional frame not rejected");
+    } catch (std::runtime_error &) {
+        testPass("one dimensional frame rejected");
+    }
+    try {
+        pyramid->subscribe(3);
+        testFail("level 3 of 2 not rejected");
+    } catch (std::runtime_error &) {
+        testPass("level 3 of 2 rejected");
+    }
+    try {
+        NTNDArrayPyramid::create(0);
+        testFail("no levels not rejected");
+    } catch (std::runtime_error &) {
+        testPass("no levels rejected");
+    }
+}
+
+void test_tiled()
+{
+    testDiag("test_tiled");
+
+    std::vector<double> values;
+    for (size_t i = 0; i < 300*203; ++i)
+        values.push_back(static_cast<double>((i*7919) % 4096));
+    NTNDArrayPtr frame = createFrame<PVUShortArray>(frameSizes(300, 203), values, 3);
+
+    NTNDArrayPyramidPtr pyramid = NTNDArrayPyramid::create(3, NTNDArrayTiler::create(3, 4096));
+    pyramid->subscribe(1);
+    pyramid->subscribe(2);
+    pyramid->subscribe(3);
+    std::vector<NTNDArrayPtr> levels(pyramid->generate(frame));
+    testOk1(sameValues<PVUShortArray>(levels[0], expected(values, 300, 203, 1, 2, true)));
+    testOk1(sameValues<PVUShortArray>(levels[1], expected(values, 300, 203, 1, 4, true)));
+    testOk1(sameValues<PVUShortArray>(levels[2], expected(values, 300, 203, 1, 8, true)));
+}
+
+void test_node()
+{
+    testDiag("test_node");
+
+    std::vector<double> values(64*64, 10);
+    NTNDArrayPtr frame = createFrame<PVUShortArray>(frameSizes(64, 64), values, 3);
+    NTNDArrayPyramidPtr pyramid = NTNDArrayPyramid::create();
+
+    {
+        NTNDArrayPyramidNode fine("fine", pyramid, 1);
+        NTNDArrayPyramidNode coarse("coarse", pyramid, 3);
+        testOk1(pyramid->getSubscribers(1) == 1 && pyramid->getSubscribers(2) == 0 &&
+                pyramid->getSubscribers(3) == 1);
+
+        NTNDArrayPtr fineLevel = fine.process(frame, NTNDArrayBufferPoolPtr());
+        NTNDArrayPtr coarseLevel = coarse.process(frame, NTNDArrayBufferPoolPtr());
+        testOk1(fineLevel && dimensionField(fineLevel, 0, "size") == 32);
+        testOk1(coarseLevel && dimensionField(coarseLevel, 0, "size") == 8);
+        // the levels of a frame are generated once
+        testOk1(pyramid->getLevel(frame, 1) == fineLevel);
+        testOk1(!pyramid->getLevel(frame, 2));
+        testOk1(fine.process(createFrame<PVUShortArray>(frameSizes(64, 64), values, 3),
+            NTNDArrayBufferPoolPtr()) != fineLevel);
+    }
+    testOk1(pyramid->getSubscribers(1) == 0 && pyramid->getSubscribers(3) == 0);
+}
+
+// the fastest of the generations, which is what a dedicated core reaches
+static double generateTime(NTNDArrayPyramidPtr const & pyramid, NTNDArrayPtr const & frame,
+    NTNDArrayBufferPoolPtr const & pool, std::vector<NTNDArrayPtr> & levels)
+{
+    double elapsed = 1e9;
+    for (int i = 0; i < 10; ++i) {
+        levels.clear();
+        epicsTime begin(epicsTime::getCurrent());
+        levels = pyramid->generate(frame, pool);
+        elapsed = std::min(elapsed, epicsTime::getCurrent() - begin);
+    }
+    return elapsed;
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    std::vector<double> values;
+    for (size_t i = 0; i < 4096; ++i)
+        values.push_back(static_cast<double>(i));
+    std::vector<double> pixels(2048*2048);
+    for (size_t i = 0; i < pixels.size(); ++i)
+        pixels[i] = values[i % values.size()];
+    NTNDArrayPtr frame = createFrame<PVUShortArray>(frameSizes(2048, 2048), pixels, 3);
+
+    NTNDArrayBufferPoolPtr pool = NTNDArrayBufferPool::create();
+    NTNDArrayPyramidPtr pyramid = NTNDArrayPyramid::create();
+    pyramid->subscribe(3);
+    std::vector<NTNDArrayPtr> levels(pyramid->generate(frame, pool));
+
+    double coarseElapsed = generateTime(pyramid, frame, pool, levels);
+    pyramid->subscribe(1);
+    pyramid->subscribe(2);
+    double elapsed = generateTime(pyramid, frame, pool, levels);
+
+    testOk1(levels[2] && dimensionField(levels[2], 0, "size") == 256);
+    testDiag("2048x2048 uint16 8x level in %.2f ms, 2x, 4x and 8x levels in %.2f ms, %.0f Mpixel/s",
+             coarseElapsed*1e3, elapsed*1e3, 2048*2048/elapsed/1e6);
+    testOk(elapsed <= 5e-3, "uint16 levels generated at %.0f Mpixel/s", 2048*2048/elapsed/1e6);
+}
+
+MAIN(testNTNDArrayPyramid) {
+    testPlan(38);
+    test_levels();
+    test_rgb();
+    test_tiled();
+    test_node();
+    test_benchmark();
+    return testDone();
+}
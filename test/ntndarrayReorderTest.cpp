@@ -0,0 +1,270 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <stdexcept>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/ntndarrayReorder.h>
+
+#include "ndarrayTestFrame.h"
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+static bool releasedIds(std::vector<NTNDArrayPtr> const & released, int32 first, int32 last)
+{
+    if (released.size() != static_cast<size_t>(last - first + 1))
+        return false;
+    for (size_t i = 0; i < released.size(); ++i)
+        if (released[i]->getUniqueId()->get() != first + static_cast<int32>(i))
+            return false;
+    return true;
+}
+
+void test_order()
+{
+    testDiag("test_order");
+
+    NTNDArrayReorderPtr reorder = NTNDArrayReorder::create(8, 10);
+    std::vector<NTNDArrayPtr> released;
+
+    NTNDArrayPtr first = createFrame(10);
+    reorder->push(first, released);
+    testOk1(released.empty() && reorder->getPending() == 1);
+    reorder->flush(released);
+    testOk1(released.size() == 1 && released[0] == first);
+    testOk1(reorder->getNext() == 11);
+
+    released.clear();
+    reorder->push(createFrame(13), released);
+    reorder->push(createFrame(12), released);
+    testOk1(released.empty() && reorder->getPending() == 2);
+    reorder->push(createFrame(11), released);
+    testOk1(releasedIds(released, 11, 13));
+    testOk1(reorder->getPending() == 0 && reorder->getNext() == 14);
+
+    released.clear();
+    reorder->push(createFrame(15), released);
+    reorder->push(createFrame(15), released);
+    reorder->push(createFrame(12), released);
+    testOk1(released.empty());
+    testOk1(reorder->getDuplicates() == 1 && reorder->getLate() == 1);
+    reorder->push(createFrame(14), released);
+    testOk1(releasedIds(released, 14, 15));
+    testOk1(reorder->getGaps() == 0 && reorder->getReleased() == 6);
+}
+
+void test_window()
+{
+    testDiag("test_window");
+
+    NTNDArrayReorderPtr reorder = NTNDArrayReorder::create(4, 10);
+    std::vector<NTNDArrayPtr> released;
+
+    reorder->push(createFrame(19), released);
+    reorder->flush(released);
+    released.clear();
+    reorder->push(createFrame(21), released);
+    reorder->push(createFrame(22), released);
+    testOk1(released.empty());
+
+    // 25 is beyond the window of 20 to 23, 20 is skipped to make room
+    reorder->push(createFrame(25), released);
+    testOk1(releasedIds(released, 21, 22));
+    testOk1(reorder->getGaps() == 1 && reorder->getNext() == 23 && reorder->getPending() == 1);
+
+    released.clear();
+    reorder->flush(released);
+    testOk1(releasedIds(released, 25, 25));
+    testOk1(reorder->getGaps() == 3 && reorder->getNext() == 26);
+
+    // with nothing held, a frame far ahead starts over
+    released.clear();
+    reorder->push(createFrame(1000), released);
+    testOk1(releasedIds(released, 1000, 1000));
+    testOk1(reorder->getGaps() == 977);
+
+    reorder->reset();
+    testOk1(reorder->getGaps() == 0 && reorder->getNext() == 0 && reorder->getReleased() == 0);
+    released.clear();
+    reorder->push(createFrame(5), released);
+    reorder->flush(released);
+    testOk1(releasedIds(released, 5, 5));
+
+    try {
+        NTNDArrayReorder::create(0);
+        testFail("window 0 not rejected");
+    } catch (std::runtime_error &) {
+        testPass("window 0 rejected");
+    }
+}
+
+void test_timeout()
+{
+    testDiag("test_timeout");
+
+    NTNDArrayReorderPtr reorder = NTNDArrayReorder::create(16, 0.05);
+    std::vector<NTNDArrayPtr> released;
+
+    reorder->push(createFrame(1), released);
+    reorder->flush(released);
+    released.clear();
+    reorder->push(createFrame(4), released);
+    reorder->push(createFrame(6), released);
+    reorder->poll(released);
+    testOk1(released.empty());
+
+    epicsThreadSleep(0.1);
+    reorder->poll(released);
+    testOk1(releasedIds(released, 4, 4));
+    testOk1(reorder->getGaps() == 2 && reorder->getPending() == 1);
+
+    // 6 waits for 5 from the release of 4 on
+    released.clear();
+    reorder->poll(released);
+    testOk1(released.empty());
+    epicsThreadSleep(0.1);
+    reorder->poll(released);
+    testOk1(releasedIds(released, 6, 6));
+    testOk1(reorder->getGaps() == 3 && reorder->getPending() == 0);
+}
+
+void test_wrap()
+{
+    testDiag("test_wrap");
+
+    NTNDArrayReorderPtr reorder = NTNDArrayReorder::create(5, 10);
+    std::vector<NTNDArrayPtr> released;
+
+    int32 last = 0x7fffffff;
+    reorder->push(createFrame(last - 1), released);
+    reorder->push(createFrame(last + 2), released);
+    reorder->push(createFrame(last + 1), released);
+    reorder->push(createFrame(last), released);
+    reorder->flush(released);
+    testOk1(released.size() == 4 &&
+            released[0]->getUniqueId()->get() == last - 1 &&
+            released[1]->getUniqueId()->get() == last &&
+            released[2]->getUniqueId()->get() == last + 1 &&
+            released[3]->getUniqueId()->get() == last + 2);
+    testOk1(reorder->getGaps() == 0 && reorder->getLate() == 0);
+}
+
+void test_start()
+{
+    testDiag("test_start");
+
+    NTNDArrayReorderPtr reorder = NTNDArrayReorder::create(4, 0.05);
+    std::vector<NTNDArrayPtr> released;
+
+    // producer threads push the first frames out of order
+    reorder->push(createFrame(5), released);
+    reorder->push(createFrame(4), released);
+    reorder->push(createFrame(6), released);
+    testOk1(released.empty() && reorder->getNext() == 4);
+    reorder->push(createFrame(1), released);
+    testOk(reorder->getLate() == 1, "frame before the window is late");
+
+    epicsThreadSleep(0.1);
+    reorder->poll(released);
+    testOk1(releasedIds(released, 4, 6));
+    testOk1(reorder->getGaps() == 0 && reorder->getPending() == 0);
+
+    // once started, frames are released as they complete the order
+    released.clear();
+    reorder->push(createFrame(7), released);
+    testOk1(releasedIds(released, 7, 7));
+
+    // a frame far ahead ends the wait for the first frames
+    reorder->reset();
+    released.clear();
+    reorder->push(createFrame(11), released);
+    reorder->push(createFrame(10), released);
+    reorder->push(createFrame(14), released);
+    testOk1(releasedIds(released, 10, 11) && reorder->getNext() == 12);
+}
+
+void test_restart()
+{
+    testDiag("test_restart");
+
+    NTNDArrayReorderPtr reorder = NTNDArrayReorder::create(4, 10);
+    std::vector<NTNDArrayPtr> released;
+
+    reorder->push(createFrame(100), released);
+    reorder->flush(released);
+    reorder->push(createFrame(101), released);
+    reorder->push(createFrame(103), released);
+    released.clear();
+
+    // the acquisition restarts from 1, the frame held is released first
+    reorder->push(createFrame(1), released);
+    reorder->push(createFrame(2), released);
+    testOk1(released.size() == 3 &&
+            released[0]->getUniqueId()->get() == 103 &&
+            released[1]->getUniqueId()->get() == 1 &&
+            released[2]->getUniqueId()->get() == 2);
+    testOk1(reorder->getRestarts() == 1 && reorder->getLate() == 0);
+    testOk1(reorder->getGaps() == 1 && reorder->getNext() == 3);
+
+    // frames behind by less than the window are still late
+    reorder->push(createFrame(0), released);
+    testOk1(reorder->getLate() == 1 && reorder->getRestarts() == 1);
+
+    reorder->reset();
+    testOk1(reorder->getRestarts() == 0);
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    std::vector<NTNDArrayPtr> frames;
+    for (int32 i = 0; i < 64; ++i)
+        frames.push_back(createFrame(i));
+
+    NTNDArrayReorderPtr reorder = NTNDArrayReorder::create(64);
+    std::vector<NTNDArrayPtr> released;
+    released.reserve(64);
+    reorder->push(createFrame(-1), released);
+    reorder->flush(released);
+    released.clear();
+
+    // pairs of frames swapped
+    const int count = 1000000;
+    size_t total = 0;
+    epicsTime begin(epicsTime::getCurrent());
+    for (int i = 0; i < count; ++i) {
+        int32 uniqueId = i ^ 1;
+        NTNDArrayPtr const & frame = frames[uniqueId % 64];
+        frame->getUniqueId()->put(uniqueId);
+        reorder->push(frame, released);
+        total += released.size();
+        released.clear();
+    }
+    double elapsed = epicsTime::getCurrent() - begin;
+
+    testOk1(total == count && reorder->getGaps() == 0);
+    testDiag("%d frames reordered in %.2f ms, %.0f ns per frame",
+             count, elapsed*1e3, elapsed/count*1e9);
+}
+
+MAIN(testNTNDArrayReorder) {
+    testPlan(40);
+    test_order();
+    test_window();
+    test_timeout();
+    test_wrap();
+    test_start();
+    test_restart();
+    test_benchmark();
+    return testDone();
+}
@@ -0,0 +1,375 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsStdio.h>
+#include <epicsTime.h>
+#include <epicsThread.h>
+
+#include <pv/serialize.h>
+
+#include <pv/nt.h>
+#include <pv/ntndarrayShm.h>
+
+#include "ndarrayTestFrame.h"
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+static PVDataCreatePtr pvDataCreate = getPVDataCreate();
+
+static std::string ringName()
+{
+    char name[64];
+    epicsSnprintf(name, sizeof(name), "/ntndarrayShmTest.%d", (int)getpid());
+    return name;
+}
+
+// a 64 by 64 frame with a timeStamp and a ColorMode attribute, without pixels
+static NTNDArrayPtr ringFrame(int32 uniqueId)
+{
+    NTNDArrayPtr ntndArray = createFrame<PVUShortArray>(frameSizes(64, 64),
+        std::vector<double>(), uniqueId, NTNDArray::createBuilder()->addTimeStamp());
+
+    PVStructureArrayPtr attribute = ntndArray->getAttribute();
+    PVStructureArray::svector attrs(1);
+    attrs[0] = pvDataCreate->createPVStructure(attribute->getStructureArray()->getStructure());
+    attrs[0]->getSubField<PVString>("name")->put("ColorMode");
+    PVIntPtr colorMode = pvDataCreate->createPVScalar<PVInt>();
+    colorMode->put(0);
+    attrs[0]->getSubField<PVUnion>("value")->set(colorMode);
+    attribute->replace(freeze(attrs));
+
+    ntndArray->getCodec()->getSubField<PVString>("name")->put("");
+    return ntndArray;
+}
+
+static void setPixels(NTNDArrayPtr const & frame, PVUShortArray::svector & pixels)
+{
+    int32 uniqueId = frame->getUniqueId()->get();
+    for (size_t i = 0; i < pixels.size(); ++i)
+        pixels[i] = static_cast<uint16>(i + uniqueId);
+    frame->getValue()->select<PVUShortArray>("ushortValue")->replace(freeze(pixels));
+}
+
+void test_open()
+{
+    testDiag("test_open");
+
+    try {
+        NTNDArrayShmRing::open(ringName());
+        testFail("opened a ring that does not exist");
+    } catch (std::runtime_error&) {
+        testPass("no ring to open");
+    }
+
+    // a segment that the producer has not finished creating
+    std::string segment(ringName());
+    int fd = shm_open(segment.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd >= 0) {
+        if (ftruncate(fd, 1024*1024) != 0)
+            testDiag("ftruncate failed");
+        close(fd);
+    }
+    try {
+        NTNDArrayShmRing::open(segment);
+        testFail("opened a ring that is not ready");
+    } catch (std::runtime_error&) {
+        testPass("ring that is not ready not opened");
+    }
+
+    // an existing segment is only replaced on request
+    try {
+        NTNDArrayShmRing::create(segment, 4, 64*64*2);
+        testFail("replaced an existing segment");
+    } catch (std::runtime_error&) {
+        testPass("existing segment not replaced");
+    }
+
+    NTNDArrayShmRingPtr producer = NTNDArrayShmRing::create(segment, 4, 64*64*2, 65536, true);
+    NTNDArrayShmRingPtr consumer = NTNDArrayShmRing::create(ringName(), 4, 64*64*2);
+    NTNDArrayShmRingPtr consumer = NTNDArrayShmRing::open(ringName());
+    testOk1(consumer->getSlotCount() == 4);
+    testOk1(consumer->getSlotSize() == 64*64*2);
+    testOk1(consumer->getLastSequence() == 0);
+    testOk1(consumer->next().get() == 0);
+
+    try {
+        consumer->allocate<uint16>(16);
+        testFail("consumer allocated a frame");
+    } catch (std::runtime_error&) {
+        testPass("consumer cannot allocate");
+    }
+}
+
+void test_inplace()
+{
+    testDiag("test_inplace");
+
+    NTNDArrayShmRingPtr producer = NTNDArrayShmRing::create(ringName(), 4, 64*64*2);
+    NTNDArrayShmRingPtr consumer = NTNDArrayShmRing::open(ringName());
+
+    NTNDArrayPtr frame = ringFrame(1);
+    PVUShortArray::svector pixels(producer->allocate<uint16>(64*64));
+    testOk1(pixels.size() == 64*64);
+    uint16 *producerPixels = pixels.data();
+    setPixels(frame, pixels);
+
+    testOk1(producer->publish(frame));
+    testOk1(consumer->getLastSequence() == 1);
+
+    NTNDArrayPtr received = consumer->next();
+    testOk1(received.get() != 0);
+    if (!received) {
+        testSkip(4, "no frame received");
+        return;
+    }
+    testOk1(*received->getPVStructure() == *frame->getPVStructure());
+
+    // the consumer maps the array the producer filled
+    const uint16 *consumerPixels =
+        received->getValue()->get<PVUShortArray>()->view().data();
+    testOk1(consumerPixels != producerPixels);
+    producerPixels[0] = 4321;
+    testOk1(consumerPixels[0] == 4321);
+
+    testOk1(consumer->next().get() == 0);
+}
+
+void test_copy()
+{
+    testDiag("test_copy");
+
+    NTNDArrayShmRingPtr producer = NTNDArrayShmRing::create(ringName(), 4, 64*64*2);
+    NTNDArrayShmRingPtr consumer = NTNDArrayShmRing::open(ringName());
+
+    NTNDArrayPtr frame = ringFrame(2);
+    PVUShortArray::svector pixels(64*64);
+    setPixels(frame, pixels);
+
+    testOk1(producer->publish(frame));
+    NTNDArrayPtr received = consumer->next();
+    testOk1(received.get() != 0 && *received->getPVStructure() == *frame->getPVStructure());
+
+    NTNDArrayPtr empty = ringFrame(3);
+    testOk1(producer->publish(empty));
+    received = consumer->next();
+    testOk1(received.get() != 0 && received->getValue()->getSelectedIndex() == PVUnion::UNDEFINED_INDEX);
+
+    PVUShortArray::svector tooLarge(64*64 + 1);
+    frame->getValue()->select<PVUShortArray>("ushortValue")->replace(freeze(tooLarge));
+    try {
+        producer->publish(frame);
+        testFail("published a frame exceeding the slot size");
+    } catch (std::runtime_error&) {
+        testPass("frame exceeding the slot size rejected");
+    }
+}
+
+void test_references()
+{
+    testDiag("test_references");
+
+    NTNDArrayShmRingPtr producer = NTNDArrayShmRing::create(ringName(), 4, 64*64*2);
+    NTNDArrayShmRingPtr consumer = NTNDArrayShmRing::open(ringName());
+
+    NTNDArrayPtr frame = ringFrame(4);
+    PVUShortArray::svector pixels(64*64);
+    setPixels(frame, pixels);
+
+    std::vector<NTNDArrayPtr> held;
+    for (size_t i = 0; i < 4; ++i) {
+        producer->publish(frame);
+        held.push_back(consumer->next());
+    }
+    testOk1(held.back().get() != 0);
+
+    testOk1(producer->allocate<uint16>(16).empty());
+    testOk1(!producer->publish(frame));
+
+    held.pop_back();
+    testOk1(producer->publish(frame));
+    testOk1(*held[0]->getPVStructure() == *frame->getPVStructure());
+
+    // frames replaced before they were read are skipped: the one
+    // published above and two of the following ones
+    held.clear();
+    for (size_t i = 0; i < 6; ++i)
+        producer->publish(frame);
+    size_t missed = consumer->getMissed();
+    NTNDArrayPtr received = consumer->next();
+    testOk(received.get() != 0 && consumer->getMissed() == missed + 3,
+           "missed %u frames", (unsigned)(consumer->getMissed() - missed));
+}
+
+void test_dead_consumer()
+{
+    testDiag("test_dead_consumer");
+
+    std::string name(ringName());
+    NTNDArrayShmRingPtr producer = NTNDArrayShmRing::create(name, 1, 64*64*2);
+    NTNDArrayPtr frame = ringFrame(6);
+    PVUShortArray::svector pixels(64*64);
+    setPixels(frame, pixels);
+    producer->publish(frame);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        testFail("fork failed");
+        return;
+    }
+    if (pid == 0) {
+        // terminates while holding the only slot
+        int status = 1;
+        try {
+            NTNDArrayShmRingPtr consumer = NTNDArrayShmRing::open(name);
+            NTNDArrayPtr received = consumer->next();
+            if (received)
+                _exit(0);
+        } catch (std::exception&) {
+        }
+        _exit(status);
+    }
+
+    int status = -1;
+    if (waitpid(pid, &status, 0) != pid)
+        status = -1;
+    testOk(WIFEXITED(status) && WEXITSTATUS(status) == 0, "consumer process held a frame");
+    testOk(producer->publish(frame), "slot of a terminated consumer reclaimed");
+}
+
+void test_processes()
+{
+    testDiag("test_processes");
+
+    const int32 frames = 200;
+    // named after the parent process
+    std::string name(ringName());
+    NTNDArrayShmRingPtr producer = NTNDArrayShmRing::create(name, 4, 64*64*2);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        testFail("fork failed");
+        return;
+    }
+    if (pid == 0) {
+        // the consumer checks that every frame it receives is complete and
+        // newer than the previous one, then lets the producer reuse its slot
+        int status = 0;
+        try {
+            NTNDArrayShmRingPtr consumer = NTNDArrayShmRing::open(name);
+            int32 last = 0;
+            epicsTime begin(epicsTime::getCurrent());
+            while (status == 0 && last != frames) {
+                NTNDArrayPtr received = consumer->next();
+                if (!received) {
+                    if (epicsTime::getCurrent() - begin > 10.0)
+                        status = 3;
+                    epicsThreadSleep(0.0001);
+                    continue;
+                }
+                int32 uniqueId = received->getUniqueId()->get();
+                if (uniqueId <= last)
+                    status = 1;
+                last = uniqueId;
+                PVUShortArray::const_svector pixels =
+                    received->getValue()->get<PVUShortArray>()->view();
+                if (pixels.size() != 64*64)
+                    status = 2;
+                for (size_t i = 0; status == 0 && i < pixels.size(); ++i)
+                    if (pixels[i] != static_cast<uint16>(i + uniqueId))
+                        status = 2;
+            }
+        } catch (std::exception&) {
+            status = 4;
+        }
+        // leaves without destroying the producer inherited from the parent
+        _exit(status);
+    }
+
+    NTNDArrayPtr frame = ringFrame(0);
+    bool published = true;
+    epicsTime begin(epicsTime::getCurrent());
+    for (int32 uniqueId = 1; published && uniqueId <= frames; ++uniqueId) {
+        PVUShortArray::svector pixels;
+        while ((pixels = producer->allocate<uint16>(64*64)).empty()) {
+            if (epicsTime::getCurrent() - begin > 10.0)
+                break;
+            epicsThreadSleep(0.0001);
+        }
+        frame->getUniqueId()->put(uniqueId);
+        published = !pixels.empty();
+        if (published) {
+            setPixels(frame, pixels);
+            published = producer->publish(frame);
+        }
+    }
+    testOk(published, "producer published %d frames", (int)frames);
+
+    int status = -1;
+    if (waitpid(pid, &status, 0) != pid)
+        status = -1;
+    testOk(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+           "consumer process exited with status %d", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    const size_t iterations = 100;
+    NTNDArrayShmRingPtr producer = NTNDArrayShmRing::create(ringName(), 4, 1024*1024*2);
+    NTNDArrayShmRingPtr consumer = NTNDArrayShmRing::open(ringName());
+
+    NTNDArrayPtr frame = ringFrame(5);
+    PVUShortArray::svector pixels(1024*1024);
+    setPixels(frame, pixels);
+
+    std::vector<epicsUInt8> bytes;
+    PVStructurePtr copy = pvDataCreate->createPVStructure(frame->getPVStructure()->getStructure());
+    epicsTime begin(epicsTime::getCurrent());
+    for (size_t i = 0; i < iterations; ++i) {
+        pixels = frame->getValue()->get<PVUShortArray>()->reuse();
+        setPixels(frame, pixels);
+        serializeToVector(frame->getPVStructure().get(), EPICS_BYTE_ORDER, bytes);
+        deserializeFromVector(copy.get(), EPICS_BYTE_ORDER, bytes);
+    }
+    double serializedTime = epicsTime::getCurrent() - begin;
+
+    size_t received = 0;
+    begin = epicsTime::getCurrent();
+    for (size_t i = 0; i < iterations; ++i) {
+        pixels = producer->allocate<uint16>(1024*1024);
+        setPixels(frame, pixels);
+        producer->publish(frame);
+        received += consumer->next() ? 1 : 0;
+    }
+    double shmTime = epicsTime::getCurrent() - begin;
+
+    testOk1(received == iterations);
+    testDiag("1024x1024 uint16 frame, filled and received: serialized copy %.1f us,"
+             " shared memory %.1f us",
+             1e6*serializedTime/iterations, 1e6*shmTime/iterations);
+}
+
+MAIN(testNTNDArrayShm) {
+    testPlan(32);
+    test_open();
+    test_inplace();
+    test_copy();
+    test_references();
+    test_dead_consumer();
+    test_processes();
+    test_benchmark();
+    return testDone();
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <stdexcept>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/ntndarraySynchronizer.h>
+
+#include "ndarrayTestFrame.h"
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+static NTNDArrayPtr setTime(NTNDArrayPtr const & frame, int64 seconds, int32 nanoseconds)
+{
+    PVStructurePtr timeStamp = frame->getDataTimeStamp();
+    timeStamp->getSubField<PVLong>("secondsPastEpoch")->put(seconds);
+    timeStamp->getSubField<PVInt>("nanoseconds")->put(nanoseconds);
+    return frame;
+}
+
+void test_groups()
+{
+    testDiag("test_groups");
+
+    NTNDArraySynchronizerPtr synchronizer = NTNDArraySynchronizer::create(3, 100e-6);
+    std::vector<NTNDArrayPtr> group;
+
+    NTNDArrayPtr a = setTime(createFrame(1), 10, 1000);
+    NTNDArrayPtr b = setTime(createFrame(2), 10, 1050);
+    NTNDArrayPtr c = setTime(createFrame(3), 10, 999000000);
+    testOk1(!synchronizer->push(0, a, group));
+    testOk1(!synchronizer->push(1, b, group));
+    testOk1(!synchronizer->push(2, c, group));
+    testOk1(synchronizer->getPending(0) == 1 && synchronizer->getPending(2) == 1);
+
+    // the third frame matches the first two
+    NTNDArrayPtr d = setTime(createFrame(4), 9, 999950000);
+    testOk1(synchronizer->push(2, d, group));
+    testOk1(group.size() == 3 && group[0] == a && group[1] == b && group[2] == d);
+    testOk1(synchronizer->getPending(0) == 0 && synchronizer->getPending(1) == 0);
+    testOk1(synchronizer->getPending(2) == 1 && synchronizer->getGroups() == 1);
+
+    // of two frames within the tolerance, the closest is taken
+    synchronizer->reset();
+    NTNDArrayPtr early = setTime(createFrame(5), 20, 0);
+    NTNDArrayPtr close = setTime(createFrame(6), 20, 60000);
+    synchronizer->push(0, early, group);
+    synchronizer->push(0, close, group);
+    synchronizer->push(1, setTime(createFrame(7), 20, 70000), group);
+    testOk1(synchronizer->push(2, setTime(createFrame(8), 20, 80000), group));
+    testOk1(group[0] == close && group[1]->getUniqueId()->get() == 7);
+    testOk1(synchronizer->getDropped() == 1);
+
+    // frames out of order are held in dataTimeStamp order
+    synchronizer->reset();
+    synchronizer->push(0, setTime(createFrame(11), 30, 500000), group);
+    synchronizer->push(0, setTime(createFrame(10), 30, 0), group);
+    synchronizer->push(1, setTime(createFrame(12), 30, 0), group);
+    testOk1(synchronizer->push(2, setTime(createFrame(13), 30, 0), group));
+    testOk1(group[0]->getUniqueId()->get() == 10 && synchronizer->getPending(0) == 1);
+    testOk1(synchronizer->getDropped() == 0);
+
+    try {
+        synchronizer->push(3, a, group);
+        testFail("stream 3 of 3 not rejected");
+    } catch (std::runtime_error &) {
+        testPass("stream 3 of 3 rejected");
+    }
+}
+
+void test_depth()
+{
+    testDiag("test_depth");
+
+    NTNDArraySynchronizerPtr synchronizer = NTNDArraySynchronizer::create(2, 1e-3, 4);
+    std::vector<NTNDArrayPtr> group;
+    for (int32 i = 0; i < 6; ++i)
+        synchronizer->push(0, setTime(createFrame(i), 40 + i, 0), group);
+    testOk1(synchronizer->getPending(0) == 4 && synchronizer->getDropped() == 2);
+    testOk1(!synchronizer->push(1, setTime(createFrame(100), 41, 0), group));
+    testOk1(synchronizer->push(1, setTime(createFrame(101), 43, 0), group));
+    testOk1(group[0]->getUniqueId()->get() == 3 && synchronizer->getPending(0) == 2);
+    // the frame of stream 1 before the group is dropped, as is frame 2 of stream 0
+    testOk1(synchronizer->getDropped() == 4 && synchronizer->getPending(1) == 0);
+
+    try {
+        NTNDArraySynchronizer::create(0, 1);
+        testFail("no streams not rejected");
+    } catch (std::runtime_error &) {
+        testPass("no streams rejected");
+    }
+}
+
+void test_bundle()
+{
+    testDiag("test_bundle");
+
+    std::vector<NTNDArrayPtr> group;
+    group.push_back(setTime(createFrame(1), 50, 300));
+    group.push_back(setTime(createFrame(2), 50, 100));
+    std::vector<std::string> names;
+    names.push_back("left");
+    names.push_back("right");
+
+    NTMultiChannelPtr bundle = NTNDArraySynchronizer::createBundle(group, names);
+    testOk1(bundle->getValue()->getLength() == 2);
+    testOk1(bundle->getValue()->view()[1]->get() == group[1]->getPVStructure());
+    testOk1(bundle->getChannelName()->view()[0] == "left");
+    testOk1(bundle->getNanoseconds()->view()[0] == 300 && bundle->getSecondsPastEpoch()->view()[1] == 50);
+    testOk1(bundle->getTimeStamp()->getSubField<PVInt>("nanoseconds")->get() == 100);
+
+    bundle = NTNDArraySynchronizer::createBundle(group);
+    testOk1(bundle->getChannelName()->view()[1] == "1");
+    try {
+        NTNDArraySynchronizer::createBundle(group, std::vector<std::string>(1, "one"));
+        testFail("missing name not rejected");
+    } catch (std::runtime_error &) {
+        testPass("missing name rejected");
+    }
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    const size_t streamCount = 8;
+    const int count = 20000;
+    std::vector<NTNDArrayPtr> frames;
+    for (size_t i = 0; i < streamCount*64; ++i)
+        frames.push_back(setTime(createFrame(0), 0, 0));
+
+    // 1 kHz triggers, each camera with its own latency and up to 20 us jitter
+    NTNDArraySynchronizerPtr synchronizer = NTNDArraySynchronizer::create(streamCount, 50e-6);
+    std::vector<NTNDArrayPtr> group;
+    group.reserve(streamCount);
+    size_t groups = 0;
+    epicsTime begin(epicsTime::getCurrent());
+    for (int i = 0; i < count; ++i) {
+        for (size_t s = 0; s < streamCount; ++s) {
+            size_t stream = (s*3 + i) % streamCount;
+            NTNDArrayPtr const & frame = frames[(i % 64)*streamCount + stream];
+            setTime(frame, 100 + i/1000, static_cast<int32>((i % 1000)*1000000 + (i*7 + stream*13) % 20000));
+            if (synchronizer->push(stream, frame, group))
+                ++groups;
+        }
+    }
+    double elapsed = epicsTime::getCurrent() - begin;
+
+    testOk1(groups == static_cast<size_t>(count) && synchronizer->getDropped() == 0);
+    testDiag("%d x %u frames grouped in %.2f ms, %.0f ns per frame",
+             count, (unsigned)streamCount, elapsed*1e3, elapsed/(count*streamCount)*1e9);
+}
+
+MAIN(testNTNDArraySynchronizer) {
+    testPlan(29);
+    test_groups();
+    test_depth();
+    test_bundle();
+    test_benchmark();
+    return testDone();
+}
@@ -0,0 +1,228 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <stdexcept>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsGuard.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/ntndarrayTiler.h>
+
+#include "ndarrayTestFrame.h"
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+// a frame whose pixels are their index
+static NTNDArrayPtr rampFrame(size_t x, size_t y, size_t z = 0)
+{
+    std::vector<size_t> sizes(frameSizes(x, y, z));
+    size_t count = 1;
+    for (size_t i = 0; i < sizes.size(); ++i)
+        count *= sizes[i];
+    std::vector<double> pixels(count);
+    for (size_t i = 0; i < count; ++i)
+        pixels[i] = static_cast<uint16>(i);
+    return createFrame<PVUShortArray>(sizes, pixels);
+}
+
+typedef NTNDArrayPixelKernel<uint16, double, NTNDArrayLinearOp<uint16, double> > LinearKernel;
+
+// sums the input elements, recording the rows each tile starts at
+class SumKernel : public NTNDArrayKernel
+{
+public:
+    SumKernel() : sum(0), tiles(0) {}
+
+    virtual void apply(NTNDArrayTile const & tile)
+    {
+        double tileSum = 0;
+        for (size_t row = 0; row < tile.height; ++row) {
+            const uint16 *in = reinterpret_cast<const uint16*>(tile.input + row*tile.inputStride);
+            for (size_t i = 0; i < tile.width; ++i)
+                tileSum += in[i];
+        }
+        epicsGuard<epicsMutex> G(mutex);
+        sum += tileSum;
+        ++tiles;
+    }
+
+    double sum;
+    size_t tiles;
+    epicsMutex mutex;
+};
+
+// sums each tile by a nested call of the tiler, one row per tile
+class NestedKernel : public NTNDArrayKernel
+{
+public:
+    explicit NestedKernel(NTNDArrayTilerPtr const & tiler) : tiler(tiler) {}
+
+    virtual void apply(NTNDArrayTile const & tile)
+    {
+        std::vector<NTNDArrayTile> rows(tile.height, tile);
+        for (size_t row = 0; row < tile.height; ++row) {
+            rows[row].y += row;
+            rows[row].height = 1;
+            rows[row].input += row*tile.inputStride;
+        }
+        tiler->run(rows, sum);
+    }
+
+    NTNDArrayTilerPtr tiler;
+    SumKernel sum;
+};
+
+class FailingKernel : public NTNDArrayKernel
+{
+public:
+    explicit FailingKernel(bool standard = true) : standard(standard) {}
+
+    virtual void apply(NTNDArrayTile const & tile)
+    {
+        if (tile.y > 0) {
+            if (standard)
+                throw std::runtime_error("kernel failed");
+            throw 42;
+        }
+    }
+
+private:
+    bool standard;
+};
+
+void test_split()
+{
+    testDiag("test_split");
+
+    NTNDArrayPtr frame = rampFrame(1000, 30);
+    NTNDArrayTilerPtr tiler = NTNDArrayTiler::create(1, 4096);
+    char output = 0;
+
+    std::vector<NTNDArrayTile> tiles = tiler->split(frame, pvUShort, &output);
+    testOk(tiles.size() == 30 && tiles[0].width == 1000 && tiles[0].height == 1,
+           "rows that fit are not split");
+    testOk1(tiles[1].y == 1 && tiles[1].inputStride == 2000);
+    testOk1(tiles[1].input - tiles[0].input == 2000 && tiles[1].output - tiles[0].output == 2000);
+
+    tiles = tiler->split(frame, pvUShort);
+    testOk(tiles.size() == 15 && tiles[0].height == 2 && !tiles[0].output,
+           "tiles without output hold more rows");
+
+    tiler = NTNDArrayTiler::create(1, 1000);
+    tiles = tiler->split(frame, pvUShort, &output);
+    testOk(tiles.size() == 120 && tiles[3].x == 750 && tiles[3].width == 250,
+           "long rows are split");
+
+    frame = rampFrame(100, 20, 3);
+    tiler = NTNDArrayTiler::create(1, 16384);
+    tiles = tiler->split(frame, pvDouble, &output);
+    size_t covered = 0;
+    for (size_t i = 0; i < tiles.size(); ++i)
+        covered += tiles[i].width*tiles[i].height;
+    testOk(covered == 100*20*3, "tiles cover the frame");
+    testOk1(tiles.back().plane == 2 && tiles.back().outputStride == 800);
+    testOk1(tiles.back().y + tiles.back().height == 20);
+}
+
+void test_transform()
+{
+    testDiag("test_transform");
+
+    NTNDArrayPtr frame = rampFrame(300, 200);
+    NTNDArrayTilerPtr tiler = NTNDArrayTiler::create(4, 8192);
+    testOk1(tiler->getThreadCount() == 4 && tiler->getTileBytes() == 8192);
+
+    LinearKernel kernel(NTNDArrayLinearOp<uint16, double>(2, 1));
+    NTNDArrayPtr output = tiler->transform(frame, kernel, pvDouble);
+
+    PVDoubleArray::const_svector value(output->getValue()->get<PVDoubleArray>()->view());
+    bool correct = value.size() == 60000;
+    for (size_t i = 0; correct && i < value.size(); ++i)
+        correct = value[i] == 2.0*static_cast<uint16>(i) + 1;
+    testOk(correct, "every element transformed");
+    testOk1(output->getDimension()->view().size() == 2);
+    testOk1(frame->getValue()->get<PVUShortArray>()->view()[1] == 1);
+
+    SumKernel sum;
+    tiler->visit(frame, sum);
+    double expected = 0;
+    for (size_t i = 0; i < 60000; ++i)
+        expected += static_cast<uint16>(i);
+    testOk1(sum.sum == expected && sum.tiles > 1);
+
+    FailingKernel failing;
+    try {
+        tiler->visit(frame, failing);
+        testFail("kernel exception ignored");
+    } catch (std::runtime_error&) {
+        testPass("kernel exception rethrown");
+    }
+
+    FailingKernel unknown(false);
+    try {
+        tiler->visit(frame, unknown);
+        testFail("unknown kernel exception ignored");
+    } catch (std::runtime_error&) {
+        testPass("unknown kernel exception reported");
+    }
+
+    try {
+        tiler->transform(frame, kernel, pvFloat);
+        testFail("mismatching kernel accepted");
+    } catch (std::runtime_error&) {
+        testPass("mismatching kernel rejected");
+    }
+
+    // the tiler is usable after a failure
+    sum.sum = 0;
+    tiler->visit(frame, sum);
+    testOk1(sum.sum == expected);
+
+    NestedKernel nested(tiler);
+    tiler->visit(frame, nested);
+    testOk(nested.sum.sum == expected && nested.sum.tiles == 200,
+        "nested calls from the kernel run serially");
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    NTNDArrayPtr frame = rampFrame(4096, 4096);
+    PVUShortArray::const_svector in(frame->getValue()->get<PVUShortArray>()->view());
+
+    NTNDArrayLinearOp<uint16, double> op(0.5, 3);
+    epicsTime begin(epicsTime::getCurrent());
+    shared_vector<double> plain(in.size());
+    for (size_t i = 0; i < in.size(); ++i)
+        plain[i] = op(in[i]);
+    double plainTime = epicsTime::getCurrent() - begin;
+
+    NTNDArrayTilerPtr tiler = NTNDArrayTiler::create();
+    LinearKernel kernel(op);
+    NTNDArrayPtr output = tiler->transform(frame, kernel, pvDouble);
+    output.reset();
+    begin = epicsTime::getCurrent();
+    output = tiler->transform(frame, kernel, pvDouble);
+    double tiledTime = epicsTime::getCurrent() - begin;
+
+    testOk1(output->getValue()->get<PVDoubleArray>()->view()[4097] == plain[4097]);
+    testDiag("4096x4096 uint16 to double, %u threads: single loop %.1f ms, tiled %.1f ms",
+             (unsigned)tiler->getThreadCount(), plainTime*1e3, tiledTime*1e3);
+}
+
+MAIN(testNTNDArrayTiler) {
+    testPlan(19);
+    test_split();
+    test_transform();
+    test_benchmark();
+    return testDone();
+}
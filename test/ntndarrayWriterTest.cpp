@@ -0,0 +1,235 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsEndian.h>
+#include <epicsStdio.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/ntndarrayWriter.h>
+
+#include "ndarrayTestFrame.h"
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+static std::string fileName(const char *suffix)
+{
+    char name[64];
+    epicsSnprintf(name, sizeof(name), "ntndarrayWriterTest.%d.%s", (int)getpid(), suffix);
+    return name;
+}
+
+static std::string readFile(std::string const & name)
+{
+    std::ifstream file(name.c_str(), std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void setPixels(NTNDArrayPtr const & frame, size_t count, uint16 first)
+{
+    PVUShortArray::svector pixels(count);
+    for (size_t i = 0; i < count; ++i)
+        pixels[i] = static_cast<uint16>(first + i);
+    frame->getValue()->select<PVUShortArray>("ushortValue")->replace(freeze(pixels));
+}
+
+static bool checkPixels(const char *data, size_t frames, size_t count)
+{
+    for (size_t f = 0; f < frames; ++f)
+        for (size_t i = 0; i < count; ++i) {
+            uint16 pixel;
+            memcpy(&pixel, data + (f*count + i)*sizeof(pixel), sizeof(pixel));
+            if (pixel != static_cast<uint16>(f*100 + i))
+                return false;
+        }
+    return true;
+}
+
+static std::string ushortType()
+{
+    return EPICS_BYTE_ORDER == EPICS_ENDIAN_LITTLE ? "<u2" : ">u2";
+}
+
+void test_npy()
+{
+    testDiag("test_npy");
+
+    std::string name(fileName("npy"));
+    NTNDArrayWriterPtr writer = NTNDArrayWriter::create(name);
+    NTNDArrayPtr frame = createFrame<PVUShortArray>(frameSizes(4, 3), std::vector<double>());
+    for (size_t f = 0; f < 3; ++f) {
+        setPixels(frame, 12, static_cast<uint16>(f*100));
+        testOk1(writer->write(frame, true));
+    }
+    writer->close();
+    testOk1(writer->getFrameCount() == 3 && writer->getBytesWritten() == 3*12*2);
+
+    std::string file(readFile(name));
+    testOk1(file.compare(0, 8, std::string("\x93NUMPY\x01\x00", 8)) == 0);
+    size_t headerLength = static_cast<unsigned char>(file[8]) |
+        static_cast<unsigned char>(file[9]) << 8;
+    std::string header(file.substr(10, headerLength));
+    testOk1((10 + headerLength) % 64 == 0 && header[header.size() - 1] == '\n');
+    testOk1(header.find("'descr': '" + ushortType() + "'") != std::string::npos);
+    testOk1(header.find("'fortran_order': False") != std::string::npos);
+    testOk(header.find("'shape': (3, 3, 4)") != std::string::npos,
+           "shape is frames, dimension[1], dimension[0]");
+    testOk1(file.size() == 10 + headerLength + 3*12*2);
+    testOk1(checkPixels(file.data() + 10 + headerLength, 3, 12));
+
+    try {
+        writer->write(frame, true);
+        testFail("write after close accepted");
+    } catch (std::runtime_error&) {
+        testPass("write after close rejected");
+    }
+
+    remove(name.c_str());
+}
+
+void test_raw()
+{
+    testDiag("test_raw");
+
+    std::string name(fileName("raw"));
+    NTNDArrayWriterPtr writer = NTNDArrayWriter::create(name, NTNDArrayWriter::rawFormat, 4096, 2);
+    // frames span buffers
+    NTNDArrayPtr frame = createFrame<PVUShortArray>(frameSizes(1000, 3), std::vector<double>());
+    for (size_t f = 0; f < 5; ++f) {
+        setPixels(frame, 3000, static_cast<uint16>(f*100));
+        writer->write(frame, true);
+    }
+
+    NTNDArrayPtr other = createFrame<PVUShortArray>(frameSizes(3, 1000), std::vector<double>());
+    setPixels(other, 3000, 0);
+    try {
+        writer->write(other, true);
+        testFail("frame of a different shape accepted");
+    } catch (std::runtime_error&) {
+        testPass("frame of a different shape rejected");
+    }
+    writer.reset();
+
+    std::string file(readFile(name));
+    testOk1(file.size() == 5*3000*2);
+    testOk1(checkPixels(file.data(), 5, 3000));
+
+    std::string sidecar(readFile(name + ".json"));
+    testOk1(sidecar.find("\"shape\": [5, 3, 1000]") != std::string::npos);
+    testOk1(sidecar.find("\"descr\": \"" + ushortType() + "\"") != std::string::npos);
+
+    remove(name.c_str());
+    remove((name + ".json").c_str());
+}
+
+void test_types()
+{
+    testDiag("test_types");
+
+    std::string name(fileName("npy"));
+    NTNDArrayWriterPtr writer = NTNDArrayWriter::create(name);
+    NTNDArrayPtr frame = NTNDArray::createBuilder()->create();
+    PVByteArray::svector bytes(7, 1);
+    frame->getValue()->select<PVByteArray>("byteValue")->replace(freeze(bytes));
+    writer->write(frame, true);
+    writer->write(frame, true);
+
+    PVDoubleArray::svector doubles(7);
+    frame->getValue()->select<PVDoubleArray>("doubleValue")->replace(freeze(doubles));
+    try {
+        writer->write(frame, true);
+        testFail("frame of a different type accepted");
+    } catch (std::runtime_error&) {
+        testPass("frame of a different type rejected");
+    }
+    writer->close();
+
+    std::string file(readFile(name));
+    testOk1(file.find("'descr': '|i1'") != std::string::npos);
+    testOk(file.find("'shape': (2, 7)") != std::string::npos, "no dimensions, one index per frame");
+    remove(name.c_str());
+
+    writer = NTNDArrayWriter::create(name);
+    writer->close();
+    testOk1(readFile(name).find("'shape': (0,)") != std::string::npos);
+    remove(name.c_str());
+}
+
+void test_direct()
+{
+    testDiag("test_direct");
+
+    std::string name(fileName("npy"));
+    NTNDArrayWriterPtr writer = NTNDArrayWriter::create(name,
+        NTNDArrayWriter::npyFormat, 1 << 20, 4, true);
+    testDiag("page cache %s", writer->isDirect() ? "bypassed" : "used");
+
+    NTNDArrayPtr frame = createFrame<PVUShortArray>(frameSizes(33, 3), std::vector<double>());
+    for (size_t f = 0; f < 7; ++f) {
+        setPixels(frame, 99, static_cast<uint16>(f*100));
+        writer->write(frame, true);
+    }
+    writer->close();
+
+    std::string file(readFile(name));
+    testOk(file.size() == 4096 + 7*99*2, "file truncated to its data");
+    testOk1(file.find("'shape': (7, 3, 33)") != std::string::npos);
+    testOk1(checkPixels(file.data() + 4096, 7, 99));
+    remove(name.c_str());
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    const size_t frames = 128;
+    const size_t count = 1024*1024;
+
+    std::string name(fileName("npy"));
+    NTNDArrayWriterPtr writer = NTNDArrayWriter::create(name,
+        NTNDArrayWriter::npyFormat, 16*1024*1024, 4, true);
+
+    NTNDArrayPtr frame = createFrame<PVUShortArray>(frameSizes(1024, 1024), std::vector<double>());
+    setPixels(frame, count, 0);
+
+    double writeTime = 0;
+    epicsTime begin(epicsTime::getCurrent());
+    for (size_t f = 0; f < frames; ++f) {
+        epicsTime start(epicsTime::getCurrent());
+        writer->write(frame, true);
+        writeTime += epicsTime::getCurrent() - start;
+    }
+    writer->close();
+    double totalTime = epicsTime::getCurrent() - begin;
+
+    double bytes = double(frames)*count*sizeof(uint16);
+    testOk1(writer->getBytesWritten() == bytes);
+    testDiag("%u 1024x1024 uint16 frames, %s: %.2f GB/s to disk,"
+             " %.1f us per frame in write()",
+             (unsigned)frames, writer->isDirect() ? "O_DIRECT" : "page cache",
+             bytes/totalTime/1e9, writeTime/frames*1e6);
+    remove(name.c_str());
+}
+
+MAIN(testNTNDArrayWriter) {
+    testPlan(25);
+    test_npy();
+    test_raw();
+    test_types();
+    test_direct();
+    test_benchmark();
+    return testDone();
+}
@@ -0,0 +1,306 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <deque>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsAtomic.h>
+#include <epicsEvent.h>
+#include <epicsGuard.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/ntqueue.h>
+
+#include "ndarrayTestFrame.h"
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+void test_fifo()
+{
+    testDiag("test_fifo");
+
+    NTNDArrayQueuePtr queue = NTNDArrayQueue::create(3);
+    testOk1(queue->getCapacity() == 4);
+    testOk1(queue->getPolicy() == NTNDArrayQueue::block);
+
+    NTNDArrayPtr frame;
+    testOk1(!queue->tryPop(frame) && !frame);
+    testOk1(!queue->pop(0.01));
+
+    for (int32 i = 0; i < 4; ++i)
+        testOk1(queue->tryPush(createFrame(i)));
+    testOk(!queue->tryPush(createFrame(4)), "full queue rejects tryPush");
+    testOk1(queue->getDepth() == 4);
+
+    bool ordered = true;
+    for (int32 i = 0; i < 4; ++i)
+        ordered = ordered && queue->pop()->getUniqueId()->get() == i;
+    testOk(ordered, "frames popped in order");
+    testOk1(queue->getDepth() == 0);
+
+    // wrap around the ring several times
+    ordered = true;
+    for (int32 i = 0; i < 20; ++i) {
+        queue->push(createFrame(i));
+        queue->push(createFrame(i + 100));
+        ordered = ordered && queue->pop()->getUniqueId()->get() == i &&
+            queue->pop()->getUniqueId()->get() == i + 100;
+    }
+    testOk(ordered, "frames popped in order after wrapping");
+}
+
+void test_dropOldest()
+{
+    testDiag("test_dropOldest");
+
+    NTNDArrayQueuePtr queue = NTNDArrayQueue::create(4, NTNDArrayQueue::dropOldest);
+    for (int32 i = 0; i < 10; ++i)
+        testOk1(queue->push(createFrame(i)));
+    testOk1(queue->getDepth() == 4);
+    testOk1(queue->getDropped() == 6);
+    testOk(queue->pop()->getUniqueId()->get() == 6, "oldest frames dropped");
+}
+
+void test_batch()
+{
+    testDiag("test_batch");
+
+    NTNDArrayQueuePtr queue = NTNDArrayQueue::create(16);
+    for (int32 i = 0; i < 10; ++i)
+        queue->push(createFrame(i));
+
+    std::vector<NTNDArrayPtr> frames;
+    testOk1(queue->popBatch(frames, 8) == 8);
+    testOk1(queue->popBatch(frames, 8) == 2);
+    testOk1(frames.size() == 10 && frames[9]->getUniqueId()->get() == 9);
+    testOk1(queue->popBatch(frames, 8, 0.01) == 0);
+}
+
+struct Producer : public epicsThreadRunable {
+    Producer(NTNDArrayQueuePtr const & queue, int32 first, int32 count) :
+        queue(queue), first(first), count(count),
+        thread(*this, "producer", epicsThreadGetStackSize(epicsThreadStackSmall))
+    {
+        thread.start();
+    }
+
+    virtual void run()
+    {
+        NTNDArrayPtr frame = createFrame(0);
+        for (int32 i = first; i < first + count; ++i) {
+            // a fresh structure per frame would dominate the timing
+            if (!queue->push(i % 2 ? frame : createFrame(i)))
+                break;
+        }
+    }
+
+    NTNDArrayQueuePtr queue;
+    int32 first, count;
+    epicsThread thread;
+};
+
+struct Consumer : public epicsThreadRunable {
+    Consumer(NTNDArrayQueuePtr const & queue, size_t batch) :
+        queue(queue), batch(batch), received(0), sum(0),
+        thread(*this, "consumer", epicsThreadGetStackSize(epicsThreadStackSmall))
+    {
+        thread.start();
+    }
+
+    virtual void run()
+    {
+        std::vector<NTNDArrayPtr> frames;
+        while (true) {
+            frames.clear();
+            if (queue->popBatch(frames, batch) == 0)
+                break;
+            for (size_t i = 0; i < frames.size(); ++i) {
+                ++received;
+                sum += frames[i]->getUniqueId()->get();
+            }
+        }
+    }
+
+    NTNDArrayQueuePtr queue;
+    size_t batch;
+    size_t received;
+    int64 sum;
+    epicsThread thread;
+};
+
+void test_threads()
+{
+    testDiag("test_threads");
+
+    const int32 count = 20000;
+    NTNDArrayQueuePtr queue = NTNDArrayQueue::create(64);
+    std::vector<Producer*> producers;
+    std::vector<Consumer*> consumers;
+    for (int i = 0; i < 4; ++i)
+        consumers.push_back(new Consumer(queue, i % 2 ? 16 : 1));
+    for (int i = 0; i < 4; ++i)
+        producers.push_back(new Producer(queue, i*count, count));
+
+    for (size_t i = 0; i < producers.size(); ++i) {
+        producers[i]->thread.exitWait();
+        delete producers[i];
+    }
+    queue->close();
+
+    size_t received = 0;
+    int64 sum = 0;
+    for (size_t i = 0; i < consumers.size(); ++i) {
+        consumers[i]->thread.exitWait();
+        received += consumers[i]->received;
+        sum += consumers[i]->sum;
+        delete consumers[i];
+    }
+
+    // odd frames are all the same frame with unique id 0
+    int64 expected = 0;
+    for (int32 i = 0; i < 4*count; i += 2)
+        expected += i;
+    testOk(received == 4*size_t(count), "every frame received once");
+    testOk1(sum == expected);
+    testOk1(!queue->push(createFrame(0)));
+}
+
+void test_close()
+{
+    testDiag("test_close");
+
+    NTNDArrayQueuePtr queue = NTNDArrayQueue::create(2);
+    Consumer consumer(queue, 1);
+    Consumer other(queue, 4);
+    epicsThreadSleep(0.05);
+    epicsTime begin(epicsTime::getCurrent());
+    queue->close();
+    consumer.thread.exitWait();
+    other.thread.exitWait();
+    testOk(epicsTime::getCurrent() - begin < 0.05, "close wakes up waiting consumers");
+    testOk1(queue->isClosed());
+}
+
+// the mutex protected queue a lock-free queue is measured against
+struct MutexQueue {
+    void push(NTNDArrayPtr const & frame)
+    {
+        {
+            epicsGuard<epicsMutex> G(mutex);
+            frames.push_back(frame);
+        }
+        event.signal();
+    }
+
+    NTNDArrayPtr pop()
+    {
+        while (true) {
+            {
+                epicsGuard<epicsMutex> G(mutex);
+                if (!frames.empty()) {
+                    NTNDArrayPtr frame(frames.front());
+                    frames.pop_front();
+                    return frame;
+                }
+            }
+            event.wait();
+        }
+    }
+
+    std::deque<NTNDArrayPtr> frames;
+    epicsMutex mutex;
+    epicsEvent event;
+};
+
+struct MutexProducer : public epicsThreadRunable {
+    MutexProducer(MutexQueue & queue, NTNDArrayPtr const & frame, size_t count) :
+        queue(queue), frame(frame), count(count),
+        thread(*this, "producer", epicsThreadGetStackSize(epicsThreadStackSmall))
+    {
+        thread.start();
+    }
+
+    virtual void run()
+    {
+        for (size_t i = 0; i < count; ++i)
+            queue.push(frame);
+    }
+
+    MutexQueue & queue;
+    NTNDArrayPtr frame;
+    size_t count;
+    epicsThread thread;
+};
+
+struct LockFreeProducer : public epicsThreadRunable {
+    LockFreeProducer(NTNDArrayQueuePtr const & queue, NTNDArrayPtr const & frame, size_t count) :
+        queue(queue), frame(frame), count(count),
+        thread(*this, "producer", epicsThreadGetStackSize(epicsThreadStackSmall))
+    {
+        thread.start();
+    }
+
+    virtual void run()
+    {
+        for (size_t i = 0; i < count; ++i)
+            queue->push(frame);
+    }
+
+    NTNDArrayQueuePtr queue;
+    NTNDArrayPtr frame;
+    size_t count;
+    epicsThread thread;
+};
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    const size_t count = 200000;
+    NTNDArrayPtr frame = createFrame(1);
+
+    MutexQueue mutexQueue;
+    epicsTime begin(epicsTime::getCurrent());
+    {
+        MutexProducer p1(mutexQueue, frame, count), p2(mutexQueue, frame, count);
+        for (size_t i = 0; i < 2*count; ++i)
+            mutexQueue.pop();
+    }
+    double mutexTime = epicsTime::getCurrent() - begin;
+
+    NTNDArrayQueuePtr queue = NTNDArrayQueue::create(1024);
+    size_t popped = 0;
+    begin = epicsTime::getCurrent();
+    {
+        LockFreeProducer p1(queue, frame, count), p2(queue, frame, count);
+        std::vector<NTNDArrayPtr> frames;
+        while (popped < 2*count) {
+            frames.clear();
+            popped += queue->popBatch(frames, 64);
+        }
+    }
+    double queueTime = epicsTime::getCurrent() - begin;
+
+    testOk1(popped == 2*count);
+    testDiag("2 producers, 1 consumer: mutex queue %.0f ns, lock-free queue %.0f ns per frame",
+             mutexTime/(2*count)*1e9, queueTime/(2*count)*1e9);
+}
+
+MAIN(testNTQueue) {
+    testPlan(36);
+    test_fifo();
+    test_dropOldest();
+    test_batch();
+    test_threads();
+    test_close();
+    test_benchmark();
+    return testDone();
+}
@@ -193,6 +193,62 @@ void test_ntscalar()
 
 }
 
+void test_cache()
+{
+    testDiag("test_cache");
+
+    NTScalarBuilderPtr builder = NTScalar::createBuilder();
+
+    StructureConstPtr s1 = builder->
+            value(pvDouble)->
+            addAlarm()->
+            addTimeStamp()->
+            createStructure();
+
+    StructureConstPtr s2 = builder->
+            value(pvDouble)->
+            addAlarm()->
+            addTimeStamp()->
+            createStructure();
+
+    testOk(s1.get() == s2.get(), "same options share structure");
+
+    StructureConstPtr s3 = builder->
+            value(pvInt)->
+            addAlarm()->
+            addTimeStamp()->
+            createStructure();
+
+    testOk(s1.get() != s3.get(), "different value type");
+
+    StructureConstPtr s4 = builder->
+            value(pvDouble)->
+            addAlarm()->
+            createStructure();
+
+    testOk(s1.get() != s4.get() && s4->getField("timeStamp").get() == 0,
+           "different options");
+
+    StructureConstPtr s5 = builder->
+            value(pvDouble)->
+            addAlarm()->
+            addTimeStamp()->
+            add("extra",fieldCreate->createScalar(pvString)) ->
+            createStructure();
+
+    testOk(s5.get() != s1.get() && s5->getField("extra").get() != 0,
+           "extra fields not cached");
+
+    StructureConstPtr s6 = NTScalarArray::createBuilder()->
+            value(pvDouble)->
+            addAlarm()->
+            addTimeStamp()->
+            createStructure();
+
+    testOk(s6.get() != s1.get() && s6->getID() == NTScalarArray::URI,
+           "NTScalarArray kept apart");
+}
+
 void test_wrap()
 {
     testDiag("test_wrap");
@@ -227,9 +283,10 @@ void test_wrap()
 }
 
 MAIN(testNTScalar) {
-    testPlan(37);
+    testPlan(42);
     test_builder();
     test_ntscalar();
+    test_cache();
     test_wrap();
     return testDone();
 }
@@ -0,0 +1,321 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsEndian.h>
+#include <epicsTime.h>
+
+#include <pv/serialize.h>
+
+#include <pv/nt.h>
+#include <pv/ntserializer.h>
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+// every allocation made by the test, counted to check in place updates
+static size_t allocations;
+
+#if __cplusplus >= 201103L
+void *operator new(std::size_t size)
+#else
+void *operator new(std::size_t size) throw(std::bad_alloc)
+#endif
+{
+    ++allocations;
+    void *p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) throw()
+{
+    std::free(p);
+}
+
+static size_t countAllocations(NTSerializerPtr const & deserializer,
+        std::vector<epicsUInt8> const & bytes, size_t iterations)
+{
+    size_t before = allocations;
+    for (size_t i = 0; i < iterations; ++i)
+        deserializeFromVector(deserializer.get(), EPICS_BYTE_ORDER, bytes);
+    return allocations - before;
+}
+
+static NTScalarPtr createScalar()
+{
+    NTScalarPtr ntScalar = NTScalar::createBuilder()->
+        value(pvDouble)->
+        addDescriptor()->
+        addAlarm()->
+        addTimeStamp()->
+        create();
+
+    ntScalar->getValue<PVDouble>()->put(3.14159);
+    ntScalar->getDescriptor()->put("a scalar");
+    ntScalar->getAlarm()->getSubField<PVInt>("severity")->put(2);
+    ntScalar->getAlarm()->getSubField<PVString>("message")->put("HIHI");
+    ntScalar->getTimeStamp()->getSubField<PVLong>("secondsPastEpoch")->put(1000000000);
+    ntScalar->getTimeStamp()->getSubField<PVInt>("nanoseconds")->put(123456789);
+    return ntScalar;
+}
+
+static NTScalarArrayPtr createScalarArray(size_t count)
+{
+    NTScalarArrayPtr ntScalarArray = NTScalarArray::createBuilder()->
+        value(pvDouble)->
+        addAlarm()->
+        addTimeStamp()->
+        create();
+
+    PVDoubleArray::svector data(count);
+    for (size_t i = 0; i < count; ++i)
+        data[i] = i*0.5;
+    ntScalarArray->getValue<PVDoubleArray>()->replace(freeze(data));
+    return ntScalarArray;
+}
+
+static NTTablePtr createTable()
+{
+    NTTablePtr ntTable = NTTable::createBuilder()->
+        addColumn("x", pvDouble)->
+        addColumn("name", pvString)->
+        addColumn("flag", pvBoolean)->
+        addTimeStamp()->
+        create();
+
+    PVDoubleArray::svector x(300);
+    PVStringArray::svector name(300);
+    PVBooleanArray::svector flag(300);
+    for (size_t i = 0; i < x.size(); ++i) {
+        x[i] = i;
+        name[i] = std::string(i % 300, 'n');
+        flag[i] = (i % 2) != 0;
+    }
+    ntTable->getColumn<PVDoubleArray>("x")->replace(freeze(x));
+    ntTable->getColumn<PVStringArray>("name")->replace(freeze(name));
+    ntTable->getColumn<PVBooleanArray>("flag")->replace(freeze(flag));
+    return ntTable;
+}
+
+static NTNDArrayPtr createNDArray(size_t count)
+{
+    NTNDArrayPtr ntndArray = NTNDArray::createBuilder()->
+        addTimeStamp()->
+        create();
+
+    PVUShortArray::svector data(count);
+    for (size_t i = 0; i < count; ++i)
+        data[i] = static_cast<uint16>(i);
+    ntndArray->getValue()->select<PVUShortArray>("ushortValue")->replace(freeze(data));
+    ntndArray->getUniqueId()->put(42);
+    ntndArray->getCodec()->getSubField<PVString>("name")->put("none");
+    return ntndArray;
+}
+
+void test_supported()
+{
+    testDiag("test_supported");
+
+    testOk1(NTSerializer::isSupported(createScalar()->getPVStructure()->getStructure()));
+    testOk1(NTSerializer::isSupported(createScalarArray(1)->getPVStructure()->getStructure()));
+    testOk1(NTSerializer::isSupported(createTable()->getPVStructure()->getStructure()));
+
+    NTNDArrayPtr ntndArray = NTNDArray::createBuilder()->create();
+    testOk1(!NTSerializer::isSupported(ntndArray->getPVStructure()->getStructure()));
+    testOk1(NTSerializer::create(ntndArray->getPVStructure()).get() != 0);
+    testOk1(NTSerializer::create(PVStructurePtr()).get() == 0);
+}
+
+static void check_identical(const char *name, PVStructurePtr const & pvStructure)
+{
+    NTSerializerPtr serializer = NTSerializer::create(pvStructure);
+    if (!serializer) {
+        testFail("%s: no serializer", name);
+        testSkip(2, "no serializer");
+        return;
+    }
+
+    std::vector<epicsUInt8> generic, specialized;
+
+    serializeToVector(pvStructure.get(), EPICS_ENDIAN_BIG, generic);
+    serializer->serialize(specialized, EPICS_ENDIAN_BIG);
+    testOk(generic == specialized, "%s: big endian output identical", name);
+
+    serializeToVector(pvStructure.get(), EPICS_ENDIAN_LITTLE, generic);
+    serializeToVector(serializer.get(), EPICS_ENDIAN_LITTLE, specialized);
+    testOk(generic == specialized, "%s: little endian output identical", name);
+
+    testOk(serializer->getSerializedSize() == generic.size(),
+           "%s: serialized size %u", name, (unsigned)generic.size());
+}
+
+void test_identical()
+{
+    testDiag("test_identical");
+
+    check_identical("NTScalar", createScalar()->getPVStructure());
+    check_identical("NTScalarArray", createScalarArray(1000)->getPVStructure());
+    check_identical("empty NTScalarArray", createScalarArray(0)->getPVStructure());
+    check_identical("NTTable", createTable()->getPVStructure());
+    check_identical("NTNDArray", createNDArray(1000)->getPVStructure());
+}
+
+void test_roundtrip()
+{
+    testDiag("test_roundtrip");
+
+    NTScalarPtr source = createScalar();
+    NTScalarPtr target = NTScalar::createBuilder()->
+        value(pvDouble)->
+        addDescriptor()->
+        addAlarm()->
+        addTimeStamp()->
+        create();
+
+    NTSerializerPtr serializer = NTSerializer::create(source->getPVStructure());
+    NTSerializerPtr deserializer = NTSerializer::create(target->getPVStructure());
+
+    std::vector<epicsUInt8> bytes;
+    serializer->serialize(bytes);
+    deserializeFromVector(deserializer.get(), EPICS_BYTE_ORDER, bytes);
+
+    testOk1(*source->getPVStructure() == *target->getPVStructure());
+}
+
+void test_inplace()
+{
+    testDiag("test_inplace");
+
+    NTScalarArrayPtr source = createScalarArray(1000);
+    NTScalarArrayPtr target = createScalarArray(0);
+    NTSerializerPtr serializer = NTSerializer::create(source->getPVStructure());
+    NTSerializerPtr deserializer = NTSerializer::create(target->getPVStructure());
+    PVDoubleArrayPtr targetValue = target->getValue<PVDoubleArray>();
+
+    std::vector<epicsUInt8> bytes;
+    serializer->serialize(bytes);
+    deserializeFromVector(deserializer.get(), EPICS_BYTE_ORDER, bytes);
+    const double *storage = targetValue->view().data();
+
+    PVDoubleArray::svector data(source->getValue<PVDoubleArray>()->reuse());
+    data[0] = -1.0;
+    source->getValue<PVDoubleArray>()->replace(freeze(data));
+    serializer->serialize(bytes);
+    deserializeFromVector(deserializer.get(), EPICS_BYTE_ORDER, bytes);
+
+    testOk(targetValue->view().data() == storage, "unshared storage reused");
+    testOk1(*source->getPVStructure() == *target->getPVStructure());
+    testOk(countAllocations(deserializer, bytes, 100) == 0,
+           "NTScalarArray updates deserialized without allocating");
+
+    // a reader still holding the previous update must not see it change
+    PVDoubleArray::const_svector held(targetValue->view());
+    data = source->getValue<PVDoubleArray>()->reuse();
+    data[0] = -2.0;
+    source->getValue<PVDoubleArray>()->replace(freeze(data));
+    serializer->serialize(bytes);
+    deserializeFromVector(deserializer.get(), EPICS_BYTE_ORDER, bytes);
+
+    testOk(targetValue->view().data() != storage, "shared storage not reused");
+    testOk(held[0] == -1.0 && targetValue->view()[0] == -2.0,
+           "shared storage left unchanged");
+
+    // NTNDArray frames of the same type and size
+    NTNDArrayPtr frameSource = createNDArray(1000);
+    NTNDArrayPtr frameTarget = NTNDArray::createBuilder()->addTimeStamp()->create();
+    serializer = NTSerializer::create(frameSource->getPVStructure());
+    deserializer = NTSerializer::create(frameTarget->getPVStructure());
+
+    serializer->serialize(bytes);
+    deserializeFromVector(deserializer.get(), EPICS_BYTE_ORDER, bytes);
+    PVUShortArrayPtr frame = frameTarget->getValue()->get<PVUShortArray>();
+    const uint16 *frameStorage = frame.get() ? frame->view().data() : 0;
+
+    frameSource->getUniqueId()->put(43);
+    serializer->serialize(bytes);
+    deserializeFromVector(deserializer.get(), EPICS_BYTE_ORDER, bytes);
+
+    testOk(frameTarget->getValue()->get<PVUShortArray>() == frame &&
+           frame->view().data() == frameStorage, "NTNDArray frame storage reused");
+    testOk1(*frameSource->getPVStructure() == *frameTarget->getPVStructure());
+    testOk(countAllocations(deserializer, bytes, 100) == 0,
+           "NTNDArray updates deserialized without allocating");
+
+    // string columns
+    NTTablePtr table = createTable();
+    NTTablePtr tableTarget = NTTable::createBuilder()->
+        addColumn("x", pvDouble)->
+        addColumn("name", pvString)->
+        addColumn("flag", pvBoolean)->
+        addTimeStamp()->
+        create();
+    serializer = NTSerializer::create(table->getPVStructure());
+    deserializer = NTSerializer::create(tableTarget->getPVStructure());
+    serializer->serialize(bytes);
+    deserializeFromVector(deserializer.get(), EPICS_BYTE_ORDER, bytes);
+    deserializeFromVector(deserializer.get(), EPICS_BYTE_ORDER, bytes);
+    testOk1(*table->getPVStructure() == *tableTarget->getPVStructure());
+}
+
+static void benchmark(const char *name, PVStructurePtr const & pvStructure,
+        size_t iterations)
+{
+    NTSerializerPtr serializer = NTSerializer::create(pvStructure);
+    PVStructurePtr copy = getPVDataCreate()->createPVStructure(pvStructure->getStructure());
+    NTSerializerPtr deserializer = NTSerializer::create(copy);
+
+    std::vector<epicsUInt8> bytes;
+
+    // the fastest of several alternating rounds, so that both paths see
+    // the same load
+    const int rounds = 5;
+    double genericTime = 1e9, specializedTime = 1e9;
+    for (int round = 0; round < rounds; ++round) {
+        epicsTime begin(epicsTime::getCurrent());
+        for (size_t i = 0; i < iterations; ++i) {
+            serializeToVector(pvStructure.get(), EPICS_BYTE_ORDER, bytes);
+            deserializeFromVector(copy.get(), EPICS_BYTE_ORDER, bytes);
+        }
+        genericTime = std::min(genericTime, epicsTime::getCurrent() - begin);
+
+        begin = epicsTime::getCurrent();
+        for (size_t i = 0; i < iterations; ++i) {
+            serializer->serialize(bytes);
+            deserializeFromVector(deserializer.get(), EPICS_BYTE_ORDER, bytes);
+        }
+        specializedTime = std::min(specializedTime, epicsTime::getCurrent() - begin);
+    }
+
+    testOk(specializedTime <= genericTime,
+           "%s round trip: generic %.3f us, specialized %.3f us", name,
+           1e6*genericTime/iterations, 1e6*specializedTime/iterations);
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    benchmark("NTScalar", createScalar()->getPVStructure(), 100000);
+    benchmark("NTScalarArray[1000]", createScalarArray(1000)->getPVStructure(), 10000);
+    benchmark("NTTable", createTable()->getPVStructure(), 1000);
+    benchmark("NTNDArray[1000]", createNDArray(1000)->getPVStructure(), 10000);
+}
+
+MAIN(testNTSerializer) {
+    testPlan(35);
+    test_supported();
+    test_identical();
+    test_roundtrip();
+    test_inplace();
+    test_benchmark();
+    return testDone();
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/ntstructurePool.h>
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+// every allocation made by the test, counted to compare pooled and
+// newly created instances
+static size_t allocations;
+
+#if __cplusplus >= 201103L
+void *operator new(std::size_t size)
+#else
+void *operator new(std::size_t size) throw(std::bad_alloc)
+#endif
+{
+    ++allocations;
+    void *p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) throw()
+{
+    std::free(p);
+}
+
+static PVStructurePtr tablePrototype()
+{
+    return NTTable::createBuilder()->
+        addColumn("time", pvDouble)->
+        addColumn("count", pvInt)->
+        addColumn("name", pvString)->
+        addDescriptor()->
+        addAlarm()->
+        addTimeStamp()->
+        createPVStructure();
+}
+
+void test_reuse()
+{
+    testDiag("test_reuse");
+
+    NTStructurePoolPtr pool = NTStructurePool::create(
+        NTScalar::createBuilder()->value(pvDouble)->addAlarm()->addTimeStamp()->createPVStructure());
+
+    NTScalarPtr scalar = pool->createInstance<NTScalar>();
+    testOk1(scalar.get() != 0 && NTScalar::isCompatible(scalar->getPVStructure()));
+    PVStructure *first = scalar->getPVStructure().get();
+    scalar->getValue<PVDouble>()->put(5);
+    scalar->getAlarm()->getSubField<PVInt>("severity")->put(2);
+    scalar.reset();
+    testOk1(pool->getFree() == 1);
+
+    scalar = pool->createInstance<NTScalar>();
+    testOk(scalar->getPVStructure().get() == first, "PVStructure reused");
+    testOk(scalar->getValue<PVDouble>()->get() == 0 &&
+           scalar->getAlarm()->getSubField<PVInt>("severity")->get() == 0,
+           "values reset to the prototype");
+    testOk1(pool->getAllocated() == 1 && pool->getReused() == 1 && pool->getFree() == 0);
+}
+
+void test_prototype()
+{
+    testDiag("test_prototype");
+
+    PVStructurePtr prototype = tablePrototype();
+    PVStringArray::svector labels(3);
+    labels[0] = "Time";
+    labels[1] = "Count";
+    labels[2] = "Name";
+    prototype->getSubField<PVStringArray>("labels")->replace(freeze(labels));
+
+    NTStructurePoolPtr pool = NTStructurePool::create(prototype);
+    testOk1(pool->getStructure() == prototype->getStructure());
+
+    NTTablePtr table = pool->createInstance<NTTable>();
+    testOk1(table->getLabels()->view().size() == 3 && table->getLabels()->view()[1] == "Count");
+
+    PVDoubleArray::svector times(4, 1.5);
+    table->getColumn<PVDoubleArray>("time")->replace(freeze(times));
+    PVDoubleArray::const_svector kept(table->getColumn<PVDoubleArray>("time")->view());
+    table->getLabels()->replace(PVStringArray::const_svector());
+    table.reset();
+
+    table = pool->createInstance<NTTable>();
+    testOk1(table->getColumn<PVDoubleArray>("time")->view().empty());
+    testOk1(table->getLabels()->view().size() == 3);
+    testOk(kept.size() == 4 && kept[3] == 1.5, "arrays of a released instance stay valid");
+}
+
+void test_referenced()
+{
+    testDiag("test_referenced");
+
+    NTStructurePoolPtr pool = NTStructurePool::create(tablePrototype());
+
+    NTTablePtr table = pool->createInstance<NTTable>();
+    PVStructurePtr pvStructure = table->getPVStructure();
+    table.reset();
+    testOk(pool->getFree() == 0, "referenced PVStructure not reused");
+    testOk1(pvStructure->getSubField<PVStringArray>("labels").get() != 0);
+
+    table = pool->createInstance<NTTable>();
+    PVStringPtr message = table->getAlarm()->getSubField<PVString>("message");
+    table.reset();
+    testOk(pool->getFree() == 0, "PVStructure with a referenced field not reused");
+    testOk1(pool->getAllocated() == 2 && pool->getReused() == 0);
+
+    table = pool->createInstance<NTTable>();
+    table.reset();
+    testOk1(pool->getFree() == 1);
+}
+
+void test_maxFree()
+{
+    testDiag("test_maxFree");
+
+    NTStructurePoolPtr pool = NTStructurePool::create(tablePrototype(), 1);
+    NTTablePtr first = pool->createInstance<NTTable>();
+    NTTablePtr second = pool->createInstance<NTTable>();
+    first.reset();
+    second.reset();
+    testOk1(pool->getFree() == 1);
+
+    // the pool lives for as long as its instances
+    NTTablePtr table = pool->createInstance<NTTable>();
+    pool.reset();
+    table.reset();
+    testPass("instance released after the last reference to its pool");
+
+    try {
+        NTStructurePool::create(PVStructurePtr());
+        testFail("pool without prototype created");
+    } catch (std::runtime_error&) {
+        testPass("pool without prototype rejected");
+    }
+}
+
+void test_allocations()
+{
+    testDiag("test_allocations");
+
+    PVStructurePtr prototype = tablePrototype();
+    NTStructurePoolPtr pool = NTStructurePool::create(prototype);
+    pool->createInstance<NTTable>().reset();
+
+    size_t before = allocations;
+    NTTablePtr created = NTTable::wrapUnsafe(getPVDataCreate()->createPVStructure(prototype));
+    size_t createdCount = allocations - before;
+
+    before = allocations;
+    NTTablePtr pooled = pool->createInstance<NTTable>();
+    size_t pooledCount = allocations - before;
+
+    testDiag("allocations per NTTable instance: %u created, %u from the pool",
+             (unsigned)createdCount, (unsigned)pooledCount);
+    testOk(pooledCount <= 3, "a pooled instance allocates its wrapper and reference counts only");
+    testOk1(pooledCount < createdCount);
+    pooled.reset();
+
+    const int count = 100000;
+    epicsTime begin(epicsTime::getCurrent());
+    for (int i = 0; i < count; ++i)
+        NTTable::wrapUnsafe(getPVDataCreate()->createPVStructure(prototype));
+    double createTime = epicsTime::getCurrent() - begin;
+
+    begin = epicsTime::getCurrent();
+    for (int i = 0; i < count; ++i)
+        pool->createInstance<NTTable>();
+    double poolTime = epicsTime::getCurrent() - begin;
+
+    testDiag("NTTable instances: %.0f/s created, %.0f/s from the pool",
+             count/createTime, count/poolTime);
+}
+
+MAIN(testNTStructurePool) {
+    testPlan(20);
+    test_reuse();
+    test_prototype();
+    test_referenced();
+    test_maxFree();
+    test_allocations();
+    return testDone();
+}
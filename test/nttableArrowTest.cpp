@@ -0,0 +1,204 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <cstring>
+#include <stdexcept>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsMath.h>
+
+#include <pv/nt.h>
+#include <pv/nttableArrow.h>
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+static NTTablePtr createTable()
+{
+    NTTablePtr table = NTTable::createBuilder()->
+        addColumn("x", pvDouble)->
+        addColumn("count", pvInt)->
+        addColumn("name", pvString)->
+        addColumn("flag", pvBoolean)->
+        create();
+
+    PVStringArray::svector labels(4);
+    labels[0] = "X [mm]";
+    labels[1] = "Count";
+    labels[2] = "Name";
+    labels[3] = "Flag";
+    table->getLabels()->replace(freeze(labels));
+
+    PVDoubleArray::svector x(10);
+    PVIntArray::svector count(10);
+    PVStringArray::svector name(10);
+    PVBooleanArray::svector flag(10);
+    for (size_t i = 0; i < 10; ++i) {
+        x[i] = i*0.5;
+        count[i] = static_cast<int32>(i*i);
+        name[i] = std::string(i, 'a' + i);
+        flag[i] = (i % 3) == 0;
+    }
+    table->getColumn<PVDoubleArray>("x")->replace(freeze(x));
+    table->getColumn<PVIntArray>("count")->replace(freeze(count));
+    table->getColumn<PVStringArray>("name")->replace(freeze(name));
+    table->getColumn<PVBooleanArray>("flag")->replace(freeze(flag));
+    return table;
+}
+
+void test_export()
+{
+    testDiag("test_export");
+
+    NTTablePtr table = createTable();
+    ArrowArray array;
+    ArrowSchema schema;
+    NTTableArrow::exportTable(table, &array, &schema);
+
+    testOk1(strcmp(schema.format, "+s") == 0);
+    testOk1(schema.n_children == 4 && array.n_children == 4);
+    testOk1(array.length == 10 && array.null_count == 0);
+
+    testOk1(strcmp(schema.children[0]->format, "g") == 0);
+    testOk1(strcmp(schema.children[0]->name, "x") == 0);
+    testOk1(strcmp(schema.children[1]->format, "i") == 0);
+    testOk1(strcmp(schema.children[2]->format, "u") == 0);
+    testOk1(strcmp(schema.children[3]->format, "b") == 0);
+
+    const double *x = table->getColumn<PVDoubleArray>("x")->view().data();
+    testOk(array.children[0]->buffers[1] == x, "numeric column exported without copy");
+
+    const int32_t *offsets = static_cast<const int32_t*>(array.children[2]->buffers[1]);
+    const char *chars = static_cast<const char*>(array.children[2]->buffers[2]);
+    testOk1(offsets[3] == 3 && offsets[4] == 6 && std::string(chars + offsets[3], 3) == "ddd");
+
+    const epicsUInt8 *bits = static_cast<const epicsUInt8*>(array.children[3]->buffers[1]);
+    testOk1(bits[0] == 0x49 && bits[1] == 0x02);
+
+    // the export keeps the column storage alive
+    table.reset();
+    testOk1(static_cast<const double*>(array.children[0]->buffers[1])[9] == 4.5);
+
+    array.release(&array);
+    schema.release(&schema);
+    testOk1(array.release == 0 && schema.release == 0);
+}
+
+void test_roundtrip()
+{
+    testDiag("test_roundtrip");
+
+    NTTablePtr table = createTable();
+    ArrowArray array;
+    ArrowSchema schema;
+    NTTableArrow::exportTable(table, &array, &schema);
+
+    NTTablePtr imported = NTTableArrow::importTable(&array, &schema);
+    testOk(array.release == 0, "array moved by import");
+    testOk1(*imported->getPVStructure() == *table->getPVStructure());
+    testOk1(imported->getLabels()->view()[0] == "X [mm]");
+    testOk(imported->getColumn<PVDoubleArray>("x")->view().data() ==
+           table->getColumn<PVDoubleArray>("x")->view().data(),
+           "numeric column imported without copy");
+
+    schema.release(&schema);
+}
+
+static bool released;
+static int32_t column[] = { 1, 2, 3, 4, 5 };
+static epicsUInt8 validity[] = { 0x1d };
+static const void *columnBuffers[] = { validity, column };
+
+static void releaseTestArray(ArrowArray *array)
+{
+    released = true;
+    array->release = 0;
+}
+
+static void releaseTestSchema(ArrowSchema *schema)
+{
+    schema->release = 0;
+}
+
+void test_import()
+{
+    testDiag("test_import");
+
+    ArrowArray child;
+    memset(&child, 0, sizeof(child));
+    child.length = 5;
+    child.n_buffers = 2;
+    child.buffers = columnBuffers;
+    child.release = &releaseTestArray;
+    ArrowArray *children[] = { &child };
+
+    ArrowArray array;
+    memset(&array, 0, sizeof(array));
+    array.length = 4;
+    array.offset = 1;
+    array.n_buffers = 1;
+    array.n_children = 1;
+    static const void *structBuffers[] = { 0 };
+    array.buffers = structBuffers;
+    array.children = children;
+    array.release = &releaseTestArray;
+
+    ArrowSchema childSchema;
+    memset(&childSchema, 0, sizeof(childSchema));
+    childSchema.format = "i";
+    childSchema.name = "value";
+    childSchema.release = &releaseTestSchema;
+    ArrowSchema *childSchemas[] = { &childSchema };
+
+    ArrowSchema schema;
+    memset(&schema, 0, sizeof(schema));
+    schema.format = "+s";
+    schema.name = "";
+    schema.n_children = 1;
+    schema.children = childSchemas;
+    schema.release = &releaseTestSchema;
+
+    released = false;
+    NTTablePtr table = NTTableArrow::importTable(&array, &schema);
+    PVIntArray::const_svector value(table->getColumn<PVIntArray>("value")->view());
+    testOk1(value.size() == 4);
+    testOk1(table->getLabels()->view()[0] == "value");
+    testOk1(!released);
+
+    table.reset();
+    testOk(!released, "held column keeps the Arrow array");
+    value.clear();
+    testOk(released, "Arrow array released with the last column");
+
+    // with nulls in the column the values are copied
+    child.null_count = 2;
+    array.release = &releaseTestArray;
+    released = false;
+    table = NTTableArrow::importTable(&array, &schema);
+    value = table->getColumn<PVIntArray>("value")->view();
+    testOk1(value.size() == 4 && value[0] == 0 && value[1] == 3 && value[2] == 4 && value[3] == 5);
+    testOk1(value.data() != column + 1);
+    value.clear();
+    table.reset();
+    testOk1(released);
+
+    childSchema.format = "tdD";
+    array.release = &releaseTestArray;
+    try {
+        NTTableArrow::importTable(&array, &schema);
+        testFail("unsupported format accepted");
+    } catch (std::runtime_error&) {
+        testOk(array.release != 0, "unsupported format rejected, array untouched");
+    }
+}
+
+MAIN(testNTTableArrow) {
+    testPlan(26);
+    test_export();
+    test_roundtrip();
+    test_import();
+    return testDone();
+}
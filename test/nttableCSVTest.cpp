@@ -0,0 +1,287 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/nttableCSV.h>
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+static NTTablePtr read(std::string const & text,
+    NTTableCSVOptions const & options = NTTableCSVOptions())
+{
+    return NTTableCSV::read(text.data(), text.size(), options);
+}
+
+static std::string write(NTTablePtr const & table,
+    NTTableCSVOptions const & options = NTTableCSVOptions())
+{
+    std::ostringstream out;
+    NTTableCSV::write(out, table, options);
+    return out.str();
+}
+
+static std::string createText(int rows)
+{
+    std::ostringstream out;
+    out << "id,value,name,flag\n";
+    for (int i = 0; i < rows; ++i)
+        out << i << ',' << i*0.25 << ",\"row, " << i << "\"," << (i%3 ? "true" : "false") << "\r\n";
+    return out.str();
+}
+
+void test_infer()
+{
+    testDiag("test_infer");
+
+    NTTablePtr table = read(
+        "Count,Value (mm),name,ok,empty\n"
+        "1,1.5,a,true,\n"
+        "\n"
+        "-2,2e3,b,FALSE,\n"
+        "3,,c,true\n");
+    testOk1(table->isValid());
+    StringArray const & names = table->getColumnNames();
+    testOk1(names.size() == 5);
+    testOk1(names[1] == "Value__mm_");
+    testOk1(table->getLabels()->view()[1] == "Value (mm)");
+
+    PVLongArrayPtr count = table->getColumn<PVLongArray>("Count");
+    testOk1(count && count->view().size() == 3 && count->view()[1] == -2);
+    PVDoubleArrayPtr value = table->getColumn<PVDoubleArray>("Value__mm_");
+    testOk1(value && value->view()[1] == 2000 && value->view()[2] != value->view()[2]);
+    PVStringArrayPtr name = table->getColumn<PVStringArray>("name");
+    testOk1(name && name->view()[2] == "c");
+    PVBooleanArrayPtr ok = table->getColumn<PVBooleanArray>("ok");
+    testOk1(ok && ok->view()[0] && !ok->view()[1]);
+    testOk1(table->getColumn<PVStringArray>("empty")->view().size() == 3);
+}
+
+void test_options()
+{
+    testDiag("test_options");
+
+    NTTableCSVOptions options;
+    options.delimiter = ';';
+    options.header = false;
+    options.types.push_back(pvUByte);
+    options.types.push_back(pvFloat);
+    NTTablePtr table = read("7;0.5\n255;-1\n", options);
+    StringArray const & names = table->getColumnNames();
+    testOk1(names.size() == 2 && names[0] == "column0" && names[1] == "column1");
+    PVUByteArrayPtr bytes = table->getColumn<PVUByteArray>("column0");
+    testOk1(bytes && bytes->view()[1] == 255);
+    PVFloatArrayPtr floats = table->getColumn<PVFloatArray>("column1");
+    testOk1(floats && floats->view()[0] == 0.5f);
+
+    try {
+        read("256;1\n", options);
+        testFail("value out of range not rejected");
+    } catch (std::runtime_error & e) {
+        testPass("value out of range rejected: %s", e.what());
+    }
+    options.types.clear();
+    options.types.push_back(pvInt);
+    try {
+        read("1;2\n", options);
+        testFail("wrong number of types not rejected");
+    } catch (std::runtime_error &) {
+        testPass("wrong number of types rejected");
+    }
+}
+
+void test_quotes()
+{
+    testDiag("test_quotes");
+
+    NTTablePtr table = read(
+        "\"first, name\",2nd,2nd\n"
+        "\"a \"\"quoted\"\" value\",1,2\n"
+        "\"two\nlines\",3,4\n");
+    StringArray const & names = table->getColumnNames();
+    testOk1(names.size() == 3 && names[0] == "first__name" &&
+        names[1] == "_2nd" && names[2] == "_2nd_2");
+    PVStringArrayPtr first = table->getColumn<PVStringArray>("first__name");
+    testOk1(first->view()[0] == "a \"quoted\" value");
+    testOk1(first->view()[1] == "two\nlines");
+    testOk1(table->getColumn<PVLongArray>("_2nd_2")->view()[1] == 4);
+
+    std::string text = write(table);
+    testOk(text.find("\"a \"\"quoted\"\" value\"") != std::string::npos,
+        "quotes escaped on write");
+    testOk1(text.compare(0, 21, "\"first, name\",2nd,2nd") == 0);
+}
+
+void test_roundtrip()
+{
+    testDiag("test_roundtrip");
+
+    NTTablePtr table = NTTable::createBuilder()->
+        addColumn("d", pvDouble)->
+        addColumn("f", pvFloat)->
+        addColumn("l", pvLong)->
+        addColumn("u", pvULong)->
+        addColumn("s", pvString)->
+        create();
+    PVDoubleArray::svector d(6);
+    PVFloatArray::svector f(6);
+    PVLongArray::svector l(6);
+    PVULongArray::svector u(6);
+    PVStringArray::svector s(6);
+    d[0] = 0.1; d[1] = 1.0/3; d[2] = -1e300; d[3] = 5e-324; d[4] = 123456789012.0;
+    d[5] = std::numeric_limits<double>::infinity();
+    f[0] = 0.1f; f[1] = 1.0f/3; f[2] = -3e38f; f[3] = 1e-40f; f[4] = 16777216.0f; f[5] = 2.5f;
+    l[0] = -9223372036854775807LL - 1; l[1] = 9223372036854775807LL;
+    u[0] = 18446744073709551615ULL;
+    s[0] = "plain"; s[1] = "comma,"; s[2] = "line\r\nbreak"; s[3] = "";
+    table->getColumn<PVDoubleArray>("d")->replace(freeze(d));
+    table->getColumn<PVFloatArray>("f")->replace(freeze(f));
+    table->getColumn<PVLongArray>("l")->replace(freeze(l));
+    table->getColumn<PVULongArray>("u")->replace(freeze(u));
+    table->getColumn<PVStringArray>("s")->replace(freeze(s));
+
+    std::string text = write(table);
+    testOk(text.find(",0.1,") != std::string::npos, "shortest digits written");
+    testOk(text.find("\n5e-324,1e-40,") != std::string::npos, "shortest digits of subnormal values written");
+
+    NTTableCSVOptions options;
+    options.types.push_back(pvDouble);
+    options.types.push_back(pvFloat);
+    options.types.push_back(pvLong);
+    options.types.push_back(pvULong);
+    options.types.push_back(pvString);
+    NTTablePtr copy = read(text, options);
+
+    PVDoubleArray::const_svector d2 = copy->getColumn<PVDoubleArray>("d")->view();
+    PVFloatArray::const_svector f2 = copy->getColumn<PVFloatArray>("f")->view();
+    bool same = d2.size() == 6 && f2.size() == 6;
+    for (size_t i = 0; same && i < 6; ++i)
+        same = d2[i] == table->getColumn<PVDoubleArray>("d")->view()[i] &&
+            f2[i] == table->getColumn<PVFloatArray>("f")->view()[i];
+    testOk(same, "floating point values read back exactly");
+    testOk1(copy->getColumn<PVLongArray>("l")->view()[0] == -9223372036854775807LL - 1);
+    testOk1(copy->getColumn<PVLongArray>("l")->view()[1] == 9223372036854775807LL);
+    testOk1(copy->getColumn<PVULongArray>("u")->view()[0] == 18446744073709551615ULL);
+    testOk1(copy->getColumn<PVStringArray>("s")->view()[2] == "line\r\nbreak");
+    testOk1(copy->getColumn<PVStringArray>("s")->view()[3] == "");
+    testOk1(write(copy) == text);
+
+    NTTablePtr zero = NTTable::createBuilder()->addColumn("z", pvDouble)->create();
+    PVDoubleArray::svector z(1, -0.0);
+    zero->getColumn<PVDoubleArray>("z")->replace(freeze(z));
+    text = write(zero);
+    options.types.assign(1, pvDouble);
+    double z2 = read(text, options)->getColumn<PVDoubleArray>("z")->view()[0];
+    testOk(text == "z\n-0\n" && z2 == 0 && 1/z2 < 0, "negative zero keeps its sign");
+}
+
+void test_parallel()
+{
+    testDiag("test_parallel");
+
+    std::string text = createText(100000);
+
+    NTTableCSVOptions serial;
+    serial.threadCount = 1;
+    NTTablePtr expected = read(text, serial);
+
+    NTTableCSVOptions parallel;
+    parallel.threadCount = 4;
+    NTTablePtr table = read(text, parallel);
+    testOk1(table->getColumn<PVLongArray>("id")->view().size() == 100000);
+    testOk1(write(table) == write(expected));
+
+    // blocks smaller than the rows the types are inferred from
+    std::istringstream in(text);
+    NTTableCSVOptions stream;
+    stream.blockSize = 4096;
+    stream.inferRows = 10;
+    NTTablePtr streamed = NTTableCSV::read(in, stream);
+    testOk1(streamed->getColumn<PVBooleanArray>("flag") != 0);
+    testOk1(write(streamed) == write(expected));
+    testOk1(streamed->getColumn<PVStringArray>("name")->view()[99999] == "row, 99999");
+
+    std::string bad = text + "x,1,a,true\n";
+    try {
+        read(bad, parallel);
+        testFail("invalid integer not rejected");
+    } catch (std::runtime_error & e) {
+        testPass("invalid integer rejected: %s", e.what());
+    }
+}
+
+void test_widen()
+{
+    testDiag("test_widen");
+
+    // the first number that is not an integer is in the last chunk
+    std::ostringstream out;
+    out << "n\n";
+    for (int i = 0; i < 100000; ++i)
+        out << (i == 5 ? std::string() : std::string("1")) << '\n';
+    out << "1.5\n";
+    std::string text = out.str();
+
+    NTTableCSVOptions options;
+    options.threadCount = 4;
+    options.inferRows = 10;
+    NTTablePtr table = read(text, options);
+    PVDoubleArrayPtr n = table->getColumn<PVDoubleArray>("n");
+    testOk(n != 0, "long column widened to double");
+    testOk1(n && n->view().size() == 100001 && n->view()[0] == 1 && n->view()[100000] == 1.5);
+    testOk(n && n->view()[5] != n->view()[5], "empty field read as an integer is NaN");
+
+    options.types.push_back(pvLong);
+    try {
+        read(text, options);
+        testFail("number in a long column given as a type not rejected");
+    } catch (std::runtime_error & e) {
+        testPass("number in a long column given as a type rejected: %s", e.what());
+    }
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    std::string text = createText(1000000);
+
+    NTTableCSVOptions options;
+    epicsTime begin(epicsTime::getCurrent());
+    NTTablePtr table = read(text, options);
+    double readTime = epicsTime::getCurrent() - begin;
+    testOk1(table->getColumn<PVLongArray>("id")->view().size() == 1000000);
+
+    begin = epicsTime::getCurrent();
+    std::string out = write(table);
+    double writeTime = epicsTime::getCurrent() - begin;
+    testOk1(out.size() > 0);
+
+    double megabytes = text.size()/1e6;
+    testDiag("%.1f MB read in %.2f ms, %.0f MB/s", megabytes, readTime*1e3, megabytes/readTime);
+    testDiag("%.1f MB written in %.2f ms, %.0f MB/s", out.size()/1e6, writeTime*1e3,
+        out.size()/1e6/writeTime);
+}
+
+MAIN(testNTTableCSV) {
+    testPlan(42);
+    test_infer();
+    test_options();
+    test_quotes();
+    test_roundtrip();
+    test_parallel();
+    test_widen();
+    test_benchmark();
+    return testDone();
+}
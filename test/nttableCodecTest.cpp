@@ -0,0 +1,320 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/nttableCodec.h>
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+static NTTablePtr createArchive(size_t count)
+{
+    NTTablePtr table = NTTable::createBuilder()->
+        addColumn("secondsPastEpoch", pvLong)->
+        addColumn("nanoseconds", pvInt)->
+        addColumn("severity", pvShort)->
+        addColumn("value", pvDouble)->
+        addColumn("channel", pvString)->
+        addColumn("id", pvULong)->
+        addColumn("jitter", pvByte)->
+        addDescriptor()->
+        addAlarm()->
+        addTimeStamp()->
+        create();
+    PVStringArray::svector labels(7);
+    labels[0] = "Seconds";
+    labels[1] = "Nanoseconds";
+    labels[2] = "Severity";
+    labels[3] = "Value";
+    labels[4] = "Channel";
+    labels[5] = "ID";
+    labels[6] = "Jitter";
+    table->getLabels()->replace(freeze(labels));
+
+    PVLongArray::svector seconds(count);
+    PVIntArray::svector nanoseconds(count);
+    PVShortArray::svector severities(count);
+    PVDoubleArray::svector values(count);
+    PVStringArray::svector channels(count);
+    PVULongArray::svector ids(count);
+    PVByteArray::svector jitter(count);
+    uint32 random = 12345;
+    for (size_t i = 0; i < count; ++i) {
+        random = random*1664525u + 1013904223u;
+        seconds[i] = 1700000000 + static_cast<int64>(i/10);
+        nanoseconds[i] = static_cast<int32>((i%10)*100000000);
+        severities[i] = i%1000 < 5 ? 2 : 0;
+        values[i] = (random >> 8)*1e-3;
+        channels[i] = i < count/2 ? "SR:C01:BPM:X" : "SR:C01:BPM:Y";
+        ids[i] = 9000000000000000000ULL + i*3;
+        jitter[i] = static_cast<int8>(static_cast<int>(random >> 28) - 8);
+    }
+    table->getColumn<PVLongArray>("secondsPastEpoch")->replace(freeze(seconds));
+    table->getColumn<PVIntArray>("nanoseconds")->replace(freeze(nanoseconds));
+    table->getColumn<PVShortArray>("severity")->replace(freeze(severities));
+    table->getColumn<PVDoubleArray>("value")->replace(freeze(values));
+    table->getColumn<PVStringArray>("channel")->replace(freeze(channels));
+    table->getColumn<PVULongArray>("id")->replace(freeze(ids));
+    table->getColumn<PVByteArray>("jitter")->replace(freeze(jitter));
+
+    table->getDescriptor()->put("archive query");
+    table->getAlarm()->getSubField<PVInt>("severity")->put(1);
+    table->getAlarm()->getSubField<PVString>("message")->put("partial");
+    table->getTimeStamp()->getSubField<PVLong>("secondsPastEpoch")->put(1700000123);
+    table->getTimeStamp()->getSubField<PVInt>("userTag")->put(-7);
+    return table;
+}
+
+template<typename PVT>
+static bool sameColumn(NTTablePtr const & a, NTTablePtr const & b, std::string const & name)
+{
+    typename PVT::const_svector x(a->getColumn<PVT>(name)->view());
+    typename PVT::const_svector y(b->getColumn<PVT>(name)->view());
+    if (x.size() != y.size())
+        return false;
+    for (size_t i = 0; i < x.size(); ++i)
+        if (!(x[i] == y[i]))
+            return false;
+    return true;
+}
+
+static size_t plainSize(NTTablePtr const & table)
+{
+    size_t size = 0;
+    StringArray const & names = table->getColumnNames();
+    for (size_t i = 0; i < names.size(); ++i) {
+        PVScalarArrayPtr column = table->getColumn<PVScalarArray>(names[i]);
+        ScalarType type = column->getScalarArray()->getElementType();
+        if (type == pvString) {
+            PVStringArray::const_svector strings(table->getColumn<PVStringArray>(names[i])->view());
+            for (size_t j = 0; j < strings.size(); ++j)
+                size += strings[j].size() + 1;
+        } else {
+            size += column->getLength()*ScalarTypeFunc::elementSize(type);
+        }
+    }
+    return size;
+}
+
+void test_roundtrip()
+{
+    testDiag("test_roundtrip");
+
+    NTTablePtr table = createArchive(10000);
+    std::vector<epicsUInt8> data;
+    NTTableCodec::encode(table, data);
+    NTTablePtr copy = NTTableCodec::decode(data);
+
+    testOk1(copy->isValid());
+    testOk1(copy->getColumnNames() == table->getColumnNames());
+    testOk1(copy->getLabels()->view()[5] == "ID");
+    testOk1(sameColumn<PVLongArray>(table, copy, "secondsPastEpoch"));
+    testOk1(sameColumn<PVIntArray>(table, copy, "nanoseconds"));
+    testOk1(sameColumn<PVShortArray>(table, copy, "severity"));
+    testOk1(sameColumn<PVDoubleArray>(table, copy, "value"));
+    testOk1(sameColumn<PVStringArray>(table, copy, "channel"));
+    testOk1(sameColumn<PVULongArray>(table, copy, "id"));
+    testOk1(sameColumn<PVByteArray>(table, copy, "jitter"));
+
+    testOk1(copy->getDescriptor()->get() == "archive query");
+    testOk1(copy->getAlarm()->getSubField<PVInt>("severity")->get() == 1);
+    testOk1(copy->getAlarm()->getSubField<PVString>("message")->get() == "partial");
+    testOk1(copy->getTimeStamp()->getSubField<PVLong>("secondsPastEpoch")->get() == 1700000123);
+    testOk1(copy->getTimeStamp()->getSubField<PVInt>("userTag")->get() == -7);
+
+    std::vector<NTTableCodec::Encoding> encodings = NTTableCodec::getEncodings(data);
+    testOk1(encodings.size() == 7);
+    testOk1(encodings[0] == NTTableCodec::deltaEncoding);
+    testOk1(encodings[2] == NTTableCodec::runLengthEncoding);
+    testOk1(encodings[3] == NTTableCodec::plainEncoding);
+    testOk1(encodings[4] == NTTableCodec::runLengthEncoding);
+    testOk1(encodings[5] == NTTableCodec::deltaEncoding);
+    testOk1(encodings[6] == NTTableCodec::bitPackedEncoding);
+    testOk1(NTTableCodec::chooseEncoding(table->getColumn<PVScalarArray>("id")) ==
+        NTTableCodec::deltaEncoding);
+
+    testDiag("%u bytes plain, %u bytes encoded",
+        static_cast<unsigned>(plainSize(table)), static_cast<unsigned>(data.size()));
+}
+
+void test_extremes()
+{
+    testDiag("test_extremes");
+
+    NTTablePtr table = NTTable::createBuilder()->
+        addColumn("l", pvLong)->
+        addColumn("u", pvULong)->
+        addColumn("b", pvBoolean)->
+        addColumn("f", pvFloat)->
+        addColumn("s", pvString)->
+        create();
+    const size_t count = 300;
+    PVLongArray::svector l(count);
+    PVULongArray::svector u(count);
+    PVBooleanArray::svector b(count);
+    PVFloatArray::svector f(count, std::numeric_limits<float>::quiet_NaN());
+    PVStringArray::svector s(count);
+    for (size_t i = 0; i < count; ++i) {
+        l[i] = i%2 ? std::numeric_limits<int64>::max() : std::numeric_limits<int64>::min();
+        u[i] = i%3 ? std::numeric_limits<uint64>::max() - i : i;
+        b[i] = i%7 == 0;
+        s[i] = i%5 ? std::string("") : std::string("x\0y", 3);
+    }
+    f[17] = -0.0f;
+    table->getColumn<PVLongArray>("l")->replace(freeze(l));
+    table->getColumn<PVULongArray>("u")->replace(freeze(u));
+    table->getColumn<PVBooleanArray>("b")->replace(freeze(b));
+    table->getColumn<PVFloatArray>("f")->replace(freeze(f));
+    table->getColumn<PVStringArray>("s")->replace(freeze(s));
+
+    std::vector<epicsUInt8> data;
+    NTTableCodec::encode(table, data);
+    NTTablePtr copy = NTTableCodec::decode(data);
+    testOk1(sameColumn<PVLongArray>(table, copy, "l"));
+    testOk1(sameColumn<PVULongArray>(table, copy, "u"));
+    testOk1(sameColumn<PVBooleanArray>(table, copy, "b"));
+    testOk1(sameColumn<PVStringArray>(table, copy, "s"));
+
+    PVFloatArray::const_svector f1(table->getColumn<PVFloatArray>("f")->view());
+    PVFloatArray::const_svector f2(copy->getColumn<PVFloatArray>("f")->view());
+    testOk(f2.size() == count && memcmp(f1.data(), f2.data(), count*sizeof(float)) == 0,
+        "float bits kept");
+    testOk1(!copy->getDescriptor() && !copy->getTimeStamp());
+
+    NTTablePtr empty = NTTable::createBuilder()->addColumn("x", pvDouble)->create();
+    NTTableCodec::encode(empty, data);
+    copy = NTTableCodec::decode(data);
+    testOk1(copy->getColumn<PVDoubleArray>("x")->view().empty());
+}
+
+static void putVarint(std::vector<epicsUInt8> & out, uint64 value)
+{
+    for (; value >= 0x80; value >>= 7)
+        out.push_back(static_cast<epicsUInt8>(value | 0x80));
+    out.push_back(static_cast<epicsUInt8>(value));
+}
+
+// the binary form of a table of one column of 2^40 rows, with a payload of a few bytes
+static std::vector<epicsUInt8> createOversized(ScalarType type, NTTableCodec::Encoding encoding,
+    std::vector<epicsUInt8> const & payload)
+{
+    const char header[] = { 'N', 'T', 'T', 'C', 1, 0 };
+    std::vector<epicsUInt8> data(header, header + sizeof(header));
+    putVarint(data, 1);
+    putVarint(data, static_cast<uint64>(1) << 40);
+    for (int i = 0; i < 2; ++i) {
+        putVarint(data, 1);
+        data.push_back('x');
+    }
+    data.push_back(static_cast<epicsUInt8>(type));
+    data.push_back(static_cast<epicsUInt8>(encoding));
+    putVarint(data, payload.size());
+    data.insert(data.end(), payload.begin(), payload.end());
+    return data;
+}
+
+void test_errors()
+{
+    testDiag("test_errors");
+
+    std::vector<epicsUInt8> data;
+    NTTableCodec::encode(createArchive(1000), data);
+
+    std::vector<epicsUInt8> truncated(data.begin(), data.end() - 1);
+    try {
+        NTTableCodec::decode(truncated);
+        testFail("truncated data not rejected");
+    } catch (std::runtime_error &) {
+        testPass("truncated data rejected");
+    }
+
+    std::vector<epicsUInt8> corrupt(data);
+    corrupt[0] = 'X';
+    try {
+        NTTableCodec::decode(corrupt);
+        testFail("bad magic not rejected");
+    } catch (std::runtime_error &) {
+        testPass("bad magic rejected");
+    }
+
+    std::vector<epicsUInt8> longer(data);
+    longer.push_back(0);
+    try {
+        NTTableCodec::decode(longer);
+        testFail("trailing bytes not rejected");
+    } catch (std::runtime_error &) {
+        testPass("trailing bytes rejected");
+    }
+
+    std::vector<epicsUInt8> payload(8, 0);
+    try {
+        NTTableCodec::decode(createOversized(pvDouble, NTTableCodec::plainEncoding, payload));
+        testFail("row count beyond the payload not rejected");
+    } catch (std::runtime_error &) {
+        testPass("row count beyond the payload rejected");
+    } catch (std::exception & e) {
+        testFail("row count beyond the payload failed with %s", e.what());
+    }
+
+    payload.assign(5, 0);
+    payload[0] = 1;
+    try {
+        NTTableCodec::decode(createOversized(pvInt, NTTableCodec::runLengthEncoding, payload));
+        testFail("row count beyond the runs not rejected");
+    } catch (std::runtime_error &) {
+        testPass("row count beyond the runs rejected");
+    } catch (std::exception & e) {
+        testFail("row count beyond the runs failed with %s", e.what());
+    }
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    NTTablePtr table = createArchive(1000000);
+    std::vector<epicsUInt8> data;
+
+    NTTablePtr copy;
+    double encodeTime = 1e9, decodeTime = 1e9;
+    for (int i = 0; i < 5; ++i) {
+        epicsTime begin(epicsTime::getCurrent());
+        NTTableCodec::encode(table, data);
+        encodeTime = std::min(encodeTime, epicsTime::getCurrent() - begin);
+
+        begin = epicsTime::getCurrent();
+        copy = NTTableCodec::decode(data);
+        decodeTime = std::min(decodeTime, epicsTime::getCurrent() - begin);
+    }
+
+    size_t plain = plainSize(table);
+    testOk1(sameColumn<PVLongArray>(table, copy, "secondsPastEpoch"));
+    testOk(plain > 3*data.size(), "compressed %.1f times", static_cast<double>(plain)/data.size());
+    testDiag("%.1f MB encoded to %.1f MB in %.2f ms (%.0f MB/s), decoded in %.2f ms (%.0f MB/s)",
+        plain/1e6, data.size()/1e6, encodeTime*1e3, plain/1e6/encodeTime,
+        decodeTime*1e3, plain/1e6/decodeTime);
+    testOk(plain/1e6/encodeTime >= 100, "encoded at %.0f MB/s", plain/1e6/encodeTime);
+    testOk(plain/1e6/decodeTime >= 100, "decoded at %.0f MB/s", plain/1e6/decodeTime);
+}
+
+MAIN(testNTTableCodec) {
+    testPlan(39);
+    test_roundtrip();
+    test_extremes();
+    test_errors();
+    test_benchmark();
+    return testDone();
+}
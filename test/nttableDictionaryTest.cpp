@@ -0,0 +1,214 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/nttableDictionary.h>
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+static const char *states[] = { "OFF", "STANDBY", "ON", "FAULT" };
+
+static NTTablePtr createTable(size_t count)
+{
+    NTTablePtr table = NTTable::createBuilder()->
+        addColumn("device", pvString)->
+        addColumn("state", pvString)->
+        addColumn("current", pvDouble)->
+        addTimeStamp()->
+        create();
+    PVStringArray::svector labels(3);
+    labels[0] = "Device";
+    labels[1] = "State";
+    labels[2] = "Current";
+    table->getLabels()->replace(freeze(labels));
+
+    PVStringArray::svector devices(count);
+    PVStringArray::svector deviceStates(count);
+    PVDoubleArray::svector currents(count);
+    for (size_t i = 0; i < count; ++i) {
+        devices[i] = i%2 ? "SR:PS:QF" : "SR:PS:QD";
+        deviceStates[i] = states[(i/3)%4];
+        currents[i] = i*0.5;
+    }
+    table->getColumn<PVStringArray>("device")->replace(freeze(devices));
+    table->getColumn<PVStringArray>("state")->replace(freeze(deviceStates));
+    table->getColumn<PVDoubleArray>("current")->replace(freeze(currents));
+    return table;
+}
+
+void test_dictionary()
+{
+    testDiag("test_dictionary");
+
+    NTStringDictionaryPtr dictionary = NTStringDictionary::create();
+    testOk1(dictionary->encode("ON") == 0);
+    testOk1(dictionary->encode("OFF") == 1);
+    testOk1(dictionary->encode("ON") == 0);
+    testOk1(dictionary->find("OFF") == 1 && dictionary->find("FAULT") == -1);
+    testOk1(dictionary->decode(1) == "OFF");
+    testOk1(dictionary->size() == 2);
+
+    std::string values[4] = { "A", "A", "ON", "B" };
+    int32 codes[4];
+    dictionary->encode(values, 4, codes);
+    testOk1(codes[0] == 2 && codes[1] == 2 && codes[2] == 0 && codes[3] == 3);
+
+    try {
+        dictionary->decode(4);
+        testFail("missing code not rejected");
+    } catch (std::runtime_error &) {
+        testPass("missing code rejected");
+    }
+
+    // enough strings to grow the table several times
+    bool same = true;
+    for (int i = 0; i < 1000; ++i) {
+        char name[32];
+        sprintf(name, "SR:PS:%d", i);
+        same = same && dictionary->encode(name) == 4 + i;
+    }
+    for (int i = 0; i < 1000 && same; ++i) {
+        char name[32];
+        sprintf(name, "SR:PS:%d", i);
+        same = dictionary->find(name) == 4 + i && dictionary->decode(4 + i) == name;
+    }
+    testOk(same && dictionary->find("ON") == 0, "codes kept as the table grows");
+}
+
+void test_encode()
+{
+    testDiag("test_encode");
+
+    NTTablePtr table = createTable(24);
+    NTTableDictionaryPtr encoded = NTTableDictionary::create(table);
+    std::vector<std::string> const & columns = encoded->getEncodedColumns();
+    testOk1(columns.size() == 2 && columns[0] == "device" && columns[1] == "state");
+    testOk1(encoded->isEncoded("state") && !encoded->isEncoded("current"));
+    testOk1(encoded->getRowCount() == 24);
+    testOk1(encoded->getDictionary()->size() == 6);
+
+    shared_vector<const int32> codes = encoded->getCodes("state");
+    testOk1(codes.size() == 24 && codes[0] == codes[2] && codes[0] != codes[3]);
+    testOk1(encoded->getValues("state")[23] == "FAULT");
+
+    // the input table is left as it was
+    testOk1(table->getColumn<PVStringArray>("state")->view()[0] == "OFF");
+
+    try {
+        encoded->getCodes("current");
+        testFail("column not encoded not rejected");
+    } catch (std::runtime_error &) {
+        testPass("column not encoded rejected");
+    }
+
+    std::vector<std::string> selected(1, "current");
+    try {
+        NTTableDictionary::create(table, selected);
+        testFail("numeric column not rejected");
+    } catch (std::runtime_error &) {
+        testPass("numeric column rejected");
+    }
+
+    // a dictionary shared by two tables
+    selected[0] = "state";
+    NTTableDictionaryPtr other = NTTableDictionary::create(createTable(6), selected,
+        encoded->getDictionary());
+    testOk1(other->getCodes("state")[0] == codes[0]);
+    testOk1(encoded->getDictionary()->size() == 6);
+}
+
+void test_queries()
+{
+    testDiag("test_queries");
+
+    NTTableDictionaryPtr encoded = NTTableDictionary::create(createTable(24));
+
+    std::vector<size_t> rows = encoded->findEqual("state", "ON");
+    testOk1(rows.size() == 6 && rows[0] == 6 && rows[5] == 20);
+    testOk1(encoded->findEqual("state", "UNKNOWN").empty());
+
+    std::vector<std::string> keys;
+    std::vector<std::vector<size_t> > groups;
+    encoded->groupBy("state", keys, groups);
+    testOk1(keys.size() == 4 && keys[0] == "OFF" && keys[3] == "FAULT");
+    testOk1(groups.size() == 4 && groups[1].size() == 6 && groups[1][0] == 3);
+
+    encoded->groupBy("device", keys, groups);
+    testOk1(keys.size() == 2 && keys[0] == "SR:PS:QD" && groups[1][0] == 1);
+}
+
+void test_plain()
+{
+    testDiag("test_plain");
+
+    NTTablePtr table = createTable(24);
+    NTTablePtr plain = NTTableDictionary::create(table)->toNTTable();
+    testOk1(plain->isValid());
+    testOk1(plain->getPVStructure()->getStructure() == table->getPVStructure()->getStructure());
+    PVStringArray::const_svector original(table->getColumn<PVStringArray>("state")->view());
+    PVStringArray::const_svector decoded(plain->getColumn<PVStringArray>("state")->view());
+    bool same = original.size() == decoded.size();
+    for (size_t i = 0; same && i < original.size(); ++i)
+        same = original[i] == decoded[i];
+    testOk(same, "decoded column equals the original");
+    testOk1(plain->getColumn<PVDoubleArray>("current")->view().data() ==
+        table->getColumn<PVDoubleArray>("current")->view().data());
+    testOk1(plain->getLabels()->view()[1] == "State");
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    const size_t count = 1000000;
+    NTTablePtr table = createTable(count);
+
+    epicsTime begin(epicsTime::getCurrent());
+    NTTableDictionaryPtr encoded = NTTableDictionary::create(table);
+    double encodeTime = epicsTime::getCurrent() - begin;
+
+    begin = epicsTime::getCurrent();
+    std::vector<size_t> rows = encoded->findEqual("state", "FAULT");
+    double codeTime = epicsTime::getCurrent() - begin;
+
+    PVStringArray::const_svector states(table->getColumn<PVStringArray>("state")->view());
+    std::vector<size_t> scanned;
+    begin = epicsTime::getCurrent();
+    std::string fault("FAULT");
+    for (size_t i = 0; i < states.size(); ++i)
+        if (states[i] == fault)
+            scanned.push_back(i);
+    double stringTime = epicsTime::getCurrent() - begin;
+
+    begin = epicsTime::getCurrent();
+    NTTablePtr plain = encoded->toNTTable();
+    double decodeTime = epicsTime::getCurrent() - begin;
+
+    testOk1(rows == scanned);
+    testDiag("%u rows encoded in %.2f ms, decoded in %.2f ms",
+        static_cast<unsigned>(count), encodeTime*1e3, decodeTime*1e3);
+    testDiag("equality filter on codes %.2f ms, on strings %.2f ms",
+        codeTime*1e3, stringTime*1e3);
+}
+
+MAIN(testNTTableDictionary) {
+    testPlan(31);
+    test_dictionary();
+    test_encode();
+    test_queries();
+    test_plain();
+    test_benchmark();
+    return testDone();
+}
@@ -0,0 +1,263 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/nttableIndex.h>
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+static NTTablePtr createInventory(size_t count)
+{
+    NTTablePtr table = NTTable::createBuilder()->
+        addColumn("name", pvString)->
+        addColumn("sector", pvInt)->
+        addColumn("position", pvDouble)->
+        addColumn("serial", pvULong)->
+        create();
+    PVStringArray::svector labels(4);
+    labels[0] = "Name";
+    labels[1] = "Sector";
+    labels[2] = "Position";
+    labels[3] = "Serial";
+    table->getLabels()->replace(freeze(labels));
+
+    PVStringArray::svector names(count);
+    PVIntArray::svector sectors(count);
+    PVDoubleArray::svector positions(count);
+    PVULongArray::svector serials(count);
+    for (size_t i = 0; i < count; ++i) {
+        char name[32];
+        sprintf(name, "dev%05u", static_cast<unsigned>(i));
+        names[i] = name;
+        sectors[i] = static_cast<int32>(i%10);
+        positions[i] = static_cast<double>((i*7919)%count)/2;
+        serials[i] = 1000000000000ULL + i;
+    }
+    table->getColumn<PVStringArray>("name")->replace(freeze(names));
+    table->getColumn<PVIntArray>("sector")->replace(freeze(sectors));
+    table->getColumn<PVDoubleArray>("position")->replace(freeze(positions));
+    table->getColumn<PVULongArray>("serial")->replace(freeze(serials));
+    return table;
+}
+
+void test_hash()
+{
+    testDiag("test_hash");
+
+    NTTablePtr table = createInventory(100);
+    NTTableIndexPtr bySector = NTTableIndex::create(table, "sector");
+    testOk1(bySector->getKind() == NTTableIndex::hashIndex && bySector->getColumn() == "sector");
+
+    std::vector<size_t> rows = bySector->find(3);
+    bool ascending = rows.size() == 10;
+    for (size_t i = 0; ascending && i < rows.size(); ++i)
+        ascending = rows[i] == 3 + 10*i;
+    testOk(ascending, "rows of sector 3 found in ascending order");
+    testOk1(bySector->find(3.5).empty());
+    testOk1(bySector->find(10).empty());
+
+    NTTableIndexPtr byName = NTTableIndex::create(table, "name");
+    rows = byName->find("dev00042");
+    testOk1(rows.size() == 1 && rows[0] == 42);
+    testOk1(byName->find("dev").empty());
+
+    NTTableIndexPtr bySerial = NTTableIndex::create(table, "serial");
+    rows = bySerial->find(1000000000099.0);
+    testOk1(rows.size() == 1 && rows[0] == 99);
+
+    try {
+        byName->find(1);
+        testFail("numeric key on string column not rejected");
+    } catch (std::runtime_error &) {
+        testPass("numeric key on string column rejected");
+    }
+    try {
+        bySector->findRange(1, 2);
+        testFail("range lookup on hash index not rejected");
+    } catch (std::runtime_error &) {
+        testPass("range lookup on hash index rejected");
+    }
+    try {
+        NTTableIndex::create(table, "missing");
+        testFail("missing column not rejected");
+    } catch (std::runtime_error &) {
+        testPass("missing column rejected");
+    }
+}
+
+void test_sorted()
+{
+    testDiag("test_sorted");
+
+    NTTablePtr table = createInventory(100);
+    PVDoubleArray::const_svector original(table->getColumn<PVDoubleArray>("position")->view());
+    PVDoubleArray::svector positions(original.size());
+    std::copy(original.begin(), original.end(), positions.begin());
+    positions[5] = std::numeric_limits<double>::quiet_NaN();
+    table->getColumn<PVDoubleArray>("position")->replace(freeze(positions));
+
+    NTTableIndexPtr index = NTTableIndex::create(table, "position", NTTableIndex::sortedIndex);
+    PVDoubleArray::const_svector values(table->getColumn<PVDoubleArray>("position")->view());
+
+    std::vector<size_t> rows = index->findRange(10, 20);
+    bool ordered = rows.size() == 21;
+    for (size_t i = 0; ordered && i < rows.size(); ++i)
+        ordered = values[rows[i]] >= 10 && values[rows[i]] <= 20 &&
+            (i == 0 || values[rows[i - 1]] <= values[rows[i]]);
+    testOk(ordered, "rows within range found in order of their elements");
+    testOk1(index->findRange(20, 10).empty());
+
+    rows = index->findRange(-std::numeric_limits<double>::infinity(),
+        std::numeric_limits<double>::infinity());
+    testOk(rows.size() == 99, "NaN is never found");
+    testOk1(index->find(std::numeric_limits<double>::quiet_NaN()).empty());
+
+    rows = index->find(values[7]);
+    testOk1(rows.size() == 1 && rows[0] == 7);
+
+    NTTableIndexPtr byName = NTTableIndex::create(table, "name", NTTableIndex::sortedIndex);
+    rows = byName->findRange("dev00010", "dev00012");
+    testOk1(rows.size() == 3 && rows[0] == 10 && rows[2] == 12);
+
+    NTTableIndexPtr bySector = NTTableIndex::create(table, "sector", NTTableIndex::sortedIndex);
+    rows = bySector->find(9);
+    testOk1(rows.size() == 10 && rows[0] == 9 && rows[9] == 99);
+}
+
+void test_invalidate()
+{
+    testDiag("test_invalidate");
+
+    NTTablePtr table = createInventory(100);
+    NTTableIndexPtr index = NTTableIndex::create(table, "sector");
+    testOk1(index->isValid() && index->getBuildCount() == 1);
+
+    index->find(1);
+    testOk1(index->getBuildCount() == 1);
+
+    PVIntArray::svector sectors(100, 1);
+    table->getColumn<PVIntArray>("sector")->replace(freeze(sectors));
+    testOk1(!index->isValid());
+    testOk1(index->find(1).size() == 100);
+    testOk1(index->isValid() && index->getBuildCount() == 2);
+
+    index->rebuild();
+    testOk1(index->getBuildCount() == 3);
+}
+
+void test_project()
+{
+    testDiag("test_project");
+
+    NTTablePtr table = createInventory(100);
+    std::vector<size_t> rows = NTTableIndex::create(table, "sector")->find(4);
+
+    NTTablePtr all = NTTableIndex::project(table, rows);
+    testOk1(all->isValid() && all->getColumnNames().size() == 4);
+    testOk1(all->getColumn<PVStringArray>("name")->view().size() == 10);
+    testOk1(all->getColumn<PVStringArray>("name")->view()[1] == "dev00014");
+    testOk1(all->getLabels()->view()[3] == "Serial");
+
+    std::vector<std::string> columns;
+    columns.push_back("serial");
+    columns.push_back("name");
+    NTTablePtr some = NTTableIndex::project(table, rows, columns);
+    StringArray const & names = some->getColumnNames();
+    testOk1(names.size() == 2 && names[0] == "serial" && names[1] == "name");
+    testOk1(some->getLabels()->view()[0] == "Serial");
+    testOk1(some->getColumn<PVULongArray>("serial")->view()[0] == 1000000000004ULL);
+
+    rows.push_back(100);
+    try {
+        NTTableIndex::project(table, rows);
+        testFail("missing row not rejected");
+    } catch (std::runtime_error &) {
+        testPass("missing row rejected");
+    }
+}
+
+void test_parallel()
+{
+    testDiag("test_parallel");
+
+    NTTablePtr table = createInventory(100000);
+    NTTableIndexPtr serial = NTTableIndex::create(table, "position", NTTableIndex::sortedIndex, 1);
+    NTTableIndexPtr parallel = NTTableIndex::create(table, "position", NTTableIndex::sortedIndex, 4);
+    testOk1(serial->findRange(100, 5000) == parallel->findRange(100, 5000));
+    testOk1(parallel->findRange(0, 1e9).size() == 100000);
+
+    NTTableIndexPtr hash = NTTableIndex::create(table, "name", NTTableIndex::hashIndex, 4);
+    std::vector<size_t> rows = hash->find("dev77777");
+    testOk1(rows.size() == 1 && rows[0] == 77777);
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    const size_t count = 1000000;
+    const int lookups = 1000;
+    NTTablePtr table = createInventory(count);
+
+    epicsTime begin(epicsTime::getCurrent());
+    NTTableIndexPtr hash = NTTableIndex::create(table, "name");
+    double hashBuild = epicsTime::getCurrent() - begin;
+
+    begin = epicsTime::getCurrent();
+    NTTableIndexPtr sorted = NTTableIndex::create(table, "position", NTTableIndex::sortedIndex);
+    double sortedBuild = epicsTime::getCurrent() - begin;
+
+    size_t found = 0;
+    begin = epicsTime::getCurrent();
+    for (int i = 0; i < lookups; ++i) {
+        char name[32];
+        sprintf(name, "dev%05u", static_cast<unsigned>(i*997%count));
+        found += hash->find(name).size();
+    }
+    double lookup = epicsTime::getCurrent() - begin;
+
+    // the same lookups by scanning the column
+    PVStringArray::const_svector names(table->getColumn<PVStringArray>("name")->view());
+    size_t scanned = 0;
+    begin = epicsTime::getCurrent();
+    for (int i = 0; i < 10; ++i) {
+        char name[32];
+        sprintf(name, "dev%05u", static_cast<unsigned>(i*997%count));
+        for (size_t row = 0; row < names.size(); ++row)
+            if (names[row] == name)
+                ++scanned;
+    }
+    double scan = (epicsTime::getCurrent() - begin)*lookups/10;
+
+    testOk1(found == static_cast<size_t>(lookups) && scanned == 10);
+    testOk1(sorted->findRange(0, 10).size() == 21);
+    testDiag("%u rows: hash index built in %.2f ms, sorted index in %.2f ms",
+        static_cast<unsigned>(count), hashBuild*1e3, sortedBuild*1e3);
+    testDiag("%d lookups in %.3f ms, %.2f us per lookup, %.0f times faster than scanning",
+        lookups, lookup*1e3, lookup/lookups*1e6, scan/lookup);
+}
+
+MAIN(testNTTableIndex) {
+    testPlan(36);
+    test_hash();
+    test_sorted();
+    test_invalidate();
+    test_project();
+    test_parallel();
+    test_benchmark();
+    return testDone();
+}
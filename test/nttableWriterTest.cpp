@@ -0,0 +1,170 @@
+/*
+ * Copyright information and license terms for this software can be
+ * found in the file LICENSE that is included with the distribution
+ */
+
+#include <stdexcept>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+#include <epicsTime.h>
+
+#include <pv/nt.h>
+#include <pv/nttableWriter.h>
+
+using namespace epics::nt;
+using namespace epics::pvData;
+
+static NTTablePtr createPrototype()
+{
+    NTTablePtr table = NTTable::createBuilder()->
+        addColumn("time", pvDouble)->
+        addColumn("count", pvInt)->
+        addColumn("name", pvString)->
+        addTimeStamp()->
+        create();
+    PVStringArray::svector labels(3);
+    labels[0] = "Time";
+    labels[1] = "Count";
+    labels[2] = "Name";
+    table->getLabels()->replace(freeze(labels));
+    return table;
+}
+
+void test_rows()
+{
+    testDiag("test_rows");
+
+    NTTableWriterPtr writer = NTTableWriter::create(createPrototype());
+    testOk1(writer->getColumnCount() == 3 && writer->getRowCount() == 0);
+    testOk1(writer->getColumnIndex("name") == 2);
+
+    for (int i = 0; i < 100; ++i) {
+        writer->append<PVDouble>(0, i*0.5);
+        writer->append<PVInt>(1, i);
+        writer->appendValue(2, "row");
+        writer->endRow();
+    }
+    testOk1(writer->getRowCount() == 100 && writer->getCapacity() >= 100);
+
+    NTTablePtr table = writer->snapshot();
+    testOk1(table->isValid());
+    testOk1(table->getLabels()->view()[1] == "Count");
+    testOk1(table->getColumn<PVDoubleArray>("time")->view().size() == 100);
+    testOk1(table->getColumn<PVDoubleArray>("time")->view()[99] == 49.5);
+    testOk1(table->getColumn<PVIntArray>("count")->view()[42] == 42);
+    testOk1(table->getColumn<PVStringArray>("name")->view()[7] == "row");
+    testOk1(table->getTimeStamp().get() != 0);
+
+    // values are converted to the column type
+    writer->appendValue(0, std::string("1.25"));
+    writer->appendValue(1, 7.0);
+    writer->appendValue(2, 3.0);
+    writer->endRow();
+
+    // a snapshot does not see later rows and shares the buffers
+    NTTablePtr later = writer->snapshot();
+    testOk1(table->getColumn<PVIntArray>("count")->view().size() == 100);
+    testOk1(later->getColumn<PVIntArray>("count")->view().size() == 101);
+    testOk1(later->getColumn<PVIntArray>("count")->view()[100] == 7);
+    testOk1(later->getColumn<PVDoubleArray>("time")->view()[100] == 1.25);
+    testOk1(later->getColumn<PVStringArray>("name")->view()[100] == "3");
+    testOk1(later->getColumn<PVIntArray>("count")->view().data() ==
+            table->getColumn<PVIntArray>("count")->view().data());
+
+    // an incomplete row is discarded
+    writer->append<PVDouble>(0, 1);
+    try {
+        writer->endRow();
+        testFail("incomplete row not rejected");
+    } catch (std::runtime_error &) {
+        testPass("incomplete row rejected");
+    }
+    writer->append<PVDouble>(0, 2);
+    writer->append<PVInt>(1, 2);
+    writer->append<PVString>(2, "two");
+    writer->endRow();
+    testOk1(writer->snapshot()->getColumn<PVDoubleArray>("time")->view()[101] == 2);
+
+    try {
+        writer->append<PVInt>(0, 1);
+        testFail("wrong column type not rejected");
+    } catch (std::runtime_error &) {
+        testPass("wrong column type rejected");
+    }
+
+    writer->clear();
+    testOk1(writer->getRowCount() == 0 && writer->snapshot()->getColumn<PVIntArray>("count")->view().empty());
+    testOk1(later->getColumn<PVIntArray>("count")->view()[100] == 7);
+}
+
+void test_batch()
+{
+    testDiag("test_batch");
+
+    NTTableWriterPtr writer = NTTableWriter::create(createPrototype(), 4);
+    testOk1(writer->getCapacity() == 4);
+
+    NTTablePtr batch = NTTable::createBuilder()->
+        addColumn("name", pvString)->
+        addColumn("count", pvLong)->
+        addColumn("time", pvFloat)->
+        create();
+    PVStringArray::svector names(3, "batch");
+    PVLongArray::svector counts(3);
+    PVFloatArray::svector times(3);
+    for (size_t i = 0; i < 3; ++i) {
+        counts[i] = 10 + i;
+        times[i] = i + 0.5f;
+    }
+    batch->getColumn<PVStringArray>("name")->replace(freeze(names));
+    batch->getColumn<PVLongArray>("count")->replace(freeze(counts));
+    batch->getColumn<PVFloatArray>("time")->replace(freeze(times));
+
+    writer->appendRows(batch);
+    writer->appendRows(batch);
+    testOk1(writer->getRowCount() == 6);
+    NTTablePtr table = writer->snapshot();
+    testOk1(table->getColumn<PVIntArray>("count")->view()[4] == 11);
+    testOk1(table->getColumn<PVDoubleArray>("time")->view()[5] == 2.5);
+    testOk1(table->getColumn<PVStringArray>("name")->view()[3] == "batch");
+
+    PVLongArray::svector shorter(2);
+    batch->getColumn<PVLongArray>("count")->replace(freeze(shorter));
+    try {
+        writer->appendRows(batch);
+        testFail("columns of different length not rejected");
+    } catch (std::runtime_error &) {
+        testPass("columns of different length rejected");
+    }
+    testOk1(writer->getRowCount() == 6);
+}
+
+void test_benchmark()
+{
+    testDiag("test_benchmark");
+
+    const int count = 2000000;
+    NTTableWriterPtr writer = NTTableWriter::create(createPrototype());
+    epicsTime begin(epicsTime::getCurrent());
+    for (int i = 0; i < count; ++i) {
+        writer->append<PVDouble>(0, i);
+        writer->append<PVInt>(1, i);
+        writer->append<PVString>(2, std::string());
+        writer->endRow();
+    }
+    NTTablePtr table = writer->snapshot();
+    double elapsed = epicsTime::getCurrent() - begin;
+
+    testOk1(table->getColumn<PVIntArray>("count")->view().size() == static_cast<size_t>(count));
+    testDiag("%d rows appended in %.2f ms, %.0f ns per row", count, elapsed*1e3, elapsed/count*1e9);
+}
+
+MAIN(testNTTableWriter) {
+    testPlan(29);
+    test_rows();
+    test_batch();
+    test_benchmark();
+    return testDone();
+}